@@ -0,0 +1,17 @@
+# The P4 sink (SINK_ENABLE true in p4src/int_v1.0/config.p4) receives INT on foo0 and sends
+# reports to foo1, p4int reads them from foo1 by the pcap PMD and exports them to the collector
+INTERFACES="--vdev=net_tap0,iface=foo0 --vdev=net_tap1,iface=foo1"
+DPDK_APP="./t4p4s/build/int@std/build/int"
+P4INT="../int_nfb_fpga/sink_fpga/p4int_influxdb/p4int"
+P4INT_EAL="--file-prefix=p4int --no-pci -l 2 --vdev=net_pcap0,iface=foo1"
+COLLECTOR=${COLLECTOR:-127.0.0.1}
+COLLECTOR_PORT=${COLLECTOR_PORT:-8089}
+
+sudo $DPDK_APP -c 0x3 -n 4 $INTERFACES -- -p 0x3 --config "(0,0,0),(0,1,1),(1,0,0),(1,1,1)" &
+# Wait for the tap interfaces of the P4 application
+while ! ip link show foo1 > /dev/null 2>&1; do
+    sleep 1
+done
+
+sudo $P4INT -k -S dpdk -c $COLLECTOR -p $COLLECTOR_PORT -r udp -- $P4INT_EAL
+sudo kill %1
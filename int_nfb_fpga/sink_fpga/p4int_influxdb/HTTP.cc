@@ -107,6 +107,10 @@ void HTTP::initCurl(const std::string &url)
     writeUrl.insert(position, "write");
   }
   writeHandle = createWriteHandle(writeUrl);
+
+  // Probe the server by an empty write, without a body curl would read it from stdin
+  curl_easy_setopt(writeHandle, CURLOPT_POSTFIELDS, "");
+  curl_easy_setopt(writeHandle, CURLOPT_POSTFIELDSIZE, 0L);
   
   CURLcode response;
   long responseCode;
@@ -206,7 +210,9 @@ void HTTP::obtainInfluxServiceUrl(const std::string &url)
 void HTTP::obtainDatabaseName(const std::string &url)
 {
   auto dbParameterPosition = url.find("db=");
-  mDatabaseName = url.substr(dbParameterPosition + 3);
+  auto dbParameterEnd = url.find('&', dbParameterPosition);
+  mDatabaseName = url.substr(dbParameterPosition + 3,
+    dbParameterEnd == std::string::npos ? std::string::npos : dbParameterEnd - dbParameterPosition - 3);
 }
 
 std::string HTTP::databaseName() const
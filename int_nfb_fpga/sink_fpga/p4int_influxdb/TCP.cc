@@ -0,0 +1,235 @@
+// MIT License
+//
+// Copyright (c) 2019 Adam Wegrzynek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+///
+/// \author Adam Wegrzynek <adam.wegrzynek@cern.ch>
+/// \author Mario Kuka <kuka@cesnet.cz>
+///
+
+#include "TCP.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <poll.h>
+#include <sys/socket.h>
+
+INT_TCP::INT_TCP(const std::string &hostname, int port, size_t spill) :
+    mSocket(mIoService),
+    mName(hostname + ":" + std::to_string(port)),
+    mSent(0),
+    mLimit(spill),
+    mConnected(false),
+    mReported(false),
+    mBackoffMs(TCP_BACKOFF_MIN_MS),
+    mRetry(std::chrono::steady_clock::now()),
+    mStop(false)
+{
+    boost::asio::ip::tcp::resolver resolver(mIoService);
+    boost::asio::ip::tcp::resolver::query query(boost::asio::ip::tcp::v4(), hostname, std::to_string(port));
+    boost::asio::ip::tcp::resolver::iterator resolverInerator = resolver.resolve(query);
+    mEndpoint = *resolverInerator;
+    connect();
+    mTimer = std::thread(&INT_TCP::timer, this);
+}
+
+INT_TCP::~INT_TCP()
+{
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+        mStop = true;
+    }
+    mWake.notify_one();
+    mTimer.join();
+
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::milliseconds(TCP_CLOSE_MS);
+    while(mSent < mSpill.size() && std::chrono::steady_clock::now() < end) {
+        if(!mConnected) {
+            // Wait for the next attempt only when it comes before the end
+            if(mRetry >= end) {
+                break;
+            }
+            std::this_thread::sleep_until(mRetry);
+            connect();
+            continue;
+        }
+        struct pollfd pfd = {mSocket.native_handle(), POLLOUT, 0};
+        poll(&pfd, 1, std::chrono::duration_cast<std::chrono::milliseconds>(end - std::chrono::steady_clock::now()).count());
+        flush();
+    }
+    if(mSent < mSpill.size()) {
+        fprintf(stderr, "tcp - %zu bytes to %s not delivered\n", mSpill.size() - mSent, mName.c_str());
+    }
+    boost::system::error_code ec;
+    mSocket.close(ec);
+}
+
+bool INT_TCP::connect()
+{
+    boost::system::error_code ec;
+    mSocket.close(ec);
+    mSocket.open(boost::asio::ip::tcp::v4(), ec);
+    if(!ec) {
+        mSocket.non_blocking(true, ec);
+    }
+    if(ec) {
+        disconnect(ec.message());
+        return false;
+    }
+
+    // Asio waits for the connection without a limit, the native connect of the non-blocking socket does not
+    int fd = mSocket.native_handle();
+    int err = 0;
+    if(::connect(fd, mEndpoint.data(), mEndpoint.size()) != 0) {
+        err = errno;
+        struct pollfd pfd = {fd, POLLOUT, 0};
+        if(err == EINPROGRESS) {
+            err = ETIMEDOUT;
+            if(poll(&pfd, 1, TCP_CONNECT_MS) == 1) {
+                socklen_t len = sizeof(err);
+                getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            }
+        }
+    }
+    if(err != 0) {
+        disconnect(strerror(err));
+        return false;
+    }
+
+    mSocket.set_option(boost::asio::ip::tcp::no_delay(true), ec);
+    if(mReported) {
+        fprintf(stderr, "tcp - reconnected to %s, %zu bytes spilled\n", mName.c_str(), mSpill.size() - mSent);
+    }
+    mConnected = true;
+    mReported = false;
+    mBackoffMs = TCP_BACKOFF_MIN_MS;
+    return true;
+}
+
+void INT_TCP::disconnect(const std::string &reason)
+{
+    boost::system::error_code ec;
+    mSocket.close(ec);
+    if(!mReported) {
+        fprintf(stderr, "tcp - connection to %s %s: %s, spilling up to %zu bytes\n", mName.c_str(),
+            mConnected ? "lost" : "failed", reason.c_str(), mLimit);
+        mReported = true;
+    }
+    mConnected = false;
+    mRetry = std::chrono::steady_clock::now() + std::chrono::milliseconds(mBackoffMs);
+    mBackoffMs = std::min<uint32_t>(mBackoffMs * 2, TCP_BACKOFF_MAX_MS);
+
+    // The cut line is written again whole
+    if(mSent != 0) {
+        size_t line = mSpill.rfind('\n', mSent - 1);
+        mSent = line == std::string::npos ? 0 : line + 1;
+    }
+}
+
+void INT_TCP::flush()
+{
+    // Collector sends nothing, a readable socket is closed by the peer
+    struct pollfd pfd = {mSocket.native_handle(), POLLIN, 0};
+    if(poll(&pfd, 1, 0) == 1) {
+        char buf[256];
+        ssize_t len = recv(mSocket.native_handle(), buf, sizeof(buf), MSG_DONTWAIT);
+        if(len == 0 || (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            disconnect(len == 0 ? "closed by the peer" : strerror(errno));
+            return;
+        }
+    }
+
+    while(mSent < mSpill.size()) {
+        boost::system::error_code ec;
+        size_t len = mSocket.send(boost::asio::buffer(mSpill.data() + mSent, mSpill.size() - mSent), 0, ec);
+        if(ec == boost::asio::error::would_block || ec == boost::asio::error::try_again) {
+            break;
+        }
+        if(ec) {
+            disconnect(ec.message());
+            return;
+        }
+        mSent += len;
+    }
+
+    // Written lines are removed once they are the larger part of the buffer, the line
+    // cut by the socket stays so that a disconnect can write it again whole
+    if(mSent == mSpill.size()) {
+        mSpill.clear();
+        mSent = 0;
+    } else if(mSent > mSpill.size() / 2) {
+        size_t line = mSpill.rfind('\n', mSent - 1);
+        if(line != std::string::npos) {
+            mSpill.erase(0, line + 1);
+            mSent -= line + 1;
+        }
+    }
+}
+
+void INT_TCP::timer()
+{
+    std::unique_lock<std::mutex> lock(mLock);
+    while(!mStop) {
+        if(mSent == mSpill.size()) {
+            mWake.wait(lock);
+            continue;
+        }
+        if(!mConnected && std::chrono::steady_clock::now() >= mRetry) {
+            connect();
+        }
+        if(mConnected) {
+            flush();
+        }
+
+        // Connected socket is full, wait for space; the next attempt otherwise
+        if(mConnected) {
+            mWake.wait_for(lock, std::chrono::milliseconds(TCP_FLUSH_MS));
+        } else {
+            mWake.wait_until(lock, mRetry);
+        }
+    }
+}
+
+void INT_TCP::send(std::string &message)
+{
+    std::lock_guard<std::mutex> guard(mLock);
+    if(!mConnected && std::chrono::steady_clock::now() >= mRetry) {
+        connect();
+    }
+
+    // Spilled data goes first
+    if(mConnected) {
+        flush();
+    }
+    if(mSpill.size() - mSent + message.size() > mLimit) {
+        throw std::runtime_error("tcp - spill buffer of " + mName + " is full, batch dropped");
+    }
+    mSpill.append(message);
+    if(mConnected) {
+        flush();
+    }
+    if(mSent != mSpill.size()) {
+        mWake.notify_one();
+    }
+}
@@ -0,0 +1,133 @@
+// MIT License
+//
+// Copyright (c) 2019 Adam Wegrzynek
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+///
+/// \author Adam Wegrzynek <adam.wegrzynek@cern.ch>
+/// \author Mario Kuka <kuka@cesnet.cz>
+///
+
+#include <boost/asio.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#ifndef INT_TRANSPORTS_TCP_H
+#define INT_TRANSPORTS_TCP_H
+
+/// Default size of the spill buffer of one transport in bytes
+#define TCP_SPILL_BYTES (64 << 20)
+/// Timeout of one connection attempt in ms
+#define TCP_CONNECT_MS 100
+/// First and maximal delay between connection attempts in ms
+#define TCP_BACKOFF_MIN_MS 100
+#define TCP_BACKOFF_MAX_MS 5000
+/// Time the destructor waits for the delivery of spilled data in ms
+#define TCP_CLOSE_MS 1000
+/// Period of the timer writing spilled data to a connection with a full socket in ms
+#define TCP_FLUSH_MS 10
+
+/// \brief Persistent TCP transport of newline delimited line protocol (Telegraf socket_listener)
+///
+/// Batches are written to a long lived connection by non-blocking writes, the
+/// part the socket does not take stays in the spill buffer and is written first
+/// by the next send. While disconnected, batches are spilled and the connection
+/// is reestablished with an exponential backoff. A line cut by the lost
+/// connection is written again whole to the new one. The timer thread of the
+/// transport reconnects and writes the spilled data when no batch comes, so
+/// the spill is delivered after the collector restarts without new traffic.
+class INT_TCP
+{
+    public:
+        /// Constructor, the collector does not have to be reachable yet
+        /// \param spill Maximal size of data waiting for the connection in bytes
+        INT_TCP(const std::string &hostname, int port, size_t spill = TCP_SPILL_BYTES);
+
+        /// Destructor, waits up to TCP_CLOSE_MS for the delivery of spilled data
+        ~INT_TCP();
+
+        /// Sends blob via TCP, returns when the data is written or spilled
+        /// \throw std::runtime_error when the blob does not fit to the spill buffer, it is dropped
+        void send(std::string& message);
+
+    private:
+        /// Connect by a non-blocking connect limited by TCP_CONNECT_MS
+        /// \return true when connected
+        bool connect();
+
+        /// Close the connection and schedule the next attempt
+        void disconnect(const std::string &reason);
+
+        /// Write as much of the spill buffer as the socket takes
+        void flush();
+
+        /// Timer thread, reconnects and flushes while data is spilled
+        void timer();
+
+        /// Boost Asio I/O functionality
+        boost::asio::io_service mIoService;
+
+        /// TCP socket
+        boost::asio::ip::tcp::socket mSocket;
+
+        /// TCP endpoint
+        boost::asio::ip::tcp::endpoint mEndpoint;
+
+        /// Collector in messages, host:port
+        std::string mName;
+
+        /// Data not written yet, the written part is removed lazily
+        std::string mSpill;
+
+        /// Bytes of the spill buffer already written
+        size_t mSent;
+
+        /// Maximal size of data waiting in the spill buffer
+        size_t mLimit;
+
+        /// Connection is established
+        bool mConnected;
+
+        /// Failure of the connection was reported, it is reported once per outage
+        bool mReported;
+
+        /// Delay of the next connection attempt
+        uint32_t mBackoffMs;
+
+        /// Time of the next connection attempt
+        std::chrono::steady_clock::time_point mRetry;
+
+        /// Lock of the connection and the spill buffer, shared by send() and the timer
+        std::mutex mLock;
+
+        /// Wakes the timer when data is spilled or the transport is destroyed
+        std::condition_variable mWake;
+
+        /// Timer thread is stopped
+        bool mStop;
+
+        /// Timer thread
+        std::thread mTimer;
+};
+
+#endif // INT_TRANSPORTS_TCP_H
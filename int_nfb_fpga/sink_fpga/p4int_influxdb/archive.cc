@@ -0,0 +1,436 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Local archive of INT reports in compressed time series
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <dirent.h>
+#include <endian.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "archive.h"
+
+// Columns of a point, the delay and the hop and link delays of every hop
+#define ARCHIVE_COLUMNS(hops) (1 + 2 * (hops))
+// XOR window of a column before its first non-zero XOR
+#define ARCHIVE_NO_WINDOW 0xff
+
+/**
+ * Append bits to the stream, the most significant bit first
+ * \param bits Stream of 64-bit words
+ * \param cnt Valid bits of the stream
+ * \param value Appended bits in the lowest bits of the value
+ * \param n Number of bits, 1 to 64
+ */
+static inline void put_bits(std::vector<uint64_t> &bits, uint64_t &cnt, uint64_t value, uint32_t n) {
+    if(n < 64) {
+        value &= (1ull << n) - 1;
+    }
+    uint32_t used = cnt & 63;
+    if(used == 0) {
+        bits.push_back(0);
+    }
+    uint32_t free = 64 - used;
+    if(n <= free) {
+        bits.back() |= value << (free - n);
+    } else {
+        bits.back() |= value >> (n - free);
+        bits.push_back(value << (64 - (n - free)));
+    }
+    cnt += n;
+}
+
+// Bit stream of a stored block
+typedef struct {
+    const uint8_t *data;
+    uint64_t       size; // Size of the stream in bits
+    uint64_t       pos;  // Next bit
+} bit_reader_t;
+
+/**
+ * Read bits of the stream, reads behind the end return zeros
+ * \param reader Stream
+ * \param n Number of bits, 1 to 64
+ * \return Bits in the lowest bits of the value
+ */
+static uint64_t get_bits(bit_reader_t &reader, uint32_t n) {
+    uint64_t value = 0;
+    while(n > 0) {
+        uint32_t left = 8 - (reader.pos & 7);
+        uint32_t take = n < left ? n : left;
+        uint8_t byte = reader.pos < reader.size ? reader.data[reader.pos >> 3] : 0;
+        value = (value << take) | ((byte >> (left - take)) & ((1u << take) - 1));
+        reader.pos += take;
+        n -= take;
+    }
+    return value;
+}
+
+/**
+ * Sign extend the lowest bits of the value
+ * \param value Value
+ * \param n Number of valid bits
+ */
+static inline int64_t sign_extend(uint64_t value, uint32_t n) {
+    return n == 64 ? (int64_t)value : (int64_t)(value << (64 - n)) >> (64 - n);
+}
+
+// Prefix codes of delta-of-delta timestamps, the code of N ones and a zero
+// is followed by the number of bits of its bucket, the last one has no zero
+static const uint32_t dod_bits[] = {0, 16, 24, 32, 64};
+#define DOD_BUCKETS (sizeof(dod_bits) / sizeof(dod_bits[0]))
+
+ArchiveWriter::ArchiveWriter(const std::string &dir, uint32_t id, uint32_t span)
+    : m_dir(dir), m_id(id), m_span(span * 1000000000ull), m_seg_start(0), m_seg(NULL), m_offset(0),
+      m_points(0), m_bytes(0)
+{
+    if(mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw std::runtime_error("Unable to create the archive " + dir + ": " + strerror(errno));
+    }
+}
+
+ArchiveWriter::~ArchiveWriter()
+{
+    try {
+        close();
+    } catch (std::runtime_error &e) {
+        printf("archive - %s\n", e.what());
+    }
+}
+
+void ArchiveWriter::openSegment(uint64_t ts)
+{
+    m_seg_start = ts / m_span * m_span;
+    char name[64];
+    snprintf(name, sizeof(name), "/%010lu-%u", (uint64_t)(m_seg_start / 1000000000), m_id);
+    m_seg_path = m_dir + name;
+
+    // Segment of the same span left by the previous run stays untouched
+    struct stat st;
+    for(uint32_t i = 1; stat((m_seg_path + ".seg").c_str(), &st) == 0; i++) {
+        m_seg_path = m_dir + name + "." + std::to_string(i);
+    }
+    m_seg = fopen((m_seg_path + ".seg").c_str(), "wb");
+    if(m_seg == NULL) {
+        throw std::runtime_error("Unable to create the segment " + m_seg_path + ": " + strerror(errno));
+    }
+    archive_seg_hdr_t hdr = {ARCHIVE_SEG_MAGIC, m_seg_start, m_span};
+    if(fwrite(&hdr, sizeof(hdr), 1, m_seg) != 1) {
+        throw std::runtime_error("Unable to write the segment " + m_seg_path);
+    }
+    m_offset = sizeof(hdr);
+    m_index.clear();
+}
+
+void ArchiveWriter::seal(open_block_t &block)
+{
+    if(block.hdr.points == 0) {
+        return;
+    }
+    // Words are stored in big endian, so the stream is read byte by byte
+    block.hdr.size = (block.bit_cnt + 7) / 8;
+    for(uint64_t &word : block.bits) {
+        word = htobe64(word);
+    }
+    if(fwrite(&block.hdr, sizeof(block.hdr), 1, m_seg) != 1 ||
+        fwrite(block.bits.data(), block.hdr.size, 1, m_seg) != 1) {
+        throw std::runtime_error("Unable to write the segment " + m_seg_path);
+    }
+    m_index.push_back({block.hdr, m_offset});
+    m_offset += sizeof(block.hdr) + block.hdr.size;
+
+    block.hdr.points = 0;
+    block.bits.clear();
+    block.bit_cnt = 0;
+}
+
+void ArchiveWriter::append(const telemetric_hdr_t &record)
+{
+    if(record.aggregated != 0) {
+        return;
+    }
+    uint64_t ts = record.dstTs;
+    // Late points stay in the open segment, the index keeps the real time range
+    if(m_seg == NULL || ts >= m_seg_start + m_span) {
+        close();
+        openSegment(ts);
+    }
+
+    open_block_t &block = m_blocks[record.flowKey];
+    if(block.hdr.points != 0 && block.hdr.hops != record.node_cnt) {
+        seal(block);
+    }
+
+    uint64_t values[ARCHIVE_COLUMNS(MAX_NODES + 1)];
+    uint32_t columns = ARCHIVE_COLUMNS(record.node_cnt);
+    values[0] = record.delay;
+    for(uint32_t i = 0; i < record.node_cnt; i++) {
+        values[1 + 2 * i] = record.node_meta[i].hop_delay;
+        values[2 + 2 * i] = (uint64_t)record.node_meta[i].link_delay;
+    }
+
+    if(block.hdr.points == 0) {
+        // The first point is stored as it is
+        block.hdr.flow_key = record.flowKey;
+        block.hdr.min_ts = ts;
+        block.hdr.max_ts = ts;
+        block.hdr.src_port = record.srcPort;
+        block.hdr.dst_port = record.dstPort;
+        block.hdr.protocol = record.protocol;
+        block.hdr.hops = record.node_cnt;
+        block.bit_cnt = 0;
+        put_bits(block.bits, block.bit_cnt, ts, 64);
+        for(uint32_t c = 0; c < columns; c++) {
+            put_bits(block.bits, block.bit_cnt, values[c], 64);
+            block.prev[c] = values[c];
+            block.lead[c] = ARCHIVE_NO_WINDOW;
+            block.trail[c] = ARCHIVE_NO_WINDOW;
+        }
+        block.prev_ts = ts;
+        block.prev_delta = 0;
+    } else {
+        // Delta-of-delta of the timestamp in the smallest bucket holding it
+        int64_t delta = (int64_t)(ts - block.prev_ts);
+        int64_t dod = delta - block.prev_delta;
+        uint32_t bucket = 0;
+        if(dod != 0) {
+            bucket = 1;
+            while(bucket + 1 < DOD_BUCKETS && dod != sign_extend(dod, dod_bits[bucket])) {
+                bucket++;
+            }
+        }
+        if(bucket + 1 < DOD_BUCKETS) {
+            put_bits(block.bits, block.bit_cnt, ((1ull << bucket) - 1) << 1, bucket + 1);
+        } else {
+            put_bits(block.bits, block.bit_cnt, (1ull << bucket) - 1, bucket);
+        }
+        if(bucket != 0) {
+            put_bits(block.bits, block.bit_cnt, dod, dod_bits[bucket]);
+        }
+        block.prev_ts = ts;
+        block.prev_delta = delta;
+        block.hdr.min_ts = std::min(block.hdr.min_ts, ts);
+        block.hdr.max_ts = std::max(block.hdr.max_ts, ts);
+
+        // Values as XOR with the previous one, the meaningful bits reuse the
+        // window of the previous XOR when they fit in it
+        for(uint32_t c = 0; c < columns; c++) {
+            uint64_t x = values[c] ^ block.prev[c];
+            block.prev[c] = values[c];
+            if(x == 0) {
+                put_bits(block.bits, block.bit_cnt, 0, 1);
+                continue;
+            }
+            uint32_t lead = __builtin_clzll(x);
+            uint32_t trail = __builtin_ctzll(x);
+            if(block.lead[c] != ARCHIVE_NO_WINDOW && lead >= block.lead[c] && trail >= block.trail[c]) {
+                put_bits(block.bits, block.bit_cnt, 2, 2);
+                put_bits(block.bits, block.bit_cnt, x >> block.trail[c], 64 - block.lead[c] - block.trail[c]);
+            } else {
+                uint32_t len = 64 - lead - trail;
+                put_bits(block.bits, block.bit_cnt, 3, 2);
+                put_bits(block.bits, block.bit_cnt, lead, 6);
+                put_bits(block.bits, block.bit_cnt, len - 1, 6);
+                put_bits(block.bits, block.bit_cnt, x >> trail, len);
+                block.lead[c] = lead;
+                block.trail[c] = trail;
+            }
+        }
+    }
+    m_points++;
+    if(++block.hdr.points == ARCHIVE_BLOCK_POINTS) {
+        seal(block);
+    }
+}
+
+void ArchiveWriter::close()
+{
+    if(m_seg == NULL) {
+        return;
+    }
+    for(std::pair<const uint64_t, open_block_t> &block : m_blocks) {
+        seal(block.second);
+    }
+    m_blocks.clear();
+    bool failed = fclose(m_seg) != 0;
+    m_seg = NULL;
+    m_bytes += m_offset;
+    if(failed) {
+        throw std::runtime_error("Unable to write the segment " + m_seg_path);
+    }
+
+    // The index is renamed into place when complete, a partial one is never read
+    archive_idx_hdr_t hdr = {ARCHIVE_IDX_MAGIC, UINT64_MAX, 0, (uint32_t)m_index.size(), 0};
+    for(const archive_idx_entry_t &entry : m_index) {
+        hdr.min_ts = std::min(hdr.min_ts, entry.block.min_ts);
+        hdr.max_ts = std::max(hdr.max_ts, entry.block.max_ts);
+    }
+    std::string tmp = m_seg_path + ".idx.tmp";
+    FILE *idx = fopen(tmp.c_str(), "wb");
+    if(idx == NULL) {
+        throw std::runtime_error("Unable to create the index " + tmp + ": " + strerror(errno));
+    }
+    failed = fwrite(&hdr, sizeof(hdr), 1, idx) != 1 ||
+        fwrite(m_index.data(), sizeof(archive_idx_entry_t), m_index.size(), idx) != m_index.size();
+    failed |= fclose(idx) != 0;
+    if(failed || rename(tmp.c_str(), (m_seg_path + ".idx").c_str()) != 0) {
+        throw std::runtime_error("Unable to write the index " + tmp);
+    }
+    m_bytes += sizeof(hdr) + m_index.size() * sizeof(archive_idx_entry_t);
+    m_index.clear();
+}
+
+int32_t archive_parse(const char *arg, options_t *opt) {
+    std::string value(arg);
+    size_t comma = value.find(',');
+    opt->archive = value.substr(0, comma);
+    opt->archive_span = ARCHIVE_SPAN_DEFAULT;
+    if(comma != std::string::npos) {
+        std::string param = value.substr(comma + 1);
+        char *end;
+        if(param.compare(0, 5, "span=") != 0) {
+            printf("Unknown archive parameter \"%s\"!\n", param.c_str());
+            return RET_ERR;
+        }
+        opt->archive_span = strtoul(param.c_str() + 5, &end, 10);
+        if(*end != '\0' || opt->archive_span == 0) {
+            printf("Span of the archive segment must be a positive number of seconds!\n");
+            return RET_ERR;
+        }
+    }
+    if(opt->archive.empty()) {
+        printf("Directory of the archive is missing!\n");
+        return RET_ERR;
+    }
+    return RET_OK;
+}
+
+uint64_t archive_flow_key(uint32_t src, uint32_t dst) {
+    // Addresses in the order of the report header, see decode_packet()
+    uint32_t addrs[2] = {src, dst};
+    uint64_t key;
+    memcpy(&key, addrs, sizeof(key));
+    return key;
+}
+
+std::vector<std::string> archive_segments(const std::string &dir) {
+    DIR *handle = opendir(dir.c_str());
+    if(handle == NULL) {
+        throw std::runtime_error("Unable to open the archive " + dir + ": " + strerror(errno));
+    }
+    std::vector<std::string> segments;
+    struct dirent *entry;
+    while((entry = readdir(handle)) != NULL) {
+        std::string name(entry->d_name);
+        if(name.size() > 4 && name.compare(name.size() - 4, 4, ".seg") == 0) {
+            segments.push_back(dir + "/" + name.substr(0, name.size() - 4));
+        }
+    }
+    closedir(handle);
+    // Names start with the zero padded start of the span
+    std::sort(segments.begin(), segments.end());
+    return segments;
+}
+
+bool archive_blocks(const std::string &seg, uint64_t from, uint64_t to, std::vector<archive_idx_entry_t> &blocks) {
+    blocks.clear();
+    FILE *idx = fopen((seg + ".idx").c_str(), "rb");
+    if(idx != NULL) {
+        archive_idx_hdr_t hdr;
+        if(fread(&hdr, sizeof(hdr), 1, idx) == 1 && hdr.magic == ARCHIVE_IDX_MAGIC) {
+            if(hdr.blocks == 0 || hdr.max_ts < from || hdr.min_ts > to) {
+                fclose(idx);
+                return false;
+            }
+            archive_idx_entry_t entry;
+            while(fread(&entry, sizeof(entry), 1, idx) == 1) {
+                if(entry.block.max_ts >= from && entry.block.min_ts <= to) {
+                    blocks.push_back(entry);
+                }
+            }
+            fclose(idx);
+            return true;
+        }
+        fclose(idx);
+    }
+
+    // Segment without the index, walk the headers of its blocks
+    FILE *file = fopen((seg + ".seg").c_str(), "rb");
+    if(file == NULL) {
+        throw std::runtime_error("Unable to open the segment " + seg + ": " + strerror(errno));
+    }
+    archive_seg_hdr_t hdr;
+    struct stat st;
+    if(fread(&hdr, sizeof(hdr), 1, file) != 1 || hdr.magic != ARCHIVE_SEG_MAGIC || fstat(fileno(file), &st) != 0) {
+        fclose(file);
+        throw std::runtime_error("File " + seg + ".seg is not a segment of the archive");
+    }
+    uint64_t offset = sizeof(hdr);
+    archive_idx_entry_t entry;
+    while(fread(&entry.block, sizeof(entry.block), 1, file) == 1) {
+        entry.offset = offset;
+        offset += sizeof(entry.block) + entry.block.size;
+        if(offset > (uint64_t)st.st_size || fseek(file, offset, SEEK_SET) != 0) {
+            // Block cut by the end of the file
+            break;
+        }
+        if(entry.block.max_ts >= from && entry.block.min_ts <= to) {
+            blocks.push_back(entry);
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+void archive_decode(const archive_block_t &block, const uint8_t *data, std::vector<archive_point_t> &points) {
+    bit_reader_t reader = {data, (uint64_t)block.size * 8, 0};
+    uint32_t hops = std::min<uint32_t>(block.hops, MAX_NODES + 1);
+    uint32_t columns = ARCHIVE_COLUMNS(hops);
+    uint64_t prev[ARCHIVE_COLUMNS(MAX_NODES + 1)];
+    uint8_t lead[ARCHIVE_COLUMNS(MAX_NODES + 1)];
+    uint8_t trail[ARCHIVE_COLUMNS(MAX_NODES + 1)];
+    uint64_t ts = 0;
+    int64_t delta = 0;
+
+    for(uint32_t p = 0; p < block.points; p++) {
+        if(p == 0) {
+            ts = get_bits(reader, 64);
+            for(uint32_t c = 0; c < columns; c++) {
+                prev[c] = get_bits(reader, 64);
+            }
+        } else {
+            uint32_t bucket = 0;
+            while(bucket + 1 < DOD_BUCKETS && get_bits(reader, 1)) {
+                bucket++;
+            }
+            int64_t dod = bucket != 0 ? sign_extend(get_bits(reader, dod_bits[bucket]), dod_bits[bucket]) : 0;
+            delta += dod;
+            ts += delta;
+            for(uint32_t c = 0; c < columns; c++) {
+                if(get_bits(reader, 1) == 0) {
+                    continue;
+                }
+                if(get_bits(reader, 1) == 1) {
+                    lead[c] = get_bits(reader, 6);
+                    uint32_t len = get_bits(reader, 6) + 1;
+                    trail[c] = 64 - lead[c] - len;
+                }
+                prev[c] ^= get_bits(reader, 64 - lead[c] - trail[c]) << trail[c];
+            }
+        }
+
+        archive_point_t point;
+        point.ts = ts;
+        point.delay = prev[0];
+        point.hops = hops;
+        for(uint32_t i = 0; i < hops; i++) {
+            point.hop_delay[i] = prev[1 + 2 * i];
+            point.link_delay[i] = (int64_t)prev[2 + 2 * i];
+        }
+        points.push_back(point);
+    }
+}
@@ -0,0 +1,209 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Local archive of INT reports in compressed time series
+ *
+ * Every report of a flow is a point of the flow series: the sink timestamp,
+ * the end-to-end delay and the hop and link delays of every hop. Points are
+ * compressed in the way of Gorilla: timestamps as delta-of-delta and values
+ * as XOR with the previous value of the same column, both with variable
+ * length prefix codes. Points of a flow are collected in an open block, the
+ * block is sealed after ARCHIVE_BLOCK_POINTS points or when the number of
+ * hops changes.
+ *
+ * Sealed blocks are appended to the segment file covering a span of sink
+ * time. Every segment has a small index of its blocks written when the
+ * segment is closed, so the reader decodes only blocks of the requested flow
+ * and time range. Segments without the index, left by a crash, are read by
+ * walking the headers of their blocks.
+ *
+ * Files of a segment are named <start>-<writer>.seg and <start>-<writer>.idx,
+ * where start is the beginning of the span in UNIX seconds and writer is the
+ * thread running the aggregation, every thread has its own writer.
+ */
+
+#ifndef _ARCHIVE_H_
+#define _ARCHIVE_H_
+
+#include <cstdio>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "p4int.h"
+
+// Points of a sealed block
+#define ARCHIVE_BLOCK_POINTS 512
+// Default span of a segment file in seconds
+#define ARCHIVE_SPAN_DEFAULT 3600
+// Magic numbers of segment and index files
+#define ARCHIVE_SEG_MAGIC 0x31474553414e4950ull // "PINASEG1"
+#define ARCHIVE_IDX_MAGIC 0x31584449414e4950ull // "PINAIDX1"
+
+// Header of a segment file
+typedef struct {
+    uint64_t magic;   // ARCHIVE_SEG_MAGIC
+    uint64_t start;   // Start of the span in UNIX NS format
+    uint64_t span;    // Span of the segment in ns
+} __attribute__((packed)) archive_seg_hdr_t;
+
+// Header of a block in the segment file, the compressed points follow
+typedef struct {
+    uint64_t flow_key; // Flow key, source and destination address of the report
+    uint64_t min_ts;   // Smallest timestamp of the block
+    uint64_t max_ts;   // Largest timestamp of the block
+    uint32_t size;     // Size of the compressed points in bytes
+    uint16_t points;   // Number of points
+    uint16_t src_port; // Ports and protocol of the first report
+    uint16_t dst_port;
+    uint8_t  protocol;
+    uint8_t  hops;     // Hops of every point
+} __attribute__((packed)) archive_block_t;
+
+// Header of an index file, block headers with their offsets follow
+typedef struct {
+    uint64_t magic;   // ARCHIVE_IDX_MAGIC
+    uint64_t min_ts;  // Smallest timestamp of the segment
+    uint64_t max_ts;  // Largest timestamp of the segment
+    uint32_t blocks;  // Number of entries
+    uint32_t reserved;
+} __attribute__((packed)) archive_idx_hdr_t;
+
+// Entry of the index
+typedef struct {
+    archive_block_t block;
+    uint64_t        offset; // Offset of the block header in the segment file
+} __attribute__((packed)) archive_idx_entry_t;
+
+// Decoded point of the flow series
+typedef struct {
+    uint64_t ts;    // Sink timestamp (UNIX NS format)
+    uint64_t delay; // End-to-end delay
+    uint8_t  hops;  // Valid items of hop_delay and link_delay
+    uint64_t hop_delay[MAX_NODES + 1];
+    int64_t  link_delay[MAX_NODES + 1];
+} archive_point_t;
+
+/**
+ * Writer of points, every thread running the aggregation owns one. Sealed
+ * blocks are written by buffered stdio, the thread blocks only when the
+ * buffer is flushed. Throws std::runtime_error when a file can not be
+ * created or written.
+ */
+class ArchiveWriter
+{
+    public:
+        /**
+         * Constructor
+         * \param dir Directory of the archive, created when missing
+         * \param id Index of the writer, part of the file names
+         * \param span Span of one segment in seconds
+         */
+        ArchiveWriter(const std::string &dir, uint32_t id, uint32_t span);
+
+        /**
+         * Destructor, seals all blocks and closes the segment
+         */
+        ~ArchiveWriter();
+
+        /**
+         * Append the report to the series of its flow
+         * \param record Decoded report, aggregates of degraded flows are skipped
+         */
+        void append(const telemetric_hdr_t &record);
+
+        /**
+         * Seal all blocks and close the segment with its index
+         */
+        void close();
+
+        /**
+         * Number of archived points
+         */
+        uint64_t points() const { return m_points; }
+
+        /**
+         * Number of bytes written to segment and index files
+         */
+        uint64_t bytes() const { return m_bytes; }
+
+    protected:
+        // Open block of a flow
+        typedef struct {
+            archive_block_t hdr;
+            std::vector<uint64_t> bits;   // Compressed points, bit stream of 64-bit words
+            uint64_t bit_cnt;             // Valid bits of the stream
+            uint64_t prev_ts;
+            int64_t  prev_delta;
+            uint64_t prev[2 * MAX_NODES + 3];  // Previous value of every column
+            uint8_t  lead[2 * MAX_NODES + 3];  // XOR window of every column
+            uint8_t  trail[2 * MAX_NODES + 3];
+        } open_block_t;
+
+        /**
+         * Open the segment holding the timestamp
+         * \param ts Timestamp of the point (UNIX NS format)
+         */
+        void openSegment(uint64_t ts);
+
+        /**
+         * Write the block to the segment and reset it
+         * \param block Open block
+         */
+        void seal(open_block_t &block);
+
+        std::string m_dir;
+        uint32_t    m_id;
+        uint64_t    m_span;       // Span of a segment in ns
+        uint64_t    m_seg_start;  // Start of the open segment, 0 without a segment
+        std::string m_seg_path;   // Path of the open segment without the suffix
+        FILE       *m_seg;
+        uint64_t    m_offset;     // Size of the open segment
+        std::vector<archive_idx_entry_t> m_index;
+        std::map<uint64_t, open_block_t> m_blocks;
+        uint64_t    m_points;
+        uint64_t    m_bytes;
+};
+
+/**
+ * Parse the archive option, "dir[,span=seconds]"
+ * \param arg Option string
+ * \param opt Where to store the directory and the span
+ * \return RET_OK on success
+ */
+int32_t archive_parse(const char *arg, options_t *opt);
+
+/**
+ * Flow key of the report from its addresses, the key of \ref telemetric_hdr_t
+ * \param src Source IPv4 address in network order
+ * \param dst Destination IPv4 address in network order
+ * \return Flow key
+ */
+uint64_t archive_flow_key(uint32_t src, uint32_t dst);
+
+/**
+ * Read the blocks of the segment overlapping the time range
+ * \param seg Path of the segment without the suffix
+ * \param from Start of the time range (UNIX NS format)
+ * \param to End of the time range, inclusive
+ * \param blocks Where to store the headers and offsets of the blocks
+ * \return false when the segment does not overlap the range
+ */
+bool archive_blocks(const std::string &seg, uint64_t from, uint64_t to, std::vector<archive_idx_entry_t> &blocks);
+
+/**
+ * List segments of the archive
+ * \param dir Directory of the archive
+ * \return Paths of the segments without the suffix, sorted by the start
+ */
+std::vector<std::string> archive_segments(const std::string &dir);
+
+/**
+ * Decompress points of the block
+ * \param block Header of the block
+ * \param data Compressed points, block.size bytes
+ * \param points Where to append the points
+ */
+void archive_decode(const archive_block_t &block, const uint8_t *data, std::vector<archive_point_t> &points);
+
+#endif // _ARCHIVE_H_
@@ -0,0 +1,184 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Reader of the local archive of the INT sink
+ *
+ * Prints the series of one flow in a time range as CSV or lists the flows of
+ * the archive. Only segments and blocks overlapping the range are read, the
+ * index of a segment is enough to skip it.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <algorithm>
+#include <stdexcept>
+#include <getopt.h>
+#include <arpa/inet.h>
+
+#include "archive.h"
+
+// Flow of the archive, summary of its blocks
+typedef struct {
+    archive_block_t first;  // Header of the first block of the flow
+    uint64_t points;
+    uint64_t min_ts;
+    uint64_t max_ts;
+} flow_summary_t;
+
+/**
+ * Print the usage of the program
+ */
+static void print_help(const char *prgname) {
+    printf("%s -a archiveDir [-s srcIp -d dstIp] [-f from] [-t to] [-l] [-h]\n", prgname);
+    printf("\t* -a = Directory of the archive (-a of p4int).\n");
+    printf("\t* -s = Source IPv4 address of the flow.\n");
+    printf("\t* -d = Destination IPv4 address of the flow.\n");
+    printf("\t* -f = Start of the time range in UNIX ns (default is the beginning).\n");
+    printf("\t* -t = End of the time range in UNIX ns, inclusive (default is the end).\n");
+    printf("\t* -l = List flows of the time range instead of printing a series.\n");
+    printf("\t* -h = Print this help.\n");
+    printf("The series is printed as CSV: dstts, delay and hop_delay and link_delay of every hop.\n");
+}
+
+/**
+ * Print the flow key as its addresses
+ */
+static void print_flow(uint64_t key) {
+    uint32_t addrs[2];
+    memcpy(addrs, &key, sizeof(addrs));
+    char src[INET_ADDRSTRLEN];
+    char dst[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &addrs[0], src, sizeof(src));
+    inet_ntop(AF_INET, &addrs[1], dst, sizeof(dst));
+    printf("%s,%s", src, dst);
+}
+
+int main(int argc, char **argv) {
+    std::string dir;
+    const char *src = NULL;
+    const char *dst = NULL;
+    uint64_t from = 0;
+    uint64_t to = UINT64_MAX;
+    bool list = false;
+
+    int op;
+    while((op = getopt(argc, argv, "a:s:d:f:t:lh")) != -1) {
+        switch(op) {
+            case 'a':
+                dir = optarg;
+                break;
+            case 's':
+                src = optarg;
+                break;
+            case 'd':
+                dst = optarg;
+                break;
+            case 'f':
+                from = strtoull(optarg, NULL, 10);
+                break;
+            case 't':
+                to = strtoull(optarg, NULL, 10);
+                break;
+            case 'l':
+                list = true;
+                break;
+            case 'h':
+                print_help(argv[0]);
+                return RET_OK;
+            default:
+                print_help(argv[0]);
+                return RET_ERR;
+        }
+    }
+
+    struct in_addr src_addr;
+    struct in_addr dst_addr;
+    if(dir.empty() || (!list && (src == NULL || dst == NULL))) {
+        print_help(argv[0]);
+        return RET_ERR;
+    }
+    if(!list && (inet_pton(AF_INET, src, &src_addr) != 1 || inet_pton(AF_INET, dst, &dst_addr) != 1)) {
+        printf("Addresses of the flow must be IPv4 addresses!\n");
+        return RET_ERR;
+    }
+    uint64_t key = list ? 0 : archive_flow_key(src_addr.s_addr, dst_addr.s_addr);
+
+    try {
+        std::vector<std::string> segments = archive_segments(dir);
+        std::vector<archive_idx_entry_t> blocks;
+        std::vector<archive_point_t> points;
+        std::vector<uint8_t> data;
+        std::map<uint64_t, flow_summary_t> flows;
+        uint32_t skipped = 0;
+        uint64_t decoded = 0;
+
+        for(const std::string &seg : segments) {
+            if(!archive_blocks(seg, from, to, blocks)) {
+                skipped++;
+                continue;
+            }
+            FILE *file = NULL;
+            for(const archive_idx_entry_t &entry : blocks) {
+                if(list) {
+                    flow_summary_t &flow = flows[entry.block.flow_key];
+                    if(flow.points == 0) {
+                        flow.first = entry.block;
+                        flow.min_ts = entry.block.min_ts;
+                    }
+                    flow.points += entry.block.points;
+                    flow.min_ts = std::min(flow.min_ts, entry.block.min_ts);
+                    flow.max_ts = std::max(flow.max_ts, entry.block.max_ts);
+                    continue;
+                }
+                if(entry.block.flow_key != key) {
+                    continue;
+                }
+                if(file == NULL && (file = fopen((seg + ".seg").c_str(), "rb")) == NULL) {
+                    throw std::runtime_error("Unable to open the segment " + seg);
+                }
+                data.resize(entry.block.size);
+                if(fseek(file, entry.offset + sizeof(archive_block_t), SEEK_SET) != 0 ||
+                    fread(data.data(), 1, data.size(), file) != data.size()) {
+                    fclose(file);
+                    throw std::runtime_error("Unable to read the segment " + seg);
+                }
+                archive_decode(entry.block, data.data(), points);
+                decoded++;
+            }
+            if(file != NULL) {
+                fclose(file);
+            }
+        }
+        fprintf(stderr, "archive - %zu segments, %u skipped by the index, %lu blocks decoded\n",
+            segments.size(), skipped, decoded);
+
+        if(list) {
+            printf("srcip,dstip,srcp,dstp,protocol,points,from,to\n");
+            for(const std::pair<const uint64_t, flow_summary_t> &flow : flows) {
+                print_flow(flow.first);
+                printf(",%u,%u,%u,%lu,%lu,%lu\n", flow.second.first.src_port, flow.second.first.dst_port,
+                    flow.second.first.protocol, flow.second.points, flow.second.min_ts, flow.second.max_ts);
+            }
+            return RET_OK;
+        }
+
+        // Blocks of more writers and late points may interleave
+        std::stable_sort(points.begin(), points.end(),
+            [](const archive_point_t &a, const archive_point_t &b) { return a.ts < b.ts; });
+        printf("dstts,delay,hop_delay,link_delay,...\n");
+        for(const archive_point_t &point : points) {
+            if(point.ts < from || point.ts > to) {
+                continue;
+            }
+            printf("%lu,%lu", point.ts, point.delay);
+            for(uint32_t i = 0; i < point.hops; i++) {
+                printf(",%lu,%ld", point.hop_delay[i], point.link_delay[i]);
+            }
+            printf("\n");
+        }
+    } catch (std::runtime_error &e) {
+        printf("%s\n", e.what());
+        return RET_ERR;
+    }
+    return RET_OK;
+}
@@ -0,0 +1,30 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Scheduling of batch cuts shared by all transports
+ */
+
+#include "batch_sched.h"
+
+BatchScheduler::BatchScheduler(const options_t *opt, bool udp)
+    : m_lines(opt->batch),
+      m_bytes(opt->batch_bytes),
+      m_age_ns(opt->batch_age * 1000000ull),
+      m_first(0)
+{
+    if(m_bytes == 0) {
+        m_bytes = udp ? BATCH_UDP_BYTES : BATCH_HTTP_BYTES;
+    }
+}
+
+uint32_t BatchScheduler::timeout(uint64_t now) const
+{
+    if(m_first == 0) {
+        return 0;
+    }
+    uint64_t deadline = m_first + m_age_ns;
+    // Already expired, wake up as soon as possible
+    if(deadline <= now) {
+        return 1;
+    }
+    return (deadline - now + 999) / 1000;
+}
@@ -0,0 +1,103 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Scheduling of batch cuts shared by all transports
+ */
+
+#ifndef _BATCH_SCHED_H_
+#define _BATCH_SCHED_H_
+
+#include <cstdint>
+#include <cstddef>
+
+#include "p4int.h"
+
+// Default maximal age of the oldest record of a batch in milliseconds
+#define BATCH_AGE_DEFAULT 50
+// Default byte budget of UDP, the largest payload of an IPv4 datagram
+#define BATCH_UDP_BYTES 65507
+// Default byte budget of HTTP requests
+#define BATCH_HTTP_BYTES (4 << 20)
+
+/**
+ * Decides when a batch is cut: on the line count, the byte budget or the
+ * maximal age of its oldest record, whichever comes first. The line count
+ * and the byte budget trade freshness for throughput, the age bounds the
+ * time a record waits in a half empty batch when the traffic is low.
+ */
+class BatchScheduler
+{
+    public:
+        /**
+         * Constructor
+         * \param opt Program options, -b lines, -B bytes and -A age
+         * \param udp UDP transport, its default byte budget is one datagram
+         */
+        BatchScheduler(const options_t *opt, bool udp);
+
+        /**
+         * Note records added to the batch, the first one starts the age
+         * \param now Monotonic time of the addition in ns
+         */
+        inline void added(uint64_t now)
+        {
+            if(m_first == 0) {
+                m_first = now;
+            }
+        }
+
+        /**
+         * Check whether the batch exceeds the byte budget
+         * \param bytes Size of the batch
+         * \return true when the last record has to move to the next batch
+         */
+        inline bool overBudget(size_t bytes) const
+        {
+            return bytes > m_bytes;
+        }
+
+        /**
+         * Check whether the batch reached the line count
+         * \param lines Lines of the batch
+         */
+        inline bool full(uint32_t lines) const
+        {
+            return lines >= m_lines;
+        }
+
+        /**
+         * Check whether the oldest record reached the maximal age
+         * \param now Monotonic time in ns
+         */
+        inline bool expired(uint64_t now) const
+        {
+            return m_first != 0 && now - m_first >= m_age_ns;
+        }
+
+        /**
+         * Time until the batch expires, the timeout of the queue wait
+         * \param now Monotonic time in ns
+         * \return Timeout in microseconds, 0 waits forever for an empty batch
+         */
+        uint32_t timeout(uint64_t now) const;
+
+        /**
+         * Note the cut of the batch, the next batch starts empty
+         */
+        inline void cut()
+        {
+            m_first = 0;
+        }
+
+        /**
+         * Byte budget of one batch
+         */
+        size_t bytes() const { return m_bytes; }
+
+    protected:
+        uint32_t m_lines;           // Line count of a full batch
+        size_t   m_bytes;           // Byte budget of a batch
+        uint64_t m_age_ns;          // Maximal age of the oldest record
+        uint64_t m_first;           // Time the oldest record was added, 0 for an empty batch
+};
+
+#endif // _BATCH_SCHED_H_
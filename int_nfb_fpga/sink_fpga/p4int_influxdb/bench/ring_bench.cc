@@ -0,0 +1,304 @@
+/**
+ * @brief Microbenchmark of the SPSC ring buffer
+ *
+ * Producer and consumer run on separate cores and move a fixed number of
+ * items through the ring. Throughput, cache and dTLB misses of both threads
+ * are reported for the previous heap allocated ring buffer and for the current
+ * one backed by 4 KB pages or hugepages, with single and bulk operations.
+ *
+ * Usage: ring_bench [items] [producer_cpu] [consumer_cpu]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <thread>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "ringbuffer.h"
+
+// Burst size used by the bulk variant, same as NDP_PACKET_BUFF
+#define BENCH_BURST 32
+
+/**
+ * Previous ring buffer implementation, kept for comparison
+ */
+template<typename T, size_t Size>
+class legacy_ringbuffer {
+public:
+    legacy_ringbuffer() : head_(0), tail_(0) {}
+
+    bool push(const T & value)
+    {
+        size_t head = head_.load(boost::memory_order_relaxed);
+        size_t next_head = next(head);
+        if (next_head == tail_.load(boost::memory_order_acquire))
+            return false;
+        ring_[head] = value;
+        head_.store(next_head, boost::memory_order_release);
+        return true;
+    }
+
+    bool pop(T & value)
+    {
+        size_t tail = tail_.load(boost::memory_order_relaxed);
+        if (tail == head_.load(boost::memory_order_acquire))
+            return false;
+        value = ring_[tail];
+        tail_.store(next(tail), boost::memory_order_release);
+        return true;
+    }
+
+private:
+    size_t next(size_t current)
+    {
+        return (current + 1) % Size;
+    }
+
+    T ring_[Size];
+    boost::atomic<size_t> head_, tail_;
+};
+
+// Capacity of the benchmarked rings, the legacy one is not a power of two
+#define BENCH_RING_SIZE (1 << 18)
+#define BENCH_LEGACY_SIZE 250000
+
+// Payload of a similar size as the exported record
+struct item_t {
+    uint64_t seq;
+    uint64_t data[63];
+};
+
+// Hardware counters of one thread
+struct counters_t {
+    uint64_t cache_misses;
+    uint64_t l1d_misses;
+    uint64_t dtlb_misses;
+};
+
+/**
+ * Open one hardware counter for the calling thread
+ * \param type Type of the counter
+ * \param config Counter configuration
+ * \return File descriptor or -1 when counters are not available
+ */
+static int perf_open(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/**
+ * Counting of cache misses in the calling thread
+ */
+class perf_scope {
+public:
+    perf_scope()
+    {
+        fd_llc_ = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+        fd_l1d_ = perf_open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+            (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+        fd_dtlb_ = perf_open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+            (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+        for (int fd : {fd_llc_, fd_l1d_, fd_dtlb_}) {
+            if (fd >= 0) {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+    }
+
+    void stop(counters_t & counters)
+    {
+        counters.cache_misses = read_counter(fd_llc_);
+        counters.l1d_misses = read_counter(fd_l1d_);
+        counters.dtlb_misses = read_counter(fd_dtlb_);
+    }
+
+private:
+    static uint64_t read_counter(int fd)
+    {
+        uint64_t value = UINT64_MAX;
+        if (fd < 0)
+            return value;
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &value, sizeof(value)) != sizeof(value))
+            value = UINT64_MAX;
+        close(fd);
+        return value;
+    }
+
+    int fd_llc_;
+    int fd_l1d_;
+    int fd_dtlb_;
+};
+
+/**
+ * Pin the calling thread to the CPU
+ * \param cpu CPU index, negative value disables the pinning
+ */
+static void pin_thread(int cpu)
+{
+    if (cpu < 0)
+        return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// Single item operations
+template<typename Ring>
+static void produce_single(Ring & ring, uint64_t items)
+{
+    item_t item;
+    memset(&item, 0, sizeof(item));
+    for (uint64_t i = 0; i < items; i++) {
+        item.seq = i;
+        while (!ring.push(item))
+            ;
+    }
+}
+
+template<typename Ring>
+static uint64_t consume_single(Ring & ring, uint64_t items)
+{
+    item_t item;
+    uint64_t errors = 0;
+    for (uint64_t i = 0; i < items; i++) {
+        while (!ring.pop(item))
+            ;
+        errors += (item.seq != i);
+    }
+    return errors;
+}
+
+// Bulk operations
+template<typename Ring>
+static void produce_bulk(Ring & ring, uint64_t items)
+{
+    item_t burst[BENCH_BURST];
+    memset(burst, 0, sizeof(burst));
+    uint64_t i = 0;
+    while (i < items) {
+        size_t cnt = std::min<uint64_t>(BENCH_BURST, items - i);
+        for (size_t k = 0; k < cnt; k++)
+            burst[k].seq = i + k;
+        size_t done = 0;
+        while (done < cnt)
+            done += ring.push_n(burst + done, cnt - done);
+        i += cnt;
+    }
+}
+
+template<typename Ring>
+static uint64_t consume_bulk(Ring & ring, uint64_t items)
+{
+    item_t burst[BENCH_BURST];
+    uint64_t errors = 0;
+    uint64_t i = 0;
+    while (i < items) {
+        size_t cnt = ring.pop_n(burst, BENCH_BURST);
+        for (size_t k = 0; k < cnt; k++)
+            errors += (burst[k].seq != i + k);
+        i += cnt;
+    }
+    return errors;
+}
+
+/**
+ * Run one benchmark case and print results
+ */
+template<typename Ring, typename Produce, typename Consume>
+static void run_case(const char * name, Ring * ring, uint64_t items, int prod_cpu, int cons_cpu,
+    Produce produce, Consume consume)
+{
+    counters_t prod_cnt, cons_cnt;
+    uint64_t errors = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread consumer([&]() {
+        pin_thread(cons_cpu);
+        perf_scope perf;
+        errors = consume(*ring, items);
+        perf.stop(cons_cnt);
+    });
+    std::thread producer([&]() {
+        pin_thread(prod_cpu);
+        perf_scope perf;
+        produce(*ring, items);
+        perf.stop(prod_cnt);
+    });
+    producer.join();
+    consumer.join();
+    auto end = std::chrono::steady_clock::now();
+
+    double secs = std::chrono::duration<double>(end - start).count();
+    printf("%-30s %12.0f ops/s", name, items / secs);
+    if (prod_cnt.cache_misses != UINT64_MAX) {
+        printf("  cache-miss/op prod %.3f cons %.3f  l1d-miss/op prod %.3f cons %.3f"
+            "  dtlb-miss/op prod %.4f cons %.4f",
+            (double)prod_cnt.cache_misses / items, (double)cons_cnt.cache_misses / items,
+            (double)prod_cnt.l1d_misses / items, (double)cons_cnt.l1d_misses / items,
+            (double)prod_cnt.dtlb_misses / items, (double)cons_cnt.dtlb_misses / items);
+    } else {
+        printf("  (hardware counters not available)");
+    }
+    printf("%s\n", errors ? "  ORDER ERROR" : "");
+}
+
+int main(int argc, char ** argv)
+{
+    uint64_t items = argc > 1 ? strtoull(argv[1], NULL, 10) : 20000000;
+    int prod_cpu = argc > 2 ? atoi(argv[2]) : 0;
+    int cons_cpu = argc > 3 ? atoi(argv[3]) : 1;
+
+    printf("items %lu, producer cpu %d, consumer cpu %d, item size %zu B\n",
+        items, prod_cpu, cons_cpu, sizeof(item_t));
+
+    typedef legacy_ringbuffer<item_t, BENCH_LEGACY_SIZE> legacy_t;
+    typedef ringbuffer<item_t> ring_t;
+
+    legacy_t * legacy = new legacy_t();
+    run_case("legacy heap push/pop", legacy, items, prod_cpu, cons_cpu,
+        produce_single<legacy_t>, consume_single<legacy_t>);
+    delete legacy;
+
+    // Rings are constructed by the consumer side in the sink, do the same here
+    pin_thread(cons_cpu);
+    ring_t * small = new ring_t(BENCH_RING_SIZE, ring_mem_local_node(), 0);
+    ring_t * huge = new ring_t(BENCH_RING_SIZE, ring_mem_local_node(), RING_MEM_HUGEPAGES);
+    char name[64];
+
+    run_case("ring 4K push/pop", small, items, prod_cpu, cons_cpu,
+        produce_single<ring_t>, consume_single<ring_t>);
+    run_case("ring 4K push_n/pop_n", small, items, prod_cpu, cons_cpu,
+        produce_bulk<ring_t>, consume_bulk<ring_t>);
+
+    // Without hugepages the ring falls back to 4 KB pages, the label tells it from the one above
+    char pages[32];
+    snprintf(pages, sizeof(pages), "%s%s", ring_mem_page_name(huge->memory().page_size),
+        huge->memory().page_size == small->memory().page_size ? " fallback" : "");
+    snprintf(name, sizeof(name), "ring %s push/pop", pages);
+    run_case(name, huge, items, prod_cpu, cons_cpu,
+        produce_single<ring_t>, consume_single<ring_t>);
+    snprintf(name, sizeof(name), "ring %s push_n/pop_n", pages);
+    run_case(name, huge, items, prod_cpu, cons_cpu,
+        produce_bulk<ring_t>, consume_bulk<ring_t>);
+    delete small;
+    delete huge;
+    return 0;
+}
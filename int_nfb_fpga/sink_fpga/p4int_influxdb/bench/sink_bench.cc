@@ -0,0 +1,384 @@
+/**
+ * @brief Microbenchmarks of the hot functions of the sink
+ *
+ * Built by Google Benchmark from the same sources as the sink. Reports come
+ * from the synthetic generator with 1 to 10 hops and a varied number of flows.
+ * BM_decode_packet compares the specialized and the generic parser of the hop
+ * metadata, the second argument selects the instruction mask. BM_decode_burst
+ * decodes whole bursts with prefetching, s/pkt is the time per report.
+ * BM_hop_times compares the scalar, SSSE3 and AVX2 timestamp processing.
+ * BM_add_report compares the line per hop (0) and the wide schema (1).
+ * BM_filter_load parses and compiles the given number of flow filter rules,
+ * BM_filter_lookup classifies one report against them per iteration.
+ * Every iteration handles one report, so the time column is ns per packet.
+ * Custom counters:
+ *   pkt/s    - processed reports per second
+ *   lines/s  - assembled line protocol records per second (add_report)
+ *   out/pkt  - line protocol bytes per report (add_report)
+ *   rules/s  - parsed and compiled filter rules per second (filter_load)
+ *   bytes/pkt - heap memory allocated per report
+ *
+ * Usage: sink_bench [--benchmark_filter=regex] [other Google Benchmark flags]
+ */
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+
+#include "filter.h"
+#include "int_process.h"
+#include "int_simd.h"
+#include "p4_influxdb.h"
+#include "ringbuffer.h"
+#include "report_gen.h"
+
+// Burst size of the ring operations, same as NDP_PACKET_BUFF
+#define BENCH_BURST 32
+// Lines of one batch of add_report, the default -b
+#define BENCH_BATCH 1000
+
+/**
+ * Sleep in microseconds, used by the poll strategy
+ */
+void delay_usecs(unsigned int us)
+{
+    struct timespec t = {(time_t)(us / 1000000), (long)(us % 1000000) * 1000};
+    while (nanosleep(&t, &t) == -1)
+        ;
+}
+
+// Heap memory allocated by the process
+static std::atomic<uint64_t> alloc_bytes(0);
+
+// Counting allocator, memory comes from malloc and returns to free
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void * operator new(size_t size)
+{
+    alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+    void *ptr = malloc(size ? size : 1);
+    if (ptr == NULL)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+/**
+ * Set the common counters
+ * \param state Benchmark state
+ * \param alloc_start Allocated bytes before the measured loop
+ */
+static void set_counters(benchmark::State &state, uint64_t alloc_start)
+{
+    state.SetItemsProcessed(state.iterations());
+    state.counters["pkt/s"] = benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+    state.counters["bytes/pkt"] = benchmark::Counter(
+        alloc_bytes.load(std::memory_order_relaxed) - alloc_start, benchmark::Counter::kAvgIterations);
+}
+
+static options_t bench_options()
+{
+    options_t opt = options_t();
+    opt.smpl_rate = 1;
+    return opt;
+}
+
+static void BM_ntoh64(benchmark::State &state)
+{
+    std::vector<uint64_t> values(1024);
+    for (size_t i = 0; i < values.size(); i++)
+        values[i] = i * 0x0123456789abcdefull;
+
+    size_t i = 0;
+    uint64_t alloc_start = alloc_bytes.load();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ntoh64(values[i]));
+        i = (i + 1) & 1023;
+    }
+    set_counters(state, alloc_start);
+}
+BENCHMARK(BM_ntoh64);
+
+static void BM_get_int_node_data(benchmark::State &state)
+{
+    ReportGenerator gen(state.range(0), 1);
+    telemetric_hdr_t hdr = telemetric_hdr_t();
+
+    uint64_t alloc_start = alloc_bytes.load();
+    for (auto _ : state) {
+        uint8_t *report = gen.next();
+        hdr.node_cnt = 0;
+        get_int_node_data(hdr, (int_meta_t *)(report + sizeof(int_influx_t)), state.range(0));
+        benchmark::DoNotOptimize(hdr);
+    }
+    set_counters(state, alloc_start);
+}
+BENCHMARK(BM_get_int_node_data)->Arg(1)->Arg(5)->Arg(10);
+
+// Instruction masks of BM_decode_packet: int_meta_t, specialized with extra fields, generic
+static const uint16_t bench_masks[] = {
+    INT_INST_LEGACY,
+    INT_INST_LEGACY | INT_INST_HOP_LATENCY | INT_INST_QUEUE,
+    INT_INST_LEGACY | INT_INST_L2_PORT_IDS,
+};
+
+static void BM_decode_packet(benchmark::State &state)
+{
+    uint16_t mask = bench_masks[state.range(1)];
+    ReportGenerator gen(state.range(0), 1000, REPORT_POOL_MIN, 0, mask);
+    options_t opt = bench_options();
+    telemetric_hdr_t hdr;
+
+    uint64_t alloc_start = alloc_bytes.load();
+    for (auto _ : state)
+        benchmark::DoNotOptimize(decode_packet(gen.next(), gen.length(), hdr, opt));
+    set_counters(state, alloc_start);
+    char label[16];
+    snprintf(label, sizeof(label), "mask 0x%04x", mask);
+    state.SetLabel(label);
+}
+BENCHMARK(BM_decode_packet)->ArgsProduct({{1, 5, 10}, {0, 1, 2}});
+
+static void BM_decode_burst(benchmark::State &state)
+{
+    ReportGenerator gen(state.range(0), 1000);
+    options_t opt = bench_options();
+    std::vector<telemetric_hdr_t> records(BENCH_BURST);
+    const uint8_t *data[BENCH_BURST];
+    uint32_t len[BENCH_BURST];
+    uint64_t rx_ns[BENCH_BURST] = {};
+    std::fill(len, len + BENCH_BURST, gen.length());
+
+    // One iteration decodes one burst, like the RX thread
+    uint64_t alloc_start = alloc_bytes.load();
+    for (auto _ : state) {
+        for (uint32_t i = 0; i < BENCH_BURST; i++)
+            data[i] = gen.next();
+        benchmark::DoNotOptimize(decode_burst(data, len, rx_ns, BENCH_BURST, records.data(), opt));
+    }
+    state.SetItemsProcessed(state.iterations() * BENCH_BURST);
+    state.counters["pkt/s"] = benchmark::Counter(state.iterations() * BENCH_BURST, benchmark::Counter::kIsRate);
+    state.counters["s/pkt"] = benchmark::Counter(state.iterations() * BENCH_BURST,
+        benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+    state.counters["bytes/pkt"] = benchmark::Counter(
+        (double)(alloc_bytes.load() - alloc_start) / BENCH_BURST, benchmark::Counter::kAvgIterations);
+    state.SetLabel(simd_name(simd_detect()));
+}
+BENCHMARK(BM_decode_burst)->Arg(1)->Arg(5)->Arg(10);
+
+static void BM_hop_times(benchmark::State &state)
+{
+    uint32_t hops = state.range(0);
+    uint32_t isa = state.range(1);
+    if (isa > simd_detect()) {
+        state.SkipWithError("instruction set not supported by the CPU");
+        return;
+    }
+    hop_times_t times = hop_times_select(isa);
+    ReportGenerator gen(hops, 1000);
+    telemetric_meta nodes[MAX_NODES + 1];
+
+    uint64_t alloc_start = alloc_bytes.load();
+    for (auto _ : state) {
+        times(gen.next() + sizeof(int_influx_t), sizeof(int_meta_t), offsetof(int_meta_t, ingress_tstamp), hops, nodes);
+        benchmark::DoNotOptimize(nodes);
+    }
+    set_counters(state, alloc_start);
+    state.SetLabel(simd_name(isa));
+}
+BENCHMARK(BM_hop_times)->ArgsProduct({{1, 5, 10}, {SIMD_SCALAR, SIMD_SSSE3, SIMD_AVX2}});
+
+static void BM_process_packet(benchmark::State &state)
+{
+    ReportGenerator gen(state.range(0), state.range(1));
+    options_t opt = bench_options();
+    FlowStore store("", 1, false);
+    flow_state_t *flows = store.shard(0);
+    telemetric_hdr_t hdr;
+    struct ndp_packet pkt;
+
+    // Insert all flows first, the loop measures the steady state
+    for (uint32_t i = 0; i < gen.count(); i++) {
+        gen.next(pkt);
+        process_packet(pkt, hdr, *flows, opt);
+    }
+
+    uint64_t alloc_start = alloc_bytes.load();
+    for (auto _ : state) {
+        gen.next(pkt);
+        benchmark::DoNotOptimize(process_packet(pkt, hdr, *flows, opt));
+    }
+    set_counters(state, alloc_start);
+}
+BENCHMARK(BM_process_packet)->ArgsProduct({{1, 5, 10}, {1, 1000, 100000}});
+
+static void BM_add_report(benchmark::State &state)
+{
+    ReportGenerator gen(state.range(0), 1000);
+    options_t opt = bench_options();
+    schema_t schema = schema_default();
+    schema.layout = state.range(1);
+    std::vector<telemetric_hdr_t> records(gen.count());
+    struct ndp_packet pkt;
+    {
+        FlowStore store("", 1, false);
+        for (telemetric_hdr_t &record : records) {
+            gen.next(pkt);
+            process_packet(pkt, record, *store.shard(0), opt);
+        }
+    }
+
+    std::string data;
+    data.reserve(BENCH_BATCH * 2 * 210);
+    size_t i = 0;
+    uint64_t lines = 0;
+    uint64_t bytes = 0;
+    uint32_t batch_lines = 0;
+    uint64_t alloc_start = alloc_bytes.load();
+    for (auto _ : state) {
+        int added = add_report(records[i], data, ROUTE_MEASUREMENT_DEFAULT, schema);
+        lines += added;
+        batch_lines += added;
+        if (batch_lines >= BENCH_BATCH) {
+            bytes += data.size();
+            data.clear();
+            batch_lines = 0;
+        }
+        if (++i == records.size())
+            i = 0;
+    }
+    set_counters(state, alloc_start);
+    bytes += data.size();
+    state.counters["lines/s"] = benchmark::Counter(lines, benchmark::Counter::kIsRate);
+    state.counters["out/pkt"] = benchmark::Counter(bytes, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_add_report)->ArgsProduct({{1, 5, 10}, {SCHEMA_HOP, SCHEMA_WIDE}});
+
+static void BM_ringbuffer_burst(benchmark::State &state)
+{
+    ringbuffer<telemetric_hdr_t> ring(RING_SIZE_DEFAULT, -1, 0);
+    std::vector<telemetric_hdr_t> in(BENCH_BURST);
+    std::vector<telemetric_hdr_t> out(BENCH_BURST);
+
+    // One iteration moves one burst through the ring
+    uint64_t alloc_start = alloc_bytes.load();
+    for (auto _ : state) {
+        ring.push_n(in.data(), BENCH_BURST);
+        benchmark::DoNotOptimize(ring.pop_n(out.data(), BENCH_BURST));
+    }
+    state.SetItemsProcessed(state.iterations() * BENCH_BURST);
+    state.counters["pkt/s"] = benchmark::Counter(state.iterations() * BENCH_BURST, benchmark::Counter::kIsRate);
+    state.counters["bytes/pkt"] = benchmark::Counter(
+        (double)(alloc_bytes.load() - alloc_start) / BENCH_BURST, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_ringbuffer_burst);
+
+/**
+ * Rules of the filter benchmarks, /24 prefixes with port ranges, exact rules
+ * and /16 prefixes with a destination prefix
+ * \param count Number of rules
+ * \return Rule texts
+ */
+static std::vector<std::string> filter_rules(uint32_t count)
+{
+    std::vector<std::string> rules;
+    uint64_t x = 88172645463325252ull;
+    char text[64];
+    for (uint32_t i = 0; i < count; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        uint32_t addr = x >> 32;
+        uint32_t port = x & 0xffff;
+        if (i % 10 < 6)
+            snprintf(text, sizeof(text), "%u.%u.%u.0/24 %u-%u", addr >> 24, (addr >> 16) & 0xff,
+                (addr >> 8) & 0xff, port / 2, port / 2 + 100);
+        else if (i % 10 < 9)
+            snprintf(text, sizeof(text), "%u.%u.%u.%u %u", addr >> 24, (addr >> 16) & 0xff,
+                (addr >> 8) & 0xff, addr & 0xff, port);
+        else
+            snprintf(text, sizeof(text), "%u.%u.0.0/16 * %u.%u.0.0/16", addr >> 24, (addr >> 16) & 0xff,
+                (addr >> 8) & 0xff, addr & 0xff);
+        rules.push_back(text);
+    }
+    return rules;
+}
+
+static void BM_filter_load(benchmark::State &state)
+{
+    std::vector<std::string> texts = filter_rules(state.range(0));
+    std::vector<filter_rule_t> rules(texts.size());
+
+    // One iteration parses and compiles the whole rule file
+    uint64_t alloc_start = alloc_bytes.load();
+    for (auto _ : state) {
+        for (size_t i = 0; i < texts.size(); i++)
+            filter_rule_parse(texts[i].c_str(), rules[i]);
+        FilterTable table(rules);
+        benchmark::DoNotOptimize(table.empty());
+    }
+    state.SetItemsProcessed(state.iterations() * texts.size());
+    state.counters["rules/s"] = benchmark::Counter(state.iterations() * texts.size(), benchmark::Counter::kIsRate);
+    state.counters["bytes/rule"] = benchmark::Counter(
+        (double)(alloc_bytes.load() - alloc_start) / texts.size(), benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_filter_load)->Arg(1000)->Arg(10000)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+static void BM_filter_lookup(benchmark::State &state)
+{
+    std::vector<std::string> texts = filter_rules(state.range(0));
+    std::vector<filter_rule_t> rules(texts.size());
+    for (size_t i = 0; i < texts.size(); i++)
+        filter_rule_parse(texts[i].c_str(), rules[i]);
+    FilterTable table(rules);
+
+    // Half of the reports come from the rules, the others are random
+    std::vector<std::array<uint32_t, 3>> reports(4096);
+    uint64_t x = 2463534242ull;
+    uint32_t matched = 0;
+    for (size_t i = 0; i < reports.size(); i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        const filter_rule_t &rule = rules[x % rules.size()];
+        uint32_t random = x >> 32;
+        if (i % 2 == 0)
+            reports[i] = {rule.src | (random & ~(~0u << (32 - rule.src_len)) & (rule.src_len ? ~0u : 0)),
+                rule.dst | (random & 0xffff), rule.port_lo};
+        else
+            reports[i] = {random, (uint32_t)(x & 0xffffffff), (uint32_t)(x & 0xffff)};
+        matched += table.match(reports[i][0], reports[i][1], reports[i][2]);
+    }
+
+    size_t i = 0;
+    uint64_t alloc_start = alloc_bytes.load();
+    for (auto _ : state) {
+        const std::array<uint32_t, 3> &report = reports[i];
+        benchmark::DoNotOptimize(table.match(report[0], report[1], report[2]));
+        i = (i + 1) & 4095;
+    }
+    set_counters(state, alloc_start);
+    char label[48];
+    snprintf(label, sizeof(label), "%.1f MiB, %u %% match", table.memory() / 1048576.0,
+        matched * 100 / (uint32_t)reports.size());
+    state.SetLabel(label);
+}
+BENCHMARK(BM_filter_lookup)->Arg(1000)->Arg(10000)->Arg(100000);
+
+BENCHMARK_MAIN();
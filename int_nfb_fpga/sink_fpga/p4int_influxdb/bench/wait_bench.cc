@@ -0,0 +1,108 @@
+/**
+ * @brief Benchmark of the consumer waiting strategies
+ *
+ * Producer pushes timestamped items into the ring at a fixed rate and notifies
+ * the consumer. For every strategy the consumer reports the CPU time it used
+ * and the latency between push and pop.
+ *
+ * Usage: wait_bench [rate_per_sec] [seconds] [producer_cpu] [consumer_cpu]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <pthread.h>
+
+#include "ringbuffer.h"
+#include "wait_strategy.h"
+
+/**
+ * Sleep in microseconds, used by the poll strategy
+ */
+void delay_usecs(unsigned int us)
+{
+    struct timespec t = {(time_t)(us / 1000000), (long)(us % 1000000) * 1000};
+    while (nanosleep(&t, &t) == -1)
+        ;
+}
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void pin_thread(int cpu)
+{
+    if (cpu < 0)
+        return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/**
+ * Run one strategy and print results
+ */
+static void run_case(uint32_t mode, uint64_t rate, double seconds, int prod_cpu, int cons_cpu)
+{
+    ringbuffer<uint64_t> ring(1 << 16, -1, 0);
+    ConsumerWaiter waiter(mode);
+    uint64_t items = rate * seconds;
+    std::vector<uint64_t> latency;
+    latency.reserve(items);
+    double cpu_secs = 0;
+
+    std::thread consumer([&]() {
+        pin_thread(cons_cpu);
+        uint64_t ts;
+        while (latency.size() < items) {
+            if (!ring.pop(ts)) {
+                waiter.wait([&ring]() { return ring.size() != 0; }, 0);
+                continue;
+            }
+            latency.push_back(now_ns() - ts);
+        }
+        struct timespec cpu;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+        cpu_secs = cpu.tv_sec + cpu.tv_nsec / 1e9;
+    });
+
+    pin_thread(prod_cpu);
+    uint64_t period = 1000000000ull / rate;
+    uint64_t start = now_ns();
+    for (uint64_t i = 0; i < items; i++) {
+        uint64_t when = start + i * period;
+        while (now_ns() < when)
+            ;
+        while (!ring.push(now_ns()))
+            ;
+        waiter.notify();
+    }
+    consumer.join();
+    double wall = (now_ns() - start) / 1e9;
+
+    std::sort(latency.begin(), latency.end());
+    printf("%-8s cpu %6.1f%%  latency p50 %8.1f us  p99 %8.1f us  max %8.1f us  parks %lu\n",
+        wait_mode_name(mode), 100.0 * cpu_secs / wall,
+        latency[latency.size() / 2] / 1e3, latency[latency.size() * 99 / 100] / 1e3,
+        latency.back() / 1e3, waiter.parks());
+}
+
+int main(int argc, char ** argv)
+{
+    uint64_t rate = argc > 1 ? strtoull(argv[1], NULL, 10) : 100000;
+    double seconds = argc > 2 ? atof(argv[2]) : 2.0;
+    int prod_cpu = argc > 3 ? atoi(argv[3]) : 0;
+    int cons_cpu = argc > 4 ? atoi(argv[4]) : 1;
+
+    printf("rate %lu items/s, %.1f s per strategy\n", rate, seconds);
+    for (uint32_t mode : {WAIT_POLL, WAIT_SPIN, WAIT_HYBRID})
+        run_case(mode, rate, seconds, prod_cpu, cons_cpu);
+    return 0;
+}
@@ -0,0 +1,588 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Capture of INT packets on commodity NICs
+ */
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/if_packet.h>
+#include <linux/net_tstamp.h>
+#ifndef CAPTURE_NO_XDP
+#include <linux/bpf.h>
+#include <linux/if_xdp.h>
+#endif
+
+#include "capture.h"
+#include "int_process.h"
+
+/**
+ * Error of a system call
+ * \param what Failed operation
+ * \param cfg Configuration of the source
+ */
+static std::runtime_error capture_error(const char *what, const source_cfg_t &cfg) {
+    return std::runtime_error(std::string(what) + " on " + cfg.iface + ": " + strerror(errno));
+}
+
+/**
+ * Index of the capture interface
+ * \param cfg Configuration of the source
+ */
+static uint32_t capture_ifindex(const source_cfg_t &cfg) {
+    uint32_t ifindex = if_nametoindex(cfg.iface.c_str());
+    if(ifindex == 0) {
+        throw std::runtime_error("Unknown capture interface " + cfg.iface);
+    }
+    return ifindex;
+}
+
+uint32_t capture_strip(uint8_t *frame, uint32_t len, uint64_t rx_unix_ns, uint8_t **report) {
+    const uint8_t *end = frame + len;
+    uint8_t *pos = frame + sizeof(struct ether_header);
+    if(pos > end) {
+        return 0;
+    }
+    uint16_t type = ntohs(((struct ether_header *)frame)->ether_type);
+    if(type == ETHERTYPE_VLAN) {
+        // One 802.1Q tag, NICs usually strip it
+        if(pos + 4 > end) {
+            return 0;
+        }
+        type = ntohs(*(uint16_t *)(pos + 2));
+        pos += 4;
+    }
+    if(type != ETHERTYPE_IP || pos + sizeof(struct iphdr) > end) {
+        return 0;
+    }
+
+    struct iphdr *ip = (struct iphdr *)pos;
+    if((ip->tos >> 2) != INT_DSCP || ip->ihl < 5) {
+        return 0;
+    }
+    pos += ip->ihl * 4;
+
+    // Ports and sequence number stay in network order, as written by the P4 program
+    int_influx_t hdr;
+    if(ip->protocol == IPPROTO_TCP) {
+        struct tcphdr *tcp = (struct tcphdr *)pos;
+        if(pos + sizeof(*tcp) > end) {
+            return 0;
+        }
+        hdr.ingress_port_id = tcp->source;
+        hdr.egress_port_id = tcp->dest;
+        hdr.seq = tcp->seq;
+        pos += tcp->doff * 4;
+    } else if(ip->protocol == IPPROTO_UDP) {
+        struct udphdr *udp = (struct udphdr *)pos;
+        if(pos + sizeof(*udp) > end) {
+            return 0;
+        }
+        hdr.ingress_port_id = udp->source;
+        hdr.egress_port_id = udp->dest;
+        hdr.seq = 0;
+        pos += sizeof(*udp);
+    } else {
+        return 0;
+    }
+
+    // Shim header has the length of all INT headers in words, the INT header follows
+    if(pos + INT_SHIM_SIZE + INT_HDR_SIZE > end) {
+        return 0;
+    }
+    uint32_t words = pos[2];
+    uint8_t *int_hdr = pos + INT_SHIM_SIZE;
+    if((int_hdr[0] >> 4) != INT_VERSION || words < 3 || pos + words * 4 > end) {
+        return 0;
+    }
+    uint8_t *meta = int_hdr + INT_HDR_SIZE;
+
+    hdr.srcAddr = ip->saddr;
+    hdr.dstAddr = ip->daddr;
+    hdr.meta_len = words - 3;
+    hdr.hop_meta_len = int_hdr[2] & 0x1f;
+    memcpy(&hdr.inst_mask, int_hdr + 4, sizeof(hdr.inst_mask));
+    hdr.ndk_tstamp1 = htonl(rx_unix_ns / 1000000000ull);
+    hdr.ndk_tstamp2 = htonl(rx_unix_ns % 1000000000ull);
+    // The P4 program fills the delay with the sink timestamp as well
+    memcpy(&hdr.delay, &hdr.ndk_tstamp1, sizeof(hdr.delay));
+
+    // Stripped headers are always longer than the report header
+    *report = meta - sizeof(hdr);
+    memcpy(*report, &hdr, sizeof(hdr));
+    return end - *report;
+}
+
+PacketCapture::PacketCapture(const source_cfg_t &cfg)
+    : m_fd(-1), m_ring((uint8_t *)MAP_FAILED), m_block(0), m_pkt(NULL), m_left(0), m_release(false), m_drops(0)
+{
+    uint32_t ifindex = capture_ifindex(cfg);
+    m_fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if(m_fd < 0) {
+        throw capture_error("Unable to open AF_PACKET socket", cfg);
+    }
+
+    int version = TPACKET_V3;
+    if(setsockopt(m_fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) != 0) {
+        close(m_fd);
+        throw capture_error("Unable to set TPACKET_V3", cfg);
+    }
+    // Hardware timestamps when the NIC provides them, the kernel ones otherwise
+    int tstamp = SOF_TIMESTAMPING_RAW_HARDWARE;
+    setsockopt(m_fd, SOL_PACKET, PACKET_TIMESTAMP, &tstamp, sizeof(tstamp));
+    // Frames sent by the host itself are not reports
+    int ignore = 1;
+    setsockopt(m_fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &ignore, sizeof(ignore));
+
+    struct tpacket_req3 req;
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = CAPTURE_BLOCK_SIZE;
+    req.tp_block_nr = CAPTURE_BLOCK_CNT;
+    req.tp_frame_size = CAPTURE_FRAME_SIZE;
+    req.tp_frame_nr = CAPTURE_BLOCK_SIZE / CAPTURE_FRAME_SIZE * CAPTURE_BLOCK_CNT;
+    req.tp_retire_blk_tov = CAPTURE_BLOCK_TMO;
+    if(setsockopt(m_fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) != 0) {
+        close(m_fd);
+        throw capture_error("Unable to create the TPACKET_V3 ring", cfg);
+    }
+    m_ring = (uint8_t *)mmap(NULL, (size_t)CAPTURE_BLOCK_SIZE * CAPTURE_BLOCK_CNT, PROT_READ | PROT_WRITE,
+        MAP_SHARED, m_fd, 0);
+    if(m_ring == MAP_FAILED) {
+        close(m_fd);
+        throw capture_error("Unable to map the TPACKET_V3 ring", cfg);
+    }
+
+    struct sockaddr_ll addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_ALL);
+    addr.sll_ifindex = ifindex;
+    // Sockets of the interface share one fanout group, flows are spread by hash.
+    // A group is bound to one interface, captures of other ones need their own.
+    int fanout = ((getpid() + ifindex) & 0xffff) | (PACKET_FANOUT_HASH << 16);
+    if(bind(m_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        setsockopt(m_fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) != 0) {
+        munmap(m_ring, (size_t)CAPTURE_BLOCK_SIZE * CAPTURE_BLOCK_CNT);
+        close(m_fd);
+        throw capture_error("Unable to bind AF_PACKET socket", cfg);
+    }
+}
+
+PacketCapture::~PacketCapture()
+{
+    munmap(m_ring, (size_t)CAPTURE_BLOCK_SIZE * CAPTURE_BLOCK_CNT);
+    close(m_fd);
+}
+
+void PacketCapture::release()
+{
+    struct tpacket_block_desc *block = (struct tpacket_block_desc *)(m_ring + (size_t)m_block * CAPTURE_BLOCK_SIZE);
+    __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    m_block = (m_block + 1) % CAPTURE_BLOCK_CNT;
+    m_release = false;
+}
+
+uint32_t PacketCapture::burstGet(struct ndp_packet *packets, uint32_t count)
+{
+    uint32_t cnt = 0;
+    // Frames without INT are skipped, a burst of them must not end the reading
+    while(cnt == 0) {
+        if(m_left == 0) {
+            if(m_release) {
+                release();
+            }
+            struct tpacket_block_desc *block = (struct tpacket_block_desc *)(m_ring + (size_t)m_block * CAPTURE_BLOCK_SIZE);
+            if((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) {
+                return 0;
+            }
+            m_pkt = (uint8_t *)block + block->hdr.bh1.offset_to_first_pkt;
+            m_left = block->hdr.bh1.num_pkts;
+        }
+        while(cnt < count && m_left > 0) {
+            struct tpacket3_hdr *hdr = (struct tpacket3_hdr *)m_pkt;
+            uint64_t rx_ns = hdr->tp_sec * 1000000000ull + hdr->tp_nsec;
+            uint8_t *report;
+            uint32_t len = capture_strip(m_pkt + hdr->tp_mac, hdr->tp_snaplen, rx_ns, &report);
+            if(len != 0) {
+                packets[cnt].data = report;
+                packets[cnt].data_length = len;
+                packets[cnt].header = NULL;
+                packets[cnt].header_length = 0;
+                cnt++;
+            }
+            m_pkt += hdr->tp_next_offset;
+            m_left--;
+        }
+        m_release = m_left == 0;
+    }
+    return cnt;
+}
+
+void PacketCapture::burstPut()
+{
+    if(m_release) {
+        release();
+    }
+}
+
+int32_t PacketCapture::discarded(uint64_t *discarded) const
+{
+    struct tpacket_stats_v3 stats;
+    socklen_t len = sizeof(stats);
+    if(getsockopt(m_fd, SOL_PACKET, PACKET_STATISTICS, &stats, &len) != 0) {
+        return RET_ERR;
+    }
+    m_drops += stats.tp_drops;
+    *discarded = m_drops;
+    return RET_OK;
+}
+
+#ifndef CAPTURE_NO_XDP
+
+/**
+ * System call of the BPF subsystem
+ */
+static int sys_bpf(int cmd, union bpf_attr *attr) {
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+/**
+ * Instruction of the BPF program
+ */
+static struct bpf_insn bpf_insn(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm) {
+    struct bpf_insn insn;
+    insn.code = code;
+    insn.dst_reg = dst;
+    insn.src_reg = src;
+    insn.off = off;
+    insn.imm = imm;
+    return insn;
+}
+
+struct xdp_prog_t {
+    int map;  // XSKMAP of sockets indexed by the NIC queue
+    int prog; // Program redirecting INT frames to the socket of their queue
+    int link; // Attachment to the interface, closing it detaches the program
+
+    /**
+     * Load the program and attach it to the interface
+     * \param cfg Configuration of the source
+     * \param ifindex Index of the interface
+     */
+    xdp_prog_t(const source_cfg_t &cfg, uint32_t ifindex) : map(-1), prog(-1), link(-1) {
+        union bpf_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.map_type = BPF_MAP_TYPE_XSKMAP;
+        attr.key_size = sizeof(uint32_t);
+        attr.value_size = sizeof(int);
+        attr.max_entries = CAPTURE_XDP_QUEUES;
+        map = sys_bpf(BPF_MAP_CREATE, &attr);
+        if(map < 0) {
+            throw capture_error("Unable to create XSKMAP", cfg);
+        }
+
+        // Frames of IPv4 with the INT DSCP are redirected, the same check as the one of
+        // capture_strip(), other traffic of the host goes to the kernel:
+        // r2 = data; r3 = data_end; r4 = r2 + 16; if r4 > r3 goto pass;
+        // r5 = ether_type; if r5 == VLAN { r4 += 4; if r4 > r3 goto pass; r5 = inner type; r2 += 4 }
+        // if r5 != IPv4 goto pass; r5 = tos >> 2; if r5 != INT_DSCP goto pass;
+        // r2 = rx_queue_index; r1 = map; r3 = XDP_PASS, the action of queues without socket;
+        // return bpf_redirect_map(r1, r2, r3); pass: return XDP_PASS
+        struct bpf_insn insns[] = {
+            bpf_insn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, data), 0),
+            bpf_insn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_3, BPF_REG_1, offsetof(struct xdp_md, data_end), 0),
+            bpf_insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0),
+            bpf_insn(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, sizeof(struct ether_header) + 2),
+            bpf_insn(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 16, 0),
+            bpf_insn(BPF_LDX | BPF_MEM | BPF_H, BPF_REG_5, BPF_REG_2, offsetof(struct ether_header, ether_type), 0),
+            bpf_insn(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, 4, htons(ETHERTYPE_VLAN)),
+            bpf_insn(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, 4),
+            bpf_insn(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 12, 0),
+            bpf_insn(BPF_LDX | BPF_MEM | BPF_H, BPF_REG_5, BPF_REG_2, sizeof(struct ether_header) + 2, 0),
+            bpf_insn(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_2, 0, 0, 4),
+            bpf_insn(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, 9, htons(ETHERTYPE_IP)),
+            bpf_insn(BPF_LDX | BPF_MEM | BPF_B, BPF_REG_5, BPF_REG_2, sizeof(struct ether_header) + 1, 0),
+            bpf_insn(BPF_ALU64 | BPF_RSH | BPF_K, BPF_REG_5, 0, 0, 2),
+            bpf_insn(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, 6, INT_DSCP),
+            bpf_insn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, rx_queue_index), 0),
+            bpf_insn(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, map),
+            bpf_insn(0, 0, 0, 0, 0),
+            bpf_insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS),
+            bpf_insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+            bpf_insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+            bpf_insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS),
+            bpf_insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+        };
+        static const char license[] = "Dual BSD/GPL";
+        memset(&attr, 0, sizeof(attr));
+        attr.prog_type = BPF_PROG_TYPE_XDP;
+        attr.insns = (uint64_t)insns;
+        attr.insn_cnt = sizeof(insns) / sizeof(insns[0]);
+        attr.license = (uint64_t)license;
+        prog = sys_bpf(BPF_PROG_LOAD, &attr);
+        if(prog < 0) {
+            close(map);
+            throw capture_error("Unable to load the XDP program", cfg);
+        }
+
+        memset(&attr, 0, sizeof(attr));
+        attr.link_create.prog_fd = prog;
+        attr.link_create.target_ifindex = ifindex;
+        attr.link_create.attach_type = BPF_XDP;
+        link = sys_bpf(BPF_LINK_CREATE, &attr);
+        if(link < 0) {
+            close(prog);
+            close(map);
+            throw capture_error("Unable to attach the XDP program", cfg);
+        }
+    }
+
+    ~xdp_prog_t() {
+        close(link);
+        close(prog);
+        close(map);
+    }
+};
+
+// Programs of interfaces, released with the last socket
+static std::mutex xdp_lock;
+static std::map<uint32_t, std::weak_ptr<xdp_prog_t>> xdp_progs;
+
+/**
+ * Program of the interface, loaded by its first socket
+ */
+static std::shared_ptr<xdp_prog_t> xdp_prog_get(const source_cfg_t &cfg, uint32_t ifindex) {
+    std::lock_guard<std::mutex> guard(xdp_lock);
+    std::shared_ptr<xdp_prog_t> prog = xdp_progs[ifindex].lock();
+    if(!prog) {
+        prog = std::make_shared<xdp_prog_t>(cfg, ifindex);
+        xdp_progs[ifindex] = prog;
+    }
+    return prog;
+}
+
+void XdpCapture::mapRing(xdp_ring_t &ring, uint64_t offset, const void *off, uint32_t size, size_t desc_size)
+{
+    const struct xdp_ring_offset *ring_off = (const struct xdp_ring_offset *)off;
+    ring.map_size = ring_off->desc + size * desc_size;
+    ring.map = mmap(NULL, ring.map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, offset);
+    if(ring.map == MAP_FAILED) {
+        throw std::runtime_error(std::string("Unable to map AF_XDP ring: ") + strerror(errno));
+    }
+    ring.producer = (uint32_t *)((uint8_t *)ring.map + ring_off->producer);
+    ring.consumer = (uint32_t *)((uint8_t *)ring.map + ring_off->consumer);
+    ring.flags = (uint32_t *)((uint8_t *)ring.map + ring_off->flags);
+    ring.desc = (uint8_t *)ring.map + ring_off->desc;
+}
+
+XdpCapture::XdpCapture(const source_cfg_t &cfg, uint32_t queue)
+    : m_fd(-1), m_umem((uint8_t *)MAP_FAILED), m_zc(false), m_taken(0)
+{
+    uint32_t ifindex = capture_ifindex(cfg);
+    if(queue >= CAPTURE_XDP_QUEUES) {
+        throw std::runtime_error("AF_XDP supports at most " + std::to_string(CAPTURE_XDP_QUEUES) + " queues");
+    }
+    memset(&m_fill, 0, sizeof(m_fill));
+    memset(&m_comp, 0, sizeof(m_comp));
+    memset(&m_rx, 0, sizeof(m_rx));
+    m_fill.map = m_comp.map = m_rx.map = MAP_FAILED;
+
+    try {
+        m_fd = socket(AF_XDP, SOCK_RAW, 0);
+        if(m_fd < 0) {
+            throw capture_error("Unable to open AF_XDP socket", cfg);
+        }
+
+        // UMEM of the socket, all frames start in the fill ring
+        m_umem = (uint8_t *)mmap(NULL, (size_t)CAPTURE_XDP_FRAMES * CAPTURE_FRAME_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if(m_umem == MAP_FAILED) {
+            throw capture_error("Unable to allocate UMEM", cfg);
+        }
+        struct xdp_umem_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.addr = (uint64_t)m_umem;
+        reg.len = (uint64_t)CAPTURE_XDP_FRAMES * CAPTURE_FRAME_SIZE;
+        reg.chunk_size = CAPTURE_FRAME_SIZE;
+        uint32_t fill_size = CAPTURE_XDP_FRAMES;
+        // Nothing is sent, the completion ring is required by the bind only
+        uint32_t comp_size = 64;
+        uint32_t rx_size = CAPTURE_XDP_RING;
+        if(setsockopt(m_fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) != 0 ||
+            setsockopt(m_fd, SOL_XDP, XDP_UMEM_FILL_RING, &fill_size, sizeof(fill_size)) != 0 ||
+            setsockopt(m_fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &comp_size, sizeof(comp_size)) != 0 ||
+            setsockopt(m_fd, SOL_XDP, XDP_RX_RING, &rx_size, sizeof(rx_size)) != 0) {
+            throw capture_error("Unable to set up UMEM", cfg);
+        }
+
+        struct xdp_mmap_offsets off;
+        socklen_t off_len = sizeof(off);
+        if(getsockopt(m_fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &off_len) != 0) {
+            throw capture_error("Unable to read AF_XDP ring offsets", cfg);
+        }
+        mapRing(m_fill, XDP_UMEM_PGOFF_FILL_RING, &off.fr, fill_size, sizeof(uint64_t));
+        mapRing(m_comp, XDP_UMEM_PGOFF_COMPLETION_RING, &off.cr, comp_size, sizeof(uint64_t));
+        mapRing(m_rx, XDP_PGOFF_RX_RING, &off.rx, rx_size, sizeof(struct xdp_desc));
+        uint64_t *fill = (uint64_t *)m_fill.desc;
+        for(uint32_t i = 0; i < CAPTURE_XDP_FRAMES; i++) {
+            fill[i] = (uint64_t)i * CAPTURE_FRAME_SIZE;
+        }
+        __atomic_store_n(m_fill.producer, CAPTURE_XDP_FRAMES, __ATOMIC_RELEASE);
+
+        // Zero-copy when requested and supported by the driver, the copy mode otherwise
+        struct sockaddr_xdp addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sxdp_family = AF_XDP;
+        addr.sxdp_ifindex = ifindex;
+        addr.sxdp_queue_id = queue;
+        addr.sxdp_flags = XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP;
+        m_zc = cfg.zerocopy && bind(m_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+        if(!m_zc) {
+            addr.sxdp_flags = XDP_COPY | XDP_USE_NEED_WAKEUP;
+            if(bind(m_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+                throw capture_error("Unable to bind AF_XDP socket", cfg);
+            }
+        }
+
+        m_prog = xdp_prog_get(cfg, ifindex);
+        union bpf_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.map_fd = m_prog->map;
+        attr.key = (uint64_t)&queue;
+        attr.value = (uint64_t)&m_fd;
+        if(sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) != 0) {
+            throw capture_error("Unable to register AF_XDP socket", cfg);
+        }
+    } catch (std::runtime_error &e) {
+        release();
+        throw;
+    }
+}
+
+XdpCapture::~XdpCapture()
+{
+    release();
+}
+
+void XdpCapture::release()
+{
+    // Release the program first, it must not redirect to a closed socket
+    m_prog.reset();
+    for(xdp_ring_t *ring : {&m_fill, &m_comp, &m_rx}) {
+        if(ring->map != MAP_FAILED) {
+            munmap(ring->map, ring->map_size);
+        }
+    }
+    if(m_fd >= 0) {
+        close(m_fd);
+    }
+    if(m_umem != MAP_FAILED) {
+        munmap(m_umem, (size_t)CAPTURE_XDP_FRAMES * CAPTURE_FRAME_SIZE);
+    }
+    m_fill.map = m_comp.map = m_rx.map = MAP_FAILED;
+    m_fd = -1;
+    m_umem = (uint8_t *)MAP_FAILED;
+}
+
+uint32_t XdpCapture::burstGet(struct ndp_packet *packets, uint32_t count)
+{
+    uint32_t cnt = 0;
+    while(cnt == 0) {
+        uint32_t consumer = *m_rx.consumer;
+        uint32_t avail = __atomic_load_n(m_rx.producer, __ATOMIC_ACQUIRE) - consumer;
+        if(avail == 0) {
+            // The driver waits for a syscall when it ran out of frames in the copy mode
+            if(__atomic_load_n(m_fill.flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP) {
+                recvfrom(m_fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+            }
+            return 0;
+        }
+        m_taken = avail < count ? avail : count;
+
+        // Frames carry no timestamp, the whole burst gets the time of reading
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        uint64_t rx_ns = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+        const struct xdp_desc *desc = (const struct xdp_desc *)m_rx.desc;
+        for(uint32_t i = 0; i < m_taken; i++) {
+            const struct xdp_desc &frame = desc[(consumer + i) & (CAPTURE_XDP_RING - 1)];
+            uint8_t *report;
+            uint32_t len = capture_strip(m_umem + frame.addr, frame.len, rx_ns, &report);
+            if(len != 0) {
+                packets[cnt].data = report;
+                packets[cnt].data_length = len;
+                packets[cnt].header = NULL;
+                packets[cnt].header_length = 0;
+                cnt++;
+            }
+        }
+        if(cnt == 0) {
+            burstPut();
+        }
+    }
+    return cnt;
+}
+
+void XdpCapture::burstPut()
+{
+    // Frames of the burst go back to the fill ring, it has room for all frames of the UMEM
+    uint32_t consumer = *m_rx.consumer;
+    uint32_t producer = *m_fill.producer;
+    const struct xdp_desc *desc = (const struct xdp_desc *)m_rx.desc;
+    uint64_t *fill = (uint64_t *)m_fill.desc;
+    for(uint32_t i = 0; i < m_taken; i++) {
+        uint64_t addr = desc[(consumer + i) & (CAPTURE_XDP_RING - 1)].addr;
+        fill[(producer + i) & (CAPTURE_XDP_FRAMES - 1)] = addr & ~(uint64_t)(CAPTURE_FRAME_SIZE - 1);
+    }
+    __atomic_store_n(m_fill.producer, producer + m_taken, __ATOMIC_RELEASE);
+    __atomic_store_n(m_rx.consumer, consumer + m_taken, __ATOMIC_RELEASE);
+    m_taken = 0;
+}
+
+int32_t XdpCapture::discarded(uint64_t *discarded) const
+{
+    struct xdp_statistics stats;
+    socklen_t len = sizeof(stats);
+    memset(&stats, 0, sizeof(stats));
+    if(getsockopt(m_fd, SOL_XDP, XDP_STATISTICS, &stats, &len) != 0) {
+        return RET_ERR;
+    }
+    *discarded = stats.rx_dropped + stats.rx_ring_full + stats.rx_fill_ring_empty_descs;
+    return RET_OK;
+}
+
+#endif // CAPTURE_NO_XDP
+
+std::unique_ptr<PacketSource> capture_create(const source_cfg_t &cfg, uint32_t queue) {
+#ifndef CAPTURE_NO_XDP
+    if(cfg.xdp) {
+        try {
+            XdpCapture *xdp = new XdpCapture(cfg, queue);
+            printf("capture - %s queue %u, AF_XDP %s mode\n", cfg.iface.c_str(), queue,
+                xdp->zeroCopy() ? "zero-copy" : "copy");
+            return std::unique_ptr<PacketSource>(xdp);
+        } catch (std::runtime_error &e) {
+            printf("capture - %s queue %u, AF_XDP unavailable (%s), using AF_PACKET\n", cfg.iface.c_str(), queue, e.what());
+        }
+    }
+#endif
+    std::unique_ptr<PacketSource> source(new PacketCapture(cfg));
+    printf("capture - %s fanout %u, AF_PACKET TPACKET_V3\n", cfg.iface.c_str(), queue);
+    return source;
+}
@@ -0,0 +1,160 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Capture of INT packets on commodity NICs
+ *
+ * Software counterpart of the P4 program of the sink. Frames with INT over
+ * TCP or UDP are captured by an AF_XDP socket or an AF_PACKET TPACKET_V3 ring
+ * and their headers are stripped in place: the int_influx_t header is written
+ * directly in front of the hop metadata, so the reports have the same layout
+ * as the ones of NDP queues and no data is copied.
+ */
+
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <cstdint>
+#include <memory>
+
+#include "source.h"
+
+// DSCP marking IPv4 packets with INT over TCP or UDP
+#define INT_DSCP 0x20
+// Supported version of the INT header
+#define INT_VERSION 1
+// Size of the INT shim header and of the INT header
+#define INT_SHIM_SIZE 4
+#define INT_HDR_SIZE 8
+
+// Size of one block of the TPACKET_V3 ring
+#define CAPTURE_BLOCK_SIZE (1 << 20)
+// Number of blocks of the TPACKET_V3 ring
+#define CAPTURE_BLOCK_CNT 64
+// Time after which the kernel hands over a partially filled block (ms)
+#define CAPTURE_BLOCK_TMO 1
+// Size of one frame of the capture rings, the AF_XDP UMEM chunk
+#define CAPTURE_FRAME_SIZE 2048
+// Number of frames of the AF_XDP UMEM, all of them are in the fill ring at the start
+#define CAPTURE_XDP_FRAMES 4096
+// Size of the AF_XDP RX ring
+#define CAPTURE_XDP_RING 2048
+// Number of NIC queues the XDP program can redirect
+#define CAPTURE_XDP_QUEUES 256
+
+/**
+ * Strip headers of the captured frame, the software equivalent of the P4 program
+ * \param frame Ethernet frame, the report is built in place
+ * \param len Length of the frame
+ * \param rx_unix_ns Receive time in UNIX NS format, stored as the sink timestamp
+ * \param report Where to store the start of the report
+ * \return Length of the report, 0 if the frame does not carry INT
+ */
+uint32_t capture_strip(uint8_t *frame, uint32_t len, uint64_t rx_unix_ns, uint8_t **report);
+
+/**
+ * AF_PACKET socket with a TPACKET_V3 ring. Sockets of all RX threads of the
+ * interface join one fanout group, the kernel spreads flows among them by hash.
+ */
+class PacketCapture : public PacketSource
+{
+    public:
+        /**
+         * Constructor
+         * \param cfg Configuration of the source
+         */
+        explicit PacketCapture(const source_cfg_t &cfg);
+        ~PacketCapture();
+
+        uint32_t burstGet(struct ndp_packet *packets, uint32_t count) override;
+        void burstPut() override;
+        int32_t discarded(uint64_t *discarded) const override;
+
+    protected:
+        /**
+         * Return the current block to the kernel
+         */
+        void release();
+
+        int      m_fd;
+        uint8_t *m_ring;
+        uint32_t m_block;         // Index of the current block
+        uint8_t *m_pkt;           // Next packet of the current block
+        uint32_t m_left;          // Packets left in the current block
+        bool     m_release;       // Current block is read, it is returned by burstPut()
+        mutable uint64_t m_drops; // The kernel resets its counter on every read
+};
+
+// XDP program of the interface, shared by sockets of all queues
+struct xdp_prog_t;
+
+/**
+ * AF_XDP socket bound to one queue of the NIC, the RX thread reads the queue
+ * of its index. Frames are received into the UMEM directly by the driver when
+ * it supports the zero-copy mode, the copy mode is used otherwise. The XDP
+ * program redirects only IPv4 frames with the INT DSCP, other traffic of the
+ * interface is passed to the kernel.
+ */
+class XdpCapture : public PacketSource
+{
+    public:
+        /**
+         * Constructor
+         * \param cfg Configuration of the source
+         * \param queue Index of the NIC queue
+         */
+        XdpCapture(const source_cfg_t &cfg, uint32_t queue);
+        ~XdpCapture();
+
+        uint32_t burstGet(struct ndp_packet *packets, uint32_t count) override;
+        void burstPut() override;
+        int32_t discarded(uint64_t *discarded) const override;
+
+        /**
+         * Check whether the socket runs in the zero-copy mode
+         */
+        bool zeroCopy() const { return m_zc; }
+
+    protected:
+        // Ring shared with the kernel
+        typedef struct {
+            uint32_t *producer;
+            uint32_t *consumer;
+            uint32_t *flags;
+            void     *desc;
+            void     *map;
+            size_t    map_size;
+        } xdp_ring_t;
+
+        /**
+         * Map the ring of the socket
+         * \param ring Where to store the ring
+         * \param offset Page offset of the ring
+         * \param off Offsets of the ring pointers
+         * \param size Number of descriptors
+         * \param desc_size Size of one descriptor
+         */
+        void mapRing(xdp_ring_t &ring, uint64_t offset, const void *off, uint32_t size, size_t desc_size);
+
+        /**
+         * Detach the socket and release its rings and UMEM
+         */
+        void release();
+
+        int      m_fd;
+        uint8_t *m_umem;
+        bool     m_zc;
+        xdp_ring_t m_fill;
+        xdp_ring_t m_comp;
+        xdp_ring_t m_rx;
+        uint32_t m_taken; // Descriptors of the last burst
+        std::shared_ptr<xdp_prog_t> m_prog;
+};
+
+/**
+ * Create the capture of one RX thread, AF_XDP with the fallback to AF_PACKET
+ * \param cfg Configuration of the source
+ * \param queue Index of the RX thread, the NIC queue of AF_XDP
+ * \return Source of reports, throws std::runtime_error on failure
+ */
+std::unique_ptr<PacketSource> capture_create(const source_cfg_t &cfg, uint32_t queue);
+
+#endif // _CAPTURE_H_
@@ -0,0 +1,156 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Control socket of the running sink
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "control.h"
+#include "stage.h"
+
+// Connected client
+typedef struct {
+    int         fd;
+    std::string line; // Received part of the command
+} control_client_t;
+
+ControlServer::ControlServer(const std::string &path, control_handler_t handler)
+    : m_path(path), m_inode(0), m_fd(-1), m_handler(handler), m_stop(false)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(addr.sun_path)) {
+        throw std::runtime_error("Path of the control socket is too long: " + path);
+    }
+    strcpy(addr.sun_path, path.c_str());
+
+    m_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(m_fd < 0) {
+        throw std::runtime_error(std::string("Unable to create the control socket: ") + strerror(errno));
+    }
+
+    // Only a stale socket is replaced, any other file at the path is kept
+    struct stat st;
+    if(lstat(path.c_str(), &st) == 0) {
+        if(!S_ISSOCK(st.st_mode)) {
+            close(m_fd);
+            throw std::runtime_error("Path of the control socket exists and is not a socket: " + path);
+        }
+        unlink(path.c_str());
+    }
+
+    // Commands change the filter, only the owner may connect. Clients can not connect
+    // before the listen, so the mode is set in between.
+    if(bind(m_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || chmod(path.c_str(), CONTROL_MODE) != 0 ||
+        listen(m_fd, CONTROL_CLIENTS) != 0 || stat(path.c_str(), &st) != 0) {
+        std::string err = strerror(errno);
+        close(m_fd);
+        throw std::runtime_error("Unable to listen on the control socket " + path + ": " + err);
+    }
+    m_inode = st.st_ino;
+    printf("control - listening on %s\n", path.c_str());
+    m_thread = std::thread(&ControlServer::serve, this);
+}
+
+ControlServer::~ControlServer()
+{
+    stop();
+}
+
+void ControlServer::stop()
+{
+    m_stop = true;
+    if(m_thread.joinable()) {
+        m_thread.join();
+    }
+    if(m_fd >= 0) {
+        close(m_fd);
+        m_fd = -1;
+        struct stat st;
+        if(stat(m_path.c_str(), &st) == 0 && st.st_ino == m_inode) {
+            unlink(m_path.c_str());
+        }
+    }
+}
+
+void ControlServer::serve()
+{
+    stage_block_signals();
+    std::vector<control_client_t> clients;
+    std::vector<struct pollfd> fds;
+    char buf[CONTROL_LINE_LEN];
+
+    while(!m_stop) {
+        fds.clear();
+        fds.push_back({m_fd, POLLIN, 0});
+        for(const control_client_t &client : clients) {
+            fds.push_back({client.fd, POLLIN, 0});
+        }
+        if(poll(fds.data(), fds.size(), CONTROL_POLL_MS) <= 0) {
+            continue;
+        }
+
+        // Clients are served in order, closed ones are removed afterwards
+        for(size_t i = 0; i < clients.size(); i++) {
+            control_client_t &client = clients[i];
+            if(fds[i + 1].revents == 0) {
+                continue;
+            }
+            ssize_t len = recv(client.fd, buf, sizeof(buf), 0);
+            if(len <= 0) {
+                close(client.fd);
+                client.fd = -1;
+                continue;
+            }
+            client.line.append(buf, len);
+            size_t end;
+            while(client.fd >= 0 && (end = client.line.find('\n')) != std::string::npos) {
+                std::string command = client.line.substr(0, end);
+                client.line.erase(0, end + 1);
+                if(!command.empty() && command.back() == '\r') {
+                    command.pop_back();
+                }
+                std::string reply = m_handler(command);
+                if(send(client.fd, reply.data(), reply.size(), MSG_NOSIGNAL) != (ssize_t)reply.size()) {
+                    close(client.fd);
+                    client.fd = -1;
+                }
+            }
+            if(client.fd >= 0 && client.line.size() > CONTROL_LINE_LEN) {
+                const char reply[] = "error command too long\n";
+                send(client.fd, reply, sizeof(reply) - 1, MSG_NOSIGNAL);
+                close(client.fd);
+                client.fd = -1;
+            }
+        }
+        clients.erase(std::remove_if(clients.begin(), clients.end(),
+            [](const control_client_t &client) { return client.fd < 0; }), clients.end());
+
+        if(fds[0].revents & POLLIN) {
+            int fd = accept4(m_fd, NULL, NULL, SOCK_CLOEXEC);
+            if(fd < 0) {
+                continue;
+            }
+            if(clients.size() >= CONTROL_CLIENTS) {
+                const char reply[] = "error too many clients\n";
+                send(fd, reply, sizeof(reply) - 1, MSG_NOSIGNAL);
+                close(fd);
+                continue;
+            }
+            clients.push_back({fd, std::string()});
+        }
+    }
+    for(const control_client_t &client : clients) {
+        close(client.fd);
+    }
+}
@@ -0,0 +1,73 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Control socket of the running sink
+ *
+ * UNIX stream socket accepting text commands, one per line. The reply of a
+ * command is any number of lines ended by a line starting with "ok" or
+ * "error". Commands are executed by the handler in the control thread, one
+ * at a time, e.g.:
+ *
+ *     echo "add 10.0.0.1 80" | socat - UNIX-CONNECT:/run/p4int.sock
+ */
+
+#ifndef _CONTROL_H_
+#define _CONTROL_H_
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+#include <sys/types.h>
+
+// Maximal length of a command
+#define CONTROL_LINE_LEN 256
+// Maximal number of connected clients
+#define CONTROL_CLIENTS 8
+// Period of checking the stop of the control thread (ms)
+#define CONTROL_POLL_MS 100
+// Permissions of the socket, connecting needs the write permission
+#define CONTROL_MODE 0600
+
+// Handler of a command, returns the reply
+typedef std::function<std::string(const std::string &)> control_handler_t;
+
+/**
+ * Server of the control socket
+ */
+class ControlServer
+{
+    public:
+        /**
+         * Constructor, binds the socket and starts the control thread.
+         * Throws std::runtime_error when the socket can not be created.
+         * \param path Path of the socket, a stale socket is replaced, other files are not
+         * touched and the constructor throws
+         * \param handler Handler of the commands
+         */
+        ControlServer(const std::string &path, control_handler_t handler);
+
+        /**
+         * Destructor, stops the thread and removes the socket
+         */
+        ~ControlServer();
+
+        /**
+         * Stop the control thread, connected clients are closed
+         */
+        void stop();
+
+    protected:
+        /**
+         * Control thread, serves the clients
+         */
+        void serve();
+
+        std::string       m_path;
+        ino_t             m_inode;   // Socket file of this server, a newer sink may replace it
+        int               m_fd;
+        control_handler_t m_handler;
+        std::atomic<bool> m_stop;
+        std::thread       m_thread;
+};
+
+#endif // _CONTROL_H_
@@ -8,18 +8,21 @@
 
 #include "device.h"
 
-int32_t open_device(p4device_t* device, options_t* opt, nfb_int_dev_t* nfb) {
+void device_path(const source_cfg_t* src, char* path) {
+    snprintf(path, DEVICE_PATH_LEN, "/dev/nfb%u", src->dev);
+}
+
+int32_t open_device(p4device_t* device, options_t* opt, const source_cfg_t* src, nfb_int_dev_t* nfb) {
     // Initialize the input structure
     nfb->dev = NULL;
-    nfb->rx  = NULL;
+    nfb->rx_cnt = 0;
+    nfb->p4_valid = false;
+    nfb->influx_rules.clear();
+    nfb->influx_drop = false;
 
     // Select the right device path
-    const char* ndp_dev;
-    if(opt->devId == 0) {
-        ndp_dev = "/dev/nfb0";
-    } else {
-        ndp_dev = "/dev/nfb1";
-    }
+    char ndp_dev[DEVICE_PATH_LEN];
+    device_path(src, ndp_dev);
 
     // Open the NDP and prepare packet transmission
     nfb->dev = nfb_open(ndp_dev);
@@ -29,32 +32,45 @@ int32_t open_device(p4device_t* device, options_t* opt, nfb_int_dev_t* nfb) {
         return RET_ERR;
     }
     
-    // Open RX queue
-    nfb->rx = ndp_open_rx_queue(nfb->dev, 0);
-    if(!nfb->rx) {
-        printf("Error during the opennign of the device queue!!\n");
+    // Open one RX queue for every RX thread of the source
+    uint32_t queues = src->queues;
+    if(queues > MAX_RX_QUEUES) {
+        printf("At most %u RX queues are supported!\n", MAX_RX_QUEUES);
         close_device(device, opt, nfb);
         return RET_ERR;
     }
+    for(uint32_t i = 0; i < queues; i++) {
+        nfb->rx[i] = ndp_open_rx_queue(nfb->dev, i);
+        if(!nfb->rx[i]) {
+            printf("Error during the opennign of the device queue!!\n");
+            close_device(device, opt, nfb);
+            return RET_ERR;
+        }
+        nfb->rx_ctrl[i] = nc_rxqueue_open_index(nfb->dev, i, QUEUE_TYPE_UNDEF);
+        nfb->rx_cnt++;
 
-    // Start transfer
-    int32_t ret = ndp_queue_start(nfb->rx);
-    if(ret != NDP_OK) {
-        printf("Error during the starting of DMA transfer!\n");
-        close_device(device, opt, nfb);
-        return RET_ERR;
-    } 
+        // Start transfer
+        int32_t ret = ndp_queue_start(nfb->rx[i]);
+        if(ret != NDP_OK) {
+            printf("Error during the starting of DMA transfer!\n");
+            close_device(device, opt, nfb);
+            return RET_ERR;
+        } 
+    }
     
     return RET_OK;
 }
 
 void close_device(p4device_t* device, options_t* opt, nfb_int_dev_t* nfb) {
     // Close device
-    if(nfb->rx){
-        ndp_queue_stop(nfb->rx);
-        ndp_close_rx_queue(nfb->rx);
+    for(uint32_t i = 0; i < nfb->rx_cnt; i++) {
+        ndp_queue_stop(nfb->rx[i]);
+        ndp_close_rx_queue(nfb->rx[i]);
+        if(nfb->rx_ctrl[i]) {
+            nc_rxqueue_close(nfb->rx_ctrl[i]);
+        }
     }
-    nfb->rx = NULL;
+    nfb->rx_cnt = 0;
 
     if(nfb->dev) { 
         nfb_close(nfb->dev);
@@ -62,6 +78,18 @@ void close_device(p4device_t* device, options_t* opt, nfb_int_dev_t* nfb) {
     nfb->dev = NULL;
 }
 
+int32_t read_rx_discarded(const nfb_int_dev_t* nfb, uint32_t queue, uint64_t* discarded) {
+    struct nc_rxqueue_counters counters;
+    if(queue >= nfb->rx_cnt || !nfb->rx_ctrl[queue]) {
+        return RET_ERR;
+    }
+    if(nc_rxqueue_read_counters(nfb->rx_ctrl[queue], &counters) != 0) {
+        return RET_ERR;
+    }
+    *discarded = counters.discarded;
+    return RET_OK;
+}
+
 /**
  * Configre p4 table "table_eth_map"
  * \param device Device structure
@@ -188,64 +216,158 @@ int32_t udp_tcp_map(const p4device_t* device, const options_t* opt) {
     return RET_OK;
 }
 
+/**
+ * Insert the default rule of table "table_influx"
+ * \param table Table "table_influx"
+ * \param filtering Reports not matching any rule are dropped
+ * \return \ref RET_OK on success
+ */
+static int32_t influx_default(p4table_t *table, bool filtering) {
+    p4rule_t *rule = p4table_get_rule_template(table);
+    if(filtering) {
+        p4rule_add_action(rule, "pkt_drop");
+    } else {
+        p4rule_add_action(rule, "fill_influx");
+    }
+    p4rule_mark_default(rule);
+    
+    uint32_t xret = p4table_insert_default_rule(table, rule);
+    p4rule_free(rule); 
+    return xret == P4DEV_OK ? RET_OK : RET_ERR;
+}
+
+/**
+ * Key of the exact rule in the map of rules of table "table_influx"
+ */
+static uint64_t influx_key(const filter_rule_t &flt) {
+    return ((uint64_t)flt.src << 16) | flt.port_lo;
+}
+
+/**
+ * Insert the exact flow filter rule to table "table_influx"
+ * \param table Table "table_influx"
+ * \param flt Exact rule of the filter
+ * \param index Where to store the index of the rule
+ * \return \ref RET_OK on success
+ */
+static int32_t influx_insert(p4table_t *table, const filter_rule_t &flt, uint32_t *index) {
+    // Keys of the table are little endian
+    uint8_t key[6];
+    for(uint32_t i = 0; i < 4; i++) {
+        key[i] = (flt.src >> (8 * i)) & 0xff;
+    }
+    key[4] = flt.port_lo & 0xff;
+    key[5] = (flt.port_lo >> 8) & 0xff;
+
+    p4rule_t *rule = p4table_get_rule_template(table);
+    p4rule_add_key_element(rule, p4key_exact_create("ip.srcAddr", 4, key));
+    p4rule_add_key_element(rule, p4key_exact_create("influx.egress_port_id", 2, key + 4));
+    p4rule_add_action(rule, "fill_influx");
+    uint32_t xret = p4table_insert_rule(table, rule, index, true);   
+    p4rule_free(rule); 
+    return xret == P4DEV_OK ? RET_OK : RET_ERR;
+}
+
 /**
  * Configre p4 table "table_influx"
- * \param device Device structure
+ * \param nfb Device structure, stores indexes of the rules
  * \param opt Options of the device tree.
  * \return \ref RET_OK on success
  */
-int32_t influx_map(const p4device_t* device, const options_t* opt) {
-    uint32_t xret;
+int32_t influx_map(nfb_int_dev_t* nfb, const options_t* opt) {
     p4table_t *table;
-    p4rule_t *rule;
     uint32_t index;
     
-    table = p4device_get_table(device, "table_influx");
+    table = p4device_get_table(&nfb->p4, "table_influx");
     if (table == NULL) {
         return RET_ERR;
     }
    
-    // Configure default rule
+    // Configure default rule, wider rules than exact ones are left to the host filter
     p4table_reset(table, 0);
-    rule = p4table_get_rule_template(table);
-    
-    if(opt->ip_flt.empty()) {
-        p4rule_add_action(rule, "fill_influx");
-    } else {
-        p4rule_add_action(rule, "pkt_drop");
-    }
-    
-    p4rule_mark_default(rule);
-    
-    xret = p4table_insert_default_rule(table, rule);
-    if (xret != P4DEV_OK) {
+    nfb->influx_rules.clear();
+    nfb->influx_drop = filter_hardware(opt->ip_flt);
+    if(influx_default(table, nfb->influx_drop) != RET_OK) {
         return RET_ERR;
     }
-    p4rule_free(rule); 
     
     // Configure flow filter
     for(auto &i : opt->ip_flt) {
-        rule = p4table_get_rule_template(table);
-        p4rule_add_key_element(rule, p4key_exact_create("ip.srcAddr", 4, i.data()));
-        p4rule_add_key_element(rule, p4key_exact_create("influx.egress_port_id", 2, i.data() + 4));
-        p4rule_add_action(rule, "fill_influx");
-        xret = p4table_insert_rule(table, rule, &index, true);   
-        p4rule_free(rule); 
-        if (xret != P4DEV_OK) {
+        if(!filter_rule_exact(i) || nfb->influx_rules.count(influx_key(i)) != 0) {
+            continue;
+        }
+        if(influx_insert(table, i, &index) != RET_OK) {
             return RET_ERR;
         }
+        nfb->influx_rules[influx_key(i)] = index;
     }
 
     printf("P4INT rule for fill_infllux been configured!\n");
     return RET_OK;
 }
 
-int32_t configure_device(const p4device_t* devices, const options_t* opt) {
+int32_t influx_rule_add(nfb_int_dev_t* nfb, const filter_rule_t& rule) {
+    uint32_t index;
+    p4table_t *table = p4device_get_table(&nfb->p4, "table_influx");
+    if(table == NULL || nfb->influx_rules.count(influx_key(rule)) != 0) {
+        return RET_ERR;
+    }
+    if(influx_insert(table, rule, &index) != RET_OK) {
+        return RET_ERR;
+    }
+    nfb->influx_rules[influx_key(rule)] = index;
+    return RET_OK;
+}
+
+int32_t influx_rule_remove(nfb_int_dev_t* nfb, const filter_rule_t& rule) {
+    p4table_t *table = p4device_get_table(&nfb->p4, "table_influx");
+    std::map<uint64_t, uint32_t>::iterator it = nfb->influx_rules.find(influx_key(rule));
+    if(table == NULL || it == nfb->influx_rules.end()) {
+        return RET_ERR;
+    }
+    if(p4table_delete_rule(table, it->second) != P4DEV_OK) {
+        return RET_ERR;
+    }
+    nfb->influx_rules.erase(it);
+    return RET_OK;
+}
+
+int32_t influx_filtering(nfb_int_dev_t* nfb, bool drop) {
+    if(nfb->influx_drop == drop) {
+        return RET_OK;
+    }
+    p4table_t *table = p4device_get_table(&nfb->p4, "table_influx");
+    if(table == NULL || influx_default(table, drop) != RET_OK) {
+        return RET_ERR;
+    }
+    nfb->influx_drop = drop;
+    return RET_OK;
+}
+
+int32_t influx_update_pre(nfb_int_dev_t* nfb, const filter_rule_t& rule, bool add, bool drop) {
+    bool exact = filter_rule_exact(rule);
+    if(add) {
+        return exact ? influx_rule_add(nfb, rule) : RET_OK;
+    }
+    if(influx_filtering(nfb, drop) != RET_OK) {
+        return RET_ERR;
+    }
+    return exact ? influx_rule_remove(nfb, rule) : RET_OK;
+}
+
+int32_t influx_update_post(nfb_int_dev_t* nfb, bool add, bool drop) {
+    return add ? influx_filtering(nfb, drop) : RET_OK;
+}
+
+int32_t configure_device(nfb_int_dev_t* nfb, const options_t* opt, const source_cfg_t* src) {
     uint32_t xret;
-    p4device_t device;
+    p4device_t& device = nfb->p4;
+    char path[DEVICE_PATH_LEN];
+    device_path(src, path);
 
     // Open the device 
-    xret = p4device_init(&device, NULL, 0, P4DEVICE_DEFAULT_COMPONENT);
+    printf("Configuring the device %s ...\n", path);
+    xret = p4device_init(&device, path, 0, P4DEVICE_DEFAULT_COMPONENT);
     if(xret != P4DEV_OK){
         printf("p4dev_direct_init failed!\n");
         printf("* ");
@@ -267,7 +389,7 @@ int32_t configure_device(const p4device_t* devices, const options_t* opt) {
     if(dma_map(&device, opt) != RET_OK) {
         return RET_ERR;
     }    
-    if(influx_map(&device, opt) != RET_OK) {
+    if(influx_map(nfb, opt) != RET_OK) {
         return RET_ERR;
     }    
     if(udp_tcp_map(&device, opt) != RET_OK) {
@@ -280,7 +402,9 @@ int32_t configure_device(const p4device_t* devices, const options_t* opt) {
         return RET_ERR;
     }
     printf("Network device was enabled!\n");
+    nfb->p4_valid = true;
 
+    // The P4 device stays open for runtime updates of the flow filter
     // TODO: segfault bug 
     //p4device_free(&device);
     return RET_OK;
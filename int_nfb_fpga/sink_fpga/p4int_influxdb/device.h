@@ -4,11 +4,14 @@
  */
 
 #include <stdint.h>
+#include <map>
 #include <p4dev.h>
 #include <nfb/ndp.h>
 #include <nfb/nfb.h>
+#include <netcope/rxqueue.h>
 
 #include "p4int.h"
+#include "filter.h"
 
 #ifndef _DEVICE_H_
 #define _DEVICE_H_
@@ -17,39 +20,113 @@
 #define RX_BITMAP 0xFF
 // Bitmap for TX 
 #define TX_BITMAP 0x00
+// Maximal number of opened RX queues
+#define MAX_RX_QUEUES 16
+// Size of the buffer of the device path
+#define DEVICE_PATH_LEN 32
 
 /**
  * Sructure with all data related to the configuration of the nfb device
  */
 typedef struct {
-    struct nfb_device* dev; // NFB device we are working with 
-    ndp_rx_queue_t*    rx;  // Opened RX queue
+    struct nfb_device* dev;                // NFB device we are working with 
+    ndp_rx_queue_t*    rx[MAX_RX_QUEUES];  // Opened RX queues, one for every RX thread
+    uint32_t           rx_cnt;             // Number of opened RX queues
+    struct nc_rxqueue* rx_ctrl[MAX_RX_QUEUES]; // Controllers of the RX queues, NULL when counters are not available
+    p4device_t         p4;                 // P4 device kept for runtime updates of the tables
+    bool               p4_valid;           // P4 device was configured by the sink
+    std::map<uint64_t, uint32_t> influx_rules; // Index of every exact filter rule in table_influx by its key
+    bool               influx_drop;        // Default action of table_influx drops reports not matching any rule
 } nfb_int_dev_t;
 
 
+/**
+ * Path of the NFB device of the source
+ * \param src NFB source
+ * \param path Where to store the path, DEVICE_PATH_LEN bytes
+ */
+void device_path(const source_cfg_t* src, char* path);
+
 /** 
  * Open the device 
  * \param device Device structure
  * \param opt Options of the device tree.
- * \param nfb Strcture with information about the device and RX queue
+ * \param src NFB source, its device and the number of RX queues
+ * \param nfb Strcture with information about the device and RX queues
  * \return \ref RET_OK on success
  */
-int32_t open_device(p4device_t* device, options_t* opt, nfb_int_dev_t* nfb);
+int32_t open_device(p4device_t* device, options_t* opt, const source_cfg_t* src, nfb_int_dev_t* nfb);
 
 /** 
  * Free the device
  * \param device Device structure
  * \param opt Options of the device tree.
- * \param nfb Strcture with information about the device and RX queue
+ * \param nfb Strcture with information about the device and RX queues
  */
 void close_device(p4device_t* device, options_t* opt, nfb_int_dev_t* nfb);
 
 /**
- * Configure the device including the sampling ratio 
- * \param device Device structure
+ * Read the number of packets the RX queue discarded because the host did not read them in time
+ * \param nfb Strcture with information about the device and RX queues
+ * \param queue Index of the RX queue
+ * \param discarded Where to store the counter
+ * \return \ref RET_OK on success, RET_ERR when the counters are not available
+ */
+int32_t read_rx_discarded(const nfb_int_dev_t* nfb, uint32_t queue, uint64_t* discarded);
+
+/**
+ * Configure the device including the sampling ratio, the P4 device stays open for runtime updates
+ * \param nfb Strcture with information about the device, stores the P4 device
  * \param opt Options of the device
+ * \param src NFB source of the device
+ * \return \ref RET_OK on success
+ */
+int32_t configure_device(nfb_int_dev_t* nfb, const options_t* opt, const source_cfg_t* src);
+
+/**
+ * Add the exact flow filter rule to table_influx of the running pipeline
+ * \param nfb Configured device
+ * \param rule Exact rule of the filter
+ * \return \ref RET_OK on success
+ */
+int32_t influx_rule_add(nfb_int_dev_t* nfb, const filter_rule_t& rule);
+
+/**
+ * Remove the exact flow filter rule from table_influx of the running pipeline
+ * \param nfb Configured device
+ * \param rule Exact rule of the filter
+ * \return \ref RET_OK on success
+ */
+int32_t influx_rule_remove(nfb_int_dev_t* nfb, const filter_rule_t& rule);
+
+/**
+ * Set the default action of table_influx of the running pipeline. Reports
+ * are dropped only when all rules are exact, see \ref filter_hardware.
+ * \param nfb Configured device
+ * \param drop Drop reports not matching any rule, otherwise pass all of them
+ * \return \ref RET_OK on success
+ */
+int32_t influx_filtering(nfb_int_dev_t* nfb, bool drop);
+
+/**
+ * First step of a runtime change of the flow filter, done before the host filter changes.
+ * Before a rule is removed other reports pass, an added exact rule is inserted.
+ * \param nfb Configured device
+ * \param rule Added or removed rule of the filter
+ * \param add Rule is added, otherwise removed
+ * \param drop Default action of table_influx after the change, see \ref filter_hardware
+ * \return \ref RET_OK on success
+ */
+int32_t influx_update_pre(nfb_int_dev_t* nfb, const filter_rule_t& rule, bool add, bool drop);
+
+/**
+ * Last step of a runtime change of the flow filter, done after the host filter changes.
+ * After a rule is added other reports are dropped, so no report of a kept rule is lost.
+ * \param nfb Configured device
+ * \param add Rule was added, otherwise removed
+ * \param drop Default action of table_influx after the change, see \ref filter_hardware
  * \return \ref RET_OK on success
  */
-int32_t configure_device(const p4device_t* devices, const options_t* opt);
+int32_t influx_update_post(nfb_int_dev_t* nfb, bool add, bool drop);
 
 #endif // _DEVICE_H_
@@ -0,0 +1,205 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief DPDK port as the source of INT reports
+ */
+
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <rte_eal.h>
+#include <rte_errno.h>
+#include <rte_ethdev.h>
+#include <rte_mbuf.h>
+#include <rte_version.h>
+
+#include "dpdk_source.h"
+#include "capture.h"
+#include "int_process.h"
+
+// Names of DPDK 21.11, older releases have them without the RTE_ prefix
+#if RTE_VERSION < RTE_VERSION_NUM(21, 11, 0, 0)
+#define RTE_ETH_MQ_RX_RSS ETH_MQ_RX_RSS
+#define RTE_ETH_MQ_RX_NONE ETH_MQ_RX_NONE
+#define RTE_ETH_RSS_IP ETH_RSS_IP
+#endif
+
+/**
+ * Error of a DPDK call
+ * \param what Failed operation
+ * \param ret Returned error code, negative errno
+ */
+static std::runtime_error dpdk_error(const char *what, int ret) {
+    return std::runtime_error(std::string(what) + ": " + rte_strerror(-ret));
+}
+
+struct dpdk_port_t {
+    uint16_t port;
+    struct rte_mempool *pool;
+
+    /**
+     * Initialize EAL and start the port with the queues of the source
+     * \param cfg Configuration of the source
+     */
+    explicit dpdk_port_t(const source_cfg_t &cfg) : port(cfg.port), pool(NULL) {
+        // EAL modifies its arguments, they must outlive it
+        static std::vector<std::string> args;
+        static std::vector<char *> argv;
+        args.assign(1, "p4int");
+        args.insert(args.end(), cfg.eal.begin(), cfg.eal.end());
+        argv.clear();
+        for(std::string &arg : args) {
+            argv.push_back(&arg[0]);
+        }
+        argv.push_back(NULL);
+        if(rte_eal_init(args.size(), argv.data()) < 0) {
+            throw dpdk_error("Unable to initialize DPDK EAL", -rte_errno);
+        }
+
+        try {
+            if(!rte_eth_dev_is_valid_port(port)) {
+                throw std::runtime_error("DPDK port " + std::to_string(port) + " does not exist, check the --vdev arguments");
+            }
+            uint16_t queues = cfg.queues;
+            int socket = rte_eth_dev_socket_id(port);
+            pool = rte_pktmbuf_pool_create("p4int_rx", DPDK_MBUFS, DPDK_MBUF_CACHE, 0, RTE_MBUF_DEFAULT_BUF_SIZE,
+                socket < 0 ? (int)rte_socket_id() : socket);
+            if(pool == NULL) {
+                throw dpdk_error("Unable to create the mbuf pool", -rte_errno);
+            }
+
+            struct rte_eth_dev_info info;
+            int ret = rte_eth_dev_info_get(port, &info);
+            if(ret != 0) {
+                throw dpdk_error("Unable to read the port info", ret);
+            }
+            if(queues > info.max_rx_queues) {
+                throw std::runtime_error("DPDK port " + std::to_string(port) + " has only " +
+                    std::to_string(info.max_rx_queues) + " RX queues");
+            }
+            // RX threads share flows of the port by RSS, one queue needs none
+            struct rte_eth_conf conf;
+            memset(&conf, 0, sizeof(conf));
+            conf.rxmode.mq_mode = queues > 1 ? RTE_ETH_MQ_RX_RSS : RTE_ETH_MQ_RX_NONE;
+            conf.rx_adv_conf.rss_conf.rss_hf = queues > 1 ? RTE_ETH_RSS_IP & info.flow_type_rss_offloads : 0;
+            // Some drivers refuse ports without a TX queue, it stays unused
+            ret = rte_eth_dev_configure(port, queues, 1, &conf);
+            if(ret != 0) {
+                throw dpdk_error("Unable to configure the port", ret);
+            }
+            for(uint16_t q = 0; q < queues; q++) {
+                ret = rte_eth_rx_queue_setup(port, q, DPDK_RX_DESC, socket, NULL, pool);
+                if(ret != 0) {
+                    throw dpdk_error("Unable to set up the RX queue", ret);
+                }
+            }
+            ret = rte_eth_tx_queue_setup(port, 0, DPDK_RX_DESC, socket, NULL);
+            if(ret != 0) {
+                throw dpdk_error("Unable to set up the TX queue", ret);
+            }
+            rte_eth_promiscuous_enable(port);
+            ret = rte_eth_dev_start(port);
+            if(ret != 0) {
+                throw dpdk_error("Unable to start the port", ret);
+            }
+        } catch (std::runtime_error &e) {
+            rte_mempool_free(pool);
+            rte_eal_cleanup();
+            throw;
+        }
+        printf("dpdk - port %u, %u RX queues\n", port, cfg.queues);
+    }
+
+    ~dpdk_port_t() {
+        rte_eth_dev_stop(port);
+        rte_eth_dev_close(port);
+        rte_mempool_free(pool);
+        rte_eal_cleanup();
+    }
+};
+
+// EAL can be initialized only once, sources of all queues share the port
+static std::mutex dpdk_lock;
+static std::weak_ptr<dpdk_port_t> dpdk_port;
+
+DpdkSource::DpdkSource(const source_cfg_t &cfg, uint32_t queue)
+    : m_queue(queue), m_cnt(0)
+{
+    std::lock_guard<std::mutex> guard(dpdk_lock);
+    m_port = dpdk_port.lock();
+    if(!m_port) {
+        m_port = std::make_shared<dpdk_port_t>(cfg);
+        dpdk_port = m_port;
+    }
+}
+
+DpdkSource::~DpdkSource()
+{
+    burstPut();
+}
+
+uint32_t DpdkSource::burstGet(struct ndp_packet *packets, uint32_t count)
+{
+    uint32_t cnt = 0;
+    while(cnt == 0) {
+        m_cnt = rte_eth_rx_burst(m_port->port, m_queue, m_mbufs, count < NDP_PACKET_BUFF ? count : NDP_PACKET_BUFF);
+        if(m_cnt == 0) {
+            return 0;
+        }
+
+        // Reports without the sink timestamp get the time of reading
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        uint64_t rx_ns = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+        for(uint16_t i = 0; i < m_cnt; i++) {
+            uint8_t *frame = rte_pktmbuf_mtod(m_mbufs[i], uint8_t *);
+            uint32_t len = rte_pktmbuf_data_len(m_mbufs[i]);
+            uint8_t *report = NULL;
+            uint32_t report_len = 0;
+            if(len >= INFLUX_ETH_LEN + sizeof(int_influx_t) && ((uint16_t)frame[12] << 8 | frame[13]) == ETHERTYPE_INFLUX) {
+                report = frame + INFLUX_ETH_LEN;
+                report_len = len - INFLUX_ETH_LEN;
+                int_influx_t *hdr = (int_influx_t *)report;
+                if(hdr->ndk_tstamp1 == 0 && hdr->ndk_tstamp2 == 0) {
+                    hdr->ndk_tstamp1 = htonl(rx_ns / 1000000000ull);
+                    hdr->ndk_tstamp2 = htonl(rx_ns % 1000000000ull);
+                }
+            } else {
+                report_len = capture_strip(frame, len, rx_ns, &report);
+            }
+            if(report_len != 0) {
+                packets[cnt].data = report;
+                packets[cnt].data_length = report_len;
+                packets[cnt].header = NULL;
+                packets[cnt].header_length = 0;
+                cnt++;
+            }
+        }
+        if(cnt == 0) {
+            burstPut();
+        }
+    }
+    return cnt;
+}
+
+void DpdkSource::burstPut()
+{
+    for(uint16_t i = 0; i < m_cnt; i++) {
+        rte_pktmbuf_free(m_mbufs[i]);
+    }
+    m_cnt = 0;
+}
+
+int32_t DpdkSource::discarded(uint64_t *discarded) const
+{
+    // Counters are per port, the first queue reports them
+    struct rte_eth_stats stats;
+    if(m_queue != 0 || rte_eth_stats_get(m_port->port, &stats) != 0) {
+        return RET_ERR;
+    }
+    *discarded = stats.imissed + stats.rx_nombuf;
+    return RET_OK;
+}
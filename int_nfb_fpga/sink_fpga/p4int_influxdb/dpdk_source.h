@@ -0,0 +1,60 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief DPDK port as the source of INT reports
+ *
+ * Reads reports of the t4p4s sink (int_dpdk/, SINK_ENABLE), Ethernet frames
+ * of ETHERTYPE_INFLUX followed by the int_influx_t header and the hop
+ * metadata. Frames with INT over TCP or UDP are stripped on the host the same
+ * way as by the capture source, so the port may also receive INT directly.
+ * Needs a build with DPDK=1.
+ */
+
+#ifndef _DPDK_SOURCE_H_
+#define _DPDK_SOURCE_H_
+
+#include <cstdint>
+#include <memory>
+
+#include "source.h"
+
+// EtherType of reports of the t4p4s sink
+#define ETHERTYPE_INFLUX 0xFFFF
+// Length of the Ethernet header in front of the report
+#define INFLUX_ETH_LEN 14
+// Number of mbufs of the RX pool
+#define DPDK_MBUFS 16383
+// Size of the per-core cache of the RX pool
+#define DPDK_MBUF_CACHE 256
+// Number of descriptors of one RX queue
+#define DPDK_RX_DESC 1024
+
+struct rte_mbuf;
+// Configured port, shared by sources of all RX queues
+struct dpdk_port_t;
+
+/**
+ * RX queue of the DPDK port, the RX thread reads the queue of its index
+ */
+class DpdkSource : public PacketSource
+{
+    public:
+        /**
+         * Constructor, the first source initializes EAL and starts the port
+         * \param cfg Configuration of the source
+         * \param queue Index of the RX queue
+         */
+        DpdkSource(const source_cfg_t &cfg, uint32_t queue);
+        ~DpdkSource();
+
+        uint32_t burstGet(struct ndp_packet *packets, uint32_t count) override;
+        void burstPut() override;
+        int32_t discarded(uint64_t *discarded) const override;
+
+    protected:
+        std::shared_ptr<dpdk_port_t> m_port;
+        uint16_t m_queue;
+        uint16_t m_cnt;                           // Mbufs of the last burst
+        struct rte_mbuf *m_mbufs[NDP_PACKET_BUFF];
+};
+
+#endif // _DPDK_SOURCE_H_
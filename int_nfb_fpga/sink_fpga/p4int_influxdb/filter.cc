@@ -0,0 +1,340 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Flow filter of INT reports
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <new>
+#include <unordered_map>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+
+#include "filter.h"
+#include "int_process.h"
+
+/**
+ * Mask of the prefix
+ * \param len Length of the prefix
+ */
+static inline uint32_t prefix_mask(uint32_t len) {
+    return len == 0 ? 0 : ~0u << (32 - len);
+}
+
+/**
+ * Parse a decimal number
+ * \param p Text, moved after the number
+ * \param max Maximal value
+ * \param value Where to store the number
+ * \return False when there is no number or it is over the maximum
+ */
+static bool parse_number(const char *&p, uint32_t max, uint32_t &value) {
+    if(*p < '0' || *p > '9') {
+        return false;
+    }
+    value = 0;
+    while(*p >= '0' && *p <= '9') {
+        value = value * 10 + (*p++ - '0');
+        if(value > max) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Parse the prefix, "a.b.c.d[/len]" or "*"
+ * \param p Text, moved after the prefix
+ * \param addr Where to store the prefix, host bits are cleared
+ * \param len Where to store the length of the prefix
+ * \return False on a wrong format
+ */
+static bool parse_prefix(const char *&p, uint32_t &addr, uint8_t &len) {
+    if(*p == '*') {
+        p++;
+        addr = 0;
+        len = 0;
+        return true;
+    }
+    addr = 0;
+    for(uint32_t i = 0; i < 4; i++) {
+        uint32_t octet;
+        if((i != 0 && *p++ != '.') || !parse_number(p, 255, octet)) {
+            return false;
+        }
+        addr = (addr << 8) | octet;
+    }
+    uint32_t bits = 32;
+    if(*p == '/' && !parse_number(++p, 32, bits)) {
+        return false;
+    }
+    len = bits;
+    addr &= prefix_mask(bits);
+    return true;
+}
+
+/**
+ * Parse the port range, "port[-port]" or "*"
+ * \param p Text, moved after the range
+ * \param lo Where to store the first port
+ * \param hi Where to store the last port
+ * \return False on a wrong format
+ */
+static bool parse_ports(const char *&p, uint16_t &lo, uint16_t &hi) {
+    if(*p == '*') {
+        p++;
+        lo = 0;
+        hi = UINT16_MAX;
+        return true;
+    }
+    uint32_t first;
+    uint32_t last;
+    if(!parse_number(p, UINT16_MAX, first)) {
+        return false;
+    }
+    last = first;
+    if(*p == '-' && (!parse_number(++p, UINT16_MAX, last) || last < first)) {
+        return false;
+    }
+    lo = first;
+    hi = last;
+    return true;
+}
+
+/**
+ * Skip spaces
+ * \param p Text, moved to the next non space character
+ * \return False at the end of the text
+ */
+static bool skip_spaces(const char *&p) {
+    while(*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+        p++;
+    }
+    return *p != '\0';
+}
+
+int32_t filter_rule_parse(const char *text, filter_rule_t &rule) {
+    const char *p = text;
+    rule.dst = 0;
+    rule.dst_len = 0;
+    rule.port_lo = 0;
+    rule.port_hi = UINT16_MAX;
+    if(!skip_spaces(p) || !parse_prefix(p, rule.src, rule.src_len)) {
+        return RET_ERR;
+    }
+    if(!skip_spaces(p)) {
+        return RET_OK;
+    }
+
+    // The second field is the destination when it has the format of an address
+    const char *field = p;
+    while(*field >= '0' && *field <= '9') {
+        field++;
+    }
+    if(*field != '.') {
+        if(!parse_ports(p, rule.port_lo, rule.port_hi)) {
+            return RET_ERR;
+        }
+        if(!skip_spaces(p)) {
+            return RET_OK;
+        }
+    }
+    if(!parse_prefix(p, rule.dst, rule.dst_len) || skip_spaces(p)) {
+        return RET_ERR;
+    }
+    return RET_OK;
+}
+
+/**
+ * Format the prefix
+ */
+static std::string prefix_str(uint32_t addr, uint8_t len) {
+    if(len == 0) {
+        return "*";
+    }
+    char text[32];
+    int pos = snprintf(text, sizeof(text), "%u.%u.%u.%u", addr >> 24, (addr >> 16) & 0xff, (addr >> 8) & 0xff,
+        addr & 0xff);
+    if(len != 32) {
+        snprintf(text + pos, sizeof(text) - pos, "/%u", len);
+    }
+    return text;
+}
+
+std::string filter_rule_str(const filter_rule_t &rule) {
+    std::string text = prefix_str(rule.src, rule.src_len) + " ";
+    if(rule.port_lo == 0 && rule.port_hi == UINT16_MAX) {
+        text += "*";
+    } else {
+        text += std::to_string(rule.port_lo);
+        if(rule.port_hi != rule.port_lo) {
+            text += "-" + std::to_string(rule.port_hi);
+        }
+    }
+    if(rule.dst_len != 0) {
+        text += " " + prefix_str(rule.dst, rule.dst_len);
+    }
+    return text;
+}
+
+bool filter_hardware(const std::vector<filter_rule_t> &rules) {
+    return !rules.empty() && std::all_of(rules.begin(), rules.end(), filter_rule_exact);
+}
+
+FilterTable::FilterTable(const std::vector<filter_rule_t> &rules)
+    : m_tbl24(NULL), m_default(0), m_rules(rules.size()),
+      m_exact(std::all_of(rules.begin(), rules.end(), filter_rule_exact))
+{
+    // Shorter prefixes first, longer ones overwrite their entries, rules of one prefix keep their order
+    std::vector<uint32_t> sorted(rules.size());
+    for(uint32_t i = 0; i < sorted.size(); i++) {
+        sorted[i] = i;
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), [&rules](uint32_t a, uint32_t b) {
+        return rules[a].src_len != rules[b].src_len ? rules[a].src_len < rules[b].src_len : rules[a].src < rules[b].src;
+    });
+    std::unordered_map<uint64_t, uint32_t> prefixes;
+    prefixes.reserve(sorted.size());
+
+    for(size_t i = 0; i < sorted.size(); ) {
+        uint32_t src = rules[sorted[i]].src;
+        uint8_t len = rules[sorted[i]].src_len;
+        filter_group_t group = {(uint32_t)m_matches.size(), 0, 0, 0};
+        for(; i < sorted.size() && rules[sorted[i]].src == src && rules[sorted[i]].src_len == len; i++) {
+            const filter_rule_t &rule = rules[sorted[i]];
+            if(rule.port_lo == 0 && rule.port_hi == UINT16_MAX && rule.dst_len == 0) {
+                if(group.any == 0) {
+                    group.any = sorted[i] + 1;
+                }
+                continue;
+            }
+            m_matches.push_back({rule.dst, prefix_mask(rule.dst_len), rule.port_lo, rule.port_hi, sorted[i]});
+            group.count++;
+        }
+        for(int32_t l = len - 1; l >= 0; l--) {
+            std::unordered_map<uint64_t, uint32_t>::const_iterator it =
+                prefixes.find(((uint64_t)(src & prefix_mask(l)) << 8) | l);
+            if(it != prefixes.end()) {
+                group.parent = it->second;
+                break;
+            }
+        }
+        m_groups.push_back(group);
+        uint32_t id = m_groups.size();
+        prefixes[((uint64_t)src << 8) | len] = id;
+
+        if(len == 0) {
+            m_default = id;
+            continue;
+        }
+        if(m_tbl24 == NULL) {
+            // Zero pages are mapped on read, only pages of the prefixes take memory
+            void *mem = mmap(NULL, FILTER_TBL24_SIZE * sizeof(uint32_t), PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if(mem == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+            m_tbl24 = (uint32_t *)mem;
+        }
+        if(len <= 24) {
+            std::fill_n(m_tbl24 + (src >> 8), 1u << (24 - len), id);
+            continue;
+        }
+        uint32_t &entry = m_tbl24[src >> 8];
+        if(!(entry & FILTER_TBL8_FLAG)) {
+            uint32_t tbl8 = m_tbl8.size() / FILTER_TBL8_GROUP;
+            m_tbl8.resize(m_tbl8.size() + FILTER_TBL8_GROUP, entry);
+            entry = FILTER_TBL8_FLAG | tbl8;
+        }
+        uint32_t first = (entry & ~FILTER_TBL8_FLAG) * FILTER_TBL8_GROUP + (src & 0xff);
+        std::fill_n(m_tbl8.begin() + first, 1u << (32 - len), id);
+    }
+}
+
+FilterTable::~FilterTable()
+{
+    if(m_tbl24 != NULL) {
+        munmap(m_tbl24, FILTER_TBL24_SIZE * sizeof(uint32_t));
+    }
+}
+
+size_t FilterTable::memory() const
+{
+    return (m_tbl24 != NULL ? FILTER_TBL24_SIZE * sizeof(uint32_t) : 0) + m_tbl8.size() * sizeof(uint32_t) +
+        m_groups.size() * sizeof(filter_group_t) + m_matches.size() * sizeof(filter_match_t);
+}
+
+FlowFilter::FlowFilter(const std::vector<filter_rule_t> &rules)
+    : m_version(0)
+{
+    for(const filter_rule_t &rule : rules) {
+        if(std::find(m_rules.begin(), m_rules.end(), rule) == m_rules.end()) {
+            m_rules.push_back(rule);
+        }
+    }
+    publish();
+}
+
+bool FlowFilter::add(const filter_rule_t &rule)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    if(std::find(m_rules.begin(), m_rules.end(), rule) != m_rules.end()) {
+        return false;
+    }
+    m_rules.push_back(rule);
+    publish();
+    return true;
+}
+
+bool FlowFilter::remove(const filter_rule_t &rule)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    std::vector<filter_rule_t>::iterator it = std::find(m_rules.begin(), m_rules.end(), rule);
+    if(it == m_rules.end()) {
+        return false;
+    }
+    m_rules.erase(it);
+    publish();
+    return true;
+}
+
+std::vector<filter_rule_t> FlowFilter::rules()
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    return m_rules;
+}
+
+void FlowFilter::publish()
+{
+    std::shared_ptr<const FilterTable> table = std::make_shared<const FilterTable>(m_rules);
+    std::atomic_store(&m_table, table);
+    m_version.fetch_add(1, std::memory_order_release);
+}
+
+uint32_t filter_burst(const FilterTable &table, struct ndp_packet *packets, uint32_t count) {
+    if(table.empty()) {
+        return count;
+    }
+    uint32_t kept = 0;
+    for(uint32_t i = 0; i < count; i++) {
+        if(packets[i].data_length < sizeof(int_influx_t)) {
+            continue;
+        }
+        uint32_t src;
+        uint32_t dst;
+        uint16_t port;
+        memcpy(&src, packets[i].data + offsetof(int_influx_t, srcAddr), sizeof(src));
+        memcpy(&dst, packets[i].data + offsetof(int_influx_t, dstAddr), sizeof(dst));
+        memcpy(&port, packets[i].data + offsetof(int_influx_t, egress_port_id), sizeof(port));
+        if(!table.match(ntohl(src), ntohl(dst), ntohs(port))) {
+            continue;
+        }
+        if(kept != i) {
+            packets[kept] = packets[i];
+        }
+        kept++;
+    }
+    return kept;
+}
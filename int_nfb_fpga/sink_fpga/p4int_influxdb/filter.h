@@ -0,0 +1,249 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Flow filter of INT reports
+ *
+ * Rules select reports by the source prefix, the egress port range and the
+ * destination prefix of the INT sink header, a report passes when any rule
+ * matches. No rule passes every report. Exact rules, a source address and one
+ * port, are the keys of table_influx of the card. Reports of NFB sources are
+ * filtered by the card as long as all rules are exact, the host filter
+ * applies to software sources and to NFB sources with wider rules.
+ *
+ * The rules are compiled to a \ref FilterTable, a DIR-24-8 table of source
+ * prefixes: the upper 24 bits of the address index a table of 2^24 entries,
+ * prefixes longer than 24 bits take a group of 256 entries of the last 8
+ * bits. An entry selects the group of rules of the longest source prefix,
+ * every group links the group of the next shorter prefix covering it, so
+ * a lookup takes two table reads and a short walk of the port and destination
+ * checks. The control thread publishes a new immutable table on every change,
+ * RX threads check the version of the rules per burst and filter without any
+ * lock.
+ */
+
+#ifndef _FILTER_H_
+#define _FILTER_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <nfb/ndp.h>
+
+#include "p4int.h"
+
+// Entries of the table of the upper 24 bits of the source address
+#define FILTER_TBL24_SIZE (1 << 24)
+// Entry of the table of 24 bits points to a group of the table of the last 8 bits
+#define FILTER_TBL8_FLAG 0x80000000u
+// Entries of one group of the table of the last 8 bits
+#define FILTER_TBL8_GROUP 256
+
+// Port and destination check of a rule
+typedef struct {
+    uint32_t dst;      // Destination prefix
+    uint32_t dst_mask; // Mask of the destination prefix
+    uint16_t port_lo;  // Range of the egress port
+    uint16_t port_hi;
+    uint32_t rule;     // Index of the rule
+} filter_match_t;
+
+// Rules of one source prefix
+typedef struct {
+    uint32_t first;  // First check in the table of checks
+    uint32_t count;  // Number of checks
+    uint32_t parent; // Group of the next shorter covering prefix, 0 for none
+    uint32_t any;    // Index + 1 of the rule matching any port and destination, 0 for none
+} filter_group_t;
+
+/**
+ * Parse the rule, "src[/len] [port[-port]] [dst[/len]]", "*" stands for any
+ * value of the field and a missing port or destination matches any of them
+ * \param text Rule text
+ * \param rule Where to store the rule
+ * \return RET_OK on success
+ */
+int32_t filter_rule_parse(const char *text, filter_rule_t &rule);
+
+/**
+ * Format the rule, the same format as \ref filter_rule_parse
+ * \param rule Rule of the filter
+ * \return Rule text
+ */
+std::string filter_rule_str(const filter_rule_t &rule);
+
+/**
+ * Rule is exact, a source address and one port, so it fits to table_influx
+ * \param rule Rule of the filter
+ */
+static inline bool filter_rule_exact(const filter_rule_t &rule)
+{
+    return rule.src_len == 32 && rule.dst_len == 0 && rule.port_lo == rule.port_hi;
+}
+
+/**
+ * Rules are equal
+ */
+static inline bool operator==(const filter_rule_t &a, const filter_rule_t &b)
+{
+    return a.src == b.src && a.src_len == b.src_len && a.dst == b.dst && a.dst_len == b.dst_len &&
+        a.port_lo == b.port_lo && a.port_hi == b.port_hi;
+}
+
+/**
+ * Compiled rules of the filter, immutable
+ */
+class FilterTable
+{
+    public:
+        /**
+         * Constructor, compiles the rules
+         * \param rules Rules of the filter
+         */
+        FilterTable(const std::vector<filter_rule_t> &rules);
+
+        /**
+         * Destructor
+         */
+        ~FilterTable();
+
+        FilterTable(const FilterTable &) = delete;
+        FilterTable &operator=(const FilterTable &) = delete;
+
+        /**
+         * No rule, every report passes
+         */
+        bool empty() const { return m_rules == 0; }
+
+        /**
+         * All rules are exact, the card filters NFB sources on its own
+         */
+        bool exact() const { return m_exact; }
+
+        /**
+         * Memory of the tables in bytes, pages of the table of 24 bits never written take no memory
+         */
+        size_t memory() const;
+
+        /**
+         * Report matches a rule
+         * \param src Source address in host order
+         * \param dst Destination address in host order
+         * \param port Egress port in host order
+         * \return True when the report passes
+         */
+        inline bool match(uint32_t src, uint32_t dst, uint16_t port) const
+        {
+            return lookup(src, dst, port) != 0;
+        }
+
+        /**
+         * Find the rule of the report. Rules of the longest source prefix win, rules of one
+         * prefix are tried in their order and a rule of any port and destination is the last one.
+         * \param src Source address in host order
+         * \param dst Destination address in host order
+         * \param port Egress port in host order
+         * \return Index + 1 of the rule, 0 when no rule matches
+         */
+        inline uint32_t lookup(uint32_t src, uint32_t dst, uint16_t port) const
+        {
+            uint32_t entry = m_tbl24 != NULL ? m_tbl24[src >> 8] : 0;
+            if(entry & FILTER_TBL8_FLAG) {
+                entry = m_tbl8[((entry & ~FILTER_TBL8_FLAG) * FILTER_TBL8_GROUP) | (src & 0xff)];
+            }
+            uint32_t group = entry != 0 ? entry : m_default;
+            while(group != 0) {
+                const filter_group_t &g = m_groups[group - 1];
+                for(uint32_t i = g.first; i < g.first + g.count; i++) {
+                    const filter_match_t &m = m_matches[i];
+                    if(port >= m.port_lo && port <= m.port_hi && (dst & m.dst_mask) == m.dst) {
+                        return m.rule + 1;
+                    }
+                }
+                if(g.any != 0) {
+                    return g.any;
+                }
+                group = g.parent;
+            }
+            return 0;
+        }
+
+    protected:
+        uint32_t                   *m_tbl24;   // Groups of the upper 24 bits, NULL without source prefixes
+        std::vector<uint32_t>       m_tbl8;    // Groups of the last 8 bits of prefixes longer than 24 bits
+        std::vector<filter_group_t> m_groups;  // Groups of rules, entries store the index + 1
+        std::vector<filter_match_t> m_matches; // Checks of all groups
+        uint32_t                    m_default; // Group of the rules of any source address, 0 for none
+        size_t                      m_rules;
+        bool                        m_exact;
+};
+
+/**
+ * Filter of the reports updated at runtime
+ */
+class FlowFilter
+{
+    public:
+        /**
+         * Constructor
+         * \param rules Initial rules (-f)
+         */
+        FlowFilter(const std::vector<filter_rule_t> &rules);
+
+        /**
+         * Add the rule. Thread safe.
+         * \param rule Rule of the filter
+         * \return False when the rule already exists
+         */
+        bool add(const filter_rule_t &rule);
+
+        /**
+         * Remove the rule. Thread safe.
+         * \param rule Rule of the filter
+         * \return False when the rule does not exist
+         */
+        bool remove(const filter_rule_t &rule);
+
+        /**
+         * Current rules. Thread safe.
+         */
+        std::vector<filter_rule_t> rules();
+
+        /**
+         * Current compiled rules, they stay valid while the pointer is held. Thread safe.
+         */
+        std::shared_ptr<const FilterTable> snapshot() const { return std::atomic_load(&m_table); }
+
+        /**
+         * Version of the rules, changes after a new table is published. Thread safe.
+         */
+        uint64_t version() const { return m_version.load(std::memory_order_acquire); }
+
+    protected:
+        /**
+         * Compile and publish the rules
+         */
+        void publish();
+
+        std::mutex                         m_lock;  // Serializes the writers
+        std::vector<filter_rule_t>         m_rules; // Rules in the order of insertion
+        std::shared_ptr<const FilterTable> m_table;
+        std::atomic<uint64_t>              m_version;
+};
+
+/**
+ * Card filters the reports of the rules on its own, all rules are exact
+ * \param rules Rules of the filter
+ */
+bool filter_hardware(const std::vector<filter_rule_t> &rules);
+
+/**
+ * Keep only reports matching the rules
+ * \param table Compiled rules
+ * \param packets Reports of the burst, the kept ones are moved to the front
+ * \param count Number of reports
+ * \return Number of kept reports
+ */
+uint32_t filter_burst(const FilterTable &table, struct ndp_packet *packets, uint32_t count);
+
+#endif // _FILTER_H_
@@ -0,0 +1,242 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Flow state of the aggregation shards in a persistent memory region
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "flow_table.h"
+
+// Size of a page of the region
+#define FLOW_REGION_PAGE 4096
+
+/**
+ * Offset of the hash tables in the region, after the header and the shards
+ * \param shards Number of shards
+ */
+static size_t flow_tables_offset(uint32_t shards) {
+    size_t end = FLOW_REGION_HDR + shards * sizeof(flow_shard_t);
+    return (end + FLOW_REGION_PAGE - 1) / FLOW_REGION_PAGE * FLOW_REGION_PAGE;
+}
+
+size_t flow_region_size(uint32_t shards) {
+    return flow_tables_offset(shards) + (size_t)shards * FLOW_TABLE_SLOTS * sizeof(flow_slot_t);
+}
+
+/**
+ * Current UNIX time in nanoseconds
+ */
+static uint64_t now_unix_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Throw std::runtime_error with the message of errno
+ */
+static void flow_error(const std::string &msg, const std::string &path) {
+    throw std::runtime_error("Flow state - " + msg + " " + path + ": " + strerror(errno));
+}
+
+/**
+ * Lock the file of the region, waits for the previous sink
+ */
+static void flow_lock(int fd, const std::string &path) {
+    if(flock(fd, LOCK_EX | LOCK_NB) == 0) {
+        return;
+    }
+    if(errno != EWOULDBLOCK) {
+        flow_error("unable to lock", path);
+    }
+    printf("flow state - waiting for the previous sink to release %s\n", path.c_str());
+    while(flock(fd, LOCK_EX) != 0) {
+        if(errno != EINTR) {
+            flow_error("unable to lock", path);
+        }
+    }
+}
+
+FlowStore::FlowStore(const std::string &path, uint32_t shards, bool hashed)
+    : m_path(path), m_fd(-1), m_region(NULL), m_size(0), m_hashed(hashed)
+{
+    if(path.empty()) {
+        m_region = mapRegion(-1, shards);
+        return;
+    }
+    m_fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if(m_fd < 0) {
+        flow_error("unable to open", path);
+    }
+    try {
+        flow_lock(m_fd, path);
+
+        // Header of the previous sink, the region is adopted only with the same layout
+        struct stat st;
+        flow_region_t hdr;
+        if(fstat(m_fd, &st) != 0) {
+            flow_error("unable to stat", path);
+        }
+        bool valid = (size_t)st.st_size >= FLOW_REGION_HDR && pread(m_fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+            hdr.magic == FLOW_REGION_MAGIC && hdr.version == FLOW_REGION_VERSION &&
+            hdr.slot_size == sizeof(flow_slot_t) && hdr.slots == FLOW_TABLE_SLOTS && hdr.shards != 0 &&
+            (size_t)st.st_size >= flow_region_size(hdr.shards);
+
+        if(valid && hdr.shards == shards) {
+            m_region = mapRegion(m_fd, shards);
+            double age = hdr.saved != 0 ? (now_unix_ns() - hdr.saved) / 1e9 : 0;
+            printf("flow state - adopted %lu flows of %s%s, saved %.1f s ago\n", flows(), path.c_str(),
+                hdr.state == FLOW_REGION_OPEN ? " after an unclean stop" : "", age);
+        } else if(valid) {
+            // Other number of shards, flows are moved to a new region replacing the old one
+            size_t old_size = flow_region_size(hdr.shards);
+            uint8_t *old = (uint8_t *)mmap(NULL, old_size, PROT_READ, MAP_SHARED, m_fd, 0);
+            if(old == MAP_FAILED) {
+                flow_error("unable to map", path);
+            }
+            std::string tmp = path + ".tmp";
+            int fd = open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+            if(fd < 0 || flock(fd, LOCK_EX) != 0) {
+                munmap(old, old_size);
+                if(fd >= 0) {
+                    close(fd);
+                }
+                flow_error("unable to create", tmp);
+            }
+            try {
+                m_region = mapRegion(fd, shards);
+                migrate(old);
+            } catch (std::runtime_error &e) {
+                munmap(old, old_size);
+                close(fd);
+                throw;
+            }
+            munmap(old, old_size);
+            if(rename(tmp.c_str(), path.c_str()) != 0) {
+                close(fd);
+                flow_error("unable to replace", path);
+            }
+            close(m_fd);
+            m_fd = fd;
+            printf("flow state - migrated %lu flows of %s from %u to %u shards\n", flows(), path.c_str(),
+                hdr.shards, shards);
+        } else {
+            if(st.st_size != 0) {
+                printf("flow state - %s is not a region of version %u, created a new one\n", path.c_str(),
+                    FLOW_REGION_VERSION);
+            }
+            if(ftruncate(m_fd, 0) != 0) {
+                flow_error("unable to truncate", path);
+            }
+            m_region = mapRegion(m_fd, shards);
+            printf("flow state - created %s, %.1f MiB of %u shards\n", path.c_str(), m_size / 1048576.0, shards);
+        }
+    } catch (std::runtime_error &e) {
+        if(m_region != NULL) {
+            munmap(m_region, m_size);
+        }
+        close(m_fd);
+        throw;
+    }
+    flow_region_t *region = (flow_region_t *)m_region;
+    region->state = FLOW_REGION_OPEN;
+}
+
+FlowStore::~FlowStore()
+{
+    if(m_fd >= 0) {
+        flow_region_t *region = (flow_region_t *)m_region;
+        region->saved = now_unix_ns();
+        region->state = FLOW_REGION_CLOSED;
+    }
+    munmap(m_region, m_size);
+    if(m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+uint64_t FlowStore::flows() const
+{
+    uint64_t count = 0;
+    for(const flow_state_t &state : m_states) {
+        count += state.shard->count;
+    }
+    return count;
+}
+
+uint8_t *FlowStore::mapRegion(int fd, uint32_t shards)
+{
+    // Tables are sparse, only pages of the used slots take memory
+    m_size = flow_region_size(shards);
+    if(fd >= 0 && ftruncate(fd, m_size) != 0) {
+        flow_error("unable to resize", m_path);
+    }
+    int flags = fd >= 0 ? MAP_SHARED : MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+    uint8_t *region = (uint8_t *)mmap(NULL, m_size, PROT_READ | PROT_WRITE, flags, fd, 0);
+    if(region == MAP_FAILED) {
+        flow_error("unable to map", m_path.empty() ? "anonymous memory" : m_path);
+    }
+
+    flow_region_t *hdr = (flow_region_t *)region;
+    hdr->magic = FLOW_REGION_MAGIC;
+    hdr->version = FLOW_REGION_VERSION;
+    hdr->shards = shards;
+    hdr->slot_size = sizeof(flow_slot_t);
+    hdr->slots = FLOW_TABLE_SLOTS;
+    m_states.assign(shards, flow_state_t());
+    for(uint32_t i = 0; i < shards; i++) {
+        flow_state_t &state = m_states[i];
+        state.shard = (flow_shard_t *)(region + FLOW_REGION_HDR) + i;
+        state.slots = (flow_slot_t *)(region + flow_tables_offset(shards)) + (size_t)i * FLOW_TABLE_SLOTS;
+        state.mask = FLOW_TABLE_SLOTS - 1;
+    }
+    return region;
+}
+
+void FlowStore::migrate(const uint8_t *old)
+{
+    const flow_region_t *hdr = (const flow_region_t *)old;
+    uint32_t shards = m_states.size();
+    uint64_t lost = 0;
+    for(uint32_t i = 0; i < shards; i++) {
+        // Counters of the shard are taken from the old shard of the same index
+        const flow_shard_t *from = (const flow_shard_t *)(old + FLOW_REGION_HDR) + i % hdr->shards;
+        m_states[i].shard->pkt_cnt = from->pkt_cnt;
+        memcpy(m_states[i].shard->prev_timestamps, from->prev_timestamps, sizeof(from->prev_timestamps));
+    }
+    for(uint32_t i = 0; i < hdr->shards; i++) {
+        const flow_slot_t *slots = (const flow_slot_t *)(old + flow_tables_offset(hdr->shards)) +
+            (size_t)i * FLOW_TABLE_SLOTS;
+        for(uint64_t s = 0; s < FLOW_TABLE_SLOTS; s++) {
+            if(!slots[s].used) {
+                continue;
+            }
+            // Hash dispatch owns the flow by one shard, RX queues may see it on any of them
+            uint32_t first = m_hashed ? flow_hash(slots[s].key) % shards : 0;
+            uint32_t last = m_hashed ? first + 1 : shards;
+            for(uint32_t shard = first; shard < last; shard++) {
+                bool created;
+                meta_data *meta = flow_find(m_states[shard], slots[s].key, created);
+                if(meta == NULL) {
+                    lost++;
+                    continue;
+                }
+                *meta = slots[s].meta;
+            }
+        }
+    }
+    for(flow_state_t &state : m_states) {
+        state.flow_full = 0;
+    }
+    if(lost != 0) {
+        printf("flow state - %lu flows did not fit to the new shards\n", lost);
+    }
+}
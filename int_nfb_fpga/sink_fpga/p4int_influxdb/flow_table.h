@@ -0,0 +1,179 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Flow state of the aggregation shards in a persistent memory region
+ *
+ * Every shard has an open addressing hash table of flows with linear
+ * probing, flows are never removed. All shards live in one region mapped from
+ * a file (-R, e.g. on /dev/shm), so a restarted sink adopts the flow state of
+ * the previous process by mapping the file again: sequence numbers, previous
+ * timestamps and sampling counters continue, no matter how many flows there
+ * are. The region has a versioned header, a region of another version or
+ * layout is not adopted. A region of another number of shards is migrated to
+ * a new one. Without the file the region is anonymous memory.
+ *
+ * The file is locked while mapped, a new sink waits until the previous one
+ * releases it, so the upgrade is: start the new sink, stop the old one.
+ */
+
+#ifndef _FLOW_TABLE_H_
+#define _FLOW_TABLE_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "p4int.h"
+#include "stage_queue.h"
+
+// Maximal number of flows in one flow state shard
+#define FLOW_TABLE_SIZE (1 << 20)
+// Slots of the hash table of one shard, the load factor stays at most 0.5
+#define FLOW_TABLE_SLOTS (2 * FLOW_TABLE_SIZE)
+// Magic number and version of the region, the version changes with the layout of meta_data
+#define FLOW_REGION_MAGIC 0x574f4c46544e4950ull // "PINTFLOW"
+#define FLOW_REGION_VERSION 1
+// Size of the header of the region
+#define FLOW_REGION_HDR 4096
+
+// States of the region
+#define FLOW_REGION_CLOSED 0 // Released by a clean stop
+#define FLOW_REGION_OPEN   1 // Mapped by a running sink or left by a crash
+
+// Header of the region
+typedef struct {
+    uint64_t magic;     // FLOW_REGION_MAGIC
+    uint32_t version;   // FLOW_REGION_VERSION
+    uint32_t state;     // FLOW_REGION_* state
+    uint32_t shards;    // Number of shards
+    uint32_t slot_size; // Size of flow_slot_t
+    uint64_t slots;     // Slots of the table of one shard
+    uint64_t saved;     // Time of the last release (UNIX NS format)
+} flow_region_t;
+
+// Persistent part of a shard
+typedef struct alignas(CACHE_LINE_SIZE) {
+    uint64_t count;                          // Flows in the table
+    uint64_t pkt_cnt;                        // Processed packets, used for sampling
+    uint64_t prev_timestamps[MAX_NODES + 1]; // Auxiliary variables for node jitter
+} flow_shard_t;
+
+// Slot of the hash table
+typedef struct {
+    uint64_t  key;      // Flow key
+    uint32_t  used;     // Slot holds a flow
+    uint32_t  reserved;
+    meta_data meta;     // Flow metadata
+} flow_slot_t;
+
+static_assert(sizeof(flow_slot_t) == CACHE_LINE_SIZE, "flow slot must fill one cache line");
+
+/**
+ * Flow state of one aggregation shard, every flow belongs to exactly one shard
+ */
+typedef struct {
+    flow_shard_t *shard;     // Persistent counters of the shard
+    flow_slot_t  *slots;     // Hash table
+    uint64_t      mask;      // Number of slots - 1
+    uint64_t      flow_full; // Reports of new flows dropped because the table was full
+    uint64_t      degraded;  // Reports folded into aggregates of degraded flows
+} flow_state_t;
+
+/**
+ * Find the flow, a new flow is inserted
+ * \param state Flow state of the shard owning the flow
+ * \param key Flow key
+ * \param created Set when the flow was inserted
+ * \return Metadata of the flow, NULL when a new flow does not fit to the table
+ */
+static inline meta_data *flow_find(flow_state_t &state, uint64_t key, bool &created)
+{
+    // Shards are selected by the low bits of the hash, slots by the high ones
+    uint64_t index = (flow_hash(key) >> 32) & state.mask;
+    while(true) {
+        flow_slot_t &slot = state.slots[index];
+        if(!slot.used) {
+            break;
+        }
+        if(slot.key == key) {
+            created = false;
+            return &slot.meta;
+        }
+        index = (index + 1) & state.mask;
+    }
+    if(state.shard->count >= FLOW_TABLE_SIZE) {
+        state.flow_full++;
+        return NULL;
+    }
+    flow_slot_t &slot = state.slots[index];
+    slot.key = key;
+    slot.meta = meta_data();
+    slot.used = 1;
+    state.shard->count++;
+    created = true;
+    return &slot.meta;
+}
+
+/**
+ * Region of the flow state of all shards
+ */
+class FlowStore
+{
+    public:
+        /**
+         * Constructor, adopts the region of the file or creates a new one.
+         * Throws std::runtime_error when the region can not be mapped.
+         * \param path File of the region, empty for anonymous memory
+         * \param shards Number of shards, threads running the aggregation
+         * \param hashed Reports are dispatched to shards by the flow hash, the
+         *               migration then moves every flow to its shard, otherwise
+         *               every shard gets all flows
+         */
+        FlowStore(const std::string &path, uint32_t shards, bool hashed);
+
+        /**
+         * Destructor, marks the region as closed and releases the file
+         */
+        ~FlowStore();
+
+        /**
+         * Flow state of the shard
+         * \param id Index of the shard
+         */
+        flow_state_t *shard(uint32_t id) { return &m_states[id]; }
+
+        /**
+         * Number of flows of all shards
+         */
+        uint64_t flows() const;
+
+    protected:
+        /**
+         * Map the region of the file, the file is extended to the size of the region
+         * \param fd File, -1 for anonymous memory
+         * \param shards Number of shards
+         * \return Start of the region
+         */
+        uint8_t *mapRegion(int fd, uint32_t shards);
+
+        /**
+         * Move flows of the region of another number of shards to the new region
+         * \param old Mapped old region
+         */
+        void migrate(const uint8_t *old);
+
+        std::string m_path;
+        int         m_fd;
+        uint8_t    *m_region;
+        size_t      m_size;
+        bool        m_hashed;
+        std::vector<flow_state_t> m_states;
+};
+
+/**
+ * Size of the region
+ * \param shards Number of shards
+ * \return Size in bytes
+ */
+size_t flow_region_size(uint32_t shards);
+
+#endif // _FLOW_TABLE_H_
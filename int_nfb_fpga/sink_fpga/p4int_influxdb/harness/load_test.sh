@@ -0,0 +1,159 @@
+#!/bin/bash
+#
+# End-to-end load test of the sink on one machine.
+#
+# The sink reads synthetic or replayed reports (-S) and exports them to the
+# local mock collector. Every combination of protocol, batch size (-b),
+# serializer count (-i) and sampling rate (-m) runs for DURATION seconds.
+# One row per run: delivered records/s, loss and RX to delivery latency.
+#
+# --source may be repeated, the sink then merges all sources. Every run checks
+# that every source received reports, that the per-source counters of the sink
+# add up to its total and that the collector got no more records than the
+# merged total allows. The script fails when any run fails the check.
+#
+# UDP datagrams are limited to 64 KB, so UDP runs use UDP_BATCHES.
+
+SINK="$(dirname "$0")/../p4int"
+SOURCES=("synth:hops=5,flows=1000,rate=200000")
+SOURCE_SET=0
+DURATION=5
+PROTOCOLS="http udp"
+BATCHES="100 1000 5000"
+UDP_BATCHES="50 200"
+SENDERS="1 2"
+SAMPLING="1 10"
+LATENCY_MS=0
+ERROR_RATE=0
+PORT=18086
+EXTRA=""
+
+# Parse parameters
+for i in "$@"
+do
+case $i in
+    --sink=*) # path of the sink binary
+        SINK="${i#*=}"
+        ;;
+    -S=*|--source=*) # source of reports, see -S of the sink, repeated for more sources
+        if [ $SOURCE_SET -eq 0 ]; then
+            SOURCES=()
+            SOURCE_SET=1
+        fi
+        SOURCES+=("${i#*=}")
+        ;;
+    -d=*|--duration=*) # seconds of one run
+        DURATION="${i#*=}"
+        ;;
+    -r=*|--protocols=*) # list of protocols
+        PROTOCOLS="${i#*=}"
+        ;;
+    -b=*|--batches=*) # list of HTTP batch sizes
+        BATCHES="${i#*=}"
+        ;;
+    -u=*|--udp-batches=*) # list of UDP batch sizes
+        UDP_BATCHES="${i#*=}"
+        ;;
+    -i=*|--senders=*) # list of serializer counts
+        SENDERS="${i#*=}"
+        ;;
+    -m=*|--sampling=*) # list of sampling rates
+        SAMPLING="${i#*=}"
+        ;;
+    -l=*|--latency=*) # delay of HTTP responses in ms
+        LATENCY_MS="${i#*=}"
+        ;;
+    -e=*|--error-rate=*) # share of HTTP batches rejected by 5xx
+        ERROR_RATE="${i#*=}"
+        ;;
+    -p=*|--port=*) # port of the collector
+        PORT="${i#*=}"
+        ;;
+    -x=*|--extra=*) # extra parameters of the sink
+        EXTRA="${i#*=}"
+        ;;
+    *)
+        echo "unknown option $i"
+        exit 1
+    ;;
+esac
+done
+
+COLLECTOR="$(dirname "$0")/mock_collector.py"
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+SOURCE_ARGS=()
+for src in "${SOURCES[@]}"; do
+    SOURCE_ARGS+=(-S "$src")
+done
+FAILED=0
+
+printf "%-5s %6s %3s %4s %10s %12s %8s %10s %10s %10s  %s\n" proto batch i m rx records/s loss% p50_us p99_us p999_us check
+for proto in $PROTOCOLS; do
+    batches=$BATCHES
+    if [ "$proto" == "udp" ]; then
+        batches=$UDP_BATCHES
+    fi
+    for b in $batches; do
+    for i in $SENDERS; do
+    for m in $SAMPLING; do
+        # Collector outlives the sink, so it receives the final flush
+        if [ "$proto" == "udp" ]; then
+            listen="--udp=$PORT"
+        else
+            listen="--http=$PORT --latency-ms=$LATENCY_MS --error-rate=$ERROR_RATE"
+        fi
+        python3 "$COLLECTOR" $listen --duration=$(($DURATION + 3)) > "$TMP/collector.json" &
+        collector=$!
+        sleep 0.5
+
+        timeout -s INT $DURATION "$SINK" -k "${SOURCE_ARGS[@]}" -c 127.0.0.1 -p $PORT -r $proto \
+            -b $b -i $i -m $m $EXTRA > "$TMP/sink.log" 2>&1
+        wait $collector
+
+        python3 - "$TMP/collector.json" "$TMP/sink.log" "${#SOURCES[@]}" "$m" "$DURATION" "$proto" "$b" "$i" <<'PY'
+import json, re, sys
+summary = json.load(open(sys.argv[1]))
+log = open(sys.argv[2]).read()
+sources, m, duration = int(sys.argv[3]), int(sys.argv[4]), float(sys.argv[5])
+match = re.search(r'^total - (\d+)$', log, re.M)
+total = int(match.group(1)) if match else 0
+
+# Per-source counters are printed only for more sources
+items = [int(n) for n in re.findall(r'^source \S+ - items (\d+),', log, re.M)]
+if sources == 1 and not items:
+    items = [total]
+errors = []
+if len(items) != sources:
+    errors.append("%d of %d sources reported" % (len(items), sources))
+elif sum(items) != total:
+    errors.append("sources %d != total %d" % (sum(items), total))
+errors += ["source %d idle" % n for n, count in enumerate(items) if count == 0]
+
+# Sampling keeps every m-th report of a flow shard, the merged delivery never exceeds total / m
+expected = total // m
+records = summary['records']
+if records > expected:
+    errors.append("delivered %d > %d" % (records, expected))
+loss = 100.0 * (expected - records) / expected if expected else 0.0
+lat = summary['latency_us']
+print("%-5s %6s %3s %4d %10d %12.0f %8.2f %10.1f %10.1f %10.1f  %s" % (
+    sys.argv[6], sys.argv[7], sys.argv[8], m, total, records / duration, loss,
+    lat['p50'], lat['p99'], lat['p999'], "; ".join(errors) if errors else "ok"))
+if sources > 1:
+    print("      sources %s" % " ".join(str(count) for count in items))
+sys.exit(1 if errors else 0)
+PY
+        if [ $? -ne 0 ]; then
+            FAILED=$((FAILED + 1))
+        fi
+    done
+    done
+    done
+done
+
+if [ $FAILED -ne 0 ]; then
+    echo "$FAILED runs failed the check"
+    exit 1
+fi
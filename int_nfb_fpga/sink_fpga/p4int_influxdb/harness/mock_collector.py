@@ -0,0 +1,153 @@
+#!/usr/bin/env python3
+"""
+Mock InfluxDB collector for load tests of the sink.
+
+Accepts line protocol by HTTP (POST /write, as InfluxDB 1.x) and by UDP.
+HTTP responses can be delayed and a share of them can fail with 5xx, rejected
+batches are not counted. Every record carries its RX time as the timestamp
+(software sources of the sink retime the reports), so the collector measures
+the RX to delivery latency of every record.
+
+At the end (duration elapsed, SIGINT or SIGTERM) one JSON summary is printed:
+lines, records, batches, rejected batches and latency percentiles in us.
+"""
+
+import argparse
+import array
+import http.server
+import json
+import random
+import signal
+import socket
+import sys
+import threading
+import time
+
+
+class Stats:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.lines = 0
+        self.records = 0
+        self.batches = 0
+        self.rejected = 0
+        self.telemetry = 0
+        self.latency = array.array('q')
+
+    def add(self, data, now_ns):
+        lines = 0
+        records = 0
+        telemetry = 0
+        latency = []
+        for line in data.split(b'\n'):
+            if not line:
+                continue
+            lines += 1
+            if line.startswith(b'int_sink'):
+                telemetry += 1
+                continue
+            # Records are the lines without a hop, one per report
+            tags = line.split(b' ', 1)[0]
+            if b',hop_index=' in tags:
+                continue
+            records += 1
+            try:
+                latency.append(now_ns - int(line.rsplit(b' ', 1)[1]))
+            except (IndexError, ValueError):
+                pass
+        with self.lock:
+            self.lines += lines
+            self.records += records
+            self.telemetry += telemetry
+            self.batches += 1
+            self.latency.extend(latency)
+
+    def summary(self):
+        with self.lock:
+            lat = sorted(self.latency)
+
+        def pct(p):
+            if not lat:
+                return 0
+            return lat[min(len(lat) - 1, int(len(lat) * p / 100))] / 1000.0
+
+        return {
+            'lines': self.lines, 'records': self.records, 'batches': self.batches,
+            'rejected': self.rejected, 'telemetry': self.telemetry,
+            'latency_us': {'p50': pct(50), 'p99': pct(99), 'p999': pct(99.9),
+                           'max': lat[-1] / 1000.0 if lat else 0},
+        }
+
+
+def make_handler(stats, args):
+    class Handler(http.server.BaseHTTPRequestHandler):
+        protocol_version = 'HTTP/1.1'
+
+        def do_POST(self):
+            data = self.rfile.read(int(self.headers.get('Content-Length', 0)))
+            if args.latency_ms:
+                time.sleep(args.latency_ms / 1000.0)
+            if not self.path.startswith('/write'):
+                self.reply(404)
+            elif random.random() < args.error_rate:
+                with stats.lock:
+                    stats.rejected += 1
+                self.reply(args.error_code)
+            else:
+                stats.add(data, time.time_ns())
+                self.reply(204)
+
+        def reply(self, code):
+            self.send_response(code)
+            self.send_header('Content-Length', '0')
+            self.end_headers()
+
+        def log_message(self, *unused):
+            pass
+
+    return Handler
+
+
+def udp_receiver(sock, stats):
+    while True:
+        try:
+            data = sock.recv(70000)
+        except OSError:
+            return
+        stats.add(data, time.time_ns())
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--http', type=int, help='HTTP port')
+    parser.add_argument('--udp', type=int, help='UDP port')
+    parser.add_argument('--latency-ms', type=float, default=0, help='delay of every HTTP response')
+    parser.add_argument('--error-rate', type=float, default=0, help='share of HTTP batches rejected by 5xx')
+    parser.add_argument('--error-code', type=int, default=503, help='status of rejected batches')
+    parser.add_argument('--duration', type=float, default=0, help='stop after this many seconds, 0 runs until a signal')
+    args = parser.parse_args()
+    if args.http is None and args.udp is None:
+        parser.error('at least one of --http and --udp is required')
+
+    stats = Stats()
+    done = threading.Event()
+    signal.signal(signal.SIGINT, lambda *unused: done.set())
+    signal.signal(signal.SIGTERM, lambda *unused: done.set())
+
+    if args.http is not None:
+        server = http.server.ThreadingHTTPServer(('127.0.0.1', args.http), make_handler(stats, args))
+        server.daemon_threads = True
+        threading.Thread(target=server.serve_forever, daemon=True).start()
+    if args.udp is not None:
+        sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 1 << 25)
+        sock.bind(('127.0.0.1', args.udp))
+        threading.Thread(target=udp_receiver, args=(sock, stats), daemon=True).start()
+
+    done.wait(args.duration if args.duration > 0 else None)
+    json.dump(stats.summary(), sys.stdout)
+    sys.stdout.write('\n')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,162 @@
+#!/bin/bash
+#
+# Test of the capture source on a veth pair, needs root.
+#
+# The sink captures the host end of the pair, INT over UDP frames are injected
+# from the other end in a network namespace. Every capture mode runs with
+# every queue count: AF_XDP (xdp=1) and AF_PACKET (xdp=0). A run passes when
+# the sink received and exported every injected report and the host got every
+# plain UDP datagram sent along them, so the XDP program passed the traffic
+# that does not carry INT to the kernel.
+
+SINK="$(dirname "$0")/../p4int"
+REPORTS=1000
+QUEUES="1 2"
+MODES="1 0"
+PORT=18089
+
+# Parse parameters
+for i in "$@"
+do
+case $i in
+    --sink=*) # path of the sink binary
+        SINK="${i#*=}"
+        ;;
+    -n=*|--reports=*) # injected reports of one run
+        REPORTS="${i#*=}"
+        ;;
+    -q=*|--queues=*) # list of queue counts of the pair
+        QUEUES="${i#*=}"
+        ;;
+    -x=*|--xdp=*) # list of capture modes, 1 is AF_XDP and 0 AF_PACKET
+        MODES="${i#*=}"
+        ;;
+    -p=*|--port=*) # port of the collector
+        PORT="${i#*=}"
+        ;;
+    *)
+        echo "unknown option $i"
+        exit 1
+    ;;
+esac
+done
+
+COLLECTOR="$(dirname "$0")/mock_collector.py"
+NS=int_veth_test
+TMP=$(mktemp -d)
+cleanup() {
+    ip link del int_veth0 2> /dev/null
+    ip netns del $NS 2> /dev/null
+    rm -rf "$TMP"
+}
+trap cleanup EXIT
+
+# Frames of INT over UDP with 3 hops of the legacy instruction mask, the
+# source port differs, so the reports spread among the queues
+cat > "$TMP/inject.py" <<'PY'
+import socket, struct, sys
+
+iface, count = sys.argv[1], int(sys.argv[2])
+sock = socket.socket(socket.AF_PACKET, socket.SOCK_RAW)
+sock.bind((iface, 0))
+hops = b''.join(struct.pack('!IHHQQ', 10 + h, 1, 2, 1000 * h, 1000 * h + 500) for h in range(3))
+words = 3 + len(hops) // 4
+for n in range(count):
+    shim = struct.pack('!BBBB', 1, 0, words, 0)
+    int_hdr = struct.pack('!BBBBHH', 0x10, 0, 6, 3, 0xcc00, 0)
+    payload = shim + int_hdr + hops
+    udp = struct.pack('!HHHH', 1024 + n % 512, 5000, 8 + len(payload), 0)
+    ip = struct.pack('!BBHHHBBH4s4s', 0x45, 0x20 << 2, 20 + len(udp) + len(payload), 0, 0, 64, 17, 0,
+        socket.inet_aton('10.10.0.2'), socket.inet_aton('10.20.%d.%d' % (n // 256 % 256, n % 256)))
+    sock.send(b'\xff' * 6 + b'\x02\x00\x00\x00\x00\x02' + b'\x08\x00' + ip + udp + payload)
+PY
+
+# Plain UDP between the ends, the receiver prints the number of datagrams
+cat > "$TMP/plain.py" <<'PY'
+import socket, sys, time
+
+sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+if sys.argv[1] == "recv":
+    sock.bind(('10.30.0.1', int(sys.argv[2])))
+    sock.settimeout(5)
+    count = 0
+    try:
+        while True:
+            sock.recv(64)
+            count += 1
+    except socket.timeout:
+        pass
+    print(count)
+else:
+    for n in range(int(sys.argv[3])):
+        sock.sendto(b'plain', ('10.30.0.1', int(sys.argv[2])))
+        time.sleep(0.01)
+PY
+
+FAILED=0
+printf "%-6s %6s %8s %8s %8s %6s  %s\n" mode queues injected total records plain check
+for q in $QUEUES; do
+for x in $MODES; do
+    ip netns add $NS
+    ip link add int_veth0 numtxqueues $q numrxqueues $q type veth peer name int_veth1 \
+        numtxqueues $q numrxqueues $q netns $NS
+    ip addr add 10.30.0.1/24 dev int_veth0
+    ip link set int_veth0 up
+    ip -n $NS addr add 10.30.0.2/24 dev int_veth1
+    ip -n $NS link set int_veth1 up
+    ip -n $NS link set lo up
+
+    python3 "$COLLECTOR" --udp=$PORT --duration=8 > "$TMP/collector.json" &
+    collector=$!
+    "$SINK" -k -S capture:int_veth0,xdp=$x,queues=$q -P rx=$q -c 127.0.0.1 -p $PORT -r udp -b 50 \
+        > "$TMP/sink.log" 2>&1 &
+    sink=$!
+    sleep 1
+
+    python3 "$TMP/plain.py" recv $(($PORT + 1)) > "$TMP/plain.log" &
+    plain=$!
+    sleep 0.5
+    ip netns exec $NS python3 "$TMP/plain.py" send $(($PORT + 1)) 100 &
+    ip netns exec $NS python3 "$TMP/inject.py" int_veth1 $REPORTS
+    wait $plain
+    plain_cnt=$(cat "$TMP/plain.log")
+    kill -INT $sink
+    wait $sink
+    wait $collector
+
+    python3 - "$TMP/collector.json" "$TMP/sink.log" "$REPORTS" "$plain_cnt" "$x" "$q" <<'PY'
+import json, re, sys
+summary = json.load(open(sys.argv[1]))
+log = open(sys.argv[2]).read()
+injected, plain = int(sys.argv[3]), int(sys.argv[4] or 0)
+match = re.search(r'^total - (\d+)$', log, re.M)
+total = int(match.group(1)) if match else 0
+mode = "xdp" if sys.argv[5] == "1" else "packet"
+if mode == "xdp" and "AF_XDP unavailable" in log:
+    mode = "packet"
+errors = []
+if sys.argv[5] == "1" and mode != "xdp":
+    errors.append("AF_XDP fallback")
+if total != injected:
+    errors.append("received %d of %d" % (total, injected))
+if summary['records'] != total:
+    errors.append("exported %d of %d" % (summary['records'], total))
+if plain != 100:
+    errors.append("plain %d of 100" % plain)
+print("%-6s %6s %8d %8d %8d %6d  %s" % (mode, sys.argv[6], injected, total, summary['records'],
+    plain, "; ".join(errors) if errors else "ok"))
+sys.exit(1 if errors else 0)
+PY
+    if [ $? -ne 0 ]; then
+        FAILED=$((FAILED + 1))
+        sed 's/^/    /' "$TMP/sink.log" | grep -i "capture\|error"
+    fi
+    ip link del int_veth0
+    ip netns del $NS
+done
+done
+
+if [ $FAILED -ne 0 ]; then
+    echo "$FAILED runs failed the check"
+    exit 1
+fi
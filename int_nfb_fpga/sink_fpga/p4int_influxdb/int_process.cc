@@ -0,0 +1,297 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ *         Pavlina Patova <xpatov00@stud.fit.vutbr.cz>
+ * @brief Processing of INT reports
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <endian.h>
+#include <arpa/inet.h>
+
+#include "int_process.h"
+#include "int_simd.h"
+
+#define TCP  6
+#define UDP 17
+
+/**
+ * Convert the passed timestamp in TS NS to Unix NS
+ * \param tsNs input timestamp in the TS NS format
+ * \return Converted timestamp in the UNIX NS format
+ */
+static inline uint64_t convertToUnixNs(uint64_t tsNs) {
+    uint32_t sec = tsNs >> 32;
+    uint32_t nanosec = tsNs & 0xffffffff;
+    // Convert seconds to nanoseconds and add the nanosecond part
+    return (sec * 100000000000) + nanosec;
+}
+
+uint64_t ntoh64(uint64_t value) {
+    return be64toh(value);
+}
+
+void print_telemetric(const telemetric_hdr_t *hdr) {
+    printf("Orig TS       => %lu\n", hdr->origTs);
+    printf("Dest TS       => %lu\n", hdr->dstTs);
+    printf("Seq           => %lu\n", hdr->seqNum);
+    printf("Delay         => %lu\n", hdr->delay);
+    printf("Sink Jitter   => %lu\n", hdr->sink_jitter);
+    printf("IP Src        => %s\n",  hdr->srcIp);
+    printf("IP Dst        => %s\n",  hdr->dstIp);
+    printf("Src Port      => %hu\n", hdr->srcPort);
+    printf("Dst Port      => %hu\n", hdr->dstPort);
+}
+
+void get_int_header_data(telemetric_hdr_t &tmpHdr, struct int_influx_t *int_hdr) {
+    // Convert destination timestamp
+    tmpHdr.dstTs = ntohl(((int_hdr->ndk_tstamp2)));
+    tmpHdr.dstTs += ntohl(((int_hdr->ndk_tstamp1)))*  1'000'000'000ll;
+
+    // Convert IP addresses
+    inet_ntop(AF_INET, &int_hdr->srcAddr, tmpHdr.srcIp, IP_BUFF_SIZE);
+    inet_ntop(AF_INET, &int_hdr->dstAddr, tmpHdr.dstIp, IP_BUFF_SIZE);
+
+    // Convert source and destination ports
+    tmpHdr.srcPort =  ntohs(((int_hdr->ingress_port_id)));
+    tmpHdr.dstPort =  ntohs(((int_hdr->egress_port_id)));
+
+    // Sequence number is zero for UDP flows
+    tmpHdr.seqNum = ntohl(((int_hdr->seq)));
+    tmpHdr.protocol = tmpHdr.seqNum == 0 ? UDP : TCP;
+}
+
+/**
+ * Read a 32-bit field of the hop metadata
+ * \param data Field in network order, may be unaligned
+ */
+static inline uint32_t load32(const uint8_t *data) {
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return ntohl(value);
+}
+
+/**
+ * Read a 64-bit field of the hop metadata
+ * \param data Field in network order, may be unaligned
+ */
+static inline uint64_t load64(const uint8_t *data) {
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    return ntoh64(value);
+}
+
+/**
+ * Parse hop metadata of the instruction mask. With Fixed set the mask is the
+ * template argument, so offsets are constants and absent fields are compiled out.
+ * \param tmpHdr Where to store parsed information
+ * \param meta Hop metadata from packet
+ * \param meta_cnt Number of nodes to proccess
+ * \param runtime_mask INT instructions, used only by the generic parser
+ */
+template<bool Fixed, uint16_t Mask>
+static void parse_hops(telemetric_hdr_t &tmpHdr, const uint8_t *meta, const uint8_t meta_cnt, uint16_t runtime_mask) {
+    const uint16_t mask = Fixed ? Mask : runtime_mask;
+    const uint32_t stride = int_hop_size(mask);
+    const bool ingress_ts = mask & INT_INST_INGRESS_TS;
+    const bool egress_ts = mask & INT_INST_EGRESS_TS;
+    const bool timestamps = ingress_ts || egress_ts;
+
+    // Source timestamp is the ingress of the first node
+    uint64_t prev_egress = 0;
+    tmpHdr.origTs = tmpHdr.dstTs;
+    // FNV-1a of the switch IDs identifies the path
+    uint32_t path = 0x811c9dc5;
+
+    // With both timestamps, delays of all hops are computed at once by vector instructions
+    telemetric_meta *nodes = &tmpHdr.node_meta[tmpHdr.node_cnt];
+    if(ingress_ts && egress_ts) {
+        hop_times(meta, stride, int_inst_offset(mask, INT_INST_INGRESS_TS), meta_cnt, nodes);
+    }
+
+    for(uint8_t i = 0; i < meta_cnt; ++i) {
+        telemetric_meta &node = nodes[i];
+        node.hop_latency = (mask & INT_INST_HOP_LATENCY) ? load32(meta + int_inst_offset(mask, INT_INST_HOP_LATENCY)) : 0;
+        uint32_t queue = (mask & INT_INST_QUEUE) ? load32(meta + int_inst_offset(mask, INT_INST_QUEUE)) : 0;
+        node.queue_id = queue >> 24;
+        node.queue_occupancy = queue & 0xffffff;
+        node.tx_utilization = (mask & INT_INST_TX_UTIL) ? load32(meta + int_inst_offset(mask, INT_INST_TX_UTIL)) : 0;
+        node.hop_index = i;
+        node.hop_jitter = 0;
+        if(mask & INT_INST_SWITCH_ID) {
+            path = (path ^ load32(meta + int_inst_offset(mask, INT_INST_SWITCH_ID))) * 0x01000193;
+        }
+
+        if(!ingress_ts || !egress_ts) {
+            // Without one of the timestamps, delays are derived from the hop latency
+            node.hop_delay = (mask & INT_INST_HOP_LATENCY) ? node.hop_latency : 0;
+            node.hop_timestamp = timestamps ? load64(meta + int_inst_offset(mask, egress_ts ?
+                INT_INST_EGRESS_TS : INT_INST_INGRESS_TS)) : 0;
+
+            // Delay can not be counted for first node (There is no previous timestamp)
+            node.link_delay = (i != 0 && timestamps) ? prev_egress - (node.hop_timestamp - node.hop_delay) : 0;
+            prev_egress = node.hop_timestamp;
+        }
+        meta += stride;
+    }
+    tmpHdr.node_cnt += meta_cnt;
+    tmpHdr.pathId = ((mask & INT_INST_SWITCH_ID) && meta_cnt) ? path : 0;
+    if(timestamps && meta_cnt) {
+        tmpHdr.origTs = nodes[0].hop_timestamp - nodes[0].hop_delay;
+        prev_egress = nodes[meta_cnt - 1].hop_timestamp;
+    }
+
+    telemetric_meta node = telemetric_meta();
+    node.hop_index = meta_cnt;
+    node.link_delay = (timestamps && meta_cnt) ? prev_egress - tmpHdr.dstTs : 0;
+    node.hop_timestamp = tmpHdr.dstTs;
+
+    tmpHdr.node_meta[tmpHdr.node_cnt++] = node;
+}
+
+// Parser of the hop metadata
+typedef void (*hop_parser_t)(telemetric_hdr_t &, const uint8_t *, const uint8_t, uint16_t);
+
+// Specialized parsers of common instruction masks, the most common first
+#define HOP_PARSER(mask) {mask, parse_hops<true, mask>}
+static const struct {
+    uint16_t     mask;
+    hop_parser_t parse;
+} hop_parsers[] = {
+    HOP_PARSER(INT_INST_LEGACY),
+    HOP_PARSER(INT_INST_LEGACY | INT_INST_HOP_LATENCY),
+    HOP_PARSER(INT_INST_LEGACY | INT_INST_QUEUE),
+    HOP_PARSER(INT_INST_LEGACY | INT_INST_HOP_LATENCY | INT_INST_QUEUE),
+    HOP_PARSER(INT_INST_LEGACY | INT_INST_HOP_LATENCY | INT_INST_QUEUE | INT_INST_TX_UTIL),
+    HOP_PARSER(INT_INST_SWITCH_ID | INT_INST_HOP_LATENCY | INT_INST_QUEUE | INT_INST_EGRESS_TS),
+};
+
+void get_int_node_data(telemetric_hdr_t &tmpHdr, struct int_meta_t *int_meta_hdr, const uint8_t meta_cnt) {
+    parse_hops<true, INT_INST_LEGACY>(tmpHdr, (const uint8_t *)int_meta_hdr, meta_cnt, INT_INST_LEGACY);
+}
+
+void get_int_node_data_mask(telemetric_hdr_t &tmpHdr, const uint8_t *meta, const uint8_t meta_cnt, uint16_t mask) {
+    hop_parser_t parse = parse_hops<false, 0>;
+    for(const auto &parser : hop_parsers) {
+        if(parser.mask == mask) {
+            parse = parser.parse;
+            break;
+        }
+    }
+    parse(tmpHdr, meta, meta_cnt, mask);
+}
+
+uint32_t decode_packet(const uint8_t *data, uint32_t data_length, telemetric_hdr_t &tmpHdr, const options_t& opt) {
+    // Prepare telemetric data into the apropriate structure
+    struct int_influx_t *int_hdr = (struct int_influx_t*)data;
+    const uint8_t *meta = data + sizeof(struct int_influx_t);
+    if(data_length < sizeof(struct int_influx_t)) {
+        return RET_ERR;
+    }
+    tmpHdr.node_cnt = 0;
+    tmpHdr.flowKey = *((uint64_t*)(data));
+    tmpHdr.aggregated = 0;
+
+    // Reports of longer paths do not fit the record, they are malformed for the sink
+    uint8_t meta_cnt = int_hdr->hop_meta_len ? int_hdr->meta_len/(int_hdr->hop_meta_len) : 0;
+    if(meta_cnt > MAX_NODES) {
+        return RET_ERR;
+    }
+    // Reports of P4 programs not filling the mask have the int_meta_t layout
+    tmpHdr.inst_mask = ntohs(int_hdr->inst_mask);
+    if(tmpHdr.inst_mask == 0) {
+        tmpHdr.inst_mask = INT_INST_LEGACY;
+    }
+
+    // Hop length of the header is in 4-byte words, it has to match the mask and
+    // the hops have to be in the report
+    if(int_hdr->hop_meta_len * 4u != int_hop_size(tmpHdr.inst_mask) ||
+        sizeof(struct int_influx_t) + meta_cnt * int_hop_size(tmpHdr.inst_mask) > data_length) {
+        return RET_ERR;
+    }
+
+    get_int_header_data(tmpHdr, int_hdr);
+    get_int_node_data_mask(tmpHdr, meta, meta_cnt, tmpHdr.inst_mask);
+    tmpHdr.delay = tmpHdr.dstTs - tmpHdr.origTs;
+
+    // Cut of timestamps to 48 bits
+    if(opt.tstmp == 1) {
+        uint64_t mask = 0x0000FFFFFFFFFFFF;
+        tmpHdr.origTs = tmpHdr.origTs & mask;
+        tmpHdr.dstTs = tmpHdr.dstTs & mask;
+    }
+
+    return RET_OK;
+}
+
+uint32_t decode_burst(const uint8_t *const *data, const uint32_t *data_length, const uint64_t *rx_ns, uint32_t count,
+    telemetric_hdr_t *records, const options_t& opt) {
+    uint32_t rec_cnt = 0;
+    for(uint32_t i = 0; i < count; i++) {
+        // Header and hop metadata of an upcoming report, prefetch does not fault behind the report
+        if(i + DECODE_PREFETCH < count) {
+            for(uint32_t line = 0; line < DECODE_PREFETCH_LINES; line++) {
+                __builtin_prefetch(data[i + DECODE_PREFETCH] + line * 64);
+            }
+        }
+        if(decode_packet(data[i], data_length[i], records[rec_cnt], opt) != RET_OK) {
+            continue;
+        }
+        records[rec_cnt++].rxNs = rx_ns[i];
+    }
+    return rec_cnt;
+}
+
+meta_data *aggregate_report(telemetric_hdr_t &tmpHdr, flow_state_t &state) {
+    // Get flow data
+    bool created;
+    meta_data *meta = flow_find(state, tmpHdr.flowKey, created);
+    if(meta == NULL) {
+        return NULL;
+    }
+    meta_data &meta_tmp = *meta;
+    if(created) {
+        // The first report of a flow has no jitter and no reordering
+        meta_tmp.prev_dstTs = tmpHdr.dstTs;
+        meta_tmp.seq = tmpHdr.seqNum != 0 ? tmpHdr.seqNum - 1 : 0;
+    }
+
+    // Calculate int header
+    tmpHdr.sink_jitter = tmpHdr.dstTs - meta_tmp.prev_dstTs;
+    if(tmpHdr.seqNum == 0) {
+        tmpHdr.reordering = 0;
+        tmpHdr.seqNum = meta_tmp.seq + 1;
+    } else {
+        tmpHdr.reordering = tmpHdr.seqNum - meta_tmp.seq - 1;
+    }
+
+    // Update flow data
+    meta_tmp.prev_dstTs = tmpHdr.dstTs;
+    meta_tmp.seq = tmpHdr.seqNum;
+
+    // Node jitter is computed from ingress timestamps, the sink uses its own one
+    for(uint8_t i = 0; i < tmpHdr.node_cnt; i++) {
+        telemetric_meta &node = tmpHdr.node_meta[i];
+        uint64_t ingress = node.hop_timestamp - node.hop_delay;
+        uint64_t &prev = state.shard->prev_timestamps[i];
+        node.hop_jitter = prev != 0 ? ingress - prev : 0;
+        prev = ingress;
+    }
+    return &meta_tmp;
+}
+
+uint32_t process_packet(struct ndp_packet& pkt, telemetric_hdr_t &tmpHdr, flow_state_t &state, const options_t& opt) {
+    uint32_t ret = decode_packet(pkt.data, pkt.data_length, tmpHdr, opt);
+    if(ret != RET_OK) {
+        return ret;
+    }
+    if(aggregate_report(tmpHdr, state) == NULL) {
+        return RET_FLOW_FULL;
+    }
+
+    // Print to console
+    if(opt.verbose) {
+        print_telemetric(&tmpHdr);
+    }
+    return RET_OK;
+}
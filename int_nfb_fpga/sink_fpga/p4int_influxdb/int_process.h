@@ -0,0 +1,152 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ *         Pavlina Patova <xpatov00@stud.fit.vutbr.cz>
+ * @brief Processing of INT reports
+ */
+
+#ifndef _INT_PROCESS_H_
+#define _INT_PROCESS_H_
+
+#include <nfb/ndp.h>
+
+#include "p4int.h"
+#include "flow_table.h"
+
+// Distance of the prefetched report in a burst
+#define DECODE_PREFETCH 4
+// Cache lines prefetched per report, the header and up to 10 hops of int_meta_t
+#define DECODE_PREFETCH_LINES 5
+
+/**
+ * Structures for handling packet data nicier
+ */
+struct int_influx_t{
+      uint32_t  srcAddr;
+      uint32_t  dstAddr;
+      uint16_t  ingress_port_id;
+      uint16_t  egress_port_id;
+      uint8_t   meta_len;
+      uint8_t   hop_meta_len;
+      uint16_t  inst_mask;
+      uint32_t  ndk_tstamp1;
+      uint32_t  ndk_tstamp2;
+      uint64_t  delay;
+      uint32_t  seq;
+}__attribute__((packed));
+
+  struct int_meta_t{
+      uint32_t switch_id;
+      uint16_t ingress_port_id;
+      uint16_t egress_port_id;
+      uint64_t ingress_tstamp;
+      uint64_t egress_tstamp;
+}__attribute__((packed));
+
+/**
+ * Size of the hop metadata
+ * \param mask INT instructions
+ * \return Size of the metadata of one hop in bytes
+ */
+constexpr uint32_t int_hop_size(uint16_t mask) {
+    uint32_t size = 0;
+    for(uint32_t bit = 0; bit < 16; bit++) {
+        if(mask & (0x8000 >> bit)) {
+            // Timestamps and level 2 port IDs take two words
+            size += (bit >= 4 && bit <= 6) ? 8 : 4;
+        }
+    }
+    return size;
+}
+
+/**
+ * Offset of the field in the hop metadata
+ * \param mask INT instructions
+ * \param inst INT_INST_* bit of the field
+ * \return Offset of the field in bytes
+ */
+constexpr uint32_t int_inst_offset(uint16_t mask, uint16_t inst) {
+    // Fields are ordered from the most significant bit
+    return int_hop_size(mask & ~(inst | (inst - 1)));
+}
+
+/**
+ * Convert the network order to 64-bit host order
+ * \param input Input network order
+ * \return Converted number
+ */
+uint64_t ntoh64(uint64_t value);
+
+/**
+ * Print telemetric data
+ * \param hdr Structureof telemetric data
+ */
+void print_telemetric(const telemetric_hdr_t *hdr);
+
+/**
+ * Write headre information to format sutable for sending
+ * \param tmpHdr Where to store parsed information
+ * \param int_hdr Raw data from packet
+ */
+void get_int_header_data(telemetric_hdr_t &tmpHdr, struct int_influx_t *int_hdr);
+
+/**
+ * Write node information to format sutable for sending, hops have the int_meta_t layout
+ * \param tmpHdr Where to store parsed information
+ * \param int_meta_hdr Raw data from packet
+ * \param meta_cnt Number of nodes to proccess
+ */
+void get_int_node_data(telemetric_hdr_t &tmpHdr, struct int_meta_t *int_meta_hdr, const uint8_t meta_cnt);
+
+/**
+ * Write node information of any instruction mask. Common masks have parsers
+ * specialized at compile time, the others are parsed by a generic one.
+ * \param tmpHdr Where to store parsed information
+ * \param meta Hop metadata from packet
+ * \param meta_cnt Number of nodes to proccess
+ * \param mask INT instructions of the hop metadata
+ */
+void get_int_node_data_mask(telemetric_hdr_t &tmpHdr, const uint8_t *meta, const uint8_t meta_cnt, uint16_t mask);
+
+/**
+ * Decode one INT report, no flow state is used
+ * \param data Report data
+ * \param data_length Length of the report data
+ * \param tmpHdr Where to store parsed information
+ * \param opt Program parameters
+ * \return RET_OK if everything was fine, RET_ERR when the hop length of the header
+ * does not match the instruction mask or the hops do not fit to the report
+ */
+uint32_t decode_packet(const uint8_t *data, uint32_t data_length, telemetric_hdr_t &tmpHdr, const options_t& opt);
+
+/**
+ * Decode a burst of INT reports, upcoming reports are prefetched
+ * \param data Reports of the burst
+ * \param data_length Length of every report
+ * \param rx_ns Monotonic time every report left the RX queue
+ * \param count Number of reports
+ * \param records Where to store decoded reports
+ * \param opt Program parameters
+ * \return Number of decoded reports, reports failing to decode are skipped
+ */
+uint32_t decode_burst(const uint8_t *const *data, const uint32_t *data_length, const uint64_t *rx_ns, uint32_t count,
+    telemetric_hdr_t *records, const options_t& opt);
+
+/**
+ * Update the flow state and compute flow dependent values of a decoded report
+ * \param tmpHdr Decoded report
+ * \param state Flow state of the shard owning the flow
+ * \return Metadata of the flow, NULL when a new flow does not fit to the table
+ */
+meta_data *aggregate_report(telemetric_hdr_t &tmpHdr, flow_state_t &state);
+
+/**
+ * Process one received packet based on the program, decode and aggregate it
+ * \param pkt Input packet to prs
+ * \param tmpHdr Where to store parsed information
+ * \param state Flow state
+ * \param opt Program parameters
+ * \return RET_OK if everything was fine, RET_FLOW_FULL when the flow table is full
+ */
+uint32_t process_packet(struct ndp_packet& pkt, telemetric_hdr_t &tmpHdr, flow_state_t &state, const options_t& opt);
+
+#endif // _INT_PROCESS_H_
@@ -0,0 +1,134 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Vectorized processing of hop timestamps
+ */
+
+#include <cstddef>
+#include <cstring>
+
+#include "int_simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86
+#endif
+
+static const char *isa_names[SIMD_CNT] = {"scalar", "ssse3", "avx2"};
+
+/**
+ * Read a timestamp in network order
+ * \param data Timestamp, may be unaligned
+ */
+static inline uint64_t load_tstamp(const uint8_t *data) {
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    return __builtin_bswap64(value);
+}
+
+static void hop_times_scalar(const uint8_t *meta, uint32_t stride, uint32_t offset, uint32_t cnt,
+    telemetric_meta *nodes) {
+    uint64_t prev = 0;
+    for(uint32_t h = 0; h < cnt; h++) {
+        const uint8_t *hop = meta + h * stride + offset;
+        uint64_t ingress = load_tstamp(hop);
+        uint64_t egress = load_tstamp(hop + 8);
+        nodes[h].hop_delay = egress - ingress;
+        nodes[h].link_delay = h != 0 ? prev - ingress : 0;
+        nodes[h].hop_timestamp = egress;
+        prev = egress;
+    }
+}
+
+#ifdef SIMD_X86
+
+// Vector code stores the link and the hop delay of a node at once
+static_assert(offsetof(telemetric_meta, hop_delay) == offsetof(telemetric_meta, link_delay) + 8,
+    "link_delay has to be followed by hop_delay");
+
+__attribute__((target("ssse3")))
+static void hop_times_ssse3(const uint8_t *meta, uint32_t stride, uint32_t offset, uint32_t cnt,
+    telemetric_meta *nodes) {
+    const __m128i swap = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    // Low lane is the egress of the previous hop, the ingress for the first hop
+    __m128i prev = _mm_setzero_si128();
+
+    // One hop per register, lanes are the ingress and the egress timestamp
+    for(uint32_t h = 0; h < cnt; h++) {
+        __m128i times = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(meta + h * stride + offset)), swap);
+        if(h == 0) {
+            prev = times;
+        }
+        // Lanes are the link delay and the hop delay
+        __m128i egress = _mm_unpackhi_epi64(times, times);
+        __m128i delays = _mm_sub_epi64(_mm_unpacklo_epi64(prev, egress), _mm_unpacklo_epi64(times, times));
+        _mm_storeu_si128((__m128i *)&nodes[h].link_delay, delays);
+        _mm_storel_epi64((__m128i *)&nodes[h].hop_timestamp, egress);
+        prev = egress;
+    }
+}
+
+__attribute__((target("avx2")))
+static void hop_times_avx2(const uint8_t *meta, uint32_t stride, uint32_t offset, uint32_t cnt,
+    telemetric_meta *nodes) {
+    const __m256i swap = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+        7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    // Lane 0 is the egress of the previous hop, the ingress for the first hop
+    __m256i prev = _mm256_setzero_si256();
+
+    // Two hops per register, lanes are ingress and egress of the first and the second hop
+    for(uint32_t h = 0; h < cnt; h += 2) {
+        __m128i first = _mm_loadu_si128((const __m128i *)(meta + h * stride + offset));
+        __m128i second = h + 1 < cnt ? _mm_loadu_si128((const __m128i *)(meta + (h + 1) * stride + offset)) : first;
+        __m256i times = _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(first), second, 1), swap);
+        if(h == 0) {
+            prev = times;
+        }
+
+        // Lanes 0 and 2 hold the results of the two hops
+        __m256i delay = _mm256_sub_epi64(_mm256_srli_si256(times, 8), times);
+        __m256i shifted = _mm256_permute4x64_epi64(times, _MM_SHUFFLE(3, 1, 3, 3));
+        __m256i link = _mm256_sub_epi64(_mm256_blend_epi32(shifted, prev, 0x03), times);
+        prev = shifted;
+
+        // Link and hop delay of every hop are adjacent in the node
+        __m256i delays = _mm256_unpacklo_epi64(link, delay);
+        __m128i egress = _mm256_castsi256_si128(_mm256_permute4x64_epi64(times, _MM_SHUFFLE(3, 3, 3, 1)));
+        _mm_storeu_si128((__m128i *)&nodes[h].link_delay, _mm256_castsi256_si128(delays));
+        _mm_storeu_si128((__m128i *)&nodes[h + 1].link_delay, _mm256_extracti128_si256(delays, 1));
+        _mm_storel_epi64((__m128i *)&nodes[h].hop_timestamp, egress);
+        _mm_storel_epi64((__m128i *)&nodes[h + 1].hop_timestamp, _mm_unpackhi_epi64(egress, egress));
+    }
+}
+
+#endif // SIMD_X86
+
+uint32_t simd_detect() {
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        return SIMD_AVX2;
+    }
+    if(__builtin_cpu_supports("ssse3")) {
+        return SIMD_SSSE3;
+    }
+#endif
+    return SIMD_SCALAR;
+}
+
+const char *simd_name(uint32_t isa) {
+    return isa < SIMD_CNT ? isa_names[isa] : "unknown";
+}
+
+hop_times_t hop_times_select(uint32_t isa) {
+#ifdef SIMD_X86
+    switch(isa) {
+        case SIMD_AVX2:
+            return hop_times_avx2;
+        case SIMD_SSSE3:
+            return hop_times_ssse3;
+    }
+#endif
+    return hop_times_scalar;
+}
+
+const hop_times_t hop_times = hop_times_select(simd_detect());
@@ -0,0 +1,55 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Vectorized processing of hop timestamps
+ */
+
+#ifndef _INT_SIMD_H_
+#define _INT_SIMD_H_
+
+#include <cstdint>
+
+#include "p4int.h"
+
+// Instruction sets of the hop timestamp processing
+#define SIMD_SCALAR 0 // Plain C++
+#define SIMD_SSSE3  1 // 128-bit byte shuffles
+#define SIMD_AVX2   2 // 256-bit byte shuffles and arithmetic
+#define SIMD_CNT    3
+
+/**
+ * Byte swap the hop timestamps and compute delays of all hops. The ingress
+ * timestamp of a hop is directly followed by the egress one. Only hop_delay,
+ * link_delay (0 for the first hop) and hop_timestamp, the egress timestamp,
+ * are written. Vector stores may write the node behind the last hop.
+ * \param meta Hop metadata in network order
+ * \param stride Size of the metadata of one hop
+ * \param offset Offset of the ingress timestamp in the metadata of a hop
+ * \param cnt Number of hops, at most MAX_NODES
+ * \param nodes Where to store the results, cnt + 1 nodes
+ */
+typedef void (*hop_times_t)(const uint8_t *meta, uint32_t stride, uint32_t offset, uint32_t cnt,
+    telemetric_meta *nodes);
+
+/**
+ * Best instruction set supported by the CPU
+ * \return SIMD_* value
+ */
+uint32_t simd_detect();
+
+/**
+ * Name of the instruction set
+ * \param isa SIMD_* value
+ */
+const char *simd_name(uint32_t isa);
+
+/**
+ * Implementation of the hop timestamp processing
+ * \param isa SIMD_* value, must be supported by the CPU
+ * \return Implementation using the instruction set
+ */
+hop_times_t hop_times_select(uint32_t isa);
+
+// Implementation of the best instruction set, selected at startup
+extern const hop_times_t hop_times;
+
+#endif // _INT_SIMD_H_
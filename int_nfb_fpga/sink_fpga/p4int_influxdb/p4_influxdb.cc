@@ -4,204 +4,738 @@
 
 #include <string>
 #include <iostream>
-#include <thread> 
+#include <memory>
 #include <sstream>
+#include <cstring>
+#include <cstdarg>
+#include <algorithm>
+#include <arpa/inet.h>
 
 #include "p4_influxdb.h"
 #include "UDP.h"
+#include "TCP.h"
 #include "HTTP.h"
 
-#define POP_THRESHOLD 10
 #define RECORD_SIZE 210
 
+/**
+ * Format and append to the data buffer, the text is not limited in length
+ * \param data Place for assembled records
+ * \param format Format of printf
+ */
+static void appendf(std::string &data, const char *format, ...) __attribute__((format(printf, 2, 3)));
+static void appendf(std::string &data, const char *format, ...)
+{
+    char text[RECORD_SIZE];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if(len < (int)sizeof(text)) {
+        data.append(text, len > 0 ? len : 0);
+        return;
+    }
+
+    // Longer text is formatted in place
+    size_t pos = data.size();
+    data.resize(pos + len + 1);
+    va_start(args, format);
+    vsnprintf(&data[pos], len + 1, format, args);
+    va_end(args);
+    data.resize(pos + len);
+}
+
+/**
+ * Assemble the report as one record, values of the hops are fields indexed by the hop
+ * \param telemetric Data for record assembling
+ * \param data Place for assembled records, ends with the measurement and tags of the record
+ */
+static void add_report_wide(const telemetric_hdr_t &telemetric, std::string &data)
+{
+    appendf(data, "origts=%lu,dstts=%lu,seq=%lu,delay=%lu,sink_jitter=%lu,reordering=%ld",
+        telemetric.origTs, telemetric.dstTs,
+        telemetric.seqNum, telemetric.delay, telemetric.sink_jitter, telemetric.reordering);
+
+    // Same fields as the hop records, the hop timestamps are not exported
+    for(uint8_t i = 0; i < telemetric.node_cnt; i++) {
+        const telemetric_meta &item = telemetric.node_meta[i];
+        if(i == 0 || item.hop_delay != 0) {
+            appendf(data, ",hop%u_delay=%lu", item.hop_index, item.hop_delay);
+        }
+        if(i != 0) {
+            appendf(data, ",hop%u_link_delay=%li", item.hop_index, item.link_delay);
+        }
+        appendf(data, ",hop%u_jitter=%li", item.hop_index, item.hop_jitter);
+
+        // Extra instructions of the hops, the sink itself has none
+        if((telemetric.inst_mask & INT_INST_EXTRA) && i + 1 < telemetric.node_cnt) {
+            if(telemetric.inst_mask & INT_INST_HOP_LATENCY) {
+                appendf(data, ",hop%u_latency=%u", item.hop_index, item.hop_latency);
+            }
+            if(telemetric.inst_mask & INT_INST_QUEUE) {
+                appendf(data, ",hop%u_queue_id=%u,hop%u_queue_occupancy=%u",
+                    item.hop_index, item.queue_id, item.hop_index, item.queue_occupancy);
+            }
+            if(telemetric.inst_mask & INT_INST_TX_UTIL) {
+                appendf(data, ",hop%u_tx_utilization=%u", item.hop_index, item.tx_utilization);
+            }
+        }
+    }
+    appendf(data, " %lu\n", telemetric.dstTs);
+}
+
+/**
+ * Append the address tag
+ * \param data Place for assembled records
+ * \param ip Address of the report as text
+ * \param addr Address of the report in network order
+ * \param len Prefix of the tag, 32 tags the address
+ */
+static void addr_tag(std::string &data, const char *ip, uint32_t addr, uint8_t len)
+{
+    if(len == 32) {
+        data.append(ip);
+        return;
+    }
+    uint32_t prefix = ntohl(addr) & (len == 0 ? 0 : ~0u << (32 - len));
+    appendf(data, "%u.%u.%u.%u/%u", prefix >> 24, (prefix >> 16) & 0xff, (prefix >> 8) & 0xff, prefix & 0xff, len);
+}
+
+uint64_t series_key(const telemetric_hdr_t &telemetric, uint32_t dest, const schema_t &schema)
+{
+    // Flow key holds the source and destination address of the report in network order
+    uint32_t src;
+    uint32_t dst;
+    memcpy(&src, &telemetric.flowKey, sizeof(src));
+    memcpy(&dst, (const uint8_t *)&telemetric.flowKey + sizeof(src), sizeof(dst));
+    src = ntohl(src) & (schema.src_len == 0 ? 0 : ~0u << (32 - schema.src_len));
+    dst = ntohl(dst) & (schema.dst_len == 0 ? 0 : ~0u << (32 - schema.dst_len));
+
+    uint64_t attrs = ((uint64_t)dest << 40) | ((uint64_t)telemetric.protocol << 32);
+    if(!schema.ports) {
+        attrs |= ((uint32_t)telemetric.srcPort << 16) | telemetric.dstPort;
+    }
+    uint64_t key = flow_hash(flow_hash(((uint64_t)src << 32) | dst) ^ attrs);
+    return schema.path ? flow_hash(key ^ telemetric.pathId) : key;
+}
+
 /**
  * Assemble reports and add them to data buffer
  * \param telemetric Data for record assembling
  * \param data Place for assembled records
+ * \param measurement Measurement of the records
+ * \param schema Schema of the records
+ * \param other Record is folded to the series "other"
  * \return Number of records added
  */
-int add_report(telemetric_hdr_t &telemetric, std::string &data)
+int add_report(telemetric_hdr_t &telemetric, std::string &data, const char *measurement, const schema_t &schema,
+    bool other)
 {
     int it = 0;
-    char report[400];
-    char tmp[400];
-    memset(report, 0, 400);
-    memset(tmp, 0, 400);
-
-    // Same part for every record
-    sprintf(tmp,
-        "int_telemetry,srcip=%s,dstip=%s,srcp=%u,dstp=%u,protocol=%u",
-        telemetric.srcIp, telemetric.dstIp, telemetric.srcPort, telemetric.dstPort, telemetric.protocol);
-   
-        
-    sprintf(report,
-        "%s origts=%lu,dstts=%lu,seq=%lu,delay=%lu,sink_jitter=%lu,reordering=%ld %lu\n",
-        tmp, telemetric.origTs, telemetric.dstTs,
-        telemetric.seqNum, telemetric.delay, telemetric.sink_jitter, telemetric.reordering, telemetric.dstTs);
 
-    data.append(report);
-    memset(report, 0, 400);
+    // Same part for every record, the measurement and tags are assembled in place
+    // and copied from there to the records of the hops
+    size_t tags_pos = data.size();
+    data.append(measurement);
+    if(other) {
+        data.append(",srcip=other,dstip=other");
+    } else {
+        uint32_t src;
+        uint32_t dst;
+        memcpy(&src, &telemetric.flowKey, sizeof(src));
+        memcpy(&dst, (const uint8_t *)&telemetric.flowKey + sizeof(src), sizeof(dst));
+        data.append(",srcip=");
+        addr_tag(data, telemetric.srcIp, src, schema.src_len);
+        data.append(",dstip=");
+        addr_tag(data, telemetric.dstIp, dst, schema.dst_len);
+        if(!schema.ports) {
+            appendf(data, ",srcp=%u,dstp=%u", telemetric.srcPort, telemetric.dstPort);
+        }
+    }
+    appendf(data, ",protocol=%u", telemetric.protocol);
+    if(schema.path && telemetric.pathId != 0 && !other) {
+        appendf(data, ",path=%08x", telemetric.pathId);
+    }
+    size_t tags_len = data.size() - tags_pos;
+    data.push_back(' ');
+    if(schema.ports) {
+        appendf(data, "srcp=%u,dstp=%u,", telemetric.srcPort, telemetric.dstPort);
+    }
+
+    // Aggregate of a degraded flow, the delay is the average one and there are no hop records
+    if(telemetric.aggregated != 0) {
+        appendf(data,
+            "origts=%lu,dstts=%lu,seq=%lu,delay=%lu,delay_max=%lu,reports=%u,sink_jitter=%lu,reordering=%ld %lu\n",
+            telemetric.origTs, telemetric.dstTs, telemetric.seqNum, telemetric.delay, telemetric.delay_max,
+            telemetric.aggregated, telemetric.sink_jitter, telemetric.reordering, telemetric.dstTs);
+        return 1;
+    }
+    if(schema.layout == SCHEMA_WIDE) {
+        add_report_wide(telemetric, data);
+        return 1;
+    }
+
+    appendf(data,
+        "origts=%lu,dstts=%lu,seq=%lu,delay=%lu,sink_jitter=%lu,reordering=%ld %lu\n",
+        telemetric.origTs, telemetric.dstTs,
+        telemetric.seqNum, telemetric.delay, telemetric.sink_jitter, telemetric.reordering, telemetric.dstTs);
     it++;
 
     bool first = true;
-    for(auto &item: telemetric.node_meta) {
+    for(uint8_t i = 0; i < telemetric.node_cnt; i++) {
+        const telemetric_meta &item = telemetric.node_meta[i];
+        // Tags are a part of the data buffer, append copies them also when the buffer grows
+        data.append(data, tags_pos, tags_len);
         if(first) {
-            sprintf(report,
-                "%s,hop_index=%u hop_delay=%lu,hop_jitter=%lu %lu\n",
-                tmp, item.hop_index, item.hop_delay, item.hop_jitter, item.hop_timestamp);
+            appendf(data, ",hop_index=%u hop_delay=%lu,hop_jitter=%lu",
+                item.hop_index, item.hop_delay, item.hop_jitter);
             first = false;
         }
         else {
             if(item.hop_delay != 0) {
-                sprintf(report,
-                    "%s,hop_index=%u hop_delay=%lu,link_delay=%li,hop_jitter=%li %lu\n",
-                    tmp, item.hop_index, item.hop_delay, item.link_delay, item.hop_jitter, item.hop_timestamp);
+                appendf(data, ",hop_index=%u hop_delay=%lu,link_delay=%li,hop_jitter=%li",
+                    item.hop_index, item.hop_delay, item.link_delay, item.hop_jitter);
             } else {
-                sprintf(report,
-                    "%s,hop_index=%u link_delay=%li,hop_jitter=%li %lu\n",
-                    tmp, item.hop_index, item.link_delay, item.hop_jitter, item.hop_timestamp);
+                appendf(data, ",hop_index=%u link_delay=%li,hop_jitter=%li",
+                    item.hop_index, item.link_delay, item.hop_jitter);
             }
         }
 
-        data.append(report);
-        memset(report, 0, 400);
+        // Extra instructions of the hops, the sink itself has none
+        if((telemetric.inst_mask & INT_INST_EXTRA) && i + 1 < telemetric.node_cnt) {
+            if(telemetric.inst_mask & INT_INST_HOP_LATENCY) {
+                appendf(data, ",hop_latency=%u", item.hop_latency);
+            }
+            if(telemetric.inst_mask & INT_INST_QUEUE) {
+                appendf(data, ",queue_id=%u,queue_occupancy=%u", item.queue_id, item.queue_occupancy);
+            }
+            if(telemetric.inst_mask & INT_INST_TX_UTIL) {
+                appendf(data, ",tx_utilization=%u", item.tx_utilization);
+            }
+        }
+        appendf(data, " %lu\n", item.hop_timestamp);
         it++;
     }
 
     return it;
 }
 
-/**
- * Read records from ring buffer and send them to the database by HTTP protocol.
- * \param ring Selected ring buffer
- * \param opt Program options
- * \param id Sender ID
- */
-static void http_sender(ringbuffer<telemetric_hdr_t, RING_BUFFER_SIZE> *ring, const options_t* opt, uint32_t id)
+int32_t schema_parse(const char *arg, options_t *opt) {
+    std::string params(arg);
+    size_t pos = params.find(',');
+    std::string layout = params.substr(0, pos);
+    if(layout == "hop") {
+        opt->schema.layout = SCHEMA_HOP;
+    } else if(layout == "wide") {
+        opt->schema.layout = SCHEMA_WIDE;
+    } else {
+        printf("Unknown schema \"%s\"!\n", layout.c_str());
+        return RET_ERR;
+    }
+
+    // Parameters key=value separated by commas
+    while(pos != std::string::npos) {
+        size_t next = params.find(',', pos + 1);
+        std::string param = params.substr(pos + 1, next == std::string::npos ? std::string::npos : next - pos - 1);
+        pos = next;
+        size_t eq = param.find('=');
+        std::string key = param.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : param.substr(eq + 1);
+        if(key == "ports" && (value == "tag" || value == "field")) {
+            opt->schema.ports = value == "field";
+            continue;
+        }
+        char *end;
+        uint64_t number = strtoull(value.c_str(), &end, 10);
+        if(value.empty() || *end != '\0') {
+            printf("Unknown schema parameter \"%s\"!\n", param.c_str());
+            return RET_ERR;
+        }
+        if(key == "path" && number <= 1) {
+            opt->schema.path = number;
+        } else if(key == "src" && number <= 32) {
+            opt->schema.src_len = number;
+        } else if(key == "dst" && number <= 32) {
+            opt->schema.dst_len = number;
+        } else if(key == "series") {
+            // Zero would fold every record, the guard is disabled without the parameter
+            if(number == 0 || number > SERIES_LIMIT_MAX) {
+                printf("Series limit has to be 1 to %llu!\n", SERIES_LIMIT_MAX);
+                return RET_ERR;
+            }
+            opt->schema.series = number;
+        } else {
+            printf("Unknown schema parameter \"%s\"!\n", param.c_str());
+            return RET_ERR;
+        }
+    }
+    return RET_OK;
+}
+
+transport_t IntExporter::createTransport(uint32_t dest) const
+{
+    if(std::string(m_opt->protocol) == "udp") {
+        // Prepare udp socket, the database of the collector is given by its port
+        std::shared_ptr<INT_UDP> udp_sock = std::make_shared<INT_UDP>(std::string(m_opt->host), m_opt->port);
+        return [udp_sock](std::string &data) { udp_sock->send(data); };
+    }
+    if(std::string(m_opt->protocol) == "tcp") {
+        // Prepare persistent tcp connection, the database of the collector is given by its port
+        std::shared_ptr<INT_TCP> tcp_sock = std::make_shared<INT_TCP>(std::string(m_opt->host), m_opt->port);
+        return [tcp_sock](std::string &data) { tcp_sock->send(data); };
+    }
+
+    // Prepare http connection
+    const route_dest_t &route = m_routes.destination(dest);
+    std::string url = std::string(m_opt->protocol) + "://" + std::string(m_opt->host) + ":" + std::to_string(m_opt->port) + "?db=" + route.db;
+    if(!route.rp.empty()) {
+        url += "&rp=" + route.rp;
+    }
+    std::shared_ptr<HTTP> http_sock = std::make_shared<HTTP>(url);
+    http_sock->enableBasicAuth(std::string(m_opt->username) + ":" + std::string(m_opt->password));
+    return [http_sock](std::string &data) { http_sock->send(data); };
+}
+
+void IntExporter::reclaimBatches(uint32_t id, std::vector<batch_t *> &pool)
 {
-    // Prepare udp socket
-    std::string url = std::string(opt->protocol) + "://" + std::string(opt->host) + ":" + std::to_string(opt->port) + "?db=int_telemetry_db";
-    HTTP http_sock(url);
-    http_sock.enableBasicAuth(std::string(opt->username) + ":" + std::string(opt->password));
+    batch_t *sent[BATCH_POOL];
+    size_t cnt;
+    while((cnt = m_free_queue->pop(id, sent, BATCH_POOL)) == 0) {
+        m_free_queue->wait(id, 0);
+    }
+    pool.insert(pool.end(), sent, sent + cnt);
+}
 
-    std::string data;
-    data.reserve(RECORD_SIZE * opt->batch);
-    
-    uint32_t it = 0;     
+batch_t *IntExporter::takeBatch(uint32_t id, std::vector<batch_t *> &pool)
+{
+    // All batches are in flight, wait for the senders
+    if(pool.empty()) {
+        reclaimBatches(id, pool);
+    }
+    batch_t *batch = pool.back();
+    pool.pop_back();
+    return batch;
+}
 
-    while(true) {
-        telemetric_hdr_t telemetric; 
-        
-        // If the buffer is empty, all processed records are flushed to the database.
-        uint32_t flush = 0;
-        while(!ring->pop(telemetric)) {
-            delay_usecs(100);
-            flush++; 
-        
-            if(flush == POP_THRESHOLD and !data.empty() and opt->hostValid) {
-                try {
-                    http_sock.send(data);
-                } catch (std::runtime_error& e) {
-                    std::stringstream msg;
-                    std::cerr << msg.str();
-                }
-                it = 0;
-                data.clear();
-            }
-        }
-        
-        // Prepare http datagram and send it
-        if(opt->hostValid) {
-            it += add_report(telemetric, data);
- 
-            // Check Batch threshold
-            if(it >= opt->batch) {
-                try {
-                    http_sock.send(data);
-                } catch (std::runtime_error& e) {
-                    std::stringstream msg;
-                    std::cerr << msg.str();
-                }
-                it = 0;
-                data.clear();
-            }       
+void IntExporter::transmit(uint32_t id, batch_t *batch, std::vector<transport_t> &transports, stage_thread_t &stats,
+    tm_thread_t *tm)
+{
+    uint64_t start = stage_now_ns();
+    try {
+        // Failed creation is retried by the next batch of the destination
+        transport_t &transport = transports[batch->dest];
+        if(!transport) {
+            transport = createTransport(batch->dest);
+        }
+        transport(batch->data);
+        tm_add(tm, TM_BYTES_SENT, batch->data.size());
+
+        // Records are fresh until the collector acknowledges them
+        uint64_t ack = stage_now_ns();
+        for(uint64_t rx : batch->rx_ns) {
+            tm_record(tm, TM_H_FRESH_NS, ack - rx);
         }
+    } catch (std::runtime_error& e) {
+        std::stringstream msg;
+        msg << "ID:" << id << ", error: "  << e.what() << std::endl;
+        std::cerr << msg.str();
+        stats.dropped += batch->lines;
+        stats.errors++;
+        tm_add(tm, TM_SEND_ERRORS, 1);
     }
+    tm_record(tm, TM_H_SEND_NS, stage_now_ns() - start);
 }
 
-/**
- * Read records from ring buffer and send them to the database by UDP piotocol.
- * \param ring Selected ring buffer
- * \param opt Program options
- * \param id Sender ID
- */
-static void udp_sender(ringbuffer<telemetric_hdr_t, RING_BUFFER_SIZE> *ring, const options_t* opt, uint32_t id)
+void IntExporter::flush(uint32_t id, batch_t *&batch, std::vector<batch_t *> &pool, std::vector<transport_t> &transports,
+    BatchScheduler &sched, uint32_t reason)
 {
-    // Prepare udp socket
-    INT_UDP udp_sock(std::string(opt->host), opt->port);
+    tm_thread_t *tm = m_serialize_tm[id];
+    sched.cut();
+    tm_add(tm, reason, 1);
+    tm_add(tm, TM_BATCHES, 1);
+    tm_add(tm, TM_BATCH_LINES, batch->lines);
+    tm_record(tm, TM_H_BATCH_LINES, batch->lines);
+    uint64_t now = stage_now_ns();
+    for(uint64_t added : batch->added_ns) {
+        tm_record(tm, TM_H_BATCH_NS, now - added);
+    }
 
-    std::string data;
-    data.reserve(65527);
-    uint32_t it = 0;     
+    if(m_send_queue != nullptr) {
+        // Serializer is mapped to one sender, batches stay in order.
+        // Queue holds more items than the pool, it can not be full.
+        uint32_t dest = batch->dest;
+        batch->owner = id;
+        m_send_queue->push_to(id, id % m_senders, batch);
+        batch = takeBatch(id, pool);
+        batch->dest = dest;
+        return;
+    }
+
+    transmit(id, batch, transports, m_serialize_stats[id], m_serialize_tm[id]);
+    batch->lines = 0;
+    batch->data.clear();
+    batch->rx_ns.clear();
+    batch->added_ns.clear();
+}
 
+void IntExporter::serializer(uint32_t id, std::promise<void> *ready)
+{
+    stage_block_signals();
+    stage_pin(m_opt->stages[STAGE_SERIALIZE], id);
+    m_serialize_tm[id] = telemetry_attach("serialize", id);
+    try {
+        m_queue.attach(id);
+        if(m_free_queue != nullptr) {
+            m_free_queue->attach(id);
+        }
+    } catch (std::runtime_error& e) {
+        ready->set_exception(std::current_exception());
+        return;
+    }
+    ready->set_value();
+
+    // Transports are used directly when there are no send threads
+    uint32_t dests = m_routes.destinations();
+    std::vector<transport_t> transports(dests);
+
+    // Batch holds the smaller of the line count and the byte budget, plus the record over the budget.
+    // Every destination has an open batch, the rest of the pool is in flight.
+    std::vector<BatchScheduler> scheds(dests, BatchScheduler(m_opt, std::string(m_opt->protocol) == "udp"));
+    size_t capacity = std::min<size_t>(scheds[0].bytes(), RECORD_SIZE * m_opt->batch) + RECORD_SIZE * (MAX_NODES + 1);
+    uint32_t pool_size = m_send_queue != nullptr ? dests + BATCH_POOL - 1 : dests;
+    std::vector<batch_t *> pool;
+    for(uint32_t i = 0; i < pool_size; i++) {
+        batch_t *batch = new batch_t();
+        batch->data.reserve(capacity);
+        batch->rx_ns.reserve(m_opt->batch);
+        batch->added_ns.reserve(m_opt->batch);
+        batch->lines = 0;
+        batch->owner = id;
+        pool.push_back(batch);
+    }
+    std::vector<batch_t *> batches(dests);
+    for(uint32_t dest = 0; dest < dests; dest++) {
+        batches[dest] = takeBatch(id, pool);
+        batches[dest]->dest = dest;
+    }
+
+    stage_thread_t &stats = m_serialize_stats[id];
+    std::vector<uint64_t> &dest_records = m_dest_records[id];
+    std::vector<telemetric_hdr_t> records(NDP_PACKET_BUFF);
     while(true) {
-        // read data
-        telemetric_hdr_t telemetric; 
-        while(!ring->pop(telemetric)) {
-            delay_usecs(100); 
-        }
-        
-        // prepare udp datagram and send it
-        if(opt->hostValid) {
-            it += add_report(telemetric, data);
-               
-            if(it == opt->batch) { 
-                try {
-                    udp_sock.send(data); 
-                } catch (std::runtime_error& e) {
-                    std::stringstream msg;
-                    msg << "ID:" << id << ", error: "  << e.what() << std::endl;
-                    std::cerr << msg.str();
+        bool closed = m_queue.closed();
+        size_t cnt = m_queue.pop(id, records.data(), records.size());
+        if(cnt == 0) {
+            if(closed) {
+                break;
+            }
+            // Sleep until new records or the deadline of the oldest record of all batches
+            uint64_t now = stage_now_ns();
+            uint32_t timeout = 0;
+            for(const BatchScheduler &sched : scheds) {
+                uint32_t left = sched.timeout(now);
+                if(left != 0 && (timeout == 0 || left < timeout)) {
+                    timeout = left;
+                }
+            }
+            bool ready = m_queue.wait(id, timeout);
+            for(uint32_t dest = 0; !ready && dest < dests; dest++) {
+                if(batches[dest]->lines != 0 && scheds[dest].expired(stage_now_ns())) {
+                    flush(id, batches[dest], pool, transports, scheds[dest], TM_CUT_AGE);
+                }
+            }
+            continue;
+        }
+
+        uint64_t start = stage_now_ns();
+        stats.items += cnt;
+        // Prepare the datagram and send it
+        if(m_opt->hostValid) {
+            tm_thread_t *tm = m_serialize_tm[id];
+            for(size_t i = 0; i < cnt; i++) {
+                tm_record(tm, TM_H_QUEUE_NS, start - records[i].rxNs);
+                uint32_t dest = m_routes.lookup(records[i]);
+                batch_t *&batch = batches[dest];
+                BatchScheduler &sched = scheds[dest];
+                size_t size = batch->data.size();
+                bool other = m_series && !m_series->admit(series_key(records[i], dest, m_opt->schema));
+                if(other) {
+                    tm_add(tm, TM_SERIES_FOLDED, 1);
+                    m_folded[id]++;
                 }
-                it = 0;
-                data.clear();
-            }       
+                uint32_t lines = add_report(records[i], batch->data, m_routes.destination(dest).measurement.c_str(),
+                    m_opt->schema, other);
+
+                // Lines of one report stay together, the report moves to the next batch
+                if(size != 0 && sched.overBudget(batch->data.size())) {
+                    std::string report = batch->data.substr(size);
+                    batch->data.resize(size);
+                    flush(id, batch, pool, transports, sched, TM_CUT_BYTES);
+                    batch->data.append(report);
+                }
+                batch->lines += lines;
+                batch->rx_ns.push_back(records[i].rxNs);
+                batch->added_ns.push_back(start);
+                sched.added(start);
+                dest_records[dest]++;
+
+                if(sched.full(batch->lines)) {
+                    flush(id, batch, pool, transports, sched, TM_CUT_LINES);
+                }
+            }
+
+            // Busy serializer never times out in the wait, check the deadlines here
+            uint64_t now = stage_now_ns();
+            for(uint32_t dest = 0; dest < dests; dest++) {
+                if(batches[dest]->lines != 0 && scheds[dest].expired(now)) {
+                    flush(id, batches[dest], pool, transports, scheds[dest], TM_CUT_AGE);
+                }
+            }
         }
+        stats.busy_ns += stage_now_ns() - start;
     }
+
+    // Flush the rest of records, return the batches to the pool
+    for(uint32_t dest = 0; dest < dests; dest++) {
+        if(batches[dest]->lines != 0) {
+            flush(id, batches[dest], pool, transports, scheds[dest], TM_CUT_CLOSE);
+        }
+        pool.push_back(batches[dest]);
+    }
+    while(m_send_queue != nullptr && pool.size() != pool_size) {
+        reclaimBatches(id, pool);
+    }
+    for(batch_t *item : pool) {
+        delete item;
+    }
+    stage_finish(stats);
 }
 
-IntExporter::IntExporter(const options_t *opt)
+void IntExporter::sender(uint32_t id, std::promise<void> *ready)
 {
-    m_th_num = opt->raw_buffer;
-    m_rr_index = 0;
+    stage_block_signals();
+    stage_pin(m_opt->stages[STAGE_SEND], id);
+    m_send_tm[id] = telemetry_attach("send", id);
+    try {
+        m_send_queue->attach(id);
+    } catch (std::runtime_error& e) {
+        ready->set_exception(std::current_exception());
+        return;
+    }
+    ready->set_value();
 
-    for(uint32_t i = 0; i < m_th_num; i++) {
-        // Prepare ring buffer and start sender
-        m_ring_buffs.push_back(new ringbuffer<telemetric_hdr_t, RING_BUFFER_SIZE>());
-        
-        if(std::string(opt->protocol) == "udp") {
-            std::thread(udp_sender, m_ring_buffs.back(), opt, i).detach();
-        } else if(std::string(opt->protocol) == "http" || std::string(opt->protocol) == "https") {
-            std::thread(http_sender, m_ring_buffs.back(), opt, i).detach();
-        } else {
-            throw std::runtime_error("Unknown protocol");
+    std::vector<transport_t> transports(m_routes.destinations());
+    stage_thread_t &stats = m_send_stats[id];
+    tm_thread_t *tm = m_send_tm[id];
+    batch_t *batches[BATCH_POOL];
+    while(true) {
+        bool closed = m_send_queue->closed();
+        size_t cnt = m_send_queue->pop(id, batches, BATCH_POOL);
+        if(cnt == 0) {
+            if(closed) {
+                break;
+            }
+            m_send_queue->wait(id, 0);
+            continue;
+        }
+
+        for(size_t i = 0; i < cnt; i++) {
+            batch_t *batch = batches[i];
+            uint64_t start = stage_now_ns();
+            transmit(id, batch, transports, stats, tm);
+            stats.busy_ns += stage_now_ns() - start;
+            stats.items += batch->lines;
+
+            // Return the batch to its serializer
+            batch->lines = 0;
+            batch->data.clear();
+            batch->rx_ns.clear();
+            batch->added_ns.clear();
+            m_free_queue->push_to(id, batch->owner, batch);
         }
-        delay_usecs(1000); 
     }
+    stage_finish(stats);
 }
 
-bool IntExporter::sendData(const telemetric_hdr_t& telemetric) 
+IntExporter::IntExporter(const options_t *opt, uint32_t producers)
+    : m_opt(opt),
+      m_routes(opt->routes),
+      m_serializers(opt->stages[STAGE_SERIALIZE].threads),
+      m_senders(opt->stages[STAGE_SEND].threads),
+      m_queue(producers, m_serializers, opt->ring_size, opt->wait_mode, true, opt->overload),
+      m_send_queue(nullptr),
+      m_free_queue(nullptr),
+      m_queue_tm(telemetry_attach("serialize_queue", 0)),
+      m_send_queue_tm(nullptr),
+      m_closed(false)
 {
-    // round robin selection
-    for(uint32_t i = 0; i < m_th_num; i++) {
-        m_rr_index = (m_rr_index + 1) % m_th_num;   
-        if(m_ring_buffs[m_rr_index]->push(telemetric)) {
-            return EXIT_SUCCESS;
-        } else {
-            continue;
+    std::string protocol(opt->protocol);
+    if(protocol != "udp" && protocol != "tcp" && protocol != "http" && protocol != "https") {
+        throw std::runtime_error("Unknown protocol");
+    }
+
+    if(m_senders != 0) {
+        // Batch queues hold more items than the pools, they never overflow
+        m_send_queue = new batch_queue_t(m_serializers, m_senders, 0, opt->wait_mode, false, OVERLOAD_NEWEST);
+        m_free_queue = new batch_queue_t(m_senders, m_serializers, 0, opt->wait_mode, false, OVERLOAD_NEWEST);
+        m_send_queue_tm = telemetry_attach("send_queue", 0);
+        m_send_queue->attachTelemetry("send_queue");
+    }
+    m_queue.attachTelemetry("serialize_queue");
+    if(!opt->routes.empty()) {
+        printf("routes - %zu routes to %u destinations\n", opt->routes.size(), m_routes.destinations());
+        for(const route_t &route : opt->routes) {
+            if((protocol == "udp" || protocol == "tcp") && (!route.rp.empty() || route.db != ROUTE_DB_DEFAULT)) {
+                printf("routes - UDP and TCP collectors store records to the database of their port, only measurements of routes apply\n");
+                break;
+            }
         }
     }
-    return EXIT_FAILURE;
+    m_dest_records.resize(m_serializers, std::vector<uint64_t>(m_routes.destinations(), 0));
+    m_folded.resize(m_serializers, 0);
+    if(opt->schema.series != 0) {
+        m_series.reset(new SeriesGuard(opt->schema.series));
+    }
+    m_serialize_stats.resize(m_serializers, stage_thread_t());
+    m_send_stats.resize(m_senders, stage_thread_t());
+    m_serialize_tm.resize(m_serializers, nullptr);
+    m_send_tm.resize(m_senders, nullptr);
+
+    // Start consumers first, so all queues are attached before the producers start
+    try {
+        for(uint32_t i = 0; i < m_senders; i++) {
+            std::promise<void> ready;
+            std::future<void> initialized = ready.get_future();
+            m_send_threads.emplace_back(&IntExporter::sender, this, i, &ready);
+            initialized.get();
+        }
+        for(uint32_t i = 0; i < m_serializers; i++) {
+            std::promise<void> ready;
+            std::future<void> initialized = ready.get_future();
+            m_serialize_threads.emplace_back(&IntExporter::serializer, this, i, &ready);
+            initialized.get();
+        }
+    } catch (std::runtime_error& e) {
+        // Stop already started threads
+        close();
+        delete m_send_queue;
+        delete m_free_queue;
+        throw;
+    }
+}
+
+IntExporter::~IntExporter()
+{
+    close();
+    delete m_send_queue;
+    delete m_free_queue;
+}
+
+void IntExporter::close()
+{
+    if(m_closed) {
+        return;
+    }
+    m_closed = true;
+
+    // Serializers drain their queues and flush the batches, then senders finish
+    m_queue.close();
+    for(std::thread &thread : m_serialize_threads) {
+        thread.join();
+    }
+    if(m_send_queue != nullptr) {
+        m_send_queue->close();
+    }
+    for(std::thread &thread : m_send_threads) {
+        thread.join();
+    }
 }
 
+bool IntExporter::sendData(uint32_t producer, const telemetric_hdr_t& telemetric)
+{
+    return m_queue.push(producer, telemetric) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
+uint32_t IntExporter::sendBurst(uint32_t producer, const telemetric_hdr_t *telemetric, uint32_t count, uint32_t *dropped_index)
+{
+    return m_queue.push_burst(producer, telemetric, count, dropped_index);
+}
+
+ring_stats_t IntExporter::queueStats() const
+{
+    return m_queue.total();
+}
+
+stage_thread_t IntExporter::transportStats() const
+{
+    // Transport runs in the senders, or in the serializers without send threads
+    const std::vector<stage_thread_t> &threads = m_senders != 0 ? m_send_stats : m_serialize_stats;
+    stage_thread_t sum = stage_thread_t();
+    for(const stage_thread_t &stats : threads) {
+        sum.items += stats.items;
+        sum.dropped += stats.dropped;
+        sum.errors += stats.errors;
+    }
+    return sum;
+}
+
+void IntExporter::sample()
+{
+    m_queue.sample(m_queue_tm);
+    if(m_send_queue != nullptr) {
+        m_send_queue->sample(m_send_queue_tm);
+    }
+}
+
+size_t IntExporter::printMemory() const
+{
+    size_t size = m_queue.printMemory("serialize");
+    if(m_series) {
+        printf("series guard - %zu KiB\n", m_series->memory() / 1024);
+        size += m_series->memory();
+    }
+    return size;
+}
+
+void IntExporter::printStats(double wall) const
+{
+    m_queue.printStats("serialize");
+    stage_print("serialize", m_serialize_stats, wall);
+    if(m_send_queue != nullptr) {
+        m_send_queue->printStats("send");
+        stage_print("send", m_send_stats, wall);
+    }
+    if(m_routes.destinations() > 1) {
+        for(uint32_t dest = 0; dest < m_routes.destinations(); dest++) {
+            uint64_t records = 0;
+            for(const std::vector<uint64_t> &counts : m_dest_records) {
+                records += counts[dest];
+            }
+            printf("route %s - %lu records\n", route_dest_str(m_routes.destination(dest)).c_str(), records);
+        }
+    }
+    if(m_series) {
+        uint64_t folded = 0;
+        for(uint64_t count : m_folded) {
+            folded += count;
+        }
+        printf("series - admitted %lu of %lu, %lu distinct estimated, %lu records folded to other\n",
+            m_series->admitted(), m_series->limit(), m_series->estimate(), folded);
+        if(m_series->exact() < m_series->limit()) {
+            printf("series - exact set of %lu, later series admitted by the estimate\n", m_series->exact());
+        }
+    }
+
+    // Transport latency and freshness are recorded by the threads running the transport
+    const char *transport = m_send_queue != nullptr ? "send" : "serialize";
+    printf("freshness - queueing p50 %.3f p99 %.3f, batching p50 %.3f p99 %.3f, "
+        "transport p50 %.3f p99 %.3f, rx to ack p50 %.3f p99 %.3f ms\n",
+        telemetry_percentile("serialize", TM_H_QUEUE_NS, 50) / 1e6,
+        telemetry_percentile("serialize", TM_H_QUEUE_NS, 99) / 1e6,
+        telemetry_percentile("serialize", TM_H_BATCH_NS, 50) / 1e6,
+        telemetry_percentile("serialize", TM_H_BATCH_NS, 99) / 1e6,
+        telemetry_percentile(transport, TM_H_SEND_NS, 50) / 1e6,
+        telemetry_percentile(transport, TM_H_SEND_NS, 99) / 1e6,
+        telemetry_percentile(transport, TM_H_FRESH_NS, 50) / 1e6,
+        telemetry_percentile(transport, TM_H_FRESH_NS, 99) / 1e6);
+}
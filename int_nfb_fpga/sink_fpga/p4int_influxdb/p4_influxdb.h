@@ -5,38 +5,256 @@
 #ifndef _P4_INT_EXPORTER_H_
 #define _P4_INT_EXPORTER_H_
 
+#include <string>
+#include <vector>
+#include <thread>
+#include <future>
+#include <functional>
+#include <memory>
+
 #include "p4int.h"
-#include "ringbuffer.h"
+#include "stage.h"
+#include "stage_queue.h"
+#include "telemetry.h"
+#include "batch_sched.h"
+#include "route.h"
+#include "series.h"
+
+// Number of batches owned by one serializer
+#define BATCH_POOL 4
+
+// Batch of line protocol records passed from a serializer to a sender
+typedef struct {
+    std::string data;  // Assembled records
+    uint32_t    lines; // Number of records in the batch
+    uint32_t    owner; // Serializer the batch returns to
+    uint32_t    dest;  // Destination of the records in the route table
+    std::vector<uint64_t> rx_ns;    // RX time of every serialized record
+    std::vector<uint64_t> added_ns; // Serialization time of every record
+} batch_t;
+
+// Queue of records waiting for the serialization
+typedef StageQueue<telemetric_hdr_t> export_queue_t;
+// Queue of batches between serializers and senders
+typedef StageQueue<batch_t *> batch_queue_t;
+// Sending of one batch to the collector
+typedef std::function<void(std::string &)> transport_t;
+
+/**
+ * Default schema of records, a line per hop with address and port tags
+ */
+static inline schema_t schema_default()
+{
+    schema_t schema = schema_t();
+    schema.layout = SCHEMA_HOP;
+    schema.src_len = 32;
+    schema.dst_len = 32;
+    return schema;
+}
 
-#define RING_BUFFER_SIZE 1000000
+/**
+ * Assemble reports and add them to data buffer
+ * \param telemetric Data for record assembling
+ * \param data Place for assembled records
+ * \param measurement Measurement of the records
+ * \param schema Schema of the records, the line per hop with address and port tags by default
+ * \param other Record is folded to the series "other"
+ * \return Number of records added
+ */
+int add_report(telemetric_hdr_t &telemetric, std::string &data, const char *measurement = ROUTE_MEASUREMENT_DEFAULT,
+    const schema_t &schema = schema_default(), bool other = false);
+
+/**
+ * Key of the series of the record for the cardinality guard
+ * \param telemetric Record of a report
+ * \param dest Destination of the record in the route table
+ * \param schema Schema of the records
+ * \return Hash of the measurement and the tags of the record
+ */
+uint64_t series_key(const telemetric_hdr_t &telemetric, uint32_t dest, const schema_t &schema);
+
+/**
+ * Parse the schema of exported records, "hop|wide[,path=0|1]"
+ * \param arg Argument of -e
+ * \param opt Program options
+ * \return RET_OK on success
+ */
+int32_t schema_parse(const char *arg, options_t *opt);
 
 /**
  * Sending int reports to the influxdb by udp or http protocol.
- * Multithreading is supported, each buffer is processed by a separate thread.
+ *
+ * The exporter implements the serialize and send stages of the pipeline.
+ * Every flow has a home serializer selected by its hash, so records of one
+ * flow are exported in order by a single thread. When the home queue is full,
+ * the record spills to the least loaded serializer. Serializers assemble
+ * batches of line protocol records and pass them to the senders, every
+ * serializer is mapped to one sender to keep the order. Without send threads
+ * the serializers send the batches themselves. Records are batched per
+ * destination of the route table (-D), every destination has its own batch
+ * and transport. The schema (-e) maps the report to tags and fields, the
+ * cardinality guard folds records of series over the limit to "other".
  */
-class IntExporter 
+class IntExporter
 {
     public:
         /**
-         * Constructor
+         * Constructor, starts all threads of the stages
          * \param opt Program options
+         * \param producers Number of threads passing records to the exporter
          */
-        IntExporter(const options_t *opt);
-        
+        IntExporter(const options_t *opt, uint32_t producers);
+
+        /**
+         * Destructor, flushes all batches and stops the threads
+         */
+        ~IntExporter();
+
         /**
-         * Send int report, 
+         * Send int report,
+         * \param producer Index of the calling thread
          * \param telemetric
          * \return EXIT_SUCCESS on success and EXIT_FAILURE on error
          */
-        bool sendData(const telemetric_hdr_t& telemetric);
-    
+        bool sendData(uint32_t producer, const telemetric_hdr_t& telemetric);
+
+        /**
+         * Send a burst of int reports, records of every serializer
+         * are stored by one bulk operation.
+         * \param producer Index of the calling thread
+         * \param telemetric Array of reports
+         * \param count Number of reports, at most NDP_PACKET_BUFF
+         * \param dropped_index Where to store indices of dropped reports, can be null
+         * \return Number of dropped reports
+         */
+        uint32_t sendBurst(uint32_t producer, const telemetric_hdr_t *telemetric, uint32_t count, uint32_t *dropped_index = nullptr);
+
+        /**
+         * Mark the end of records, flush all batches and wait for the threads.
+         * Producers must not send anything afterwards.
+         */
+        void close();
+
+        /**
+         * Sample depths of all queues, called by the monitor thread only
+         */
+        void sample();
+
+        /**
+         * Dispatch statistics of the export queue
+         */
+        ring_stats_t queueStats() const;
+
+        /**
+         * Statistics of the transport summed over all threads sending batches,
+         * dropped are lines of failed batches and errors are the failed batches
+         */
+        stage_thread_t transportStats() const;
+
+        /**
+         * Print memory footprint of all queues
+         * \return Size of the memory in bytes
+         */
+        size_t printMemory() const;
+
+        /**
+         * Print dispatch statistics, queue depths and load of all threads
+         * \param wall Run time of the pipeline in seconds
+         */
+        void printStats(double wall) const;
+
+        /**
+         * Create transport of the calling thread
+         * \param dest Destination of the batches in the route table
+         * \return Transport sending one batch
+         */
+        transport_t createTransport(uint32_t dest) const;
+
     protected:
-        // Number of threads 
-        uint32_t m_th_num; 
-        // Ring bufferes 
-        std::vector<ringbuffer<telemetric_hdr_t, RING_BUFFER_SIZE>*> m_ring_buffs;
-        // Rouind robin index
-        uint32_t m_rr_index;
+        /**
+         * Serialize stage, assemble batches of records
+         * \param id Index of the serializer
+         * \param ready Signals the attached queues
+         */
+        void serializer(uint32_t id, std::promise<void> *ready);
+
+        /**
+         * Send stage, send batches of the serializers
+         * \param id Index of the sender
+         * \param ready Signals the attached queue
+         */
+        void sender(uint32_t id, std::promise<void> *ready);
+
+        /**
+         * Pass the full batch to the sender or send it directly
+         * \param id Index of the serializer
+         * \param batch Batch to flush, replaced by an empty one of the same destination
+         * \param pool Free batches of the serializer
+         * \param transports Transports of the serializer without send threads
+         * \param sched Scheduler of the batch
+         * \param reason TM_CUT_* counter of the cut
+         */
+        void flush(uint32_t id, batch_t *&batch, std::vector<batch_t *> &pool, std::vector<transport_t> &transports,
+            BatchScheduler &sched, uint32_t reason);
+
+        /**
+         * Wait until the senders return at least one batch
+         * \param id Index of the serializer
+         * \param pool Free batches of the serializer
+         */
+        void reclaimBatches(uint32_t id, std::vector<batch_t *> &pool);
+
+        /**
+         * Get an empty batch, waits for the senders when all are in flight
+         * \param id Index of the serializer
+         * \param pool Free batches of the serializer
+         * \return Empty batch
+         */
+        batch_t *takeBatch(uint32_t id, std::vector<batch_t *> &pool);
+
+        /**
+         * Send the batch by the transport of its destination and account the result,
+         * the transport is created on the first batch of the destination
+         * \param id Index of the calling thread
+         * \param batch Batch to send
+         * \param transports Transports of the calling thread, one per destination
+         * \param stats Statistics of the calling thread
+         * \param tm Telemetry of the calling thread
+         */
+        void transmit(uint32_t id, batch_t *batch, std::vector<transport_t> &transports, stage_thread_t &stats,
+            tm_thread_t *tm);
+
+        // Program options
+        const options_t *m_opt;
+        // Destinations of the records
+        RouteTable m_routes;
+        // Records of every destination per serializer
+        std::vector<std::vector<uint64_t>> m_dest_records;
+        // Cardinality guard of the series, null without the limit
+        std::unique_ptr<SeriesGuard> m_series;
+        // Records folded to the series "other" per serializer
+        std::vector<uint64_t> m_folded;
+        // Thread counts of the stages
+        uint32_t m_serializers;
+        uint32_t m_senders;
+        // Records waiting for the serialization
+        export_queue_t m_queue;
+        // Full batches for the senders and sent batches back for the serializers,
+        // not used without send threads
+        batch_queue_t *m_send_queue;
+        batch_queue_t *m_free_queue;
+        // Threads of the stages and their statistics
+        std::vector<std::thread> m_serialize_threads;
+        std::vector<std::thread> m_send_threads;
+        std::vector<stage_thread_t> m_serialize_stats;
+        std::vector<stage_thread_t> m_send_stats;
+        // Telemetry of the threads and the queues
+        std::vector<tm_thread_t *> m_serialize_tm;
+        std::vector<tm_thread_t *> m_send_tm;
+        tm_thread_t *m_queue_tm;
+        tm_thread_t *m_send_queue_tm;
+        // Set after the threads were stopped
+        bool m_closed;
 };
 
 #endif // _P4_INFLUXDB_H_
@@ -21,67 +21,42 @@
 #include "device.h"
 #include "p4int.h"
 #include "p4_influxdb.h"
+#include "pipeline.h"
+#include "stage.h"
+#include "wait_strategy.h"
+#include "telemetry.h"
+#include "source.h"
+#include "batch_sched.h"
+#include "archive.h"
+#include "recorder.h"
+#include "filter.h"
+#include "route.h"
+#include "TCP.h"
 
 /**
- * Structures for handling packet data nicier
- */
-struct int_influx_t{
-      uint32_t  srcAddr;
-      uint32_t  dstAddr;
-      uint16_t  ingress_port_id;
-      uint16_t  egress_port_id;
-      uint8_t   meta_len;
-      uint8_t   hop_meta_len;
-      uint8_t   rsvd1[2];
-      uint32_t  ndk_tstamp1;
-      uint32_t  ndk_tstamp2;
-      uint64_t  delay;
-      uint32_t  seq;
-}__attribute__((packed));
- 
-  struct int_meta_t{
-      uint32_t switch_id;
-      uint16_t ingress_port_id;
-      uint16_t egress_port_id;
-      uint64_t ingress_tstamp;
-      uint64_t egress_tstamp;
-}__attribute__((packed));
-
-#define TCP  6
-#define UDP 17
-
-/**
- * Auxiliary variables for node jitter
- */
-#define MAX_NODES 10
-uint64_t prev_timestamps[MAX_NODES];
-
-/**
- * Packet counter
- */
-uint64_t pkt_cnt = 0;
-
-/**
- * Packet drop counter
+ * Helping control variable
  */
-uint64_t pkt_drop = 0;
+volatile sig_atomic_t stop = 0;
 
 /**
- * Helping control variable
+ * Setup the stop flag 
  */
-volatile sig_atomic_t stop = 0;
+void setup_stop(int sig) {
+    stop = 1;
+}
 
 /**
- * Flow metadata
+ * Request the dump of the self-telemetry
  */
-static std::map<uint64_t, meta_data> flow_map;
+void setup_dump(int sig) {
+    telemetry_request_dump();
+}
 
 /**
- * Setup the stop flag 
+ * Request the dump of the flight recorder
  */
-void setup_stop(int sig) {
-    printf("\ntotal - %lu\ndrop - %lu\n", pkt_cnt, pkt_drop);
-    stop = 1;
+void setup_record(int sig) {
+    recorder_request();
 }
 
 /**
@@ -111,218 +86,84 @@ retry:
     return;
 }
 
-/**
- * Convert the passed timestamp in TS NS to Unix NS
- * \param tsNs input timestamp in the TS NS format
- * \return Converted timestamp in the UNIX NS format
- */
-static inline uint64_t convertToUnixNs(uint64_t tsNs) {
-    uint32_t sec = tsNs >> 32;
-    uint32_t nanosec = tsNs & 0xffffffff;
-    // Convert seconds to nanoseconds and add the nanosecond part
-    return (sec * 100000000000) + nanosec;
-}
-
-/**
- * Convert the network order to 64-bit host order
- * \param input Input network order  
- * \return Converted number
- */
-uint64_t ntoh64(uint64_t value) {
-    uint64_t rval;
-    const uint64_t* input = &value;
-    uint8_t *data = (uint8_t *)&rval;
-
-    data[0] = *input >> 56;
-    data[1] = *input >> 48;
-    data[2] = *input >> 40;
-    data[3] = *input >> 32;
-    data[4] = *input >> 24;
-    data[5] = *input >> 16;
-    data[6] = *input >> 8;
-    data[7] = *input >> 0;
-
-    return rval;
-}
-
-/**
- * Print telemetric data
- * \param hdr Structureof telemetric data
- */
-void print_telemetric(const telemetric_hdr_t *hdr) {
-    printf("Orig TS       => %lu\n", hdr->origTs);
-    printf("Dest TS       => %lu\n", hdr->dstTs);
-    printf("Seq           => %lu\n", hdr->seqNum);
-    printf("Delay         => %lu\n", hdr->delay);
-    printf("Sink Jitter   => %lu\n", hdr->sink_jitter);
-    printf("IP Src        => %s\n",  hdr->srcIp);
-    printf("IP Dst        => %s\n",  hdr->dstIp);
-    printf("Src Port      => %hu\n", hdr->srcPort);
-    printf("Dst Port      => %hu\n", hdr->dstPort);
-}
-
-/**
- * Write headre information to format sutable for sending
- * \param tmpHdr Where to store parsed information
- * \param int_hdr Raw data from packet
- * \param opt Program parameters
- * \param map_key Map key
- */
-void get_int_header_data(telemetric_hdr_t &tmpHdr, struct int_influx_t *int_hdr, uint64_t map_key) {
-    // Convert destination timestamp
-    tmpHdr.dstTs = ntohl(((int_hdr->ndk_tstamp2)));
-    tmpHdr.dstTs += ntohl(((int_hdr->ndk_tstamp1)))*  1'000'000'000ll;
-
-    // Convert IP addresses 
-    inet_ntop(AF_INET, &int_hdr->srcAddr, tmpHdr.srcIp, IP_BUFF_SIZE);
-    inet_ntop(AF_INET, &int_hdr->dstAddr, tmpHdr.dstIp, IP_BUFF_SIZE);
-
-    // Convert source and destination ports
-    tmpHdr.srcPort =  ntohs(((int_hdr->ingress_port_id)));
-    tmpHdr.dstPort =  ntohs(((int_hdr->egress_port_id)));
-
-    // Get flow data
-    // TODO: Implement flow hash table   
-    meta_data &meta_tmp = flow_map[map_key];
-
-    // Calculate int header
-    tmpHdr.delay = tmpHdr.dstTs - tmpHdr.origTs;
-    tmpHdr.seqNum = ntohl(((int_hdr->seq))); 
-    tmpHdr.sink_jitter = tmpHdr.dstTs - meta_tmp.prev_dstTs;
-    
-    if(tmpHdr.seqNum == 0) {
-        tmpHdr.reordering = 0;
-        tmpHdr.seqNum = meta_tmp.seq + 1; 
-        tmpHdr.protocol = UDP;
-    } else {
-        tmpHdr.reordering = tmpHdr.seqNum - meta_tmp.seq - 1; 
-        tmpHdr.protocol = TCP;
-    } 
-    
-    // Update flow data
-    meta_tmp.prev_dstTs = tmpHdr.dstTs;
-    meta_tmp.seq = tmpHdr.seqNum;
-}
-
-/**
- * Write node information to format sutable for sending
- * \param tmpHdr Where to store parsed information
- * \param int_meta_hdr Raw data from packet
- * \param meta_cnt Number of nodes to proccess
- */
-void get_int_node_data(telemetric_hdr_t &tmpHdr, struct int_meta_t *int_meta_hdr, const uint8_t meta_cnt) {
-    // Convert source timestamp
-    tmpHdr.origTs = ntoh64(((int_meta_hdr->ingress_tstamp)));
-
-    // Storing information for delay counting
-    int64_t tmp_eg_timestamp = ntoh64(int_meta_hdr->egress_tstamp);
-    
-    struct telemetric_meta node;
-    for(uint8_t i = 0; i < meta_cnt; ++i) {
-        node.hop_index = i;
-        node.hop_delay = ntoh64(int_meta_hdr->egress_tstamp) - ntoh64(int_meta_hdr->ingress_tstamp);
-        node.link_delay = 0;
-        node.hop_timestamp = ntoh64(int_meta_hdr->egress_tstamp);
-
-        // Delay can not be counted for first node (There is no previous timestamp)
-        if(i != 0)
-        {
-            node.link_delay = tmp_eg_timestamp -  ntoh64(int_meta_hdr->ingress_tstamp);
-            tmp_eg_timestamp = ntoh64(int_meta_hdr->egress_tstamp);
-        }
-
-        node.hop_jitter = ntoh64(int_meta_hdr->ingress_tstamp) - prev_timestamps[i];
-        prev_timestamps[i] = ntoh64(int_meta_hdr->ingress_tstamp);
-
-        tmpHdr.node_meta.push_back(node); 
-        ++int_meta_hdr;
-    }
-
-    node.hop_index = meta_cnt;
-    node.hop_delay = 0;
-    node.link_delay = tmp_eg_timestamp - tmpHdr.dstTs;
-    node.hop_timestamp = tmpHdr.dstTs;
-    node.hop_jitter = tmpHdr.dstTs - prev_timestamps[meta_cnt];
-    prev_timestamps[meta_cnt] = tmpHdr.dstTs;
-    
-    tmpHdr.node_meta.push_back(node); 
-}
-
-/**
- * Report data to influx
- * \param influxdb Database descriptor
- * \param opt Program parameters
- * \param tmpHdr Data to send
- */
-void report_to_influx(IntExporter &exporter, const options_t& opt, telemetric_hdr_t &tmpHdr) {
-    if(opt.hostValid && (pkt_cnt % opt.smpl_rate == 0)) {
-        uint32_t ret = exporter.sendData(tmpHdr);
-        if(ret != EXIT_SUCCESS) {
-            //printf("Error during the export to InfluxDB\n");
-            //return RET_ERR;
-            pkt_drop++;
-            if(pkt_drop % 1000 == 0 && pkt_drop != 0) {
-                std::cout << "dropped: " << pkt_drop << std::endl;
-            }
-        }
-    }
-         
-    // Print to console
-    if(opt.verbose) {
-        print_telemetric(&tmpHdr);
-    } 
-}
-
-/**
- * Process one received packet based on the program
- * \param pkt Input packet to prs
- * \param influxdb Database descriptor
- * \param opt Program parameters
- * \return RET_OK if everything was fine
- */
-uint32_t process_packet(struct ndp_packet& pkt, IntExporter &exporter, const options_t& opt) {
-    // Prepare telemetric data into the apropriate structure
-    telemetric_hdr_t tmpHdr;
-    struct int_influx_t *int_hdr = (struct int_influx_t*)pkt.data;
-    struct int_influx_t *tmp = int_hdr;
-    struct int_meta_t *int_meta_hdr = (struct int_meta_t *)(++tmp);
-    
-    uint64_t map_key = *((uint64_t*)(pkt.data));
-    get_int_header_data(tmpHdr, int_hdr, map_key);
-
-    uint8_t meta_cnt = int_hdr->meta_len/(int_hdr->hop_meta_len);
-    get_int_node_data(tmpHdr, int_meta_hdr, meta_cnt);
- 
-    // Cut of timestamps to 48 bits
-    if(opt.tstmp == 1) {
-        uint64_t mask = 0x0000FFFFFFFFFFFF;
-        tmpHdr.origTs = tmpHdr.origTs & mask;
-        tmpHdr.dstTs = tmpHdr.dstTs & mask;
-    }
-
-    report_to_influx(exporter, opt, tmpHdr);
-
-    return RET_OK;
-}
-
 /** 
  * Print the help
  * \param prgname Name of program 
  */
 void print_help(const char* prgname) {
     printf("%s [-d device] [-c collectorAddress] [-p collectorPort] [-r collectorProtocol]" 
-           " [-u username] [-s password] [-b numOfReports] [-l logFile] [-m samplingRate]"
-           " [-i buffer_size] [-vtkh]\n", prgname);
-    printf("\t* -d = ID of the device (e.g.,0 stands for /dev/nfb0, default is 0).\n");
+           " [-u username] [-s password] [-b numOfLines] [-B numOfBytes] [-A ageMs] [-e schema] [-l logFile] [-m samplingRate] [-a archiveDir] [-F seconds] [-R stateFile] [-f filterFile] [-D routeFile] [-C controlSocket]"
+           " [-i serializers] [-q ringSize] [-w waitMode] [-o overloadPolicy] [-P stage=threads[@cpus]] [-T periodMs] [-S source] [-vtkh] [-- eal_args]\n", prgname);
+    printf("\t* -d = ID of the device of nfb sources without dev (e.g.,0 stands for /dev/nfb0, default is 0).\n");
     printf("\t* -c = Host address of the collector.\n");
     printf("\t* -p = Port of collector.\n");
-    printf("\t* -r = Protocol of collector.\n");
+    printf("\t* -r = Protocol of collector: udp, tcp, http or https. tcp writes line protocol to a persistent\n"
+           "\t       connection (e.g., Telegraf socket_listener), batches are spilled up to %u MiB while it is\n"
+           "\t       down and the connection is reestablished with a backoff.\n", TCP_SPILL_BYTES >> 20);
     printf("\t* -u = Username of collector.\n");
     printf("\t* -s = Password of collector.\n");
-    printf("\t* -b = How many reports send at once (default is 1000).\n"); 
+    printf("\t* -b = Lines of a full batch (default is 1000).\n"); 
+    printf("\t* -B = Byte budget of a batch, 0 is one datagram for UDP and %u for HTTP and TCP (default is 0).\n", BATCH_HTTP_BYTES); 
+    printf("\t* -A = Maximal age of the oldest record of a batch in ms (default is %u). A batch is sent on\n"
+           "\t       whichever of -b, -B and -A comes first.\n", BATCH_AGE_DEFAULT); 
+    printf("\t* -e = Schema of records, hop[,params] writes a line of the report and a line per hop, wide[,params]\n"
+           "\t       writes one line per report with hop fields indexed by the hop (hop0_delay, hop1_link_delay,\n"
+           "\t       ...) and no hop timestamps (default is hop). Parameters: path=1 tags records by a hash of the\n"
+           "\t       switch IDs, ports=field exports ports as fields, src=N and dst=N tag addresses by their /N\n"
+           "\t       prefix, series=N folds records of series over N distinct ones to srcip=other,dstip=other\n"
+           "\t       (N is 1 to 2^32, series over the first %u are admitted by an estimate of the distinct ones).\n"
+           "\t       Records of flows sharing a series and a timestamp overwrite each other in InfluxDB.\n",
+           SERIES_EXACT_MAX); 
     printf("\t* -l = Error messages will be written to given log file.\n"); 
     printf("\t* -m = Set sampling rate of reporting to database (default is 1).\n"); 
-    printf("\t* -i = Number of senders.\n"); 
+    printf("\t* -a = Keep every report in compressed time series of the local archive, dir[,span=seconds]\n"
+           "\t       with one segment file per span of sink time (default is %u s). Sampling does not apply,\n"
+           "\t       read the archive by p4int_archive.\n", ARCHIVE_SPAN_DEFAULT); 
+    printf("\t* -F = Flight recorder keeping raw reports of the last seconds, seconds[,rate=N,slots=N,delay=ns,dir=path]\n"
+           "\t       with slots for the seconds at N reports/s of one RX thread (default is %u), slots=N sets\n"
+           "\t       the number of reports kept by one RX thread instead. SIGUSR2 or a report delay over the delay\n"
+           "\t       threshold dumps them to dir/flight-<time>-<reason>.pcap (default dir is .), the dump can be\n"
+           "\t       replayed by -S replay.\n", RECORDER_RATE_DEFAULT); 
+    printf("\t* -R = Keep the flow state in the file (e.g., /dev/shm/p4int.flows), a restarted sink adopts it and\n"
+           "\t       continues sequence numbers and jitter of all flows. A new sink waits until the previous one\n"
+           "\t       releases the file.\n"); 
+    printf("\t* -f = File of flow filter rules, one \"src[/len] [port[-port]] [dst[/len]]\" per line, * is any value\n"
+           "\t       of the field. Only reports of the source prefix, egress port range and destination prefix\n"
+           "\t       of a rule pass (default is all reports). The card filters reports of exact rules, a source\n"
+           "\t       address and one port, wider rules are applied by the host.\n"); 
+    printf("\t* -D = File of routes to databases of the collector, one \"db[,measurement=name,rp=policy] rule\" per\n"
+           "\t       line with the rule of -f. The route of the longest source prefix wins, routes of one prefix\n"
+           "\t       in the order of the file. Other reports go to %s/%s, every destination has its own\n"
+           "\t       batches. Names have at most %u characters of [A-Za-z0-9_.-]. UDP and TCP collectors take\n"
+           "\t       only the measurement, the database is given by the port.\n",
+           ROUTE_DB_DEFAULT, ROUTE_MEASUREMENT_DEFAULT, ROUTE_NAME_MAX); 
+    printf("\t* -C = Control socket (UNIX stream, owner only) changing the flow filter at runtime by the commands\n"
+           "\t       \"add rule\", \"remove rule\" and \"list\" with rules of -f, \"dump\" dumps the flight recorder.\n"); 
+    printf("\t* -i = Number of serializer threads, same as -P serialize=N.\n"); 
+    printf("\t* -q = Capacity of the input queue of one stage thread in items (default is %u).\n", RING_SIZE_DEFAULT); 
+    printf("\t* -w = Waiting of idle threads: poll, spin or hybrid (default is hybrid).\n"); 
+    printf("\t* -o = Overload policy of full queues: newest (drop the new item), oldest (discard the oldest\n"
+           "\t       items), degrade (export flows losing records as aggregates) or block (wait for space\n"
+           "\t       up to %u us), default is newest.\n", OVERLOAD_BLOCK_USECS); 
+    printf("\t* -P = Threads and core set of a pipeline stage, can be repeated. Stages are rx, decode,\n"
+           "\t       aggregate, serialize and send, zero threads run the stage inline in the previous one\n"
+           "\t       (default is rx=1 decode=0 aggregate=0 serialize=1 send=0, e.g. -P decode=2@2-3).\n"); 
+    printf("\t* -T = Period of the self-telemetry export to the collector in ms, 0 disables it (default is %u).\n"
+           "\t       Telemetry is printed on SIGUSR1 regardless of this option.\n", TELEMETRY_PERIOD_DEFAULT); 
+    printf("\t* -S = Source of INT reports: nfb[:dev=N] (default), synth[:hops=N,flows=N,rate=N,mask=N] generating\n"
+           "\t       synthetic reports with the INT instruction mask (default is 0x%04x) or replay:file.pcap[,rate=N]\n"
+           "\t       looping raw reports of a pcap file with link type %u. Rate is in reports per second of\n"
+           "\t       one RX thread, software sources need no card. capture:iface[,xdp=0|1,zc=0|1] receives INT\n"
+           "\t       packets of a network interface by AF_XDP, the RX thread N reads the NIC queue N (use as many\n"
+           "\t       RX threads as the NIC has queues), zero-copy when the driver supports it. Without AF_XDP\n"
+           "\t       (xdp=0) AF_PACKET sockets of the RX threads share the traffic by flow hash. dpdk[:port=N]\n"
+           "\t       reads reports of the t4p4s sink or INT packets from a DPDK port with one RX queue per RX\n"
+           "\t       thread, EAL arguments follow --, e.g. -S dpdk -- --vdev=net_pcap0,iface=foo1.\n"
+           "\t       Repeat -S for more sources, e.g. -S nfb:dev=0 -S nfb:dev=1 -S replay:a.pcap. Every source\n"
+           "\t       takes the queues=N parameter, the number of its RX threads (default is rx of -P for a single\n"
+           "\t       source, 1 otherwise), -P rx is then their sum. Reports of more sources are aggregated in\n"
+           "\t       the aggregate stage (aggregate=1 unless -P says otherwise) and exported together.\n",
+           INT_INST_LEGACY, PCAP_LINKTYPE_RAW_INT); 
     printf("\t* -v = Enable the verbose mode for printinf of parsed data.\n"); 
     printf("\t* -t = Enable 48-bit timestamp mode.\n");
     printf("\t* -k = Disable P4 device configuration.\n");
@@ -343,18 +184,44 @@ void load_flt(const char *file, options_t *opt) {
     
     std::string line;
     while (std::getline(infile, line)) {
-        std::array<uint8_t, 6> array;
-        uint16_t port;
-        
-        sscanf(line.c_str(), "%" SCNu8 ".%" SCNu8 ".%" SCNu8 ".%" SCNu8 " %" SCNu16, 
-            &array[3], &array[2], &array[1], &array[0], &port);
-        array[4] = port & 0xff;
-        array[5] = (port >> 8) & 0xff;
-
-        opt->ip_flt.push_back(array);
+        filter_rule_t rule;
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+        if (filter_rule_parse(line.c_str(), rule) != RET_OK) {
+            fprintf(stderr, "Invalid rule \"%s\" in \"%s\", expected \"src[/len] [port[-port]] [dst[/len]]\"\n", line.c_str(), file);
+            exit(1);
+        }
+        opt->ip_flt.push_back(rule);
     }
 }   
 
+/**
+ * Load routes to databases of the collector
+ * \param file Load from this file
+ * \param opt Program parameters
+ */
+void load_routes(const char *file, options_t *opt) {
+    std::ifstream infile(file);
+    if (infile.fail()) {
+        fprintf(stderr, "Failed to open file \"%s\"\n", file);
+        exit(1);
+    }
+
+    std::string line;
+    while (std::getline(infile, line)) {
+        route_t route;
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+        if (route_parse(line.c_str(), route) != RET_OK) {
+            fprintf(stderr, "Invalid route \"%s\" in \"%s\", expected \"db[,measurement=name,rp=policy] rule\"\n", line.c_str(), file);
+            exit(1);
+        }
+        opt->routes.push_back(route);
+    }
+}
+
 /**
  * Parse arguments and prepare the configuration
  *
@@ -368,18 +235,31 @@ static int32_t parse_arguments(options_t* opt, int32_t argc, char** argv) {
     opt->devId = 0;
     opt->hostValid = 0;
     opt->batch = 1000;
+    opt->batch_bytes = 0;
+    opt->batch_age = BATCH_AGE_DEFAULT;
     opt->log = 0;
     opt->verbose = 0;
     opt->tstmp = 0;   
     opt->p4cfg = 1;
     opt->smpl_rate = 1;
-    opt->raw_buffer = 1; 
+    opt->archive_span = ARCHIVE_SPAN_DEFAULT;
+    opt->schema = schema_default();
+    opt->recorder_window = 0;
+    opt->recorder_rate = RECORDER_RATE_DEFAULT;
+    opt->recorder_slots = 0;
+    opt->recorder_delay = 0;
+    opt->recorder_dir = ".";
+    stage_defaults(opt);
+    opt->ring_size = RING_SIZE_DEFAULT;
+    opt->wait_mode = WAIT_HYBRID;
+    opt->overload = OVERLOAD_NEWEST;
+    opt->telemetry = TELEMETRY_PERIOD_DEFAULT;
 
     int32_t op;
     char* tmp;
      
     // Parse all parameters
-    while((op = getopt(argc, argv, "d:c:p:r:u:s:b:l:m:f:i:vtkh")) != -1) {
+    while((op = getopt(argc, argv, "d:c:p:r:u:s:b:B:A:e:l:m:a:F:R:C:f:D:i:q:w:o:P:T:S:vtkh")) != -1) {
         switch(op) {
             case 'd':
                 // Parse the device ID
@@ -423,6 +303,24 @@ static int32_t parse_arguments(options_t* opt, int32_t argc, char** argv) {
             case 'b':
                 // Size of batch
                 opt->batch = atoi(optarg);
+                if(opt->batch == 0) {
+                    printf("Size of the batch has to be positive!");
+                    return RET_ERR;
+                }
+                break;
+
+            case 'B':
+                // Byte budget of batch
+                opt->batch_bytes = atoi(optarg);
+                break;
+
+            case 'A':
+                // Maximal age of batch
+                opt->batch_age = atoi(optarg);
+                if(opt->batch_age == 0) {
+                    printf("Maximal age of the batch has to be positive!");
+                    return RET_ERR;
+                }
                 break;
 
             case 'l':
@@ -436,14 +334,97 @@ static int32_t parse_arguments(options_t* opt, int32_t argc, char** argv) {
                 opt->smpl_rate = atoi(optarg);
                 break;
             
+            case 'e':
+                // Schema of exported records
+                if(schema_parse(optarg, opt) != RET_OK) {
+                    return RET_ERR;
+                }
+                break;
+            
+            case 'a':
+                // Local archive of all reports
+                if(archive_parse(optarg, opt) != RET_OK) {
+                    return RET_ERR;
+                }
+                break;
+            
+            case 'F':
+                // Flight recorder of raw reports
+                if(recorder_parse(optarg, opt) != RET_OK) {
+                    return RET_ERR;
+                }
+                break;
+            
+            case 'R':
+                // Flow state kept over restarts
+                opt->flow_state = optarg;
+                break;
+            
+            case 'C':
+                // Control socket
+                opt->control = optarg;
+                break;
+            
             case 'f':
                 // Load flow filter
                 load_flt(optarg, opt);
                 break;
             
+            case 'D':
+                // Load routes to databases
+                load_routes(optarg, opt);
+                break;
+            
             case 'i':
-                // Size of internal raw buffer
-                opt->raw_buffer = atoi(optarg);
+                // Number of serializers
+                opt->stages[STAGE_SERIALIZE].threads = atoi(optarg);
+                break;
+            
+            case 'q':
+                // Capacity of the ring buffers
+                opt->ring_size = atoi(optarg);
+                if(opt->ring_size == 0) {
+                    printf("Size of the ring buffer has to be positive!");
+                    return RET_ERR;
+                }
+                break;
+            
+            case 'w':
+                // Waiting strategy
+                if(wait_mode_parse(optarg) < 0) {
+                    printf("Unknown waiting strategy \"%s\"!", optarg);
+                    return RET_ERR;
+                }
+                opt->wait_mode = wait_mode_parse(optarg);
+                break;
+            
+            case 'o':
+                // Overload policy
+                if(overload_parse(optarg) < 0) {
+                    printf("Unknown overload policy \"%s\"!", optarg);
+                    return RET_ERR;
+                }
+                opt->overload = overload_parse(optarg);
+                break;
+            
+            case 'P':
+                // Topology of the pipeline
+                if(stage_parse(optarg, opt) != RET_OK) {
+                    return RET_ERR;
+                }
+                break;
+            
+            case 'T':
+                // Period of the self-telemetry export
+                opt->telemetry = atoi(optarg);
+                break;
+            
+            case 'S':
+                // Source of reports, repeated for more sources
+                opt->sources.emplace_back();
+                if(source_parse(optarg, &opt->sources.back()) != RET_OK) {
+                    return RET_ERR;
+                }
                 break;
             
             case 'v':
@@ -471,55 +452,36 @@ static int32_t parse_arguments(options_t* opt, int32_t argc, char** argv) {
                 return RET_ERR;
         } 
     }
-    return RET_OK;
+    if(source_resolve(opt) != RET_OK) {
+        return RET_ERR;
+    }
+
+    // Arguments after -- belong to DPDK EAL
+    for(source_cfg_t &cfg : opt->sources) {
+        if(cfg.type == SOURCE_DPDK) {
+            cfg.eal.assign(argv + optind, argv + argc);
+            optind = argc;
+        }
+    }
+    if(optind < argc) {
+        printf("Unexpected argument \"%s\"!\n", argv[optind]);
+        return RET_ERR;
+    }
+    return stage_check(opt);
 }
 
 /**
- * Processing all incoming packets
- * \param device P4 device
- * \param nfb NFB device
- * \param opt Program parameters
- * \return RET_OK if everything was fine
+ * Close devices of all NFB sources
+ * \param device Device structure
+ * \param opt Program options
+ * \param nfb Devices of all sources
  */
-int loop_proccess(p4device_t &device, nfb_int_dev_t &nfb, IntExporter &exporter, options_t &opt) {
-    uint32_t pkt_rx_ret;
-    uint32_t ret_pkt_proc;
-    struct ndp_packet packets[NDP_PACKET_BUFF]; 
-    
-    while(!stop) {
-        // Read the packet from the buffer
-        pkt_rx_ret = ndp_rx_burst_get(nfb.rx, packets, NDP_PACKET_BUFF);
-    
-        // flush influxdb buffer
-        if(pkt_rx_ret == 0) {
-            delay_usecs(100);
-            continue;
-        }
-
-        // Process all packets 
-        for(uint8_t i = 0; i < pkt_rx_ret; i++) {
-            // Increment counter for each finished one 
-            pkt_cnt++;
-            // Process packet
-            ret_pkt_proc = process_packet(packets[i], exporter, opt);
-            if(ret_pkt_proc != RET_OK) {
-                printf("Error during the packet processing!\n");
-                close_device(&device, &opt, &nfb);
-                return RET_ERR;
-            }
-        }
-
-        // Mark all read packets as finished   
-        if(pkt_rx_ret != 0) {
-            ndp_rx_burst_put(nfb.rx); 
-        }
+static void close_devices(p4device_t* device, options_t* opt, std::vector<nfb_int_dev_t>& nfb) {
+    for(nfb_int_dev_t& dev : nfb) {
+        close_device(device, opt, &dev);
     }
-   
-    close_device(&device,&opt,&nfb);
-    return RET_OK;
 }
 
-
 int32_t main(int32_t argc, char** argv) {
     // Prepare the configuration
     int32_t ret;
@@ -528,36 +490,65 @@ int32_t main(int32_t argc, char** argv) {
         return RET_ERR;
     }
     
-    // Prepare device 
+    // Prepare devices of NFB sources, software sources run without the card
     p4device_t device;
-    nfb_int_dev_t nfb;
-    ret = open_device(&device, &opt, &nfb);
-    if(ret != RET_OK) {
-        // Close all already opened parts
-        close_device(&device, &opt, &nfb);
-        return RET_ERR;
+    std::vector<nfb_int_dev_t> nfb(opt.sources.size());
+    for(nfb_int_dev_t& dev : nfb) {
+        dev.dev = NULL;
+        dev.rx_cnt = 0;
     }
-
-    // Configure the device
-    if(opt.p4cfg) {
-        ret = configure_device(&device,&opt);
+    for(size_t i = 0; i < opt.sources.size(); i++) {
+        if(opt.sources[i].type != SOURCE_NFB) {
+            continue;
+        }
+        ret = open_device(&device, &opt, &opt.sources[i], &nfb[i]);
         if(ret != RET_OK) {
-            close_device(&device,&opt,&nfb);
+            // Close all already opened parts
+            close_devices(&device, &opt, nfb);
             return RET_ERR;
         }
+
+        // Configure the device
+        if(opt.p4cfg) {
+            ret = configure_device(&nfb[i], &opt, &opt.sources[i]);
+            if(ret != RET_OK) {
+                close_devices(&device, &opt, nfb);
+                return RET_ERR;
+            }
+        }
     }
 
     // Register signal to enable catching of Ctrl+c
     if(signal(SIGINT, setup_stop) == SIG_ERR) {
         printf("Unable to register SIGINT handler!\n");
-        close_device(&device, &opt, &nfb);
+        close_devices(&device, &opt, nfb);
+        return RET_ERR;
+    }
+
+    // Dump of the self-telemetry
+    if(signal(SIGUSR1, setup_dump) == SIG_ERR) {
+        printf("Unable to register SIGUSR1 handler!\n");
+        close_devices(&device, &opt, nfb);
+        return RET_ERR;
+    }
+
+    // Dump of the flight recorder
+    if(signal(SIGUSR2, setup_record) == SIG_ERR) {
+        printf("Unable to register SIGUSR2 handler!\n");
+        close_devices(&device, &opt, nfb);
         return RET_ERR;
     }
   
-    // Prepare exporter 
-    IntExporter exporter(&opt);
+    // Prepare the pipeline, the exporter runs its serialize and send stages
+    Pipeline pipeline(&opt, &nfb);
+    IntExporter exporter(&opt, Pipeline::exportProducers(&opt));
     // infinite loop packet processing
-    ret = loop_proccess(device, nfb, exporter, opt);
+    ret = pipeline.run(exporter, &stop);
+    close_devices(&device, &opt, nfb);
+
+    // Print statistics of all stages
+    printf("wait - %s\n", wait_mode_name(opt.wait_mode));
+    pipeline.printStats(exporter);
     
     return ret;
 }
@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <vector>
 #include <array>
+#include <string>
 
 // Success return code
 #define RET_OK 0
@@ -20,16 +21,107 @@
 #define RET_NO_PKT 2 
 // Not enough space for the packet 
 #define RET_PKT_SIZE 3 
+// Flow table is full
+#define RET_FLOW_FULL 4
 // Size of char buffers 
 #define CHAR_BUFF_SIZE 512
 // Size of the NDP packet buffer 
 #define NDP_PACKET_BUFF 32
 // Size of the charatecter buffer inside the telemetric structure 
 #define IP_BUFF_SIZE 17
+// Maximal number of INT nodes on the path
+#define MAX_NODES 10
+
+// INT instructions, bits of the inst_mask in the order of fields of the hop metadata
+#define INT_INST_SWITCH_ID   0x8000 // Switch ID, 4 bytes
+#define INT_INST_PORT_IDS    0x4000 // Level 1 ingress and egress port IDs, 4 bytes
+#define INT_INST_HOP_LATENCY 0x2000 // Hop latency, 4 bytes
+#define INT_INST_QUEUE       0x1000 // Queue ID and occupancy, 4 bytes
+#define INT_INST_INGRESS_TS  0x0800 // Ingress timestamp, 8 bytes
+#define INT_INST_EGRESS_TS   0x0400 // Egress timestamp, 8 bytes
+#define INT_INST_L2_PORT_IDS 0x0200 // Level 2 ingress and egress port IDs, 8 bytes
+#define INT_INST_TX_UTIL     0x0100 // Egress port TX utilization, 4 bytes
+// Layout of int_meta_t, assumed for reports without the mask
+#define INT_INST_LEGACY (INT_INST_SWITCH_ID | INT_INST_PORT_IDS | INT_INST_INGRESS_TS | INT_INST_EGRESS_TS)
+// Instructions exported as extra fields of hop records
+#define INT_INST_EXTRA (INT_INST_HOP_LATENCY | INT_INST_QUEUE | INT_INST_TX_UTIL)
+// Default capacity of the input queue of one stage thread (items)
+#define RING_SIZE_DEFAULT (1 << 18)
+
+// Stages of the processing pipeline
+#define STAGE_RX        0 // Reading of NDP packets
+#define STAGE_DECODE    1 // Parsing of INT reports
+#define STAGE_AGGREGATE 2 // Flow state and sampling
+#define STAGE_SERIALIZE 3 // Assembling of line protocol batches
+#define STAGE_SEND      4 // Transport to the collector
+#define STAGE_CNT       5
+
+// Configuration of one pipeline stage
+typedef struct {
+    uint32_t         threads; // Number of threads, 0 runs the stage in the threads of the previous one
+    std::vector<int> cpus;    // Core set of the stage, empty leaves the scheduling to the OS
+} stage_cfg_t;
+
+// Sources of INT reports
+#define SOURCE_NFB     0 // NDP queues of the NFB card
+#define SOURCE_SYNTH   1 // Synthetic reports generated in memory
+#define SOURCE_REPLAY  2 // Raw reports replayed from a pcap file
+#define SOURCE_CAPTURE 3 // INT packets captured on a network interface
+#define SOURCE_DPDK    4 // Reports of the t4p4s sink read from a DPDK port
+
+// Configuration of the source of INT reports
+typedef struct {
+    uint32_t    type;     // SOURCE_* value
+    std::string name;     // Label of the source in statistics and telemetry
+    uint32_t    queues;   // RX queues of the source, every one is read by its own RX thread
+    uint32_t    dev;      // NFB device, /dev/nfbN
+    uint32_t    hops;     // Hops of synthetic reports
+    uint32_t    flows;    // Flows of synthetic reports of one RX thread
+    uint64_t    rate;     // Reports per second of one RX thread, 0 is unlimited
+    uint16_t    mask;     // Instructions of synthetic reports (INT_INST_*)
+    std::string file;     // Pcap file of the replay
+    std::string iface;    // Network interface of the capture
+    uint8_t     xdp;      // Capture by AF_XDP, AF_PACKET is the fallback
+    uint8_t     zerocopy; // Zero-copy mode of AF_XDP
+    uint16_t    port;     // DPDK port
+    std::vector<std::string> eal; // DPDK EAL arguments, the arguments after --
+} source_cfg_t;
+
+// Layouts of exported records
+#define SCHEMA_HOP  0 // Line of the report and one line per hop
+#define SCHEMA_WIDE 1 // One line per report, hop values are indexed fields
+
+// Schema of exported records
+typedef struct {
+    uint32_t layout;  // SCHEMA_* value
+    uint8_t  path;    // Tag records by the hash of the switch IDs of the path
+    uint8_t  ports;   // Ports are fields of the records instead of tags
+    uint8_t  src_len; // Prefix of the source address tag, 32 tags the address
+    uint8_t  dst_len; // Prefix of the destination address tag, 32 tags the address
+    uint64_t series;  // Limit of distinct series, records of later series are tagged "other", 0 disables it
+} schema_t;
+
+// Rule of the flow filter, addresses and ports in host order
+typedef struct {
+    uint32_t src;     // Source prefix of the report
+    uint32_t dst;     // Destination prefix of the report
+    uint16_t port_lo; // Range of the egress port of the report
+    uint16_t port_hi;
+    uint8_t  src_len; // Length of the source prefix, 0 matches any address
+    uint8_t  dst_len; // Length of the destination prefix, 0 matches any address
+} filter_rule_t;
+
+// Route of reports to a destination of the collector, empty names are the defaults of the exporter
+typedef struct {
+    filter_rule_t rule;        // Reports of the route
+    std::string   db;          // Database
+    std::string   measurement; // Measurement of the records
+    std::string   rp;          // Retention policy
+} route_t;
 
 // Configuration of the program 
 typedef struct {
-    uint32_t devId;                    // Device ID 
+    uint32_t devId;                    // Device ID of NFB sources without the dev parameter
     char     host[CHAR_BUFF_SIZE];     // Host address of the collector 
     uint8_t  hostValid;                // Valid of host address  
     uint16_t port;                     // Host destination port 
@@ -37,14 +129,32 @@ typedef struct {
     char     username[CHAR_BUFF_SIZE]; // Host username  
     char     password[CHAR_BUFF_SIZE]; // Host password  
     uint32_t batch;                    // How many packets send at once
+    uint32_t batch_bytes;              // Byte budget of a batch, 0 is the default of the transport
+    uint32_t batch_age;                // Maximal age of the oldest record of a batch in ms
     uint8_t  log;                      // Enable log file 
     char     logFile[CHAR_BUFF_SIZE];  // Path of the log file 
     uint8_t  verbose;                  // Print parsed data 
     uint8_t  tstmp;                    // Enables 48-bit timestamp mod 
     uint8_t  p4cfg;                    // Configure P4 device
     uint32_t smpl_rate;                // Sampling rate
-    uint32_t raw_buffer;               // Size of buffer for raw int data
-    std::vector<std::array<uint8_t, 6>> ip_flt; // Filter this flows (srouce ip and destination port)
+    uint32_t ring_size;                // Capacity of the input queue of one stage thread
+    uint32_t wait_mode;                // Waiting strategy of idle threads (WAIT_*)
+    uint32_t overload;                 // Overload policy of full queues (OVERLOAD_*)
+    uint32_t telemetry;                // Period of the self-telemetry export in ms, 0 disables it
+    stage_cfg_t stages[STAGE_CNT];     // Topology of the processing pipeline
+    std::vector<source_cfg_t> sources; // Sources of INT reports, RX threads are assigned to them in order
+    std::string archive;               // Directory of the local archive, empty disables it
+    uint32_t archive_span;             // Span of an archive segment in seconds
+    uint32_t recorder_window;          // Window of the flight recorder in seconds, 0 disables it
+    uint64_t recorder_rate;            // Expected reports per second of one RX thread, sizes the slots
+    uint64_t recorder_slots;           // Slots of the flight recorder of one RX thread, 0 is window * rate
+    uint64_t recorder_delay;           // Delay of a report triggering the dump, 0 disables the trigger
+    std::string recorder_dir;          // Directory of the flight recorder dumps
+    std::string flow_state;            // File of the flow state region kept over restarts, empty keeps it in memory
+    std::string control;               // Path of the control socket, empty disables it
+    std::vector<filter_rule_t> ip_flt; // Filter this flows (source prefix, egress port range and destination prefix)
+    std::vector<route_t> routes;       // Routes of reports to databases and measurements, in the order of the file
+    schema_t schema;                   // Schema of exported records
 } options_t;
 
 struct telemetric_meta {
@@ -52,7 +162,11 @@ struct telemetric_meta {
     uint64_t hop_delay;
     uint64_t hop_jitter;
     uint8_t  hop_index;
+    uint8_t  queue_id;          // INT_INST_QUEUE
+    uint32_t hop_latency;       // INT_INST_HOP_LATENCY
     uint64_t hop_timestamp;
+    uint32_t queue_occupancy;   // INT_INST_QUEUE
+    uint32_t tx_utilization;    // INT_INST_TX_UTIL
 };
 
 // Structure with telemetric information to export 
@@ -68,13 +182,24 @@ typedef struct {
    uint64_t    delay;               // Difference between the dest. and orig. timestamp
    uint64_t    sink_jitter;         // Difference between the dest timestamp of current packet and the previous
    int64_t     reordering;
-   std::vector<telemetric_meta> node_meta;              
+   uint64_t    flowKey;             // Flow identifier used for the flow-affine dispatch
+   uint32_t    aggregated;          // Number of reports summarized by the record, 0 for a single report
+   uint64_t    delay_max;           // Maximal delay of the summarized reports
+   uint64_t    rxNs;                // Monotonic time the report left the RX queue
+   uint16_t    inst_mask;           // Instructions of the hop metadata (INT_INST_*)
+   uint32_t    pathId;              // Hash of the switch IDs of the path, 0 without INT_INST_SWITCH_ID
+   uint8_t     node_cnt;            // Number of valid items in node_meta
+   telemetric_meta node_meta[MAX_NODES + 1]; // Every node and the sink itself
 } telemetric_hdr_t;
 
 // Flow metadata structure 
 struct meta_data {
-    uint64_t seq = 0;        // Current sequence number
-    uint64_t prev_dstTs = 0; // Previous destination timestamp
+    uint64_t seq = 0;            // Current sequence number
+    uint64_t prev_dstTs = 0;     // Previous destination timestamp
+    uint64_t degraded_until = 0; // Flow is exported as aggregates until this dest. timestamp
+    uint32_t agg_cnt = 0;        // Reports of the pending aggregate
+    uint64_t agg_delay_sum = 0;  // Sum of delays of the pending aggregate
+    uint64_t agg_delay_max = 0;  // Maximal delay of the pending aggregate
 };
 
 /**
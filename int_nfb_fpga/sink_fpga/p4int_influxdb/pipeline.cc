@@ -0,0 +1,686 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Processing pipeline of the INT sink
+ */
+
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+
+#include "pipeline.h"
+#include "wait_strategy.h"
+
+/**
+ * Stage running the aggregation, the last one before the serialization
+ * \param opt Program options
+ * \return STAGE_* value
+ */
+static uint32_t aggregate_stage(const options_t *opt) {
+    if(opt->stages[STAGE_AGGREGATE].threads != 0) {
+        return STAGE_AGGREGATE;
+    }
+    return opt->stages[STAGE_DECODE].threads != 0 ? STAGE_DECODE : STAGE_RX;
+}
+
+uint32_t Pipeline::exportProducers(const options_t *opt)
+{
+    return opt->stages[aggregate_stage(opt)].threads;
+}
+
+Pipeline::Pipeline(const options_t *opt, std::vector<nfb_int_dev_t> *nfb)
+    : m_opt(opt), m_nfb(nfb), m_filter(opt->ip_flt), m_exporter(nullptr), m_raw_queue(nullptr), m_decoded_queue(nullptr),
+      m_raw_tm(nullptr), m_decoded_tm(nullptr), m_archive_points(0), m_archive_bytes(0), m_dropped(0), m_stop(nullptr), m_monitor_stop(false), m_wall(0)
+{
+    uint32_t rx = opt->stages[STAGE_RX].threads;
+    uint32_t decode = opt->stages[STAGE_DECODE].threads;
+    uint32_t aggregate = opt->stages[STAGE_AGGREGATE].threads;
+
+    if(decode != 0) {
+        m_raw_queue = new raw_queue_t(rx, decode, opt->ring_size, opt->wait_mode, false, opt->overload);
+        m_raw_tm = telemetry_attach("decode_queue", 0);
+        m_raw_queue->attachTelemetry("decode_queue");
+    }
+    if(aggregate != 0) {
+        m_decoded_queue = new decoded_queue_t(decode != 0 ? decode : rx, aggregate, opt->ring_size, opt->wait_mode, false, opt->overload);
+        m_decoded_tm = telemetry_attach("aggregate_queue", 0);
+        m_decoded_queue->attachTelemetry("aggregate_queue");
+    }
+    for(uint32_t stage = STAGE_RX; stage <= STAGE_AGGREGATE; stage++) {
+        m_stats[stage].resize(opt->stages[stage].threads, stage_thread_t());
+    }
+    m_flows.resize(exportProducers(opt), nullptr);
+    m_tm.resize(exportProducers(opt), nullptr);
+    for(uint32_t src = 0; src < opt->sources.size(); src++) {
+        for(uint32_t queue = 0; queue < opt->sources[src].queues; queue++) {
+            m_rx_map.emplace_back(src, queue);
+        }
+    }
+}
+
+Pipeline::~Pipeline()
+{
+    delete m_raw_queue;
+    delete m_decoded_queue;
+}
+
+void Pipeline::drop(tm_thread_t *tm, uint32_t dropped)
+{
+    if(dropped == 0) {
+        return;
+    }
+    tm_add(tm, TM_DROPPED, dropped);
+    uint64_t prev_drop = m_dropped.fetch_add(dropped, std::memory_order_relaxed);
+    uint64_t pkt_drop = prev_drop + dropped;
+    if(pkt_drop / 1000 != prev_drop / 1000) {
+        std::cout << "dropped: " << pkt_drop << std::endl;
+    }
+}
+
+bool Pipeline::degrade(telemetric_hdr_t &record, meta_data &meta, flow_state_t &state)
+{
+    bool degraded = record.dstTs < meta.degraded_until;
+    if(!degraded && meta.agg_cnt == 0) {
+        return true;
+    }
+
+    // Fold the report, the pending aggregate is completed also when the degradation ends
+    meta.agg_cnt++;
+    meta.agg_delay_sum += record.delay;
+    meta.agg_delay_max = std::max(meta.agg_delay_max, record.delay);
+    if(degraded && meta.agg_cnt < DEGRADE_REPORTS) {
+        state.degraded++;
+        return false;
+    }
+
+    record.aggregated = meta.agg_cnt;
+    record.delay = meta.agg_delay_sum / meta.agg_cnt;
+    record.delay_max = meta.agg_delay_max;
+    record.node_cnt = 0;
+    meta.agg_cnt = 0;
+    meta.agg_delay_sum = 0;
+    meta.agg_delay_max = 0;
+    return true;
+}
+
+void Pipeline::aggregate(uint32_t producer, telemetric_hdr_t *records, uint32_t count)
+{
+    flow_state_t &state = *m_flows[producer];
+    tm_thread_t *tm = m_tm[producer];
+    meta_data *flows[NDP_PACKET_BUFF];
+    uint64_t flow_cnt = state.shard->count;
+
+    // Every report updates the flow state, only the sampled ones are exported
+    uint32_t rec_cnt = 0;
+    for(uint32_t i = 0; i < count; i++) {
+        meta_data *meta = aggregate_report(records[i], state);
+        if(meta == NULL) {
+            // Flow table is full, counted by the flow state
+            continue;
+        }
+        if(m_opt->verbose) {
+            print_telemetric(&records[i]);
+        }
+        if(!m_archive.empty() && m_archive[producer]) {
+            archive(producer, records[i]);
+        }
+        if(m_recorder) {
+            m_recorder->checkDelay(records[i].delay);
+        }
+        state.shard->pkt_cnt++;
+        if(state.shard->pkt_cnt % m_opt->smpl_rate != 0) {
+            continue;
+        }
+        if(m_opt->overload == OVERLOAD_DEGRADE && !degrade(records[i], *meta, state)) {
+            continue;
+        }
+        if(rec_cnt != i) {
+            records[rec_cnt] = records[i];
+        }
+        flows[rec_cnt++] = meta;
+    }
+    tm_add(tm, TM_FLOW_LOOKUPS, count);
+    tm_add(tm, TM_FLOW_NEW, state.shard->count - flow_cnt);
+
+    if(m_opt->hostValid && rec_cnt != 0) {
+        uint32_t dropped_index[NDP_PACKET_BUFF];
+        uint32_t dropped = m_exporter->sendBurst(producer, records, rec_cnt, dropped_index);
+        if(m_opt->overload == OVERLOAD_DEGRADE) {
+            // Flows losing records are exported as aggregates for a while
+            for(uint32_t i = 0; i < dropped; i++) {
+                const telemetric_hdr_t &record = records[dropped_index[i]];
+                flows[dropped_index[i]]->degraded_until = record.dstTs + DEGRADE_NSECS;
+            }
+        }
+        tm_add(tm, TM_EXPORTED, rec_cnt - dropped);
+        drop(tm, dropped);
+    }
+}
+
+std::string Pipeline::command(const std::string &line)
+{
+    size_t sep = line.find(' ');
+    std::string cmd = line.substr(0, sep);
+    std::string arg = sep == std::string::npos ? "" : line.substr(sep + 1);
+
+    if(cmd == "add" || cmd == "remove") {
+        filter_rule_t rule;
+        if(filter_rule_parse(arg.c_str(), rule) != RET_OK) {
+            return "error rule must be \"src[/len] [port[-port]] [dst[/len]]\"\n";
+        }
+        bool add = cmd == "add";
+        std::vector<filter_rule_t> rules = m_filter.rules();
+        std::vector<filter_rule_t>::iterator it = std::find(rules.begin(), rules.end(), rule);
+        if((it != rules.end()) == add) {
+            return add ? "error rule exists\n" : "error no such rule\n";
+        }
+        if(add) {
+            rules.push_back(rule);
+        } else {
+            rules.erase(it);
+        }
+
+        // Diff of table_influx of every configured card around the change of the host filter,
+        // the pipeline stays enabled. The card drops other reports only when all rules are exact.
+        bool drop = filter_hardware(rules);
+        std::string failed;
+        for(size_t i = 0; i < m_nfb->size(); i++) {
+            nfb_int_dev_t &nfb = (*m_nfb)[i];
+            if(nfb.p4_valid && influx_update_pre(&nfb, rule, add, drop) != RET_OK) {
+                failed += " " + m_opt->sources[i].name;
+            }
+        }
+        if(add) {
+            m_filter.add(rule);
+        } else {
+            m_filter.remove(rule);
+        }
+        for(size_t i = 0; i < m_nfb->size(); i++) {
+            nfb_int_dev_t &nfb = (*m_nfb)[i];
+            if(nfb.p4_valid && influx_update_post(&nfb, add, drop) != RET_OK) {
+                failed += " " + m_opt->sources[i].name;
+            }
+        }
+        if(!failed.empty()) {
+            return "error table_influx of" + failed + " not updated\n";
+        }
+        return "ok " + filter_rule_str(rule) + "\n";
+    } else if(cmd == "list" && arg.empty()) {
+        std::string reply;
+        std::vector<filter_rule_t> rules = m_filter.rules();
+        for(const filter_rule_t &rule : rules) {
+            reply += filter_rule_str(rule) + "\n";
+        }
+        return reply + "ok " + std::to_string(rules.size()) + " rules" + (rules.empty() ? ", all flows pass\n" : "\n");
+    } else if(cmd == "dump" && arg.empty()) {
+        if(!m_recorder) {
+            return "error flight recorder is disabled\n";
+        }
+        m_recorder->trigger("control");
+        return "ok\n";
+    } else if(cmd == "help" && arg.empty()) {
+        return "add src[/len] [port[-port]] [dst[/len]]\nremove src[/len] [port[-port]] [dst[/len]]\nlist\ndump\nok\n";
+    }
+    return "error unknown command, try help\n";
+}
+
+void Pipeline::archive(uint32_t producer, const telemetric_hdr_t &record)
+{
+    ArchiveWriter &writer = *m_archive[producer];
+    try {
+        writer.append(record);
+    } catch (std::runtime_error& e) {
+        // The thread keeps exporting, only its archive stops
+        printf("archive %u - %s, archiving stopped\n", producer, e.what());
+        m_archive_points += writer.points();
+        m_archive_bytes += writer.bytes();
+        m_archive[producer].reset();
+    }
+}
+
+void Pipeline::decoded(uint32_t producer, tm_thread_t *tm, telemetric_hdr_t *records, uint32_t count)
+{
+    if(m_decoded_queue != nullptr) {
+        drop(tm, m_decoded_queue->push_burst(producer, records, count));
+    } else {
+        aggregate(producer, records, count);
+    }
+}
+
+/**
+ * Account decoding of one burst
+ * \param tm Telemetry of the calling thread
+ * \param start Start of the decoding in ns
+ * \param received Number of reports of the burst
+ * \param count Number of decoded reports
+ */
+static inline void parsed(tm_thread_t *tm, uint64_t start, uint32_t received, uint32_t count)
+{
+    if(received != count) {
+        tm_add(tm, TM_DECODE_ERRORS, received - count);
+    }
+    if(count == 0) {
+        return;
+    }
+    uint64_t elapsed = stage_now_ns() - start;
+    tm_add(tm, TM_PARSED, count);
+    tm_add(tm, TM_PARSE_NS, elapsed);
+    tm_record(tm, TM_H_PARSE_NS, elapsed / count);
+}
+
+void Pipeline::rxThread(uint32_t id)
+{
+    // The first RX thread is the main one receiving signals
+    if(id != 0) {
+        stage_block_signals();
+    }
+    stage_pin(m_opt->stages[STAGE_RX], id);
+    tm_thread_t *tm = telemetry_attach("rx", id, m_opt->sources[m_rx_map[id].first].name.c_str());
+    if(aggregate_stage(m_opt) == STAGE_RX) {
+        m_tm[id] = tm;
+    }
+
+    PacketSource &source = *m_sources[id];
+    // The card configured by the sink filters reports of NFB sources as long as all rules are exact
+    uint32_t src = m_rx_map[id].first;
+    bool card_filter = m_opt->sources[src].type == SOURCE_NFB && (*m_nfb)[src].p4_valid;
+    uint64_t filter_version = m_filter.version();
+    std::shared_ptr<const FilterTable> filter = m_filter.snapshot();
+    uint64_t discarded_start = 0;
+    bool discarded_valid = source.discarded(&discarded_start) == RET_OK;
+    struct ndp_packet packets[NDP_PACKET_BUFF];
+    std::vector<raw_report_t> raw(m_raw_queue != nullptr ? NDP_PACKET_BUFF : 0);
+    std::vector<telemetric_hdr_t> records(NDP_PACKET_BUFF);
+    const uint8_t *data[NDP_PACKET_BUFF];
+    uint32_t len[NDP_PACKET_BUFF];
+    uint64_t rx_ns[NDP_PACKET_BUFF];
+    stage_thread_t &stats = m_stats[STAGE_RX][id];
+    PollBackoff backoff(m_opt->wait_mode);
+
+    while(!*m_stop) {
+        // Read the packet from the buffer
+        uint32_t pkt_rx_ret = source.burstGet(packets, NDP_PACKET_BUFF);
+        if(pkt_rx_ret == 0) {
+            tm_add(tm, TM_RX_EMPTY, 1);
+            backoff.idle();
+            continue;
+        }
+        backoff.reset();
+        uint64_t start = stage_now_ns();
+        tm_add(tm, TM_RX_BURSTS, 1);
+        tm_add(tm, TM_RX_PACKETS, pkt_rx_ret);
+        tm_record(tm, TM_H_BURST, pkt_rx_ret);
+        if(m_recorder) {
+            m_recorder->record(id, packets, pkt_rx_ret);
+        }
+        uint32_t pkt_cnt = pkt_rx_ret;
+        if(filter_version != m_filter.version()) {
+            filter_version = m_filter.version();
+            filter = m_filter.snapshot();
+        }
+        if(!filter->empty() && !(card_filter && filter->exact())) {
+            pkt_cnt = filter_burst(*filter, packets, pkt_rx_ret);
+            tm_add(tm, TM_RX_FILTERED, pkt_rx_ret - pkt_cnt);
+        }
+
+        if(m_raw_queue != nullptr) {
+            // Copy reports out of the NDP buffer for the decode stage, reports
+            // shorter than the flow key are malformed and never reach the decoder
+            uint32_t raw_cnt = 0;
+            for(uint32_t i = 0; i < pkt_cnt; i++) {
+                if(packets[i].data_length < sizeof(raw[raw_cnt].key)) {
+                    continue;
+                }
+                memcpy(&raw[raw_cnt].key, packets[i].data, sizeof(raw[raw_cnt].key));
+                raw[raw_cnt].rx_ns = start;
+                raw[raw_cnt].len = std::min<uint32_t>(packets[i].data_length, RAW_REPORT_SIZE);
+                memcpy(raw[raw_cnt].data, packets[i].data, raw[raw_cnt].len);
+                raw_cnt++;
+            }
+            if(raw_cnt != pkt_cnt) {
+                tm_add(tm, TM_DECODE_ERRORS, pkt_cnt - raw_cnt);
+                stats.errors += pkt_cnt - raw_cnt;
+            }
+            drop(tm, m_raw_queue->push_burst(id, raw.data(), raw_cnt));
+        } else {
+            for(uint32_t i = 0; i < pkt_cnt; i++) {
+                data[i] = packets[i].data;
+                len[i] = packets[i].data_length;
+                rx_ns[i] = start;
+            }
+            uint32_t rec_cnt = decode_burst(data, len, rx_ns, pkt_cnt, records.data(), *m_opt);
+            parsed(tm, start, pkt_cnt, rec_cnt);
+            stats.errors += pkt_cnt - rec_cnt;
+            decoded(id, tm, records.data(), rec_cnt);
+        }
+
+        // Mark all read packets as finished
+        source.burstPut();
+        stats.items += pkt_rx_ret;
+        stats.busy_ns += stage_now_ns() - start;
+    }
+
+    // Packets lost in the NDP ring because the thread did not read them in time
+    uint64_t discarded_end;
+    if(discarded_valid && source.discarded(&discarded_end) == RET_OK) {
+        stats.dropped = discarded_end - discarded_start;
+    }
+    stage_finish(stats);
+}
+
+void Pipeline::decodeThread(uint32_t id, std::promise<void> *ready)
+{
+    stage_block_signals();
+    stage_pin(m_opt->stages[STAGE_DECODE], id);
+    try {
+        m_raw_queue->attach(id);
+    } catch (std::runtime_error& e) {
+        ready->set_exception(std::current_exception());
+        return;
+    }
+    tm_thread_t *tm = telemetry_attach("decode", id);
+    if(aggregate_stage(m_opt) == STAGE_DECODE) {
+        m_tm[id] = tm;
+    }
+    ready->set_value();
+
+    std::vector<raw_report_t> raw(NDP_PACKET_BUFF);
+    std::vector<telemetric_hdr_t> records(NDP_PACKET_BUFF);
+    const uint8_t *data[NDP_PACKET_BUFF];
+    uint32_t len[NDP_PACKET_BUFF];
+    uint64_t rx_ns[NDP_PACKET_BUFF];
+    stage_thread_t &stats = m_stats[STAGE_DECODE][id];
+
+    while(true) {
+        bool closed = m_raw_queue->closed();
+        size_t cnt = m_raw_queue->pop(id, raw.data(), raw.size());
+        if(cnt == 0) {
+            if(closed) {
+                break;
+            }
+            m_raw_queue->wait(id, 0);
+            continue;
+        }
+
+        uint64_t start = stage_now_ns();
+        for(size_t i = 0; i < cnt; i++) {
+            data[i] = raw[i].data;
+            len[i] = raw[i].len;
+            rx_ns[i] = raw[i].rx_ns;
+        }
+        uint32_t rec_cnt = decode_burst(data, len, rx_ns, cnt, records.data(), *m_opt);
+        parsed(tm, start, cnt, rec_cnt);
+        stats.errors += cnt - rec_cnt;
+        decoded(id, tm, records.data(), rec_cnt);
+        stats.items += cnt;
+        stats.busy_ns += stage_now_ns() - start;
+    }
+    stage_finish(stats);
+}
+
+void Pipeline::aggregateThread(uint32_t id, std::promise<void> *ready)
+{
+    stage_block_signals();
+    stage_pin(m_opt->stages[STAGE_AGGREGATE], id);
+    try {
+        m_decoded_queue->attach(id);
+    } catch (std::runtime_error& e) {
+        ready->set_exception(std::current_exception());
+        return;
+    }
+    m_tm[id] = telemetry_attach("aggregate", id);
+    ready->set_value();
+
+    std::vector<telemetric_hdr_t> records(NDP_PACKET_BUFF);
+    stage_thread_t &stats = m_stats[STAGE_AGGREGATE][id];
+
+    while(true) {
+        bool closed = m_decoded_queue->closed();
+        size_t cnt = m_decoded_queue->pop(id, records.data(), records.size());
+        if(cnt == 0) {
+            if(closed) {
+                break;
+            }
+            m_decoded_queue->wait(id, 0);
+            continue;
+        }
+
+        uint64_t start = stage_now_ns();
+        aggregate(id, records.data(), cnt);
+        stats.items += cnt;
+        stats.busy_ns += stage_now_ns() - start;
+    }
+    stage_finish(stats);
+}
+
+void Pipeline::exportTelemetry(transport_t &transport)
+{
+    std::string data;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    if(telemetry_lines(data, now.tv_sec * 1000000000ull + now.tv_nsec) == 0) {
+        return;
+    }
+    try {
+        transport(data);
+    } catch (std::runtime_error& e) {
+        std::cerr << "Telemetry export error: " << e.what() << std::endl;
+    }
+}
+
+void Pipeline::monitorThread()
+{
+    stage_block_signals();
+    // Telemetry is sent by its own transport to the default destination, so it does not wait for the senders
+    transport_t transport;
+    if(m_opt->telemetry != 0 && m_opt->hostValid) {
+        try {
+            transport = m_exporter->createTransport(0);
+        } catch (std::runtime_error& e) {
+            std::cerr << "Telemetry export disabled: " << e.what() << std::endl;
+        }
+    }
+
+    uint64_t next_export = stage_now_ns() + m_opt->telemetry * 1000000ull;
+    while(!m_monitor_stop.load(std::memory_order_relaxed)) {
+        delay_usecs(STAGE_SAMPLE_USECS);
+        if(m_raw_queue != nullptr) {
+            m_raw_queue->sample(m_raw_tm);
+        }
+        if(m_decoded_queue != nullptr) {
+            m_decoded_queue->sample(m_decoded_tm);
+        }
+        m_exporter->sample();
+
+        if(telemetry_dump_requested()) {
+            telemetry_dump(stdout);
+        }
+        if(transport && stage_now_ns() >= next_export) {
+            exportTelemetry(transport);
+            next_export += m_opt->telemetry * 1000000ull;
+        }
+    }
+
+    // Last values, so the collector sees the final counters
+    if(transport) {
+        exportTelemetry(transport);
+    }
+}
+
+int32_t Pipeline::run(IntExporter &exporter, volatile sig_atomic_t *stop)
+{
+    m_exporter = &exporter;
+    m_stop = stop;
+    uint64_t start = stage_now_ns();
+    int32_t ret = RET_OK;
+
+    // Start consumers first, so all queues are attached before the producers start
+    std::vector<std::thread> aggregate_threads;
+    std::vector<std::thread> decode_threads;
+    try {
+        // Flow state of the previous sink is adopted before any report is aggregated
+        m_store.reset(new FlowStore(m_opt->flow_state, exportProducers(m_opt), aggregate_stage(m_opt) != STAGE_RX));
+        for(uint32_t i = 0; i < exportProducers(m_opt); i++) {
+            m_flows[i] = m_store->shard(i);
+        }
+        if(m_opt->recorder_window != 0) {
+            m_recorder.reset(new Recorder(m_opt, m_opt->stages[STAGE_RX].threads));
+        }
+        if(!m_opt->control.empty()) {
+            m_control.reset(new ControlServer(m_opt->control,
+                [this](const std::string &line) { return command(line); }));
+        }
+        for(uint32_t i = 0; !m_opt->archive.empty() && i < exportProducers(m_opt); i++) {
+            m_archive.emplace_back(new ArchiveWriter(m_opt->archive, i, m_opt->archive_span));
+        }
+        for(uint32_t i = 0; i < m_opt->stages[STAGE_RX].threads; i++) {
+            uint32_t src = m_rx_map[i].first;
+            m_sources.push_back(source_create(m_opt->sources[src], &(*m_nfb)[src], m_rx_map[i].second));
+        }
+        for(uint32_t i = 0; i < m_opt->stages[STAGE_AGGREGATE].threads; i++) {
+            std::promise<void> ready;
+            std::future<void> initialized = ready.get_future();
+            aggregate_threads.emplace_back(&Pipeline::aggregateThread, this, i, &ready);
+            initialized.get();
+        }
+        for(uint32_t i = 0; i < m_opt->stages[STAGE_DECODE].threads; i++) {
+            std::promise<void> ready;
+            std::future<void> initialized = ready.get_future();
+            decode_threads.emplace_back(&Pipeline::decodeThread, this, i, &ready);
+            initialized.get();
+        }
+    } catch (std::runtime_error& e) {
+        printf("Unable to start the pipeline: %s\n", e.what());
+        ret = RET_ERR;
+    }
+
+    std::vector<std::thread> rx_threads;
+    std::thread monitor;
+    if(ret == RET_OK) {
+        printf("pipeline memory - %.1f MiB\n", (m_raw_queue ? m_raw_queue->printMemory("decode") : 0) / 1048576.0 +
+            (m_decoded_queue ? m_decoded_queue->printMemory("aggregate") : 0) / 1048576.0 + exporter.printMemory() / 1048576.0);
+        monitor = std::thread(&Pipeline::monitorThread, this);
+
+        // The calling thread is the first RX thread
+        for(uint32_t i = 1; i < m_opt->stages[STAGE_RX].threads; i++) {
+            rx_threads.emplace_back(&Pipeline::rxThread, this, i);
+        }
+        rxThread(0);
+        for(std::thread &thread : rx_threads) {
+            thread.join();
+        }
+    }
+
+    // Drain the stages in order, every stage finishes after its input was closed and emptied
+    if(m_raw_queue != nullptr) {
+        m_raw_queue->close();
+    }
+    for(std::thread &thread : decode_threads) {
+        thread.join();
+    }
+    if(m_decoded_queue != nullptr) {
+        m_decoded_queue->close();
+    }
+    for(std::thread &thread : aggregate_threads) {
+        thread.join();
+    }
+    m_monitor_stop = true;
+    if(monitor.joinable()) {
+        monitor.join();
+    }
+    if(m_control) {
+        m_control->stop();
+    }
+    exporter.close();
+    if(m_recorder) {
+        m_recorder->stop();
+    }
+
+    // Segments of the archive get their index when closed
+    for(std::unique_ptr<ArchiveWriter> &writer : m_archive) {
+        if(!writer) {
+            continue;
+        }
+        try {
+            writer->close();
+        } catch (std::runtime_error& e) {
+            printf("archive - %s\n", e.what());
+        }
+        m_archive_points += writer->points();
+        m_archive_bytes += writer->bytes();
+        writer.reset();
+    }
+
+    m_wall = (stage_now_ns() - start) / 1e9;
+    return ret;
+}
+
+void Pipeline::printStats(const IntExporter &exporter) const
+{
+    uint64_t total = 0;
+    uint64_t ndp = 0;
+    for(const stage_thread_t &stats : m_stats[STAGE_RX]) {
+        total += stats.items;
+        ndp += stats.dropped;
+    }
+    printf("total - %lu\ndrop - %lu\n", total, m_dropped.load());
+
+    stage_print("rx", m_stats[STAGE_RX], m_wall);
+    if(m_opt->sources.size() > 1) {
+        // RX threads of every source
+        for(uint32_t src = 0; src < m_opt->sources.size(); src++) {
+            uint64_t items = 0;
+            uint64_t dropped = 0;
+            for(uint32_t i = 0; i < m_rx_map.size(); i++) {
+                if(m_rx_map[i].first == src) {
+                    items += m_stats[STAGE_RX][i].items;
+                    dropped += m_stats[STAGE_RX][i].dropped;
+                }
+            }
+            printf("source %s - items %lu, dropped %lu\n", m_opt->sources[src].name.c_str(), items, dropped);
+        }
+    }
+    if(m_raw_queue != nullptr) {
+        m_raw_queue->printStats("decode");
+        stage_print("decode", m_stats[STAGE_DECODE], m_wall);
+    }
+    if(m_decoded_queue != nullptr) {
+        m_decoded_queue->printStats("aggregate");
+        stage_print("aggregate", m_stats[STAGE_AGGREGATE], m_wall);
+    }
+    exporter.printStats(m_wall);
+
+    // Losses of all stages
+    uint64_t flow_full = 0;
+    uint64_t degraded = 0;
+    for(const flow_state_t *state : m_flows) {
+        if(state != nullptr) {
+            flow_full += state->flow_full;
+            degraded += state->degraded;
+        }
+    }
+    uint64_t decode_errors = 0;
+    for(uint32_t stage : {STAGE_RX, STAGE_DECODE}) {
+        for(const stage_thread_t &stats : m_stats[stage]) {
+            decode_errors += stats.errors;
+        }
+    }
+    ring_stats_t raw = m_raw_queue ? m_raw_queue->total() : ring_stats_t();
+    ring_stats_t decoded = m_decoded_queue ? m_decoded_queue->total() : ring_stats_t();
+    ring_stats_t exported = exporter.queueStats();
+    stage_thread_t transport = exporter.transportStats();
+    printf("loss - ndp overrun %lu, decode errors %lu, decode queue %lu, aggregate queue %lu, flow table full %lu, "
+           "export queue %lu, transport %lu lines in %lu batches\n",
+        ndp, decode_errors, raw.dropped + raw.evicted, decoded.dropped + decoded.evicted, flow_full,
+        exported.dropped + exported.evicted, transport.dropped, transport.errors);
+    printf("overload - policy %s, evicted %lu, blocked %lu, degraded %lu\n", overload_name(m_opt->overload),
+        raw.evicted + decoded.evicted + exported.evicted, raw.blocked + decoded.blocked + exported.blocked, degraded);
+    if(m_store) {
+        printf("flow state - %lu flows in %zu shards%s%s\n", m_store->flows(), m_flows.size(),
+            m_opt->flow_state.empty() ? "" : ", kept in ", m_opt->flow_state.c_str());
+    }
+    if(!m_opt->archive.empty()) {
+        uint64_t points = m_archive_points.load();
+        printf("archive - %s, points %lu, bytes %lu, %.2f B per point\n", m_opt->archive.c_str(), points,
+            m_archive_bytes.load(), points ? (double)m_archive_bytes.load() / points : 0.0);
+    }
+}
@@ -0,0 +1,246 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Processing pipeline of the INT sink
+ */
+
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include <csignal>
+#include <atomic>
+#include <thread>
+#include <future>
+#include <memory>
+
+#include "p4int.h"
+#include "device.h"
+#include "source.h"
+#include "int_process.h"
+#include "stage.h"
+#include "stage_queue.h"
+#include "telemetry.h"
+#include "p4_influxdb.h"
+#include "archive.h"
+#include "recorder.h"
+#include "filter.h"
+#include "control.h"
+
+// Maximal size of a raw INT report passed to the decode stage
+#define RAW_REPORT_SIZE 512
+// Time a flow stays degraded after one of its records was dropped (ns)
+#define DEGRADE_NSECS 1000000000ull
+// Number of reports summarized by one aggregate of a degraded flow
+#define DEGRADE_REPORTS 64
+
+// Raw INT report copied out of the NDP buffer
+typedef struct {
+    uint64_t key;                   // Flow key, first 8 bytes of the report
+    uint64_t rx_ns;                 // Monotonic time the report left the RX queue
+    uint16_t len;                   // Length of the report
+    uint8_t  data[RAW_REPORT_SIZE]; // Report data
+} raw_report_t;
+
+/**
+ * Flow key of the raw report
+ */
+static inline uint64_t stage_key(const raw_report_t &item)
+{
+    return item.key;
+}
+
+// Queue of raw reports waiting for the decoding
+typedef StageQueue<raw_report_t> raw_queue_t;
+// Queue of decoded reports waiting for the aggregation
+typedef StageQueue<telemetric_hdr_t> decoded_queue_t;
+
+/**
+ * Processing pipeline RX -> decode -> aggregate -> serialize -> send.
+ *
+ * Every stage runs in its own threads connected by \ref StageQueue. RX threads
+ * are assigned to queues of all sources in order, with several sources the
+ * reports of all of them meet in the aggregate stage. A stage
+ * configured with zero threads runs inline in the threads of the previous
+ * stage, the default topology decodes and aggregates in the RX thread.
+ * Queues dispatch reports by the flow hash, so the flow state is sharded by
+ * the threads running the aggregation and needs no locking. Serialize and
+ * send stages are implemented by \ref IntExporter.
+ *
+ * A monitor thread samples queue depths, together with the busy time of every
+ * thread they show the bottleneck stage. It also prints the self-telemetry on
+ * request and exports it periodically as the int_sink measurement, every ring
+ * of a queue with its own home, spilled and stolen items.
+ *
+ * Full queues are handled by the OVERLOAD_* policy. With OVERLOAD_DEGRADE a flow
+ * whose record was dropped by the export queue is exported as an aggregate of
+ * DEGRADE_REPORTS reports for DEGRADE_NSECS. Losses are counted where they
+ * happen: NDP overruns, every queue, full flow tables and the transport.
+ *
+ * With the local archive every report accepted by the flow state, before the
+ * sampling, is appended to the \ref ArchiveWriter of the aggregating thread.
+ * The \ref Recorder keeps copies of raw reports of the last seconds.
+ *
+ * Commands of the \ref ControlServer change the flow filter while the
+ * pipeline runs: table_influx of NFB sources gets only the diff of the rules,
+ * the RX threads of software sources apply the \ref FlowFilter on the host.
+ */
+class Pipeline
+{
+    public:
+        /**
+         * Constructor
+         * \param opt Program options
+         * \param nfb Opened device of every source, used by NFB sources only, the
+         *            control socket updates table_influx of configured devices
+         */
+        Pipeline(const options_t *opt, std::vector<nfb_int_dev_t> *nfb);
+
+        /**
+         * Destructor
+         */
+        ~Pipeline();
+
+        /**
+         * Number of threads passing records to the exporter
+         * \param opt Program options
+         * \return Number of threads of the last stage before serialization
+         */
+        static uint32_t exportProducers(const options_t *opt);
+
+        /**
+         * Run the pipeline until the stop flag is set, then drain all queues.
+         * The first RX thread is the calling one.
+         * \param exporter Serialize and send stages
+         * \param stop Stop flag
+         * \return RET_OK if everything was fine
+         */
+        int32_t run(IntExporter &exporter, volatile sig_atomic_t *stop);
+
+        /**
+         * Print statistics of all stages
+         * \param exporter Serialize and send stages
+         */
+        void printStats(const IntExporter &exporter) const;
+
+    protected:
+        /**
+         * RX stage
+         * \param id Index of the RX thread and its source
+         */
+        void rxThread(uint32_t id);
+
+        /**
+         * Decode stage
+         * \param id Index of the decode thread
+         * \param ready Signals the attached queue
+         */
+        void decodeThread(uint32_t id, std::promise<void> *ready);
+
+        /**
+         * Aggregate stage
+         * \param id Index of the aggregate thread
+         * \param ready Signals the attached queue
+         */
+        void aggregateThread(uint32_t id, std::promise<void> *ready);
+
+        /**
+         * Sample queue depths and export the self-telemetry until the pipeline stops
+         */
+        void monitorThread();
+
+        /**
+         * Send the self-telemetry to the collector
+         * \param transport Transport of the monitor
+         */
+        void exportTelemetry(transport_t &transport);
+
+        /**
+         * Pass decoded reports to the aggregate stage or aggregate them inline
+         * \param producer Index of the calling thread in its stage
+         * \param tm Telemetry of the calling thread
+         * \param records Decoded reports
+         * \param count Number of reports
+         */
+        void decoded(uint32_t producer, tm_thread_t *tm, telemetric_hdr_t *records, uint32_t count);
+
+        /**
+         * Aggregate reports, sample them and pass them to the exporter
+         * \param producer Index of the calling thread in its stage
+         * \param records Decoded reports
+         * \param count Number of reports
+         */
+        void aggregate(uint32_t producer, telemetric_hdr_t *records, uint32_t count);
+
+        /**
+         * Append the report to the archive, the archive of the thread stops on failure
+         * \param producer Index of the calling thread in its stage
+         * \param record Decoded report
+         */
+        void archive(uint32_t producer, const telemetric_hdr_t &record);
+
+        /**
+         * Execute the command of the control socket
+         * \param line Command, "add ip port", "remove ip port", "list", "dump" or "help"
+         * \return Reply ended by the "ok" or "error" line
+         */
+        std::string command(const std::string &line);
+
+        /**
+         * Fold the report of a degraded flow into the aggregate of the flow
+         * \param record Sampled report, replaced by the aggregate when it is complete
+         * \param meta Metadata of the flow
+         * \param state Flow state of the calling thread
+         * \return true when the record has to be exported
+         */
+        bool degrade(telemetric_hdr_t &record, meta_data &meta, flow_state_t &state);
+
+        /**
+         * Count dropped reports and report them
+         * \param tm Telemetry of the calling thread
+         * \param dropped Number of dropped reports
+         */
+        void drop(tm_thread_t *tm, uint32_t dropped);
+
+        // Program options
+        const options_t *m_opt;
+        // NFB device of every source
+        std::vector<nfb_int_dev_t> *m_nfb;
+        // Flow filter of software sources, the rules of -f and the control socket
+        FlowFilter m_filter;
+        // Control socket, null without -C
+        std::unique_ptr<ControlServer> m_control;
+        // Index of the source and its queue read by every RX thread
+        std::vector<std::pair<uint32_t, uint32_t>> m_rx_map;
+        // Source of reports of every RX thread
+        std::vector<std::unique_ptr<PacketSource>> m_sources;
+        // Serialize and send stages, valid during run()
+        IntExporter *m_exporter;
+        // Queues of the decode and aggregate stages, null when the stage runs inline
+        raw_queue_t *m_raw_queue;
+        decoded_queue_t *m_decoded_queue;
+        // Flow state of every thread running the aggregation, shards of m_store
+        std::unique_ptr<FlowStore> m_store;
+        std::vector<flow_state_t *> m_flows;
+        // Telemetry of every thread running the aggregation
+        std::vector<tm_thread_t *> m_tm;
+        // Telemetry of the queues, written by the monitor
+        tm_thread_t *m_raw_tm;
+        tm_thread_t *m_decoded_tm;
+        // Local archive of every thread running the aggregation, empty without -a
+        std::vector<std::unique_ptr<ArchiveWriter>> m_archive;
+        // Flight recorder of raw reports, null without -F
+        std::unique_ptr<Recorder> m_recorder;
+        // Archived points and bytes of writers already closed
+        std::atomic<uint64_t> m_archive_points;
+        std::atomic<uint64_t> m_archive_bytes;
+        // Statistics of the threads
+        std::vector<stage_thread_t> m_stats[STAGE_AGGREGATE + 1];
+        // Dropped reports of all stages
+        std::atomic<uint64_t> m_dropped;
+        // Stop flag of the RX threads and the monitor
+        volatile sig_atomic_t *m_stop;
+        std::atomic<bool> m_monitor_stop;
+        // Run time of the pipeline in seconds
+        double m_wall;
+};
+
+#endif // _PIPELINE_H_
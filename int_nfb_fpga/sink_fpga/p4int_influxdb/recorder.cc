@@ -0,0 +1,269 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Flight recorder of raw INT reports
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <stdexcept>
+
+#include "recorder.h"
+#include "source.h"
+#include "stage.h"
+
+// Report copied out of the ring by the dump
+typedef struct {
+    uint64_t ts;
+    uint16_t len;
+    uint16_t caplen;
+    uint8_t  data[RECORDER_SLOT_DATA];
+} recorded_t;
+
+// Dump requested by the signal
+static volatile sig_atomic_t recorder_signal = 0;
+
+/**
+ * Current UNIX time in nanoseconds
+ */
+static uint64_t now_unix_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void recorder_request() {
+    recorder_signal = 1;
+}
+
+Recorder::Recorder(const options_t *opt, uint32_t rings)
+    : m_rings(rings), m_window(opt->recorder_window * 1000000000ull), m_threshold(opt->recorder_delay),
+      m_dir(opt->recorder_dir), m_state(RECORDER_IDLE), m_trigger(0), m_holdoff(0), m_dumps(0), m_stop(false)
+{
+    // Slots hold the window at the expected rate unless given, power of two so the index is masked
+    uint64_t wanted = opt->recorder_slots != 0 ? opt->recorder_slots : opt->recorder_window * opt->recorder_rate;
+    uint64_t slots = 1;
+    while(slots < wanted) {
+        slots <<= 1;
+    }
+    for(uint32_t i = 0; i < rings; i++) {
+        recorder_ring_t &ring = m_rings[i];
+        if(ring_mem_alloc(&ring.mem, slots * sizeof(recorder_slot_t), -1, RING_MEM_HUGEPAGES) != RET_OK) {
+            for(uint32_t j = 0; j < i; j++) {
+                ring_mem_free(&m_rings[j].mem);
+            }
+            throw std::runtime_error("Unable to allocate the flight recorder");
+        }
+        ring.slots = new (ring.mem.addr) recorder_slot_t[slots];
+        ring.mask = slots - 1;
+        ring.head.store(0, std::memory_order_relaxed);
+    }
+    m_reason[0] = '\0';
+    printf("recorder - %u x %lu slots x %zu B, %.1f MiB, window %u s up to %lu reports/s of one RX thread\n", rings,
+        slots, sizeof(recorder_slot_t), rings * slots * sizeof(recorder_slot_t) / 1048576.0, opt->recorder_window,
+        slots / opt->recorder_window);
+    m_thread = std::thread(&Recorder::dumpThread, this);
+}
+
+Recorder::~Recorder()
+{
+    stop();
+    for(recorder_ring_t &ring : m_rings) {
+        ring_mem_free(&ring.mem);
+    }
+}
+
+void Recorder::record(uint32_t ring, const struct ndp_packet *packets, uint32_t count)
+{
+    recorder_ring_t &r = m_rings[ring];
+    uint64_t ts = now_unix_ns();
+    uint64_t head = r.head.load(std::memory_order_relaxed);
+    for(uint32_t i = 0; i < count; i++) {
+        recorder_slot_t &slot = r.slots[head++ & r.mask];
+        uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+        slot.seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.len = std::min<uint32_t>(packets[i].data_length, UINT16_MAX);
+        slot.caplen = std::min<uint32_t>(packets[i].data_length, RECORDER_SLOT_DATA);
+        slot.ts = ts;
+        memcpy(slot.data, packets[i].data, slot.caplen);
+        slot.seq.store(seq + 2, std::memory_order_release);
+    }
+    r.head.store(head, std::memory_order_release);
+}
+
+void Recorder::trigger(const char *reason)
+{
+    uint32_t idle = RECORDER_IDLE;
+    if(!m_state.compare_exchange_strong(idle, RECORDER_CLAIMED)) {
+        return;
+    }
+    m_trigger = now_unix_ns();
+    snprintf(m_reason, sizeof(m_reason), "%s", reason);
+    m_state.store(RECORDER_PENDING, std::memory_order_release);
+}
+
+void Recorder::triggerDelay()
+{
+    uint64_t now = now_unix_ns();
+    uint64_t holdoff = m_holdoff.load(std::memory_order_relaxed);
+    if(now < holdoff || !m_holdoff.compare_exchange_strong(holdoff, now + RECORDER_HOLDOFF_MS * 1000000ull)) {
+        return;
+    }
+    trigger("delay");
+}
+
+void Recorder::stop()
+{
+    m_stop = true;
+    if(m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void Recorder::dumpThread()
+{
+    stage_block_signals();
+    while(true) {
+        bool stopping = m_stop.load();
+        if(recorder_signal) {
+            recorder_signal = 0;
+            trigger("signal");
+        }
+        if(m_state.load(std::memory_order_acquire) == RECORDER_PENDING) {
+            // Reports after the trigger belong to the incident too, unless the sink stops
+            if(stopping || now_unix_ns() >= m_trigger + RECORDER_POST_MS * 1000000ull) {
+                dump(m_trigger, m_reason);
+                m_state.store(RECORDER_IDLE, std::memory_order_release);
+            }
+        }
+        if(stopping) {
+            break;
+        }
+        delay_usecs(RECORDER_POLL_USECS);
+    }
+}
+
+void Recorder::dump(uint64_t trigger, const char *reason)
+{
+    uint64_t from = trigger - std::min(trigger, m_window);
+    std::vector<recorded_t> copies;
+    uint64_t torn = 0;
+
+    // Copy the slots of the window, RX threads keep overwriting the oldest ones
+    for(recorder_ring_t &ring : m_rings) {
+        uint64_t head = ring.head.load(std::memory_order_acquire);
+        uint64_t tail = head > ring.mask + 1 ? head - ring.mask - 1 : 0;
+        for(uint64_t i = tail; i < head; i++) {
+            recorder_slot_t &slot = ring.slots[i & ring.mask];
+            uint32_t seq = slot.seq.load(std::memory_order_acquire);
+            if(slot.ts < from) {
+                continue;
+            }
+            copies.emplace_back();
+            recorded_t &copy = copies.back();
+            copy.len = slot.len;
+            copy.caplen = std::min<uint16_t>(slot.caplen, RECORDER_SLOT_DATA);
+            copy.ts = slot.ts;
+            memcpy(copy.data, slot.data, copy.caplen);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if((seq & 1) || slot.seq.load(std::memory_order_relaxed) != seq || copy.ts < from) {
+                // Overwritten during the copy
+                copies.pop_back();
+                torn++;
+            }
+        }
+    }
+    std::vector<const recorded_t *> reports;
+    for(const recorded_t &copy : copies) {
+        reports.push_back(&copy);
+    }
+    std::stable_sort(reports.begin(), reports.end(),
+        [](const recorded_t *a, const recorded_t *b) { return a->ts < b->ts; });
+
+    char name[64];
+    snprintf(name, sizeof(name), "/flight-%lu-%s.pcap", (uint64_t)(trigger / 1000000000), reason);
+    std::string path = m_dir + name;
+    std::string tmp = path + ".tmp";
+    FILE *file = fopen(tmp.c_str(), "wb");
+    if(file == NULL) {
+        printf("recorder - unable to create %s: %s\n", tmp.c_str(), strerror(errno));
+        return;
+    }
+    pcap_file_hdr_t hdr = {PCAP_MAGIC_NS, 2, 4, 0, 0, RECORDER_SLOT_DATA, PCAP_LINKTYPE_RAW_INT};
+    bool failed = fwrite(&hdr, sizeof(hdr), 1, file) != 1;
+    for(const recorded_t *report : reports) {
+        pcap_rec_hdr_t rec = {(uint32_t)(report->ts / 1000000000), (uint32_t)(report->ts % 1000000000),
+            report->caplen, report->len};
+        failed |= fwrite(&rec, sizeof(rec), 1, file) != 1;
+        failed |= fwrite(report->data, report->caplen, 1, file) != 1 && report->caplen != 0;
+    }
+    failed |= fclose(file) != 0;
+    if(failed || rename(tmp.c_str(), path.c_str()) != 0) {
+        printf("recorder - unable to write %s\n", path.c_str());
+        return;
+    }
+    m_dumps++;
+    double span = reports.empty() ? 0 : (reports.back()->ts - reports.front()->ts) / 1e9;
+    printf("recorder - %s, %zu reports of %.3f s (%s), %lu overwritten during the dump\n", path.c_str(),
+        reports.size(), span, reason, torn);
+}
+
+int32_t recorder_parse(const char *arg, options_t *opt) {
+    char *end;
+    opt->recorder_window = strtoul(arg, &end, 10);
+    if(end == arg || opt->recorder_window == 0) {
+        printf("Window of the flight recorder must be a positive number of seconds!\n");
+        return RET_ERR;
+    }
+
+    // Parameters key=value separated by commas
+    std::string params(*end == ',' ? end + 1 : end);
+    if(*end != '\0' && *end != ',') {
+        printf("Unknown flight recorder option \"%s\"!\n", arg);
+        return RET_ERR;
+    }
+    size_t pos = 0;
+    while(pos < params.size()) {
+        size_t next = params.find(',', pos);
+        std::string param = params.substr(pos, next == std::string::npos ? std::string::npos : next - pos);
+        pos = next == std::string::npos ? params.size() : next + 1;
+        size_t eq = param.find('=');
+        std::string key = param.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : param.substr(eq + 1);
+        if(key == "dir" && !value.empty()) {
+            opt->recorder_dir = value;
+            continue;
+        }
+        uint64_t number = strtoull(value.c_str(), &end, 0);
+        if(value.empty() || *end != '\0') {
+            printf("Unknown flight recorder parameter \"%s\"!\n", param.c_str());
+            return RET_ERR;
+        }
+        if(key == "rate" && number > 0) {
+            opt->recorder_rate = number;
+        } else if(key == "slots" && number > 0) {
+            opt->recorder_slots = number;
+        } else if(key == "delay") {
+            opt->recorder_delay = number;
+        } else {
+            printf("Unknown flight recorder parameter \"%s\"!\n", param.c_str());
+            return RET_ERR;
+        }
+    }
+
+    // Rate is limited before the multiplication, so it does not overflow
+    uint64_t slots = opt->recorder_slots;
+    if(slots == 0) {
+        slots = opt->recorder_rate > RECORDER_SLOTS_MAX ? opt->recorder_rate : opt->recorder_rate * opt->recorder_window;
+    }
+    if(slots > RECORDER_SLOTS_MAX) {
+        printf("Flight recorder has at most %llu slots of one RX thread, lower the window, rate or slots!\n",
+            RECORDER_SLOTS_MAX);
+        return RET_ERR;
+    }
+    return RET_OK;
+}
@@ -0,0 +1,166 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Flight recorder of raw INT reports
+ *
+ * Every RX thread copies the reports of its bursts into its own ring of
+ * fixed size slots, the oldest reports are overwritten. Slots are guarded by
+ * a sequence number (odd while written), so the dump thread reads them
+ * without any lock and skips the slots overwritten during the copy. The RX
+ * thread never waits for the dump.
+ *
+ * A trigger, SIGUSR2, \ref Recorder::trigger or a report delay over the
+ * threshold, makes the dump thread wait RECORDER_POST_MS and then write the
+ * reports of the window before the trigger and of the wait to a pcap file of
+ * PCAP_LINKTYPE_RAW_INT, which can be replayed by the replay source.
+ */
+
+#ifndef _RECORDER_H_
+#define _RECORDER_H_
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <nfb/ndp.h>
+
+#include "p4int.h"
+#include "ringbuffer.h"
+#include "ring_memory.h"
+
+// Bytes of a report kept in one slot, longer reports are truncated
+#define RECORDER_SLOT_DATA 496
+// Default expected rate of reports of one RX thread, the slots hold the window of it
+#define RECORDER_RATE_DEFAULT 20000
+// Maximal number of slots of one RX thread
+#define RECORDER_SLOTS_MAX (1ull << 26)
+// Default window of a dump in seconds
+#define RECORDER_WINDOW_DEFAULT 5
+// Recording continues after the trigger before the dump (ms)
+#define RECORDER_POST_MS 500
+// Delay threshold triggers at most once in this time (ms)
+#define RECORDER_HOLDOFF_MS 10000
+// Period of checking the triggers by the dump thread (us)
+#define RECORDER_POLL_USECS 10000
+// Length of the reason of the trigger
+#define RECORDER_REASON_LEN 16
+
+// States of the trigger
+#define RECORDER_IDLE    0 // No dump requested
+#define RECORDER_CLAIMED 1 // Trigger is storing its time and reason
+#define RECORDER_PENDING 2 // Dump thread owns the trigger
+
+// One recorded report
+typedef struct alignas(CACHE_LINE_SIZE) {
+    std::atomic<uint32_t> seq; // Odd while the slot is written
+    uint16_t len;              // Length of the report
+    uint16_t caplen;           // Recorded bytes of the report
+    uint64_t ts;               // Receive time (UNIX NS format)
+    uint8_t  data[RECORDER_SLOT_DATA];
+} recorder_slot_t;
+
+// Ring of one RX thread
+typedef struct {
+    ring_mem_t       mem;
+    recorder_slot_t *slots;
+    uint64_t         mask;                    // Number of slots - 1
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head; // Slots ever written
+} recorder_ring_t;
+
+/**
+ * Flight recorder of the last seconds of raw reports
+ */
+class Recorder
+{
+    public:
+        /**
+         * Constructor, allocates the rings and starts the dump thread.
+         * Throws std::runtime_error when the memory is not available.
+         * \param opt Program options, the window, slots, threshold and directory of -F
+         * \param rings Number of RX threads
+         */
+        Recorder(const options_t *opt, uint32_t rings);
+
+        /**
+         * Destructor, stops the dump thread and frees the rings
+         */
+        ~Recorder();
+
+        /**
+         * Copy reports of the burst to the ring of the RX thread
+         * \param ring Index of the RX thread
+         * \param packets Reports of the burst
+         * \param count Number of reports
+         */
+        void record(uint32_t ring, const struct ndp_packet *packets, uint32_t count);
+
+        /**
+         * Check the delay of the report against the threshold
+         * \param delay Delay of the report
+         */
+        inline void checkDelay(uint64_t delay) {
+            if(m_threshold != 0 && delay > m_threshold) {
+                triggerDelay();
+            }
+        }
+
+        /**
+         * Request the dump, ignored while another one is pending. Thread safe.
+         * \param reason Reason written to the name of the pcap file
+         */
+        void trigger(const char *reason);
+
+        /**
+         * Finish the pending dump and stop the dump thread
+         */
+        void stop();
+
+        /**
+         * Number of written dumps
+         */
+        uint32_t dumps() const { return m_dumps.load(); }
+
+    protected:
+        /**
+         * Trigger of the delay threshold, limited by RECORDER_HOLDOFF_MS
+         */
+        void triggerDelay();
+
+        /**
+         * Dump thread, waits for triggers
+         */
+        void dumpThread();
+
+        /**
+         * Write reports of the window to a pcap file
+         * \param trigger Time of the trigger (UNIX NS format)
+         * \param reason Reason of the trigger
+         */
+        void dump(uint64_t trigger, const char *reason);
+
+        std::vector<recorder_ring_t> m_rings;
+        uint64_t    m_window;      // Window of the dump in ns
+        uint64_t    m_threshold;   // Delay threshold, 0 disables it
+        std::string m_dir;         // Directory of the dumps
+        std::atomic<uint32_t> m_state;     // RECORDER_* state of the trigger
+        uint64_t              m_trigger;   // Time of the pending trigger
+        std::atomic<uint64_t> m_holdoff;   // Delay threshold is ignored until this time
+        char                  m_reason[RECORDER_REASON_LEN];
+        std::atomic<uint32_t> m_dumps;
+        std::atomic<bool>     m_stop;
+        std::thread           m_thread;
+};
+
+/**
+ * Parse the recorder option, "seconds[,rate=N,slots=N,delay=ns,dir=path]"
+ * \param arg Option string
+ * \param opt Where to store the configuration
+ * \return RET_OK on success
+ */
+int32_t recorder_parse(const char *arg, options_t *opt);
+
+/**
+ * Request the dump of the recorder, safe to call from a signal handler
+ */
+void recorder_request();
+
+#endif // _RECORDER_H_
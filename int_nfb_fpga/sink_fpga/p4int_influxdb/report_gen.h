@@ -0,0 +1,138 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Generator of synthetic INT reports
+ *
+ * Reports have the same layout as the ones produced by the P4 program of the
+ * sink: the int_influx_t header followed by the hop metadata of the instruction
+ * mask, int_meta_t by default, all in network order. Flows differ in source and destination address, so every
+ * flow has its own flow key. Reports are prebuilt into a pool which is then
+ * cycled, the generator itself costs only a pointer increment.
+ */
+
+#ifndef _REPORT_GEN_H_
+#define _REPORT_GEN_H_
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <arpa/inet.h>
+
+#include "int_process.h"
+
+// Minimal number of reports in the pool, bigger pools keep the cache cold
+#define REPORT_POOL_MIN 4096
+// Distance of two hop timestamps (ns)
+#define REPORT_HOP_NS 1000
+
+class ReportGenerator
+{
+public:
+    /**
+     * Constructor
+     * \param hops Number of hops of every report, 1 to MAX_NODES
+     * \param flows Number of distinct flows
+     * \param pool Minimal number of prebuilt reports
+     * \param first_flow Index of the first flow, generators with disjoint ranges produce disjoint flows
+     * \param mask INT instructions of the hop metadata
+     */
+    ReportGenerator(uint32_t hops, uint32_t flows, uint32_t pool = REPORT_POOL_MIN, uint32_t first_flow = 0,
+        uint16_t mask = INT_INST_LEGACY)
+        : mask_(mask), len_(sizeof(int_influx_t) + hops * int_hop_size(mask)), next_(0)
+    {
+        count_ = pool > flows ? pool : flows;
+        data_.resize(count_ * len_);
+        for (uint32_t i = 0; i < count_; i++)
+            build(&data_[i * len_], hops, first_flow + i % flows, i / flows + 1);
+    }
+
+    /**
+     * Next report of the pool
+     * \return Report data, valid as long as the generator
+     */
+    uint8_t * next()
+    {
+        uint8_t *report = &data_[next_ * len_];
+        if (++next_ == count_)
+            next_ = 0;
+        return report;
+    }
+
+    /**
+     * Fill the NDP packet with the next report
+     */
+    void next(struct ndp_packet &pkt)
+    {
+        pkt.data = next();
+        pkt.data_length = len_;
+        pkt.header = NULL;
+        pkt.header_length = 0;
+    }
+
+    uint32_t length() const { return len_; }
+    uint32_t count() const { return count_; }
+
+private:
+    static uint64_t hton64(uint64_t value)
+    {
+        return ((uint64_t)htonl(value & 0xffffffff) << 32) | htonl(value >> 32);
+    }
+
+    /**
+     * Store the field of the hop metadata if the mask has its instruction
+     */
+    void put32(uint8_t *hop, uint16_t inst, uint32_t value)
+    {
+        value = htonl(value);
+        if (mask_ & inst)
+            memcpy(hop + int_inst_offset(mask_, inst), &value, sizeof(value));
+    }
+
+    void put64(uint8_t *hop, uint16_t inst, uint64_t value)
+    {
+        value = hton64(value);
+        if (mask_ & inst)
+            memcpy(hop + int_inst_offset(mask_, inst), &value, sizeof(value));
+    }
+
+    void build(uint8_t *data, uint32_t hops, uint32_t flow, uint32_t seq)
+    {
+        uint64_t origin = 1700000000ull * 1000000000ull + seq * 1000000ull;
+        uint64_t sink = origin + (hops + 1) * REPORT_HOP_NS;
+
+        int_influx_t *hdr = (int_influx_t *)data;
+        memset(hdr, 0, sizeof(*hdr));
+        hdr->srcAddr = htonl(0x0a000000 | (flow & 0xffffff));
+        hdr->dstAddr = htonl(0x0a800000 | ((flow * 7) & 0xffffff));
+        hdr->ingress_port_id = htons(1024 + flow % 60000);
+        hdr->egress_port_id = htons(5001);
+        // Lengths are in 4-byte words as in the INT header
+        uint32_t hop_len = int_hop_size(mask_);
+        hdr->meta_len = hops * hop_len / 4;
+        hdr->hop_meta_len = hop_len / 4;
+        hdr->inst_mask = htons(mask_);
+        hdr->ndk_tstamp1 = htonl(sink / 1000000000ull);
+        hdr->ndk_tstamp2 = htonl(sink % 1000000000ull);
+        hdr->seq = htonl(flow % 2 ? 0 : seq);
+
+        uint8_t *meta = (uint8_t *)(hdr + 1);
+        memset(meta, 0, hops * hop_len);
+        for (uint32_t h = 0; h < hops; h++) {
+            uint8_t *hop = meta + h * hop_len;
+            put32(hop, INT_INST_SWITCH_ID, h + 1);
+            put32(hop, INT_INST_PORT_IDS, (1 << 16) | 2);
+            put32(hop, INT_INST_HOP_LATENCY, REPORT_HOP_NS / 2);
+            put32(hop, INT_INST_QUEUE, (h % 8) << 24 | (flow + seq) % 1000);
+            put64(hop, INT_INST_INGRESS_TS, origin + h * REPORT_HOP_NS);
+            put64(hop, INT_INST_EGRESS_TS, origin + h * REPORT_HOP_NS + REPORT_HOP_NS / 2);
+            put32(hop, INT_INST_TX_UTIL, (flow * 13 + h) % 100);
+        }
+    }
+
+    uint16_t mask_;
+    uint32_t len_;
+    uint32_t count_;
+    uint32_t next_;
+    std::vector<uint8_t> data_;
+};
+
+#endif // _REPORT_GEN_H_
@@ -0,0 +1,121 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Backing memory of ring buffers
+ */
+
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "p4int.h"
+#include "ring_memory.h"
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+#define PAGE_4K (4096ul)
+#define PAGE_2M (2ul << 20)
+#define PAGE_1G (1ul << 30)
+
+/**
+ * Round the size up to a multiple of the page size
+ * \param size Size in bytes
+ * \param page_size Page size in bytes
+ * \return Rounded size
+ */
+static size_t page_align(size_t size, size_t page_size) {
+    return (size + page_size - 1) & ~(page_size - 1);
+}
+
+/**
+ * Try to map anonymous memory backed by pages of the given size
+ * \param size Size in bytes, multiple of the page size
+ * \param page_size Page size in bytes
+ * \return Start of the region or MAP_FAILED
+ */
+static void *map_pages(size_t size, size_t page_size) {
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    if(page_size == PAGE_2M) {
+        flags |= MAP_HUGETLB | (21 << MAP_HUGE_SHIFT);
+    } else if(page_size == PAGE_1G) {
+        flags |= MAP_HUGETLB | (30 << MAP_HUGE_SHIFT);
+    }
+    return mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+}
+
+int32_t ring_mem_alloc(ring_mem_t *mem, size_t size, int node, uint32_t flags) {
+    mem->addr = MAP_FAILED;
+    mem->node = -1;
+
+    // Use the biggest page that does not waste more than half of the mapping
+    if(flags & RING_MEM_HUGEPAGES) {
+        const size_t pages[] = {PAGE_1G, PAGE_2M};
+        for(size_t page : pages) {
+            if(size < page / 2) {
+                continue;
+            }
+            mem->size = page_align(size, page);
+            mem->addr = map_pages(mem->size, page);
+            if(mem->addr != MAP_FAILED) {
+                mem->page_size = page;
+                break;
+            }
+        }
+    }
+
+    // Fallback to regular pages
+    if(mem->addr == MAP_FAILED) {
+        mem->page_size = PAGE_4K;
+        mem->size = page_align(size, PAGE_4K);
+        mem->addr = map_pages(mem->size, PAGE_4K);
+        if(mem->addr == MAP_FAILED) {
+            mem->addr = NULL;
+            return RET_ERR;
+        }
+        if(flags & RING_MEM_HUGEPAGES) {
+            madvise(mem->addr, mem->size, MADV_HUGEPAGE);
+        }
+    }
+
+    // Bind the region before the first touch, pages are then faulted on the node
+    if(node >= 0 && node < (int)(8 * sizeof(unsigned long))) {
+        unsigned long nodemask = 1ul << node;
+        long ret = syscall(__NR_mbind, mem->addr, mem->size, MPOL_BIND,
+            &nodemask, 8 * sizeof(nodemask), 0);
+        if(ret == 0) {
+            mem->node = node;
+        }
+    }
+
+    return RET_OK;
+}
+
+void ring_mem_free(ring_mem_t *mem) {
+    if(mem->addr) {
+        munmap(mem->addr, mem->size);
+    }
+    mem->addr = NULL;
+}
+
+int ring_mem_local_node() {
+    unsigned cpu;
+    unsigned node;
+    if(syscall(__NR_getcpu, &cpu, &node, NULL) != 0) {
+        return -1;
+    }
+    return node;
+}
+
+const char *ring_mem_page_name(size_t page_size) {
+    switch(page_size) {
+        case PAGE_1G:
+            return "1G";
+        case PAGE_2M:
+            return "2M";
+        default:
+            return "4K";
+    }
+}
@@ -0,0 +1,53 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Backing memory of ring buffers
+ */
+
+#ifndef _RING_MEMORY_H_
+#define _RING_MEMORY_H_
+
+#include <cstdint>
+#include <cstddef>
+
+// Try to back the memory by 1 GB or 2 MB hugepages
+#define RING_MEM_HUGEPAGES 0x1
+
+// Description of one memory region
+typedef struct {
+    void   *addr;      // Start of the region
+    size_t  size;      // Size of the mapped region in bytes
+    size_t  page_size; // Size of pages backing the region
+    int     node;      // NUMA node of the region, -1 when not bound
+} ring_mem_t;
+
+/**
+ * Map a memory region for a ring buffer. Hugepages are used when requested and
+ * available, 4 KB pages with transparent hugepages advice otherwise.
+ * \param mem Description of the mapped region
+ * \param size Requested size in bytes
+ * \param node NUMA node to bind the region to, negative value disables binding
+ * \param flags RING_MEM_* flags
+ * \return RET_OK on success
+ */
+int32_t ring_mem_alloc(ring_mem_t *mem, size_t size, int node, uint32_t flags);
+
+/**
+ * Unmap the memory region
+ * \param mem Region mapped by \ref ring_mem_alloc
+ */
+void ring_mem_free(ring_mem_t *mem);
+
+/**
+ * NUMA node of the CPU the calling thread runs on
+ * \return Node index, -1 when not known
+ */
+int ring_mem_local_node();
+
+/**
+ * Human readable name of the page size
+ * \param page_size Page size in bytes
+ * \return Name of the page size
+ */
+const char *ring_mem_page_name(size_t page_size);
+
+#endif // _RING_MEMORY_H_
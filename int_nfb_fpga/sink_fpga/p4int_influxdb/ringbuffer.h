@@ -5,43 +5,224 @@
 #ifndef INT_RINGBUFFER_H
 #define INT_RINGBUFFER_H
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
 #include <boost/atomic.hpp>
 
-template<typename T, size_t Size>
+#include "ring_memory.h"
+
+// Size of the CPU cache line
+#define CACHE_LINE_SIZE 64
+
+/**
+ * Single producer single consumer ring buffer.
+ *
+ * Indices are free running and masked by (size - 1), the capacity is rounded up
+ * to a power of two. Producer and consumer indices live on separate cache lines
+ * and each side keeps a cached copy of the opposite index, which is reloaded
+ * only when the ring looks full (producer) or empty (consumer).
+ *
+ * Items are stored in a region from \ref ring_mem_alloc, optionally backed by
+ * hugepages and bound to a NUMA node. Items are constructed by the calling
+ * thread, so create the ring from the thread that will use it the most.
+ */
+template<typename T>
 class ringbuffer {
 public:
-    ringbuffer() : head_(0), tail_(0) {}
+    /**
+     * Constructor
+     * \param capacity Minimal number of items
+     * \param node NUMA node of the storage, negative value disables binding
+     * \param flags RING_MEM_* flags of the storage
+     */
+    ringbuffer(size_t capacity, int node = -1, uint32_t flags = RING_MEM_HUGEPAGES)
+        : head_(0), tail_cache_(0), tail_(0), head_cache_(0)
+    {
+        size_ = 1;
+        while (size_ < capacity)
+            size_ <<= 1;
+        mask_ = size_ - 1;
+
+        if (ring_mem_alloc(&mem_, size_ * sizeof(T), node, flags) != 0)
+            throw std::runtime_error("Unable to allocate memory of the ring buffer");
+        ring_ = static_cast<T *>(mem_.addr);
+        for (size_t i = 0; i < size_; i++)
+            new (&ring_[i]) T();
+    }
+
+    ~ringbuffer()
+    {
+        for (size_t i = 0; i < size_; i++)
+            ring_[i].~T();
+        ring_mem_free(&mem_);
+    }
+
+    ringbuffer(const ringbuffer &) = delete;
+    ringbuffer & operator=(const ringbuffer &) = delete;
 
     bool push(const T & value)
     {
         size_t head = head_.load(boost::memory_order_relaxed);
-        size_t next_head = next(head);
-        if (next_head == tail_.load(boost::memory_order_acquire))
-            return false;
-        ring_[head] = value;
-        head_.store(next_head, boost::memory_order_release);
+        if (head - tail_cache_ == size_) {
+            tail_cache_ = tail_.load(boost::memory_order_acquire);
+            if (head - tail_cache_ == size_)
+                return false;
+        }
+        ring_[head & mask_] = value;
+        head_.store(head + 1, boost::memory_order_release);
         return true;
     }
-    
+
     bool pop(T & value)
     {
         size_t tail = tail_.load(boost::memory_order_relaxed);
-        if (tail == head_.load(boost::memory_order_acquire))
-            return false;
-        value = ring_[tail];
-        tail_.store(next(tail), boost::memory_order_release);
+        if (tail == head_cache_) {
+            head_cache_ = head_.load(boost::memory_order_acquire);
+            if (tail == head_cache_)
+                return false;
+        }
+        value = ring_[tail & mask_];
+        tail_.store(tail + 1, boost::memory_order_release);
         return true;
     }
 
-private:
+    /**
+     * Push up to count values with one index update
+     * \param values Array of values
+     * \param count Number of values in the array
+     * \return Number of stored values
+     */
+    size_t push_n(const T * values, size_t count)
+    {
+        return push_bulk(count, [values](size_t i) -> const T & { return values[i]; });
+    }
 
-    size_t next(size_t current)
+    /**
+     * Push selected values with one index update
+     * \param values Array of values
+     * \param index Indices of the values to store
+     * \param count Number of indices
+     * \return Number of stored values, the first ones from the index array
+     */
+    size_t push_n(const T * values, const uint32_t * index, size_t count)
     {
-        return (current + 1) % Size;
+        return push_bulk(count, [values, index](size_t i) -> const T & { return values[index[i]]; });
+    }
+
+    /**
+     * Pop up to count values with one index update
+     * \param values Output array
+     * \param count Capacity of the output array
+     * \return Number of read values
+     */
+    size_t pop_n(T * values, size_t count)
+    {
+        size_t tail = tail_.load(boost::memory_order_relaxed);
+        size_t avail = head_cache_ - tail;
+        if (avail < count) {
+            head_cache_ = head_.load(boost::memory_order_acquire);
+            avail = head_cache_ - tail;
+        }
+        if (count > avail)
+            count = avail;
+        // Two contiguous runs, see push_bulk()
+        T * ring = ring_;
+        size_t start = tail & mask_;
+        size_t first = std::min(count, size_ - start);
+        for (size_t i = 0; i < first; i++)
+            values[i] = ring[start + i];
+        for (size_t i = first; i < count; i++)
+            values[i] = ring[i - first];
+        if (count)
+            tail_.store(tail + count, boost::memory_order_release);
+        return count;
+    }
+
+    /**
+     * Discard up to count oldest values, called by the consumer
+     * \param count Number of values to discard
+     * \return Number of discarded values
+     */
+    size_t skip_n(size_t count)
+    {
+        size_t tail = tail_.load(boost::memory_order_relaxed);
+        head_cache_ = head_.load(boost::memory_order_acquire);
+        size_t avail = head_cache_ - tail;
+        if (count > avail)
+            count = avail;
+        if (count)
+            tail_.store(tail + count, boost::memory_order_release);
+        return count;
+    }
+
+    /**
+     * Number of items the ring can hold
+     */
+    size_t capacity() const
+    {
+        return size_;
+    }
+
+    /**
+     * Memory region backing the items
+     */
+    const ring_mem_t & memory() const
+    {
+        return mem_;
+    }
+
+    /**
+     * Approximate number of stored items, the value can be outdated
+     * by the time it is used when called concurrently.
+     */
+    size_t size() const
+    {
+        size_t tail = tail_.load(boost::memory_order_acquire);
+        size_t head = head_.load(boost::memory_order_acquire);
+        return head - tail;
+    }
+
+private:
+    template<typename Get>
+    size_t push_bulk(size_t count, Get get)
+    {
+        size_t head = head_.load(boost::memory_order_relaxed);
+        size_t space = size_ - (head - tail_cache_);
+        if (space < count) {
+            tail_cache_ = tail_.load(boost::memory_order_acquire);
+            space = size_ - (head - tail_cache_);
+        }
+        if (count > space)
+            count = space;
+        // Items are copied in two contiguous runs, up to the end of the storage and
+        // from its start, so no index is masked and the copies of the items follow
+        // each other.
+        T * ring = ring_;
+        size_t start = head & mask_;
+        size_t first = std::min(count, size_ - start);
+        for (size_t i = 0; i < first; i++)
+            ring[start + i] = get(i);
+        for (size_t i = first; i < count; i++)
+            ring[i - first] = get(i);
+        if (count)
+            head_.store(head + count, boost::memory_order_release);
+        return count;
     }
 
-    T ring_[Size];
-    boost::atomic<size_t> head_, tail_;
+    // Read only cache line shared by both sides
+    alignas(CACHE_LINE_SIZE) T * ring_;
+    size_t size_;
+    size_t mask_;
+    ring_mem_t mem_;
+    // Producer cache line
+    alignas(CACHE_LINE_SIZE) boost::atomic<size_t> head_;
+    size_t tail_cache_;
+    // Consumer cache line
+    alignas(CACHE_LINE_SIZE) boost::atomic<size_t> tail_;
+    size_t head_cache_;
 };
 
 #endif
@@ -0,0 +1,109 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Routing of reports to databases and measurements of the collector
+ */
+
+#include <stdexcept>
+
+#include "route.h"
+
+/**
+ * Name is usable in the URL of the database and in the line protocol without escaping
+ * \param name Name of a database, measurement or retention policy
+ */
+static bool route_name_valid(const std::string &name) {
+    if(name.empty() || name.size() > ROUTE_NAME_MAX) {
+        return false;
+    }
+    for(char c : name) {
+        if(!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+            c == '_' || c == '-' || c == '.')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int32_t route_parse(const char *text, route_t &route) {
+    const char *p = text;
+    while(*p == ' ' || *p == '\t') {
+        p++;
+    }
+    const char *end = p;
+    while(*end != '\0' && *end != ' ' && *end != '\t') {
+        end++;
+    }
+    std::string dest(p, end);
+    if(filter_rule_parse(end, route.rule) != RET_OK) {
+        return RET_ERR;
+    }
+
+    // Database and parameters key=value separated by commas
+    size_t pos = dest.find(',');
+    route.db = dest.substr(0, pos);
+    route.measurement.clear();
+    route.rp.clear();
+    if(!route_name_valid(route.db)) {
+        return RET_ERR;
+    }
+    while(pos != std::string::npos) {
+        size_t next = dest.find(',', pos + 1);
+        std::string param = dest.substr(pos + 1, next == std::string::npos ? std::string::npos : next - pos - 1);
+        pos = next;
+        size_t eq = param.find('=');
+        std::string key = param.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : param.substr(eq + 1);
+        if(!route_name_valid(value)) {
+            return RET_ERR;
+        }
+        if(key == "measurement") {
+            route.measurement = value;
+        } else if(key == "rp") {
+            route.rp = value;
+        } else {
+            return RET_ERR;
+        }
+    }
+    return RET_OK;
+}
+
+std::string route_dest_str(const route_dest_t &dest) {
+    return dest.db + (dest.rp.empty() ? "" : "." + dest.rp) + "/" + dest.measurement;
+}
+
+/**
+ * Rules of the routes
+ */
+static std::vector<filter_rule_t> route_rules(const std::vector<route_t> &routes) {
+    std::vector<filter_rule_t> rules;
+    rules.reserve(routes.size());
+    for(const route_t &route : routes) {
+        rules.push_back(route.rule);
+    }
+    return rules;
+}
+
+RouteTable::RouteTable(const std::vector<route_t> &routes)
+    : m_table(route_rules(routes))
+{
+    m_dests.push_back({ROUTE_DB_DEFAULT, ROUTE_MEASUREMENT_DEFAULT, ""});
+    for(const route_t &route : routes) {
+        route_dest_t dest = {route.db.empty() ? ROUTE_DB_DEFAULT : route.db,
+            route.measurement.empty() ? ROUTE_MEASUREMENT_DEFAULT : route.measurement, route.rp};
+
+        // Routes of the same destination share its batches
+        uint32_t id = 0;
+        while(id < m_dests.size() && (m_dests[id].db != dest.db || m_dests[id].measurement != dest.measurement ||
+            m_dests[id].rp != dest.rp)) {
+            id++;
+        }
+        if(id == m_dests.size()) {
+            if(m_dests.size() == ROUTE_DESTINATIONS_MAX) {
+                throw std::runtime_error("Too many destinations of routes, the maximum is " +
+                    std::to_string(ROUTE_DESTINATIONS_MAX));
+            }
+            m_dests.push_back(dest);
+        }
+        m_rule_dest.push_back(id);
+    }
+}
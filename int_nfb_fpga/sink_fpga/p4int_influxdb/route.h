@@ -0,0 +1,107 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Routing of reports to databases and measurements of the collector
+ *
+ * Routes select reports by the rules of the flow filter, the source prefix,
+ * the egress port range and the destination prefix, and map them to a
+ * destination: a database, a measurement and a retention policy. The route
+ * of the longest source prefix wins, routes of one prefix are tried in the
+ * order of the file. Reports of no route go to the default destination.
+ * Routes of the same destination share it, every serializer keeps one batch
+ * per destination and every thread sending batches keeps one transport per
+ * destination.
+ */
+
+#ifndef _ROUTE_H_
+#define _ROUTE_H_
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+
+#include "p4int.h"
+#include "filter.h"
+
+// Database of reports without a route
+#define ROUTE_DB_DEFAULT "int_telemetry_db"
+// Measurement of reports without a route
+#define ROUTE_MEASUREMENT_DEFAULT "int_telemetry"
+// Maximal number of destinations, the default one included
+#define ROUTE_DESTINATIONS_MAX 256
+// Maximal length of a database, measurement or retention policy name, keeps the tags of a record bounded
+#define ROUTE_NAME_MAX 64
+
+// Destination of records, empty retention policy is the default one of the database
+typedef struct {
+    std::string db;
+    std::string measurement;
+    std::string rp;
+} route_dest_t;
+
+/**
+ * Parse the route, "db[,measurement=name,rp=policy] rule" with the rule of \ref filter_rule_parse,
+ * names are at most \ref ROUTE_NAME_MAX characters of [A-Za-z0-9_.-]
+ * \param text Route text
+ * \param route Where to store the route
+ * \return RET_OK on success
+ */
+int32_t route_parse(const char *text, route_t &route);
+
+/**
+ * Format the destination, "db[.rp]/measurement"
+ * \param dest Destination of records
+ * \return Destination text
+ */
+std::string route_dest_str(const route_dest_t &dest);
+
+/**
+ * Compiled routes, immutable
+ */
+class RouteTable
+{
+    public:
+        /**
+         * Constructor, compiles the routes, throws std::runtime_error when there
+         * are too many destinations
+         * \param routes Routes in the order of the file (-D)
+         */
+        RouteTable(const std::vector<route_t> &routes);
+
+        /**
+         * Number of destinations, the default one is 0
+         */
+        uint32_t destinations() const { return m_dests.size(); }
+
+        /**
+         * Destination of records
+         * \param dest Index of the destination
+         */
+        const route_dest_t &destination(uint32_t dest) const { return m_dests[dest]; }
+
+        /**
+         * Find the destination of the record
+         * \param record Record of a report
+         * \return Index of the destination
+         */
+        inline uint32_t lookup(const telemetric_hdr_t &record) const
+        {
+            if(m_table.empty()) {
+                return 0;
+            }
+            // Flow key holds the source and destination address of the report in network order
+            uint32_t src;
+            uint32_t dst;
+            memcpy(&src, &record.flowKey, sizeof(src));
+            memcpy(&dst, (const uint8_t *)&record.flowKey + sizeof(src), sizeof(dst));
+            uint32_t rule = m_table.lookup(ntohl(src), ntohl(dst), record.dstPort);
+            return rule != 0 ? m_rule_dest[rule - 1] : 0;
+        }
+
+    protected:
+        FilterTable               m_table;     // Rules of the routes
+        std::vector<uint32_t>     m_rule_dest; // Destination of every route
+        std::vector<route_dest_t> m_dests;     // Destinations, the default one first
+};
+
+#endif // _ROUTE_H_
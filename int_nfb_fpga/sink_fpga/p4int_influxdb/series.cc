@@ -0,0 +1,96 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Cardinality guard of the exported series
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "series.h"
+
+SeriesGuard::SeriesGuard(uint64_t limit)
+    : m_limit(limit), m_exact(std::min<uint64_t>(limit, SERIES_EXACT_MAX)), m_checks(0), m_estimate(0), m_admitted(0)
+{
+    // Set is at most half full, probes stay short also for series over the limit
+    size_t slots = 1;
+    while(slots < 2 * m_exact) {
+        slots <<= 1;
+    }
+    m_mask = slots - 1;
+    m_slots.reset(new std::atomic<uint64_t>[slots]());
+    for(std::atomic<uint8_t> &reg : m_registers) {
+        reg.store(0, std::memory_order_relaxed);
+    }
+}
+
+bool SeriesGuard::admit(uint64_t key)
+{
+    key = key != 0 ? key : 1;
+    observe(key);
+    for(size_t i = key & m_mask; ; i = (i + 1) & m_mask) {
+        uint64_t slot = m_slots[i].load(std::memory_order_acquire);
+        if(slot == key) {
+            return true;
+        }
+        if(slot != 0) {
+            continue;
+        }
+
+        // Reserve a place in the set, then race for the slot
+        uint64_t admitted = m_admitted.load(std::memory_order_relaxed);
+        do {
+            if(admitted >= m_exact) {
+                return m_exact < m_limit && admitEstimated();
+            }
+        } while(!m_admitted.compare_exchange_weak(admitted, admitted + 1, std::memory_order_relaxed));
+        if(m_slots[i].compare_exchange_strong(slot, key, std::memory_order_acq_rel)) {
+            return true;
+        }
+        m_admitted.fetch_sub(1, std::memory_order_relaxed);
+        if(slot == key) {
+            return true;
+        }
+    }
+}
+
+bool SeriesGuard::admitEstimated()
+{
+    if(m_checks.fetch_add(1, std::memory_order_relaxed) % SERIES_ESTIMATE_PERIOD == 0) {
+        m_estimate.store(estimate(), std::memory_order_relaxed);
+    }
+    return m_estimate.load(std::memory_order_relaxed) < m_limit;
+}
+
+void SeriesGuard::observe(uint64_t key)
+{
+    // Upper bits select the register, the rank is the position of the first set bit of the rest
+    std::atomic<uint8_t> &reg = m_registers[key >> (64 - SERIES_HLL_BITS)];
+    uint8_t rank = __builtin_clzll((key << SERIES_HLL_BITS) | (1ull << (SERIES_HLL_BITS - 1))) + 1;
+    uint8_t current = reg.load(std::memory_order_relaxed);
+    while(rank > current && !reg.compare_exchange_weak(current, rank, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t SeriesGuard::estimate() const
+{
+    const double m = SERIES_HLL_REGISTERS;
+    double sum = 0;
+    uint32_t zeros = 0;
+    for(const std::atomic<uint8_t> &reg : m_registers) {
+        uint8_t rank = reg.load(std::memory_order_relaxed);
+        sum += std::ldexp(1.0, -rank);
+        zeros += rank == 0;
+    }
+    double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+
+    // Linear counting is more precise for small cardinalities
+    if(estimate <= 2.5 * m && zeros != 0) {
+        estimate = m * std::log(m / zeros);
+    }
+    return std::llround(estimate);
+}
+
+size_t SeriesGuard::memory() const
+{
+    return (m_mask + 1) * sizeof(uint64_t) + sizeof(m_registers);
+}
@@ -0,0 +1,105 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Cardinality guard of the exported series
+ *
+ * Every record belongs to the InfluxDB series of its measurement and tags.
+ * The guard admits new series until the limit (-e series=N) is reached,
+ * records of later series are folded to the series "other". A HyperLogLog
+ * can not tell whether a series was seen, so admitted series are kept in
+ * an insert only hash set of their 64-bit keys shared by all serializers,
+ * twice the limit in size, and stay admitted for the whole run. The
+ * HyperLogLog counts all series seen, folded ones included, and estimates
+ * the cardinality the collector would hold without the guard.
+ *
+ * The set holds at most SERIES_EXACT_MAX series. Over it, series are admitted
+ * while the estimate is under the limit, so the limit holds within the error
+ * of the HyperLogLog and a series admitted earlier can be folded later.
+ */
+
+#ifndef _SERIES_H_
+#define _SERIES_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+
+// Register index bits of the HyperLogLog, 4096 registers have a standard error of 1.6 %
+#define SERIES_HLL_BITS 12
+#define SERIES_HLL_REGISTERS (1 << SERIES_HLL_BITS)
+// Largest limit of distinct series
+#define SERIES_LIMIT_MAX (1ull << 32)
+// Series of the exact set, 64 MiB of slots
+#define SERIES_EXACT_MAX (1 << 22)
+// Series checked over the exact set between two estimates
+#define SERIES_ESTIMATE_PERIOD 1024
+
+/**
+ * Limit of distinct series, thread safe
+ */
+class SeriesGuard
+{
+    public:
+        /**
+         * Constructor
+         * \param limit Maximal number of admitted series
+         */
+        SeriesGuard(uint64_t limit);
+
+        /**
+         * Admit the series of a record, a new series is admitted under the limit only
+         * \param key Hash of the measurement and the tags of the record
+         * \return False when the record has to be folded to the series "other"
+         */
+        bool admit(uint64_t key);
+
+        /**
+         * Number of series admitted by the exact set
+         */
+        uint64_t admitted() const { return m_admitted.load(std::memory_order_relaxed); }
+
+        /**
+         * Limit of admitted series
+         */
+        uint64_t limit() const { return m_limit; }
+
+        /**
+         * Limit of the series of the exact set, the smaller of the limit and SERIES_EXACT_MAX
+         */
+        uint64_t exact() const { return m_exact; }
+
+        /**
+         * Estimate of distinct series seen, folded ones included
+         */
+        uint64_t estimate() const;
+
+        /**
+         * Memory of the set and the registers in bytes
+         */
+        size_t memory() const;
+
+    protected:
+        /**
+         * Add the series to the HyperLogLog
+         * \param key Hash of the series
+         */
+        void observe(uint64_t key);
+
+        /**
+         * Admit a series missing in the full exact set by the estimate, refreshed
+         * every SERIES_ESTIMATE_PERIOD calls
+         * \return False when the estimate reached the limit
+         */
+        bool admitEstimated();
+
+        uint64_t                                 m_limit;
+        uint64_t                                 m_exact;    // Series kept in the set
+        std::atomic<uint64_t>                    m_checks;   // Calls of admitEstimated()
+        std::atomic<uint64_t>                    m_estimate; // Last estimate of admitEstimated()
+        size_t                                   m_mask;     // Slots of the set - 1
+        std::unique_ptr<std::atomic<uint64_t>[]> m_slots;    // Keys of admitted series, 0 is an empty slot
+        std::atomic<uint64_t>                    m_admitted; // Series of the set, at most m_exact
+        std::atomic<uint8_t>                     m_registers[SERIES_HLL_REGISTERS];
+};
+
+#endif // _SERIES_H_
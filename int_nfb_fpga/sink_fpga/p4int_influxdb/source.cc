@@ -0,0 +1,329 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Sources of INT reports read by the RX stage
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <stdexcept>
+#include <arpa/inet.h>
+
+#include "source.h"
+#include "capture.h"
+#ifdef WITH_DPDK
+#include "dpdk_source.h"
+#endif
+#include "stage.h"
+
+// Names of SOURCE_* values, prefixes of labels of sources
+static const char *source_names[] = {"nfb", "synth", "replay", "capture", "dpdk"};
+
+/**
+ * Current UNIX time in nanoseconds
+ */
+static uint64_t now_unix_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Shift the timestamp of the hop metadata
+ * \param data Timestamp in network order, may be unaligned
+ * \param shift Shift in ns
+ */
+static void shift_tstamp(uint8_t *data, uint64_t shift) {
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    value = ntoh64(ntoh64(value) + shift);
+    memcpy(data, &value, sizeof(value));
+}
+
+/**
+ * Shift all timestamps of the report, so its sink timestamp is the given time
+ * \param data Report data
+ * \param len Length of the report
+ * \param now New sink timestamp in UNIX NS format
+ */
+static void report_retime(uint8_t *data, uint32_t len, uint64_t now) {
+    if(len < sizeof(int_influx_t)) {
+        return;
+    }
+    int_influx_t *hdr = (int_influx_t *)data;
+    uint64_t sink = ntohl(hdr->ndk_tstamp1) * 1000000000ull + ntohl(hdr->ndk_tstamp2);
+    uint64_t shift = now - sink;
+    hdr->ndk_tstamp1 = htonl(now / 1000000000ull);
+    hdr->ndk_tstamp2 = htonl(now % 1000000000ull);
+
+    uint16_t mask = ntohs(hdr->inst_mask) ? ntohs(hdr->inst_mask) : INT_INST_LEGACY;
+    uint32_t stride = int_hop_size(mask);
+    uint8_t *meta = (uint8_t *)(hdr + 1);
+    uint32_t hops = hdr->hop_meta_len ? hdr->meta_len / hdr->hop_meta_len : 0;
+    for(uint32_t h = 0; h < hops && meta + (h + 1) * stride <= data + len; h++) {
+        if(mask & INT_INST_INGRESS_TS) {
+            shift_tstamp(meta + h * stride + int_inst_offset(mask, INT_INST_INGRESS_TS), shift);
+        }
+        if(mask & INT_INST_EGRESS_TS) {
+            shift_tstamp(meta + h * stride + int_inst_offset(mask, INT_INST_EGRESS_TS), shift);
+        }
+    }
+}
+
+NdpSource::NdpSource(const nfb_int_dev_t *nfb, uint32_t queue)
+    : m_nfb(nfb), m_queue(queue)
+{
+}
+
+uint32_t NdpSource::burstGet(struct ndp_packet *packets, uint32_t count)
+{
+    return ndp_rx_burst_get(m_nfb->rx[m_queue], packets, count);
+}
+
+void NdpSource::burstPut()
+{
+    ndp_rx_burst_put(m_nfb->rx[m_queue]);
+}
+
+int32_t NdpSource::discarded(uint64_t *discarded) const
+{
+    return read_rx_discarded(m_nfb, m_queue, discarded);
+}
+
+PacedSource::PacedSource(uint64_t rate)
+    : m_rate(rate), m_start(0), m_sent(0)
+{
+}
+
+uint32_t PacedSource::burstGet(struct ndp_packet *packets, uint32_t count)
+{
+    uint64_t now = stage_now_ns();
+    if(m_start == 0) {
+        m_start = now;
+    }
+    if(m_rate != 0) {
+        // Reports allowed since the start, the RX thread backs off when there are none
+        uint64_t allowed = (uint64_t)((now - m_start) / 1e9 * m_rate);
+        if(allowed <= m_sent) {
+            return 0;
+        }
+        if(allowed - m_sent < count) {
+            count = allowed - m_sent;
+        }
+    }
+
+    uint64_t unix_now = now_unix_ns();
+    uint32_t cnt = 0;
+    while(cnt < count && next(packets[cnt])) {
+        report_retime(packets[cnt].data, packets[cnt].data_length, unix_now);
+        cnt++;
+    }
+    m_sent += cnt;
+    return cnt;
+}
+
+SynthSource::SynthSource(const source_cfg_t &cfg, uint32_t queue)
+    : PacedSource(cfg.rate), m_gen(cfg.hops, cfg.flows, REPORT_POOL_MIN, queue * cfg.flows, cfg.mask)
+{
+}
+
+bool SynthSource::next(struct ndp_packet &pkt)
+{
+    m_gen.next(pkt);
+    return true;
+}
+
+ReplaySource::ReplaySource(const source_cfg_t &cfg)
+    : PacedSource(cfg.rate), m_next(0)
+{
+    std::ifstream file(cfg.file, std::ios::binary);
+    if(!file) {
+        throw std::runtime_error("Unable to open the replay file " + cfg.file);
+    }
+
+    pcap_file_hdr_t hdr;
+    if(!file.read((char *)&hdr, sizeof(hdr)) || (hdr.magic != PCAP_MAGIC_US && hdr.magic != PCAP_MAGIC_NS)) {
+        throw std::runtime_error("Replay file " + cfg.file + " is not a pcap file in the host byte order");
+    }
+    if(hdr.linktype != PCAP_LINKTYPE_RAW_INT) {
+        throw std::runtime_error("Replay file " + cfg.file + " does not contain raw INT reports (link type 147)");
+    }
+
+    pcap_rec_hdr_t rec;
+    while(file.read((char *)&rec, sizeof(rec))) {
+        std::vector<uint8_t> report(rec.caplen);
+        if(!file.read((char *)report.data(), rec.caplen)) {
+            break;
+        }
+        if(rec.caplen >= sizeof(int_influx_t)) {
+            m_reports.push_back(std::move(report));
+        }
+    }
+    if(m_reports.empty()) {
+        throw std::runtime_error("Replay file " + cfg.file + " contains no INT report");
+    }
+}
+
+bool ReplaySource::next(struct ndp_packet &pkt)
+{
+    std::vector<uint8_t> &report = m_reports[m_next];
+    if(++m_next == m_reports.size()) {
+        m_next = 0;
+    }
+    pkt.data = report.data();
+    pkt.data_length = report.size();
+    pkt.header = NULL;
+    pkt.header_length = 0;
+    return true;
+}
+
+/**
+ * Parse list of key=value parameters of the source
+ * \param str Parameters separated by commas
+ * \param cfg Where to store the parameters
+ * \return RET_OK on success
+ */
+static int32_t parse_source_params(const char *str, source_cfg_t *cfg) {
+    while(*str) {
+        const char *end = strchr(str, ',');
+        std::string param(str, end ? end - str : strlen(str));
+        size_t eq = param.find('=');
+        if(eq == std::string::npos) {
+            printf("Source parameter \"%s\" is not in format key=value!\n", param.c_str());
+            return RET_ERR;
+        }
+        std::string key = param.substr(0, eq);
+        uint64_t value = strtoull(param.c_str() + eq + 1, NULL, 0);
+        if(key == "hops" && value >= 1 && value <= MAX_NODES) {
+            cfg->hops = value;
+        } else if(key == "flows" && value >= 1) {
+            cfg->flows = value;
+        } else if(key == "rate") {
+            cfg->rate = value;
+        } else if(key == "mask" && value <= 0xffff && int_hop_size(value) != 0) {
+            cfg->mask = value;
+        } else if(key == "xdp" && value <= 1) {
+            cfg->xdp = value;
+        } else if(key == "zc" && value <= 1) {
+            cfg->zerocopy = value;
+        } else if(key == "port" && value <= 0xffff) {
+            cfg->port = value;
+        } else if(key == "dev") {
+            cfg->dev = value;
+        } else if(key == "queues" && value >= 1) {
+            cfg->queues = value;
+        } else {
+            printf("Invalid source parameter \"%s\"!\n", param.c_str());
+            return RET_ERR;
+        }
+        str = end ? end + 1 : str + param.size();
+    }
+    return RET_OK;
+}
+
+int32_t source_parse(const char *arg, source_cfg_t *cfg) {
+    cfg->queues = 0;
+    cfg->dev = SOURCE_DEV_DEFAULT;
+    cfg->hops = SOURCE_SYNTH_HOPS;
+    cfg->flows = SOURCE_SYNTH_FLOWS;
+    cfg->rate = 0;
+    cfg->mask = INT_INST_LEGACY;
+    cfg->file.clear();
+    cfg->iface.clear();
+    cfg->xdp = 1;
+    cfg->zerocopy = 1;
+    cfg->port = 0;
+
+    if(strncmp(arg, "nfb", 3) == 0 && (arg[3] == '\0' || arg[3] == ':')) {
+        cfg->type = SOURCE_NFB;
+        return parse_source_params(arg[3] ? arg + 4 : arg + 3, cfg);
+    }
+    if(strncmp(arg, "synth", 5) == 0 && (arg[5] == '\0' || arg[5] == ':')) {
+        cfg->type = SOURCE_SYNTH;
+        return parse_source_params(arg[5] ? arg + 6 : arg + 5, cfg);
+    }
+    if(strncmp(arg, "replay:", 7) == 0) {
+        cfg->type = SOURCE_REPLAY;
+        const char *params = strchr(arg + 7, ',');
+        cfg->file.assign(arg + 7, params ? params - arg - 7 : strlen(arg + 7));
+        if(cfg->file.empty()) {
+            printf("Missing file of the replay source!\n");
+            return RET_ERR;
+        }
+        return params ? parse_source_params(params + 1, cfg) : RET_OK;
+    }
+    if(strncmp(arg, "capture:", 8) == 0) {
+        cfg->type = SOURCE_CAPTURE;
+        const char *params = strchr(arg + 8, ',');
+        cfg->iface.assign(arg + 8, params ? params - arg - 8 : strlen(arg + 8));
+        if(cfg->iface.empty()) {
+            printf("Missing interface of the capture source!\n");
+            return RET_ERR;
+        }
+        return params ? parse_source_params(params + 1, cfg) : RET_OK;
+    }
+    if(strncmp(arg, "dpdk", 4) == 0 && (arg[4] == '\0' || arg[4] == ':')) {
+#ifdef WITH_DPDK
+        cfg->type = SOURCE_DPDK;
+        return parse_source_params(arg[4] ? arg + 5 : arg + 4, cfg);
+#else
+        printf("The sink is built without DPDK, build it by make DPDK=1!\n");
+        return RET_ERR;
+#endif
+    }
+    printf("Unknown source \"%s\"!\n", arg);
+    return RET_ERR;
+}
+
+int32_t source_resolve(options_t *opt) {
+    if(opt->sources.empty()) {
+        opt->sources.emplace_back();
+        source_parse("nfb", &opt->sources.back());
+    }
+
+    uint32_t rx = 0;
+    uint32_t dpdk = 0;
+    for(size_t i = 0; i < opt->sources.size(); i++) {
+        source_cfg_t &cfg = opt->sources[i];
+        cfg.name = source_names[cfg.type] + std::to_string(i);
+        if(cfg.dev == SOURCE_DEV_DEFAULT) {
+            cfg.dev = opt->devId;
+        }
+        if(cfg.queues == 0) {
+            cfg.queues = opt->sources.size() == 1 ? opt->stages[STAGE_RX].threads : 1;
+        }
+        rx += cfg.queues;
+        dpdk += cfg.type == SOURCE_DPDK;
+    }
+    if(dpdk > 1) {
+        printf("Only one DPDK source is supported, use its queues instead!\n");
+        return RET_ERR;
+    }
+    opt->stages[STAGE_RX].threads = rx;
+
+    // Flows of all sources share one flow state sharded by the flow hash,
+    // RX threads of different sources must not aggregate their own reports
+    if(opt->sources.size() > 1 && opt->stages[STAGE_DECODE].threads == 0 && opt->stages[STAGE_AGGREGATE].threads == 0) {
+        opt->stages[STAGE_AGGREGATE].threads = 1;
+    }
+    return RET_OK;
+}
+
+std::unique_ptr<PacketSource> source_create(const source_cfg_t &cfg, const nfb_int_dev_t *nfb, uint32_t queue) {
+    switch(cfg.type) {
+        case SOURCE_SYNTH:
+            return std::unique_ptr<PacketSource>(new SynthSource(cfg, queue));
+        case SOURCE_REPLAY:
+            return std::unique_ptr<PacketSource>(new ReplaySource(cfg));
+        case SOURCE_CAPTURE:
+            return capture_create(cfg, queue);
+#ifdef WITH_DPDK
+        case SOURCE_DPDK:
+            return std::unique_ptr<PacketSource>(new DpdkSource(cfg, queue));
+#endif
+        default:
+            return std::unique_ptr<PacketSource>(new NdpSource(nfb, queue));
+    }
+}
@@ -0,0 +1,200 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Sources of INT reports read by the RX stage
+ */
+
+#ifndef _SOURCE_H_
+#define _SOURCE_H_
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+
+#include "p4int.h"
+#include "device.h"
+#include "report_gen.h"
+
+// Default parameters of the synthetic source
+#define SOURCE_SYNTH_HOPS  5
+#define SOURCE_SYNTH_FLOWS 1000
+
+// NFB source without the dev parameter uses the device of -d
+#define SOURCE_DEV_DEFAULT UINT32_MAX
+
+// Link type of pcap files with raw INT reports, LINKTYPE_USER0
+#define PCAP_LINKTYPE_RAW_INT 147
+// Magic numbers of the pcap file with us and ns timestamps
+#define PCAP_MAGIC_US 0xa1b2c3d4
+#define PCAP_MAGIC_NS 0xa1b23c4d
+
+// Header of the pcap file
+typedef struct {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t  thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+} pcap_file_hdr_t;
+
+// Header of one pcap record
+typedef struct {
+    uint32_t ts_sec;
+    uint32_t ts_frac;
+    uint32_t caplen;
+    uint32_t len;
+} pcap_rec_hdr_t;
+
+/**
+ * Source of INT reports of one RX thread. Reports of a burst stay valid
+ * until burstPut() is called.
+ */
+class PacketSource
+{
+    public:
+        virtual ~PacketSource() {}
+
+        /**
+         * Read a burst of reports
+         * \param packets Where to store the reports
+         * \param count Maximal number of reports
+         * \return Number of read reports
+         */
+        virtual uint32_t burstGet(struct ndp_packet *packets, uint32_t count) = 0;
+
+        /**
+         * Release reports of the last burst
+         */
+        virtual void burstPut() {}
+
+        /**
+         * Read the number of reports the source lost because they were not read in time
+         * \param discarded Where to store the counter
+         * \return RET_OK on success, RET_ERR when the source has no such counter
+         */
+        virtual int32_t discarded(uint64_t *discarded) const { return RET_ERR; }
+};
+
+/**
+ * NDP queue of the NFB card
+ */
+class NdpSource : public PacketSource
+{
+    public:
+        /**
+         * Constructor
+         * \param nfb Opened device
+         * \param queue Index of the RX queue
+         */
+        NdpSource(const nfb_int_dev_t *nfb, uint32_t queue);
+
+        uint32_t burstGet(struct ndp_packet *packets, uint32_t count) override;
+        void burstPut() override;
+        int32_t discarded(uint64_t *discarded) const override;
+
+    protected:
+        const nfb_int_dev_t *m_nfb;
+        uint32_t m_queue;
+};
+
+/**
+ * Source pacing reports of a prebuilt pool. Timestamps of every report are
+ * shifted so its sink timestamp is the time of reading, the exported records
+ * then carry the RX time and the collector can measure the RX to delivery latency.
+ */
+class PacedSource : public PacketSource
+{
+    public:
+        /**
+         * Constructor
+         * \param rate Reports per second, 0 is unlimited
+         */
+        explicit PacedSource(uint64_t rate);
+
+        uint32_t burstGet(struct ndp_packet *packets, uint32_t count) override;
+
+    protected:
+        /**
+         * Next report of the pool
+         * \param pkt Where to store the report
+         * \return false when the source has no more reports
+         */
+        virtual bool next(struct ndp_packet &pkt) = 0;
+
+        // Reports per second
+        uint64_t m_rate;
+        // Start of the pacing and number of read reports
+        uint64_t m_start;
+        uint64_t m_sent;
+};
+
+/**
+ * Synthetic reports of the \ref ReportGenerator
+ */
+class SynthSource : public PacedSource
+{
+    public:
+        /**
+         * Constructor
+         * \param cfg Configuration of the source
+         * \param queue Index of the RX thread, every thread generates its own flows
+         */
+        SynthSource(const source_cfg_t &cfg, uint32_t queue);
+
+    protected:
+        bool next(struct ndp_packet &pkt) override;
+
+        ReportGenerator m_gen;
+};
+
+/**
+ * Raw INT reports replayed in a loop from a pcap file of LINKTYPE_USER0
+ */
+class ReplaySource : public PacedSource
+{
+    public:
+        /**
+         * Constructor, loads the whole file
+         * \param cfg Configuration of the source
+         */
+        explicit ReplaySource(const source_cfg_t &cfg);
+
+    protected:
+        bool next(struct ndp_packet &pkt) override;
+
+        // Reports of the file, each one in its own buffer so they can be retimed in place
+        std::vector<std::vector<uint8_t>> m_reports;
+        size_t m_next;
+};
+
+/**
+ * Parse the source of reports, "nfb[:dev=N,queues=N]", "synth[:hops=N,flows=N,rate=N,mask=N]",
+ * "replay:file[,rate=N]", "capture:iface[,xdp=0|1,zc=0|1]" or "dpdk[:port=N]", all sources
+ * accept the queues parameter
+ * \param arg Source string
+ * \param cfg Where to store the configuration
+ * \return RET_OK on success
+ */
+int32_t source_parse(const char *arg, source_cfg_t *cfg);
+
+/**
+ * Complete configuration of all sources after parsing of the arguments. The
+ * default source is the NFB device of -d, a single source without the queues
+ * parameter has one queue per RX thread of -P rx=N, several sources one queue
+ * by default. Then the RX stage has one thread per queue of every source.
+ * \param opt Program options
+ * \return RET_OK on success
+ */
+int32_t source_resolve(options_t *opt);
+
+/**
+ * Create the source of one RX thread
+ * \param cfg Configuration of the source
+ * \param nfb Opened device of the source, used by the NFB source only
+ * \param queue Index of the queue of the source
+ * \return Source of reports, throws std::runtime_error on failure
+ */
+std::unique_ptr<PacketSource> source_create(const source_cfg_t &cfg, const nfb_int_dev_t *nfb, uint32_t queue);
+
+#endif // _SOURCE_H_
@@ -0,0 +1,193 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Configuration and statistics of pipeline stages
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <csignal>
+#include <pthread.h>
+
+#include "stage.h"
+
+static const char *stage_names[STAGE_CNT] = {"rx", "decode", "aggregate", "serialize", "send"};
+
+const char *stage_name(uint32_t stage) {
+    return stage < STAGE_CNT ? stage_names[stage] : "unknown";
+}
+
+static const char *overload_names[] = {"newest", "oldest", "degrade", "block"};
+
+int32_t overload_parse(const char *name) {
+    for(int32_t i = OVERLOAD_NEWEST; i <= OVERLOAD_BLOCK; i++) {
+        if(strcmp(name, overload_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *overload_name(uint32_t policy) {
+    return policy <= OVERLOAD_BLOCK ? overload_names[policy] : "unknown";
+}
+
+void stage_defaults(options_t *opt) {
+    for(uint32_t i = 0; i < STAGE_CNT; i++) {
+        opt->stages[i].threads = 0;
+        opt->stages[i].cpus.clear();
+    }
+    // One RX thread decoding and aggregating inline, one sender serializing and sending
+    opt->stages[STAGE_RX].threads = 1;
+    opt->stages[STAGE_SERIALIZE].threads = 1;
+}
+
+/**
+ * Parse list of cores, e.g. "2-3,5"
+ * \param str List of cores
+ * \param cpus Where to store the cores
+ * \return RET_OK on success
+ */
+static int32_t parse_cpus(const char *str, std::vector<int> &cpus) {
+    cpus.clear();
+    while(*str) {
+        char *end;
+        long first = strtol(str, &end, 10);
+        long last = first;
+        if(end == str || first < 0) {
+            return RET_ERR;
+        }
+        if(*end == '-') {
+            str = end + 1;
+            last = strtol(str, &end, 10);
+            if(end == str || last < first) {
+                return RET_ERR;
+            }
+        }
+        for(long cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+        if(*end == ',') {
+            end++;
+        } else if(*end != '\0') {
+            return RET_ERR;
+        }
+        str = end;
+    }
+    return cpus.empty() ? RET_ERR : RET_OK;
+}
+
+int32_t stage_parse(const char *arg, options_t *opt) {
+    const char *eq = strchr(arg, '=');
+    if(eq == NULL) {
+        printf("Stage configuration \"%s\" is not in format name=threads[@cpus]!\n", arg);
+        return RET_ERR;
+    }
+
+    uint32_t stage;
+    for(stage = 0; stage < STAGE_CNT; stage++) {
+        if(strlen(stage_names[stage]) == (size_t)(eq - arg) && strncmp(arg, stage_names[stage], eq - arg) == 0) {
+            break;
+        }
+    }
+    if(stage == STAGE_CNT) {
+        printf("Unknown stage in \"%s\"!\n", arg);
+        return RET_ERR;
+    }
+
+    char *end;
+    stage_cfg_t &cfg = opt->stages[stage];
+    cfg.threads = strtoul(eq + 1, &end, 10);
+    if(end == eq + 1) {
+        printf("Missing number of threads in \"%s\"!\n", arg);
+        return RET_ERR;
+    }
+    cfg.cpus.clear();
+    if(*end == '@') {
+        if(parse_cpus(end + 1, cfg.cpus) != RET_OK) {
+            printf("Invalid core set in \"%s\"!\n", arg);
+            return RET_ERR;
+        }
+    } else if(*end != '\0') {
+        printf("Invalid number of threads in \"%s\"!\n", arg);
+        return RET_ERR;
+    }
+    return RET_OK;
+}
+
+int32_t stage_check(const options_t *opt) {
+    if(opt->stages[STAGE_RX].threads == 0) {
+        printf("At least one RX thread is required!\n");
+        return RET_ERR;
+    }
+    if(opt->stages[STAGE_SERIALIZE].threads == 0) {
+        printf("At least one serialize thread is required!\n");
+        return RET_ERR;
+    }
+
+    printf("pipeline -");
+    for(uint32_t i = 0; i < STAGE_CNT; i++) {
+        const stage_cfg_t &cfg = opt->stages[i];
+        if(cfg.threads == 0) {
+            printf(" %s=inline", stage_names[i]);
+            continue;
+        }
+        printf(" %s=%u", stage_names[i], cfg.threads);
+        for(size_t c = 0; c < cfg.cpus.size(); c++) {
+            printf("%c%d", c == 0 ? '@' : ',', cfg.cpus[c]);
+        }
+    }
+    printf("\n");
+    return RET_OK;
+}
+
+void stage_pin(const stage_cfg_t &cfg, uint32_t id) {
+    if(cfg.cpus.empty()) {
+        return;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(cfg.cpus.size() >= cfg.threads) {
+        CPU_SET(cfg.cpus[id], &set);
+    } else {
+        for(int cpu : cfg.cpus) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        printf("Unable to set the core set of a thread!\n");
+    }
+}
+
+void stage_block_signals() {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, SIGUSR1);
+    sigaddset(&set, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+}
+
+uint64_t stage_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void stage_finish(stage_thread_t &stats) {
+    struct timespec cpu;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    stats.cpu_ns = cpu.tv_sec * 1000000000ull + cpu.tv_nsec;
+}
+
+void stage_print(const char *name, const std::vector<stage_thread_t> &threads, double wall) {
+    for(size_t i = 0; i < threads.size(); i++) {
+        const stage_thread_t &stats = threads[i];
+        printf("%s %zu - items %lu, busy %.1f%%, cpu %.1f%%, dropped %lu, errors %lu\n",
+            name, i, stats.items, 100.0 * stats.busy_ns / 1e9 / wall, 100.0 * stats.cpu_ns / 1e9 / wall,
+            stats.dropped, stats.errors);
+    }
+}
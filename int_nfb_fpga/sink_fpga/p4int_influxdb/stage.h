@@ -0,0 +1,117 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Configuration and statistics of pipeline stages
+ */
+
+#ifndef _STAGE_H_
+#define _STAGE_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "p4int.h"
+#include "ringbuffer.h"
+
+// Period of the queue depth sampling in microseconds
+#define STAGE_SAMPLE_USECS 100000
+
+// Overload policies, what happens when the input queue of a stage is full
+// Drop the item which does not fit
+#define OVERLOAD_NEWEST  0
+// Consumers discard the oldest items when the queue is almost full
+#define OVERLOAD_OLDEST  1
+// Flows losing records are exported as periodic aggregates for a while
+#define OVERLOAD_DEGRADE 2
+// Producers wait for space for a while, then drop the item
+#define OVERLOAD_BLOCK   3
+
+// Maximal time a producer waits for space in the block policy
+#define OVERLOAD_BLOCK_USECS 1000
+
+// Statistics of one stage thread, written by the thread only
+typedef struct alignas(CACHE_LINE_SIZE) {
+    uint64_t items;   // Processed items
+    uint64_t busy_ns; // Time spent by processing of items
+    uint64_t cpu_ns;  // CPU time of the thread, stored when it finishes
+    uint64_t dropped; // Items lost by the thread, e.g. NDP overruns of RX or failed transport
+    uint64_t errors;  // Failed operations, e.g. batches the transport did not deliver
+} stage_thread_t;
+
+/**
+ * Name of the stage
+ * \param stage STAGE_* value
+ * \return Name of the stage
+ */
+const char *stage_name(uint32_t stage);
+
+/**
+ * Parse name of the overload policy
+ * \param name One of "newest", "oldest", "degrade" or "block"
+ * \return OVERLOAD_* value or -1 for unknown name
+ */
+int32_t overload_parse(const char *name);
+
+/**
+ * Name of the overload policy
+ * \param policy OVERLOAD_* value
+ * \return Name of the policy
+ */
+const char *overload_name(uint32_t policy);
+
+/**
+ * Set default topology of the pipeline
+ * \param opt Program parameters
+ */
+void stage_defaults(options_t *opt);
+
+/**
+ * Parse configuration of one stage in format name=threads[@cpus],
+ * e.g. "decode=2@4-5" or "serialize=3@6,8,10"
+ * \param arg Configuration string
+ * \param opt Program parameters
+ * \return RET_OK on success
+ */
+int32_t stage_parse(const char *arg, options_t *opt);
+
+/**
+ * Check the topology and print it
+ * \param opt Program parameters
+ * \return RET_OK when the topology is valid
+ */
+int32_t stage_check(const options_t *opt);
+
+/**
+ * Pin the calling thread to the core set of its stage. When the set has
+ * enough cores every thread gets its own one, otherwise the threads share
+ * the whole set.
+ * \param cfg Configuration of the stage
+ * \param id Index of the thread in the stage
+ */
+void stage_pin(const stage_cfg_t &cfg, uint32_t id);
+
+/**
+ * Block asynchronous signals in the calling worker thread, so SIGINT and
+ * SIGUSR1 are delivered to the main thread and never interrupt a transport
+ */
+void stage_block_signals();
+
+/**
+ * Current monotonic time in nanoseconds
+ */
+uint64_t stage_now_ns();
+
+/**
+ * Store the CPU time of the calling thread
+ * \param stats Statistics of the thread
+ */
+void stage_finish(stage_thread_t &stats);
+
+/**
+ * Print statistics of all threads of the stage
+ * \param name Name of the stage
+ * \param threads Statistics of the threads
+ * \param wall Run time of the pipeline in seconds
+ */
+void stage_print(const char *name, const std::vector<stage_thread_t> &threads, double wall);
+
+#endif // _STAGE_H_
@@ -0,0 +1,541 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Lock-free queue connecting two pipeline stages
+ */
+
+#ifndef _STAGE_QUEUE_H_
+#define _STAGE_QUEUE_H_
+
+#include <cstdio>
+#include <vector>
+#include <array>
+#include <atomic>
+#include <algorithm>
+
+#include "p4int.h"
+#include "ringbuffer.h"
+#include "wait_strategy.h"
+#include "stage.h"
+#include "telemetry.h"
+
+// Minimal capacity of one ring of the queue (items)
+#define STAGE_RING_MIN 1024
+
+// Dispatch statistics of one producer and consumer pair
+typedef struct {
+    uint64_t home;    // Items whose home consumer is this one
+    uint64_t spilled; // Home items stored to another consumer because this one was full
+    uint64_t stolen;  // Items of other consumers stored to this one
+    uint64_t dropped; // Home items dropped because no ring had space
+    uint64_t blocked; // Home items stored after the producer waited for space
+    uint64_t evicted; // Oldest items discarded by the consumer
+} ring_stats_t;
+
+// Queue depth sampled by the monitor
+typedef struct {
+    uint64_t sum;     // Sum of the samples
+    uint64_t max;     // Maximal sample
+    uint64_t samples; // Number of samples
+} depth_stats_t;
+
+/**
+ * Increment the dispatch counter. Every counter has a single writer, the
+ * producer or the consumer for evicted items, like \ref tm_add the relaxed
+ * load and store keep concurrent reads of the monitor well defined.
+ * \param counter Counter of \ref ring_stats_t or of evicted items
+ * \param value Increment
+ */
+static inline void ring_count(uint64_t &counter, uint64_t value)
+{
+    __atomic_store_n(&counter, __atomic_load_n(&counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+/**
+ * Hash of the flow key, keys differ only in a few address bytes
+ * \param key Flow key
+ * \return Murmur3 finalizer of the key
+ */
+static inline uint64_t flow_hash(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ull;
+    key ^= key >> 33;
+    return key;
+}
+
+/**
+ * Flow key of the exported record
+ */
+static inline uint64_t stage_key(const telemetric_hdr_t &item)
+{
+    return item.flowKey;
+}
+
+/**
+ * Queue between P producer and C consumer threads of two stages.
+ *
+ * Every producer and consumer pair is connected by its own SPSC ring buffer,
+ * so no operation needs a lock or an atomic read-modify-write. Items are
+ * dispatched by the hash of their flow key (\ref stage_key), which keeps the
+ * records of one flow in order and on one consumer. With spilling enabled an
+ * item whose home ring is full goes to the least loaded consumer instead.
+ *
+ * Overload policy selects what is sacrificed when a ring is full. With
+ * OVERLOAD_OLDEST the consumer keeps its rings below 7/8 of the capacity by
+ * discarding the oldest items, so fresh items fit. With OVERLOAD_BLOCK the
+ * producer waits up to OVERLOAD_BLOCK_USECS per burst. Other policies drop
+ * the item which does not fit, the caller gets indices of dropped items.
+ *
+ * Rings of a consumer are allocated by \ref attach from the consumer thread,
+ * so the memory is local to its NUMA node. All consumers have to be attached
+ * before the producers start.
+ */
+template<typename T>
+class StageQueue
+{
+    public:
+        /**
+         * Constructor
+         * \param producers Number of producer threads
+         * \param consumers Number of consumer threads
+         * \param capacity Capacity of the input of one consumer, shared by its rings
+         * \param wait_mode WAIT_* strategy of the consumers
+         * \param spill Enable spilling of full home rings
+         * \param policy OVERLOAD_* policy
+         */
+        StageQueue(uint32_t producers, uint32_t consumers, size_t capacity, uint32_t wait_mode, bool spill, uint32_t policy)
+            : m_producers(producers), m_consumers(consumers), m_spill(spill), m_policy(policy), m_closed(false)
+        {
+            m_capacity = std::max<size_t>(capacity / producers, STAGE_RING_MIN);
+            m_rings.resize(producers * consumers, nullptr);
+            m_stats.resize(producers * consumers, ring_stats_t());
+            m_evicted.resize(consumers, 0);
+            m_depth.resize(consumers, depth_stats_t{0, 0, 0});
+            m_burst_index.resize(producers * consumers);
+            m_burst_cnt.resize(producers * consumers, 0);
+            m_next.resize(consumers, 0);
+            for(uint32_t c = 0; c < consumers; c++) {
+                m_waiters.push_back(new ConsumerWaiter(wait_mode));
+            }
+        }
+
+        ~StageQueue()
+        {
+            for(ringbuffer<T> *ring : m_rings) {
+                delete ring;
+            }
+            for(ConsumerWaiter *waiter : m_waiters) {
+                delete waiter;
+            }
+        }
+
+        StageQueue(const StageQueue &) = delete;
+        StageQueue &operator=(const StageQueue &) = delete;
+
+        /**
+         * Allocate rings of the consumer, called by the consumer thread
+         * \param consumer Index of the consumer
+         */
+        void attach(uint32_t consumer)
+        {
+            int node = ring_mem_local_node();
+            for(uint32_t p = 0; p < m_producers; p++) {
+                m_rings[p * m_consumers + consumer] = new ringbuffer<T>(m_capacity, node);
+            }
+        }
+
+        /**
+         * Home consumer of the flow
+         * \param key Flow key
+         * \return Index of the consumer
+         */
+        inline uint32_t home(uint64_t key) const
+        {
+            return flow_hash(key) % m_consumers;
+        }
+
+        /**
+         * Store the item to a given consumer, no spilling is done
+         * \param producer Index of the calling producer
+         * \param consumer Index of the consumer
+         * \param item Item to store
+         * \return true on success, false when the ring is full
+         */
+        bool push_to(uint32_t producer, uint32_t consumer, const T &item)
+        {
+            ring_stats_t &stats = m_stats[producer * m_consumers + consumer];
+            ring_count(stats.home, 1);
+            if(!ring(producer, consumer)->push(item)) {
+                ring_count(stats.dropped, 1);
+                return false;
+            }
+            m_waiters[consumer]->notify();
+            return true;
+        }
+
+        /**
+         * Store the item to its home consumer
+         * \param producer Index of the calling producer
+         * \param item Item to store
+         * \return true on success, false when the item was dropped
+         */
+        bool push(uint32_t producer, const T &item)
+        {
+            return push_burst(producer, &item, 1) == 0;
+        }
+
+        /**
+         * Store a burst of items, items of every consumer are stored
+         * by one bulk operation.
+         * \param producer Index of the calling producer
+         * \param items Array of items
+         * \param count Number of items, at most NDP_PACKET_BUFF
+         * \param dropped_index Where to store indices of dropped items, can be null
+         * \return Number of dropped items
+         */
+        uint32_t push_burst(uint32_t producer, const T *items, uint32_t count, uint32_t *dropped_index = nullptr)
+        {
+            std::array<uint32_t, NDP_PACKET_BUFF> *index = &m_burst_index[producer * m_consumers];
+            uint32_t *index_cnt = &m_burst_cnt[producer * m_consumers];
+            ring_stats_t *stats = &m_stats[producer * m_consumers];
+
+            // Group the burst by home consumers
+            for(uint32_t i = 0; i < count; i++) {
+                uint32_t c = home(stage_key(items[i]));
+                index[c][index_cnt[c]++] = i;
+            }
+
+            // Store every group by one bulk operation, spill what does not fit
+            uint32_t dropped = 0;
+            uint64_t deadline = 0;
+            for(uint32_t c = 0; c < m_consumers; c++) {
+                if(index_cnt[c] == 0) {
+                    continue;
+                }
+                ring_count(stats[c].home, index_cnt[c]);
+                size_t pushed = ring(producer, c)->push_n(items, index[c].data(), index_cnt[c]);
+                if(pushed != 0) {
+                    m_waiters[c]->notify();
+                }
+                for(size_t i = pushed; i < index_cnt[c]; i++) {
+                    const T &item = items[index[c][i]];
+                    uint32_t spill = m_spill ? leastLoaded(producer, c) : c;
+                    if(spill != c && ring(producer, spill)->push(item)) {
+                        m_waiters[spill]->notify();
+                        ring_count(stats[c].spilled, 1);
+                        ring_count(stats[spill].stolen, 1);
+                    } else if(m_policy == OVERLOAD_BLOCK && block(producer, c, item, deadline)) {
+                        ring_count(stats[c].blocked, 1);
+                    } else {
+                        ring_count(stats[c].dropped, 1);
+                        if(dropped_index != nullptr) {
+                            dropped_index[dropped] = index[c][i];
+                        }
+                        dropped++;
+                    }
+                }
+                index_cnt[c] = 0;
+            }
+            return dropped;
+        }
+
+        /**
+         * Read items of the consumer, rings of the producers are
+         * visited in the round robin order
+         * \param consumer Index of the calling consumer
+         * \param items Where to store the items
+         * \param count Maximal number of items
+         * \return Number of read items
+         */
+        size_t pop(uint32_t consumer, T *items, size_t count)
+        {
+            uint32_t &next = m_next[consumer];
+            for(uint32_t i = 0; i < m_producers; i++) {
+                uint32_t p = next;
+                next = next + 1 == m_producers ? 0 : next + 1;
+                if(m_policy == OVERLOAD_OLDEST) {
+                    evict(consumer, ring(p, consumer));
+                }
+                size_t cnt = ring(p, consumer)->pop_n(items, count);
+                if(cnt != 0) {
+                    return cnt;
+                }
+            }
+            return 0;
+        }
+
+        /**
+         * Wait for items of the consumer or for the close of the queue
+         * \param consumer Index of the calling consumer
+         * \param timeout_us Timeout in microseconds, 0 waits forever
+         * \return false on timeout
+         */
+        bool wait(uint32_t consumer, uint32_t timeout_us)
+        {
+            return m_waiters[consumer]->wait([this, consumer]() {
+                return depth(consumer) != 0 || closed();
+            }, timeout_us);
+        }
+
+        /**
+         * Mark the end of the input, all producers have finished.
+         * Parked consumers are woken up.
+         */
+        void close()
+        {
+            m_closed.store(true, std::memory_order_release);
+            for(ConsumerWaiter *waiter : m_waiters) {
+                waiter->notify();
+            }
+        }
+
+        /**
+         * Check the end of the input, consumers drain the queue
+         * and stop when it is closed and empty
+         */
+        inline bool closed() const
+        {
+            return m_closed.load(std::memory_order_acquire);
+        }
+
+        /**
+         * Number of items waiting for the consumer
+         * \param consumer Index of the consumer
+         */
+        size_t depth(uint32_t consumer) const
+        {
+            size_t size = 0;
+            for(uint32_t p = 0; p < m_producers; p++) {
+                size += ring(p, consumer)->size();
+            }
+            return size;
+        }
+
+        /**
+         * Register the telemetry of every ring, one slot per consumer tagged by its index.
+         * Called before the monitor thread starts.
+         * \param name Name of the queue in the telemetry
+         */
+        void attachTelemetry(const char *name)
+        {
+            for(uint32_t c = 0; c < m_consumers; c++) {
+                m_ring_tm.push_back(telemetry_attach(name, c, "", c));
+            }
+        }
+
+        /**
+         * Sample depths of all consumers and publish the dispatch statistics of every
+         * ring to its telemetry, called by the monitor thread only
+         * \param tm Telemetry recording the depths, can be null
+         */
+        void sample(tm_thread_t *tm = nullptr)
+        {
+            for(uint32_t c = 0; c < m_consumers; c++) {
+                uint64_t size = depth(c);
+                if(tm != nullptr) {
+                    tm_record(tm, TM_H_QUEUE_DEPTH, size);
+                }
+                if(!m_ring_tm.empty()) {
+                    ring_stats_t sum = stats(c);
+                    tm_set(m_ring_tm[c], TM_HOME, sum.home);
+                    tm_set(m_ring_tm[c], TM_SPILLED, sum.spilled);
+                    tm_set(m_ring_tm[c], TM_STOLEN, sum.stolen);
+                }
+                m_depth[c].sum += size;
+                m_depth[c].max = std::max(m_depth[c].max, size);
+                m_depth[c].samples++;
+            }
+        }
+
+        /**
+         * Sampled depth of the consumer
+         */
+        const depth_stats_t &depthStats(uint32_t consumer) const { return m_depth[consumer]; }
+
+        /**
+         * Dispatch statistics of the consumer summed over all producers
+         */
+        ring_stats_t stats(uint32_t consumer) const
+        {
+            ring_stats_t sum = ring_stats_t();
+            for(uint32_t p = 0; p < m_producers; p++) {
+                const ring_stats_t &stats = m_stats[p * m_consumers + consumer];
+                sum.home += __atomic_load_n(&stats.home, __ATOMIC_RELAXED);
+                sum.spilled += __atomic_load_n(&stats.spilled, __ATOMIC_RELAXED);
+                sum.stolen += __atomic_load_n(&stats.stolen, __ATOMIC_RELAXED);
+                sum.dropped += __atomic_load_n(&stats.dropped, __ATOMIC_RELAXED);
+                sum.blocked += __atomic_load_n(&stats.blocked, __ATOMIC_RELAXED);
+            }
+            sum.evicted = __atomic_load_n(&m_evicted[consumer], __ATOMIC_RELAXED);
+            return sum;
+        }
+
+        /**
+         * Dispatch statistics summed over all consumers
+         */
+        ring_stats_t total() const
+        {
+            ring_stats_t sum = ring_stats_t();
+            for(uint32_t c = 0; c < m_consumers; c++) {
+                ring_stats_t stats = this->stats(c);
+                sum.home += stats.home;
+                sum.spilled += stats.spilled;
+                sum.stolen += stats.stolen;
+                sum.dropped += stats.dropped;
+                sum.blocked += stats.blocked;
+                sum.evicted += stats.evicted;
+            }
+            return sum;
+        }
+
+        /**
+         * Waiting of the consumer
+         */
+        const ConsumerWaiter &waiter(uint32_t consumer) const { return *m_waiters[consumer]; }
+
+        uint32_t producers() const { return m_producers; }
+        uint32_t consumers() const { return m_consumers; }
+
+        /**
+         * Print dispatch statistics and sampled depths of all consumers
+         * \param name Name of the consuming stage
+         */
+        void printStats(const char *name) const
+        {
+            for(uint32_t c = 0; c < m_consumers; c++) {
+                ring_stats_t sum = stats(c);
+                const depth_stats_t &depth = m_depth[c];
+                double rate = sum.home ? (100.0 * sum.spilled) / sum.home : 0.0;
+                printf("%s queue %u - home %lu, spilled %lu (%.2f%%), stolen %lu, dropped %lu, blocked %lu, evicted %lu, depth avg %.1f max %lu, parks %lu\n",
+                    name, c, sum.home, sum.spilled, rate, sum.stolen, sum.dropped, sum.blocked, sum.evicted,
+                    depth.samples ? (double)depth.sum / depth.samples : 0.0, depth.max, m_waiters[c]->parks());
+            }
+        }
+
+        /**
+         * Print memory footprint of all rings
+         * \param name Name of the queue
+         * \return Size of the memory in bytes
+         */
+        size_t printMemory(const char *name) const
+        {
+            size_t total = 0;
+            for(uint32_t c = 0; c < m_consumers; c++) {
+                const ring_mem_t &mem = ring(0, c)->memory();
+                size_t size = 0;
+                for(uint32_t p = 0; p < m_producers; p++) {
+                    size += ring(p, c)->memory().size;
+                }
+                printf("%s queue %u - %u x %zu items x %zu B, %.1f MiB on %s pages, NUMA node %d\n",
+                    name, c, m_producers, ring(0, c)->capacity(), sizeof(T),
+                    size / 1048576.0, ring_mem_page_name(mem.page_size), mem.node);
+                total += size;
+            }
+            return total;
+        }
+
+    protected:
+        /**
+         * Ring of the producer and consumer pair
+         */
+        inline ringbuffer<T> *ring(uint32_t producer, uint32_t consumer) const
+        {
+            return m_rings[producer * m_consumers + consumer];
+        }
+
+        /**
+         * Wait until the item fits to the ring of the consumer, the wait
+         * of one burst is limited by OVERLOAD_BLOCK_USECS
+         * \param producer Index of the producer
+         * \param consumer Index of the consumer
+         * \param item Item to store
+         * \param deadline End of the wait, set by the first call of the burst
+         * \return true when the item was stored
+         */
+        bool block(uint32_t producer, uint32_t consumer, const T &item, uint64_t &deadline)
+        {
+            uint64_t now = stage_now_ns();
+            if(deadline == 0) {
+                deadline = now + OVERLOAD_BLOCK_USECS * 1000ull;
+            }
+            while(!ring(producer, consumer)->push(item)) {
+                if(now >= deadline) {
+                    return false;
+                }
+                cpu_relax();
+                now = stage_now_ns();
+            }
+            m_waiters[consumer]->notify();
+            return true;
+        }
+
+        /**
+         * Discard the oldest items of an almost full ring, called by the consumer
+         * \param consumer Index of the consumer
+         * \param ring Ring of the consumer
+         */
+        inline void evict(uint32_t consumer, ringbuffer<T> *ring)
+        {
+            size_t size = ring->size();
+            size_t capacity = ring->capacity();
+            if(size > capacity - capacity / 8) {
+                ring_count(m_evicted[consumer], ring->skip_n(size - (capacity - capacity / 4)));
+            }
+        }
+
+        /**
+         * Select the consumer whose ring of the producer has the lowest occupancy
+         * \param producer Index of the producer
+         * \param skip Index of the consumer to ignore
+         * \return Index of the consumer
+         */
+        uint32_t leastLoaded(uint32_t producer, uint32_t skip) const
+        {
+            uint32_t best = skip;
+            size_t best_size = SIZE_MAX;
+            for(uint32_t c = 0; c < m_consumers; c++) {
+                if(c == skip) {
+                    continue;
+                }
+                size_t size = ring(producer, c)->size();
+                if(size < best_size) {
+                    best = c;
+                    best_size = size;
+                }
+            }
+            return best;
+        }
+
+        // Number of producers and consumers
+        uint32_t m_producers;
+        uint32_t m_consumers;
+        // Capacity of one ring
+        size_t m_capacity;
+        // Spilling of full home rings
+        bool m_spill;
+        // OVERLOAD_* policy
+        uint32_t m_policy;
+        // End of the input
+        std::atomic<bool> m_closed;
+        // Rings indexed by producer * consumers + consumer
+        std::vector<ringbuffer<T> *> m_rings;
+        // Dispatch statistics, every item is written by its producer only, see ring_count()
+        std::vector<ring_stats_t> m_stats;
+        // Items discarded by every consumer, written by the consumer only, see ring_count()
+        std::vector<uint64_t> m_evicted;
+        // Burst grouping of every producer, indices into the burst and their counts
+        std::vector<std::array<uint32_t, NDP_PACKET_BUFF>> m_burst_index;
+        std::vector<uint32_t> m_burst_cnt;
+        // Round robin position of every consumer
+        std::vector<uint32_t> m_next;
+        // Waiting of the consumers
+        std::vector<ConsumerWaiter *> m_waiters;
+        // Sampled depths, written by the monitor only
+        std::vector<depth_stats_t> m_depth;
+        // Telemetry of every ring, empty when not attached
+        std::vector<tm_thread_t *> m_ring_tm;
+};
+
+#endif // _STAGE_QUEUE_H_
@@ -0,0 +1,267 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Self-telemetry of the sink
+ */
+
+#include <csignal>
+#include <cstring>
+#include <mutex>
+#include <deque>
+#include <vector>
+
+#include "telemetry.h"
+
+static const char *counter_names[TM_COUNTERS] = {
+    "rx_bursts", "rx_packets", "rx_empty", "parsed", "parse_ns", "flow_lookups", "flow_new",
+    "exported", "dropped", "batches", "batch_lines", "bytes_sent", "send_errors",
+    "cut_lines", "cut_bytes", "cut_age", "cut_close", "rx_filtered", "series_folded",
+    "decode_errors",
+    "home", "spilled", "stolen"
+};
+
+static const char *hist_names[TM_HISTS] = {
+    "burst", "parse_ns", "queue_depth", "batch_lines", "send_ns", "queue_ns", "batch_ns", "fresh_ns"
+};
+
+// Registered slots, deque keeps addresses of slots stable
+static std::mutex tm_lock;
+static std::deque<tm_thread_t> tm_threads;
+// Histograms at the previous telemetry_lines() call
+static std::vector<std::vector<uint64_t>> tm_prev;
+
+static volatile sig_atomic_t tm_dump = 0;
+
+tm_thread_t *telemetry_attach(const char *stage, uint32_t id, const char *source, int32_t ring) {
+    std::lock_guard<std::mutex> guard(tm_lock);
+    tm_threads.emplace_back();
+    tm_thread_t *tm = &tm_threads.back();
+    snprintf(tm->stage, sizeof(tm->stage), "%s", stage);
+    snprintf(tm->source, sizeof(tm->source), "%s", source);
+    tm->id = id;
+    tm->ring = ring;
+    for(uint32_t i = 0; i < TM_COUNTERS; i++) {
+        tm->counters[i].store(0, std::memory_order_relaxed);
+    }
+    for(uint32_t h = 0; h < TM_HISTS; h++) {
+        for(uint32_t b = 0; b < TM_BUCKETS; b++) {
+            tm->hists[h][b].store(0, std::memory_order_relaxed);
+        }
+    }
+    return tm;
+}
+
+void telemetry_request_dump() {
+    tm_dump = 1;
+}
+
+bool telemetry_dump_requested() {
+    if(!tm_dump) {
+        return false;
+    }
+    tm_dump = 0;
+    return true;
+}
+
+/**
+ * Largest value of the histogram bucket, inverse of \ref tm_bucket
+ * \param bucket Index of the bucket
+ * \return Upper bound of the bucket
+ */
+static uint64_t bucket_upper(uint32_t bucket) {
+    if(bucket < (1u << TM_SUB_BITS)) {
+        return bucket;
+    }
+    uint32_t shift = (bucket >> TM_SUB_BITS) - 1;
+    uint64_t lower = (uint64_t)((1u << TM_SUB_BITS) | (bucket & ((1u << TM_SUB_BITS) - 1))) << shift;
+    return lower + (1ull << shift) - 1;
+}
+
+/**
+ * Value of the histogram percentile, the upper bound of its bucket
+ * \param hist Histogram buckets
+ * \param total Number of values
+ * \param percentile Requested percentile 0-100
+ * \return Upper bound of the bucket
+ */
+static uint64_t hist_percentile(const uint64_t *hist, uint64_t total, uint32_t percentile) {
+    uint64_t rank = (total * percentile + 99) / 100;
+    uint64_t seen = 0;
+    for(uint32_t b = 0; b < TM_BUCKETS; b++) {
+        seen += hist[b];
+        if(seen >= rank && hist[b]) {
+            return bucket_upper(b);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Slots are of the same stage, source and ring
+ */
+static bool same_group(const tm_thread_t &a, const tm_thread_t &b) {
+    return strcmp(a.stage, b.stage) == 0 && strcmp(a.source, b.source) == 0 && a.ring == b.ring;
+}
+
+/**
+ * Sum telemetry of all threads of the stage
+ * \param stage Name of the stage
+ * \param group Slot of the source and ring to sum, NULL for all sources and rings
+ * \param counters Where to store counters
+ * \param hists Where to store histograms
+ */
+static void stage_sum(const char *stage, const tm_thread_t *group, uint64_t *counters, uint64_t (*hists)[TM_BUCKETS]) {
+    memset(counters, 0, sizeof(uint64_t) * TM_COUNTERS);
+    memset(hists, 0, sizeof(uint64_t) * TM_HISTS * TM_BUCKETS);
+    for(const tm_thread_t &tm : tm_threads) {
+        if(strcmp(tm.stage, stage) != 0 || (group != NULL && !same_group(tm, *group))) {
+            continue;
+        }
+        for(uint32_t i = 0; i < TM_COUNTERS; i++) {
+            counters[i] += tm.counters[i].load(std::memory_order_relaxed);
+        }
+        for(uint32_t h = 0; h < TM_HISTS; h++) {
+            for(uint32_t b = 0; b < TM_BUCKETS; b++) {
+                hists[h][b] += tm.hists[h][b].load(std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+/**
+ * First thread of every stage, source and ring in order of registration
+ */
+static std::vector<const tm_thread_t *> stage_list() {
+    std::vector<const tm_thread_t *> stages;
+    for(const tm_thread_t &tm : tm_threads) {
+        bool found = false;
+        for(const tm_thread_t *first : stages) {
+            found |= same_group(*first, tm);
+        }
+        if(!found) {
+            stages.push_back(&tm);
+        }
+    }
+    return stages;
+}
+
+void telemetry_dump(FILE *out) {
+    std::lock_guard<std::mutex> guard(tm_lock);
+    fprintf(out, "telemetry -\n");
+    for(const tm_thread_t &tm : tm_threads) {
+        if(tm.source[0]) {
+            fprintf(out, "  %s %u (%s):", tm.stage, tm.id, tm.source);
+        } else if(tm.ring >= 0) {
+            fprintf(out, "  %s ring %d:", tm.stage, tm.ring);
+        } else {
+            fprintf(out, "  %s %u:", tm.stage, tm.id);
+        }
+        for(uint32_t i = 0; i < TM_COUNTERS; i++) {
+            uint64_t value = tm.counters[i].load(std::memory_order_relaxed);
+            if(value) {
+                fprintf(out, " %s %lu", counter_names[i], value);
+            }
+        }
+        fprintf(out, "\n");
+
+        for(uint32_t h = 0; h < TM_HISTS; h++) {
+            uint64_t hist[TM_BUCKETS];
+            uint64_t total = 0;
+            for(uint32_t b = 0; b < TM_BUCKETS; b++) {
+                hist[b] = tm.hists[h][b].load(std::memory_order_relaxed);
+                total += hist[b];
+            }
+            if(total == 0) {
+                continue;
+            }
+            fprintf(out, "    %s - count %lu, p50 %lu, p99 %lu, max %lu\n", hist_names[h], total,
+                hist_percentile(hist, total, 50), hist_percentile(hist, total, 99),
+                hist_percentile(hist, total, 100));
+        }
+    }
+    fflush(out);
+}
+
+uint64_t telemetry_percentile(const char *stage, uint32_t hist, uint32_t percentile) {
+    std::lock_guard<std::mutex> guard(tm_lock);
+    uint64_t counters[TM_COUNTERS];
+    uint64_t hists[TM_HISTS][TM_BUCKETS];
+    stage_sum(stage, NULL, counters, hists);
+
+    uint64_t total = 0;
+    for(uint32_t b = 0; b < TM_BUCKETS; b++) {
+        total += hists[hist][b];
+    }
+    return total ? hist_percentile(hists[hist], total, percentile) : 0;
+}
+
+uint32_t telemetry_lines(std::string &data, uint64_t timestamp) {
+    std::lock_guard<std::mutex> guard(tm_lock);
+    std::vector<const tm_thread_t *> stages = stage_list();
+    tm_prev.resize(stages.size(), std::vector<uint64_t>(TM_HISTS * TM_BUCKETS, 0));
+
+    uint32_t lines = 0;
+    for(size_t s = 0; s < stages.size(); s++) {
+        uint64_t counters[TM_COUNTERS];
+        uint64_t hists[TM_HISTS][TM_BUCKETS];
+        stage_sum(stages[s]->stage, stages[s], counters, hists);
+
+        data += "int_sink,stage=";
+        data += stages[s]->stage;
+        if(stages[s]->source[0]) {
+            data += ",source=";
+            data += stages[s]->source;
+        }
+        if(stages[s]->ring >= 0) {
+            data += ",ring=";
+            data += std::to_string(stages[s]->ring);
+        }
+        char sep = ' ';
+        for(uint32_t i = 0; i < TM_COUNTERS; i++) {
+            if(counters[i] == 0) {
+                continue;
+            }
+            data += sep;
+            data += counter_names[i];
+            data += '=';
+            data += std::to_string(counters[i]);
+            data += 'i';
+            sep = ',';
+        }
+
+        // Percentiles of values recorded in this period
+        for(uint32_t h = 0; h < TM_HISTS; h++) {
+            uint64_t delta[TM_BUCKETS];
+            uint64_t total = 0;
+            for(uint32_t b = 0; b < TM_BUCKETS; b++) {
+                uint64_t &prev = tm_prev[s][h * TM_BUCKETS + b];
+                delta[b] = hists[h][b] - prev;
+                prev = hists[h][b];
+                total += delta[b];
+            }
+            if(total == 0) {
+                continue;
+            }
+            static const uint32_t percentiles[] = {50, 99, 100};
+            static const char *suffixes[] = {"_p50=", "_p99=", "_max="};
+            for(uint32_t p = 0; p < 3; p++) {
+                data += sep;
+                data += hist_names[h];
+                data += suffixes[p];
+                data += std::to_string(hist_percentile(delta, total, percentiles[p]));
+                data += 'i';
+                sep = ',';
+            }
+        }
+
+        if(sep == ' ') {
+            // Nothing recorded yet, the line would have no field
+            data.resize(data.rfind("int_sink,"));
+            continue;
+        }
+        data += ' ';
+        data += std::to_string(timestamp);
+        data += '\n';
+        lines++;
+    }
+    return lines;
+}
@@ -0,0 +1,186 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Self-telemetry of the sink
+ */
+
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <atomic>
+
+#include "ringbuffer.h"
+
+// Counters
+#define TM_RX_BURSTS     0  // Non empty RX bursts
+#define TM_RX_PACKETS    1  // Received packets
+#define TM_RX_EMPTY      2  // Empty RX polls
+#define TM_PARSED        3  // Decoded reports
+#define TM_PARSE_NS      4  // Time spent by decoding
+#define TM_FLOW_LOOKUPS  5  // Lookups of the flow table
+#define TM_FLOW_NEW      6  // Flows inserted to the flow table
+#define TM_EXPORTED      7  // Records passed to the exporter
+#define TM_DROPPED       8  // Items dropped by full queues
+#define TM_BATCHES       9  // Assembled batches
+#define TM_BATCH_LINES   10 // Lines of assembled batches
+#define TM_BYTES_SENT    11 // Bytes delivered by the transport
+#define TM_SEND_ERRORS   12 // Batches the transport failed to deliver
+#define TM_CUT_LINES     13 // Batches cut on the line count
+#define TM_CUT_BYTES     14 // Batches cut on the byte budget
+#define TM_CUT_AGE       15 // Batches cut on the age of the oldest record
+#define TM_CUT_CLOSE     16 // Batches flushed at the end of the program
+#define TM_RX_FILTERED   17 // Received packets dropped by the host flow filter
+#define TM_SERIES_FOLDED 18 // Records folded to the series "other" by the cardinality guard
+#define TM_DECODE_ERRORS 19 // Reports dropped by the decoder, malformed or truncated
+#define TM_HOME          20 // Items whose home is the ring, slots of queue rings only
+#define TM_SPILLED       21 // Home items of the ring stored to another one because it was full
+#define TM_STOLEN        22 // Items of other rings stored to the ring
+#define TM_COUNTERS      23
+
+// Histograms with power of two buckets
+#define TM_H_BURST       0 // Packets per RX burst
+#define TM_H_PARSE_NS    1 // Decoding time per report, averaged over a burst
+#define TM_H_QUEUE_DEPTH 2 // Sampled occupancy of a queue
+#define TM_H_BATCH_LINES 3 // Lines per batch
+#define TM_H_SEND_NS     4 // Latency of the transport per batch, hand-off to acknowledgement
+#define TM_H_QUEUE_NS    5 // Age of a record when it is serialized, since it left the RX queue
+#define TM_H_BATCH_NS    6 // Time a record waits in its batch until the hand-off to the transport
+#define TM_H_FRESH_NS    7 // Age of a record when the collector acknowledged it
+#define TM_HISTS         8
+
+// Every power of two is split to 2^TM_SUB_BITS buckets, the error of a percentile is below 25 %
+#define TM_SUB_BITS 2
+#define TM_BUCKETS  (64 << TM_SUB_BITS)
+
+// Default period of the self-telemetry export in milliseconds, 0 disables it
+#define TELEMETRY_PERIOD_DEFAULT 0
+
+/**
+ * Telemetry of one thread.
+ *
+ * Every value has a single writer, the owning thread, which updates it by
+ * a relaxed load and store. No atomic read-modify-write or fence is used on
+ * the hot path, the atomics only make concurrent reads of the aggregator
+ * well defined. Slots are padded to cache lines.
+ */
+typedef struct alignas(CACHE_LINE_SIZE) {
+    char                  stage[32];                       // Name of the stage
+    char                  source[32];                      // Name of the source of RX threads, empty otherwise
+    uint32_t              id;                              // Index of the thread in the stage
+    int32_t               ring;                            // Consumer of the slot of a queue ring, -1 otherwise
+    std::atomic<uint64_t> counters[TM_COUNTERS];           // TM_* counters
+    std::atomic<uint64_t> hists[TM_HISTS][TM_BUCKETS];     // TM_H_* histograms
+} tm_thread_t;
+
+/**
+ * Increment the counter
+ * \param tm Telemetry of the calling thread
+ * \param counter TM_* counter
+ * \param value Increment
+ */
+static inline void tm_add(tm_thread_t *tm, uint32_t counter, uint64_t value)
+{
+    std::atomic<uint64_t> &item = tm->counters[counter];
+    item.store(item.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+/**
+ * Set the counter, for values counted elsewhere and published by their only reader
+ * \param tm Telemetry of the calling thread
+ * \param counter TM_* counter
+ * \param value New value
+ */
+static inline void tm_set(tm_thread_t *tm, uint32_t counter, uint64_t value)
+{
+    tm->counters[counter].store(value, std::memory_order_relaxed);
+}
+
+/**
+ * Histogram bucket of the value, small values have their own buckets, the
+ * others are bucketed by the exponent and the top TM_SUB_BITS bits
+ * \param value Recorded value
+ * \return Index of the bucket
+ */
+static inline uint32_t tm_bucket(uint64_t value)
+{
+    if(value < (1u << TM_SUB_BITS)) {
+        return value;
+    }
+    uint32_t exp = 63 - __builtin_clzll(value);
+    return ((exp - TM_SUB_BITS + 1) << TM_SUB_BITS) | ((value >> (exp - TM_SUB_BITS)) & ((1u << TM_SUB_BITS) - 1));
+}
+
+/**
+ * Record the same value several times
+ * \param tm Telemetry of the calling thread
+ * \param hist TM_H_* histogram
+ * \param value Recorded value
+ * \param count Number of occurrences
+ */
+static inline void tm_record_n(tm_thread_t *tm, uint32_t hist, uint64_t value, uint64_t count)
+{
+    std::atomic<uint64_t> &item = tm->hists[hist][tm_bucket(value)];
+    item.store(item.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+}
+
+/**
+ * Record the value to the histogram
+ * \param tm Telemetry of the calling thread
+ * \param hist TM_H_* histogram
+ * \param value Recorded value
+ */
+static inline void tm_record(tm_thread_t *tm, uint32_t hist, uint64_t value)
+{
+    tm_record_n(tm, hist, value, 1);
+}
+
+/**
+ * Register telemetry of the calling thread, slots live until the program ends
+ * \param stage Name of the stage
+ * \param id Index of the thread in the stage
+ * \param source Name of the source the thread reads, threads of a stage are grouped by it
+ * \param ring Consumer ring of a queue, slots of a queue are grouped by it, -1 for threads
+ * \return Telemetry of the thread
+ */
+tm_thread_t *telemetry_attach(const char *stage, uint32_t id, const char *source = "", int32_t ring = -1);
+
+/**
+ * Request the dump of all telemetry, safe to call from a signal handler
+ */
+void telemetry_request_dump();
+
+/**
+ * Check and clear the dump request
+ * \return true when the dump was requested
+ */
+bool telemetry_dump_requested();
+
+/**
+ * Print telemetry of every thread
+ * \param out Output stream
+ */
+void telemetry_dump(FILE *out);
+
+/**
+ * Percentile of the histogram summed over all threads of the stage and all sources, since the start
+ * \param stage Name of the stage
+ * \param hist TM_H_* histogram
+ * \param percentile Requested percentile 0-100
+ * \return Upper bound of the bucket holding the percentile, 0 without values
+ */
+uint64_t telemetry_percentile(const char *stage, uint32_t hist, uint32_t percentile);
+
+/**
+ * Assemble the self-monitoring measurement, one line per stage and source,
+ * lines of RX threads carry the source tag, lines of queue rings the ring tag. Counters are
+ * cumulative, histogram percentiles cover the time since the previous call.
+ * Called by one thread only.
+ * \param data Where to append the lines
+ * \param timestamp Timestamp of the lines in UNIX NS format
+ * \return Number of lines
+ */
+uint32_t telemetry_lines(std::string &data, uint64_t timestamp);
+
+#endif // _TELEMETRY_H_
@@ -0,0 +1,240 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Tests of the flow filter and of its updates of table_influx
+ *
+ * The card is replaced by the p4dev stub of this directory, which logs every
+ * change of the tables. Run by "make test", it fails when any check fails.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+
+#include "device.h"
+#include "filter.h"
+#include "int_process.h"
+#include "p4dev_stub.h"
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static uint32_t failures = 0;
+
+/**
+ * Count and print a failed check
+ */
+static void check(bool ok, const char *cond, int line)
+{
+    if(!ok) {
+        printf("filter_test.cc:%d: check failed: %s\n", line, cond);
+        failures++;
+    }
+}
+
+/**
+ * Parse the rule of the test
+ */
+static filter_rule_t rule(const char *text)
+{
+    filter_rule_t parsed;
+    if(filter_rule_parse(text, parsed) != RET_OK) {
+        printf("invalid rule \"%s\"\n", text);
+        failures++;
+    }
+    return parsed;
+}
+
+/**
+ * Changes of the tables since the last call
+ */
+static std::vector<std::string> changes()
+{
+    std::vector<std::string> log = p4stub_log();
+    p4stub_clear();
+    return log;
+}
+
+/**
+ * Logged insert of the exact rule to table_influx, keys of the table are little endian
+ */
+static std::string insert(uint32_t index, uint32_t src, uint16_t port)
+{
+    char text[128];
+    snprintf(text, sizeof(text), "insert table_influx %u ip.srcAddr=%02x%02x%02x%02x influx.egress_port_id=%02x%02x fill_influx",
+        index, src & 0xff, (src >> 8) & 0xff, (src >> 16) & 0xff, src >> 24, port & 0xff, port >> 8);
+    return text;
+}
+
+/**
+ * Configuration of the card with the rules of -f
+ */
+static void test_configure(nfb_int_dev_t &nfb)
+{
+    options_t opt = options_t();
+    source_cfg_t src = source_cfg_t();
+    opt.ip_flt = {rule("10.0.0.1 80"), rule("10.0.0.2 443"), rule("10.0.0.1 80")};
+    CHECK(configure_device(&nfb, &opt, &src) == RET_OK);
+    CHECK(nfb.p4_valid);
+    CHECK(nfb.influx_drop);
+
+    // Duplicate rules take one entry
+    std::vector<std::string> log;
+    for(const std::string &line : changes()) {
+        if(line.find("table_influx") != std::string::npos) {
+            log.push_back(line);
+        }
+    }
+    CHECK((log == std::vector<std::string>{"reset table_influx", "default table_influx pkt_drop",
+        insert(0, 0x0a000001, 80), insert(1, 0x0a000002, 443)}));
+    CHECK(p4stub_rules("table_influx") == 2);
+}
+
+/**
+ * Runtime diffs of table_influx
+ */
+static void test_rules(nfb_int_dev_t &nfb)
+{
+    CHECK(influx_rule_add(&nfb, rule("10.0.0.3 8080")) == RET_OK);
+    CHECK((changes() == std::vector<std::string>{insert(2, 0x0a000003, 8080)}));
+
+    // Existing and unknown rules do not touch the table
+    CHECK(influx_rule_add(&nfb, rule("10.0.0.3 8080")) == RET_ERR);
+    CHECK(influx_rule_remove(&nfb, rule("10.0.0.9 80")) == RET_ERR);
+    CHECK(changes().empty());
+
+    CHECK(influx_rule_remove(&nfb, rule("10.0.0.2 443")) == RET_OK);
+    CHECK((changes() == std::vector<std::string>{"delete table_influx 1"}));
+    CHECK(p4stub_rules("table_influx") == 2);
+
+    // Failed insert is not remembered, the rule can be added again
+    p4stub_fail_next();
+    CHECK(influx_rule_add(&nfb, rule("10.0.0.4 80")) == RET_ERR);
+    CHECK(influx_rule_remove(&nfb, rule("10.0.0.4 80")) == RET_ERR);
+    CHECK(influx_rule_add(&nfb, rule("10.0.0.4 80")) == RET_OK);
+    CHECK((changes() == std::vector<std::string>{insert(3, 0x0a000004, 80)}));
+
+    // Same default action is not written again
+    CHECK(influx_filtering(&nfb, true) == RET_OK);
+    CHECK(changes().empty());
+}
+
+/**
+ * Change of the rules as done by the control socket, the default action around the diff
+ * \param rules Rules before the change, updated
+ * \param changed Added or removed rule
+ * \param add Rule is added
+ * \return Changes of table_influx
+ */
+static std::vector<std::string> update(nfb_int_dev_t &nfb, std::vector<filter_rule_t> &rules, const char *changed,
+    bool add)
+{
+    filter_rule_t item = rule(changed);
+    if(add) {
+        rules.push_back(item);
+    } else {
+        for(size_t i = 0; i < rules.size(); i++) {
+            if(rules[i] == item) {
+                rules.erase(rules.begin() + i);
+                break;
+            }
+        }
+    }
+    bool drop = filter_hardware(rules);
+    CHECK(influx_update_pre(&nfb, item, add, drop) == RET_OK);
+    CHECK(influx_update_post(&nfb, add, drop) == RET_OK);
+    CHECK(nfb.influx_drop == drop);
+    CHECK(p4stub_default("table_influx") == (drop ? "pkt_drop" : "fill_influx"));
+    return changes();
+}
+
+/**
+ * Default action switches so that no report of a kept rule is lost
+ */
+static void test_filtering(nfb_int_dev_t &nfb)
+{
+    std::vector<filter_rule_t> rules = {rule("10.0.0.1 80"), rule("10.0.0.3 8080"), rule("10.0.0.4 80")};
+
+    // Wide rule is left to the host, the card passes other reports once the host filters them
+    CHECK((update(nfb, rules, "10.1.0.0/16", true) == std::vector<std::string>{"default table_influx fill_influx"}));
+
+    // Exact rule under a wide one, the card keeps passing everything
+    CHECK((update(nfb, rules, "10.0.0.5 53", true) == std::vector<std::string>{insert(4, 0x0a000005, 53)}));
+
+    // All rules exact again, the card drops other reports
+    CHECK((update(nfb, rules, "10.1.0.0/16", false) == std::vector<std::string>{"default table_influx pkt_drop"}));
+
+    // Removing all rules passes other reports before the last rule goes
+    update(nfb, rules, "10.0.0.3 8080", false);
+    update(nfb, rules, "10.0.0.4 80", false);
+    update(nfb, rules, "10.0.0.5 53", false);
+    CHECK((update(nfb, rules, "10.0.0.1 80", false) == std::vector<std::string>{"default table_influx fill_influx",
+        "delete table_influx 0"}));
+    CHECK(p4stub_rules("table_influx") == 0);
+
+    // First rule is inserted before the card starts to drop other reports
+    CHECK((update(nfb, rules, "10.0.0.6 80", true) == std::vector<std::string>{insert(5, 0x0a000006, 80),
+        "default table_influx pkt_drop"}));
+}
+
+/**
+ * Report of the burst
+ */
+static std::vector<uint8_t> report(uint32_t src, uint32_t dst, uint16_t port)
+{
+    std::vector<uint8_t> data(sizeof(int_influx_t), 0);
+    int_influx_t *hdr = (int_influx_t *)data.data();
+    hdr->srcAddr = htonl(src);
+    hdr->dstAddr = htonl(dst);
+    hdr->egress_port_id = htons(port);
+    return data;
+}
+
+/**
+ * Host filter of a burst
+ */
+static void test_burst()
+{
+    std::vector<std::vector<uint8_t>> reports = {
+        report(0x0a000001, 0x0b000001, 80),   // exact rule
+        report(0x0a000001, 0x0b000001, 81),   // other port
+        report(0x0a010203, 0x0c000001, 1000), // wide rule, destination and port range
+        report(0x0a010203, 0x0c000001, 3000), // port out of the range
+        report(0x0a010203, 0x0d000001, 1000), // other destination
+        report(0x0b000001, 0x0b000001, 80),   // other source
+        report(0x0a000001, 0x0b000001, 80),   // cut report
+    };
+    reports.back().resize(sizeof(int_influx_t) - 1);
+    std::vector<struct ndp_packet> packets(reports.size());
+    for(size_t i = 0; i < reports.size(); i++) {
+        packets[i].data = reports[i].data();
+        packets[i].data_length = reports[i].size();
+    }
+
+    // No rule keeps all reports
+    FilterTable none({});
+    CHECK(filter_burst(none, packets.data(), packets.size()) == packets.size());
+
+    FilterTable table({rule("10.0.0.1 80"), rule("10.1.0.0/16 1000-2000 12.0.0.0/8")});
+    CHECK(!table.exact());
+    uint32_t kept = filter_burst(table, packets.data(), packets.size());
+    CHECK(kept == 2);
+    CHECK(kept >= 1 && packets[0].data == reports[0].data());
+    CHECK(kept >= 2 && packets[1].data == reports[2].data());
+}
+
+int main()
+{
+    nfb_int_dev_t nfb = nfb_int_dev_t();
+    test_configure(nfb);
+    test_rules(nfb);
+    test_filtering(nfb);
+    test_burst();
+
+    if(failures != 0) {
+        printf("filter_test - %u checks failed\n", failures);
+        return 1;
+    }
+    printf("filter_test - ok\n");
+    return 0;
+}
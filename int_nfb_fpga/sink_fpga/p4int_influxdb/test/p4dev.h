@@ -0,0 +1,53 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Stub of the p4dev library for the tests
+ *
+ * Declares only the calls used by device.cc. The stub keeps the tables in
+ * memory and logs every change of them, see p4dev_stub.h. The directory of
+ * the tests is searched first, so the stub replaces the installed header.
+ */
+
+#ifndef _P4DEV_STUB_P4DEV_H_
+#define _P4DEV_STUB_P4DEV_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int API_RET;
+
+#define P4DEV_OK 0
+#define P4DEV_ERROR 1
+#define P4DEVICE_DEFAULT_COMPONENT 0
+
+typedef struct {
+    int opened;
+} p4device_t;
+
+typedef struct p4table p4table_t;
+typedef struct p4rule p4rule_t;
+typedef struct p4key p4key_elem_t;
+
+API_RET p4device_init(p4device_t *dev, const char *path, int flags, int component);
+void p4device_free(p4device_t *dev);
+p4table_t *p4device_get_table(const p4device_t *dev, const char *name);
+p4rule_t *p4table_get_rule_template(p4table_t *table);
+API_RET p4table_insert_default_rule(p4table_t *table, p4rule_t *rule);
+API_RET p4table_insert_rule(p4table_t *table, p4rule_t *rule, uint32_t *index, bool overwrite);
+API_RET p4table_delete_rule(p4table_t *table, uint32_t index);
+API_RET p4table_reset(p4table_t *table, int flags);
+API_RET p4rule_add_action(p4rule_t *rule, const char *action);
+API_RET p4rule_mark_default(p4rule_t *rule);
+API_RET p4rule_add_key_element(p4rule_t *rule, p4key_elem_t *key);
+void p4rule_free(p4rule_t *rule);
+p4key_elem_t *p4key_exact_create(const char *name, uint32_t size, const uint8_t *value);
+void p4dev_err_stderr(API_RET ret);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _P4DEV_STUB_P4DEV_H_
@@ -0,0 +1,22 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Stub of the p4dev library for the tests, enabling of the pipeline
+ */
+
+#ifndef _P4DEV_STUB_P4DEV_BASE_H_
+#define _P4DEV_STUB_P4DEV_BASE_H_
+
+#include "p4dev.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+API_RET p4base_enable(const p4device_t *dev);
+API_RET p4base_disable(const p4device_t *dev);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _P4DEV_STUB_P4DEV_BASE_H_
@@ -0,0 +1,169 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Stub of the p4dev library for the tests
+ */
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "p4dev_base.h"
+#include "p4dev_stub.h"
+
+struct p4key {
+    std::string name;
+    std::string value; // Bytes in hex
+};
+
+struct p4rule {
+    std::vector<p4key> keys;
+    std::string        action;
+    bool               is_default;
+};
+
+struct p4table {
+    std::string                     name;
+    std::string                     default_action;
+    std::map<uint32_t, std::string> rules; // Rule text by the index
+    uint32_t                        next;  // Index of the next inserted rule
+};
+
+static std::map<std::string, p4table> tables;
+static std::vector<std::string> changes;
+static bool fail_next = false;
+
+/**
+ * Log the change of a table unless it has to fail
+ * \param text Text of the change
+ * \return P4DEV_OK when the change is applied
+ */
+static API_RET change(const std::string &text) {
+    if(fail_next) {
+        fail_next = false;
+        return P4DEV_ERROR;
+    }
+    changes.push_back(text);
+    return P4DEV_OK;
+}
+
+const std::vector<std::string> &p4stub_log() {
+    return changes;
+}
+
+void p4stub_clear() {
+    changes.clear();
+}
+
+std::string p4stub_default(const char *table) {
+    return tables[table].default_action;
+}
+
+size_t p4stub_rules(const char *table) {
+    return tables[table].rules.size();
+}
+
+void p4stub_fail_next() {
+    fail_next = true;
+}
+
+API_RET p4device_init(p4device_t *dev, const char *, int, int) {
+    dev->opened = 1;
+    return P4DEV_OK;
+}
+
+void p4device_free(p4device_t *dev) {
+    dev->opened = 0;
+}
+
+p4table_t *p4device_get_table(const p4device_t *, const char *name) {
+    p4table &table = tables[name];
+    table.name = name;
+    return &table;
+}
+
+p4rule_t *p4table_get_rule_template(p4table_t *) {
+    return new p4rule{{}, "", false};
+}
+
+API_RET p4table_insert_default_rule(p4table_t *table, p4rule_t *rule) {
+    if(!rule->is_default || change("default " + table->name + " " + rule->action) != P4DEV_OK) {
+        return P4DEV_ERROR;
+    }
+    table->default_action = rule->action;
+    return P4DEV_OK;
+}
+
+API_RET p4table_insert_rule(p4table_t *table, p4rule_t *rule, uint32_t *index, bool) {
+    std::string text;
+    for(const p4key &key : rule->keys) {
+        text += key.name + "=" + key.value + " ";
+    }
+    text += rule->action;
+    if(change("insert " + table->name + " " + std::to_string(table->next) + " " + text) != P4DEV_OK) {
+        return P4DEV_ERROR;
+    }
+    *index = table->next++;
+    table->rules[*index] = text;
+    return P4DEV_OK;
+}
+
+API_RET p4table_delete_rule(p4table_t *table, uint32_t index) {
+    if(table->rules.count(index) == 0 ||
+        change("delete " + table->name + " " + std::to_string(index)) != P4DEV_OK) {
+        return P4DEV_ERROR;
+    }
+    table->rules.erase(index);
+    return P4DEV_OK;
+}
+
+API_RET p4table_reset(p4table_t *table, int) {
+    if(change("reset " + table->name) != P4DEV_OK) {
+        return P4DEV_ERROR;
+    }
+    table->default_action.clear();
+    table->rules.clear();
+    return P4DEV_OK;
+}
+
+API_RET p4rule_add_action(p4rule_t *rule, const char *action) {
+    rule->action = action;
+    return P4DEV_OK;
+}
+
+API_RET p4rule_mark_default(p4rule_t *rule) {
+    rule->is_default = true;
+    return P4DEV_OK;
+}
+
+API_RET p4rule_add_key_element(p4rule_t *rule, p4key_elem_t *key) {
+    rule->keys.push_back(*key);
+    delete key;
+    return P4DEV_OK;
+}
+
+void p4rule_free(p4rule_t *rule) {
+    delete rule;
+}
+
+p4key_elem_t *p4key_exact_create(const char *name, uint32_t size, const uint8_t *value) {
+    p4key *key = new p4key{name, ""};
+    char hex[3];
+    for(uint32_t i = 0; i < size; i++) {
+        snprintf(hex, sizeof(hex), "%02x", value[i]);
+        key->value += hex;
+    }
+    return key;
+}
+
+void p4dev_err_stderr(API_RET ret) {
+    fprintf(stderr, "p4dev stub error %d\n", ret);
+}
+
+API_RET p4base_enable(const p4device_t *) {
+    return P4DEV_OK;
+}
+
+API_RET p4base_disable(const p4device_t *) {
+    return P4DEV_OK;
+}
@@ -0,0 +1,48 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Inspection of the p4dev stub
+ *
+ * Every change of a table is logged as one line:
+ *
+ *     default table action
+ *     insert table index key=hex... action
+ *     delete table index
+ *     reset table
+ *
+ * Keys are the bytes given to p4key_exact_create in hex, in their order.
+ */
+
+#ifndef _P4DEV_STUB_H_
+#define _P4DEV_STUB_H_
+
+#include <string>
+#include <vector>
+
+/**
+ * Changes of the tables since the last \ref p4stub_clear
+ */
+const std::vector<std::string> &p4stub_log();
+
+/**
+ * Clear the log, the tables are kept
+ */
+void p4stub_clear();
+
+/**
+ * Current default action of the table, empty when none was inserted
+ * \param table Name of the table
+ */
+std::string p4stub_default(const char *table);
+
+/**
+ * Number of rules of the table, the default one is not counted
+ * \param table Name of the table
+ */
+size_t p4stub_rules(const char *table);
+
+/**
+ * The next change of any table fails with P4DEV_ERROR and is not applied
+ */
+void p4stub_fail_next();
+
+#endif // _P4DEV_STUB_H_
@@ -0,0 +1,115 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Tests of the vectorized hop timestamp processing
+ *
+ * Every instruction set supported by the CPU is compared with the scalar
+ * version on random hop metadata, for every hop count up to MAX_NODES, so the
+ * counts which are not a multiple of the vector width are covered as well.
+ * Run by "make test", it fails when any check fails.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+#include "int_simd.h"
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+// Random reports of every hop count and layout
+#define TEST_ROUNDS 1000
+// Value of the fields the processing must not write
+#define TEST_GUARD 0x5a
+
+static uint32_t failures = 0;
+
+/**
+ * Count and print a failed check
+ */
+static void check(bool ok, const char *cond, int line)
+{
+    if(!ok) {
+        printf("simd_test.cc:%d: check failed: %s\n", line, cond);
+        failures++;
+    }
+}
+
+/**
+ * Compare the fields the hop timestamp processing does not write
+ */
+static bool same_other(const telemetric_meta &a, const telemetric_meta &b)
+{
+    return a.hop_jitter == b.hop_jitter && a.hop_index == b.hop_index && a.queue_id == b.queue_id &&
+        a.hop_latency == b.hop_latency && a.queue_occupancy == b.queue_occupancy &&
+        a.tx_utilization == b.tx_utilization;
+}
+
+/**
+ * Compare the written fields
+ */
+static bool same_times(const telemetric_meta &a, const telemetric_meta &b)
+{
+    return a.link_delay == b.link_delay && a.hop_delay == b.hop_delay && a.hop_timestamp == b.hop_timestamp;
+}
+
+/**
+ * Compare the instruction set with the scalar version
+ * \param isa SIMD_* value supported by the CPU
+ * \param rng Generator of the metadata
+ */
+static void test_isa(uint32_t isa, std::mt19937_64 &rng)
+{
+    hop_times_t scalar = hop_times_select(SIMD_SCALAR);
+    hop_times_t vector = hop_times_select(isa);
+    // Legacy layout, timestamps only and timestamps behind the other instructions
+    const uint32_t layouts[][2] = {{24, 8}, {16, 0}, {44, 28}};
+    uint8_t meta[(MAX_NODES + 1) * 44];
+    telemetric_meta expected[MAX_NODES + 1];
+    telemetric_meta nodes[MAX_NODES + 1];
+
+    for(uint32_t round = 0; round < TEST_ROUNDS; round++) {
+        for(const uint32_t *layout : layouts) {
+            for(uint32_t cnt = 0; cnt <= MAX_NODES; cnt++) {
+                for(uint8_t &byte : meta) {
+                    byte = rng();
+                }
+                memset(expected, TEST_GUARD, sizeof(expected));
+                memset(nodes, TEST_GUARD, sizeof(nodes));
+                scalar(meta, layout[0], layout[1], cnt, expected);
+                vector(meta, layout[0], layout[1], cnt, nodes);
+
+                // Only the times are written, they may be written to the node behind the last hop as well
+                bool same = true;
+                for(uint32_t h = 0; h <= MAX_NODES; h++) {
+                    same &= same_other(nodes[h], expected[h]);
+                    same &= h == cnt || same_times(nodes[h], expected[h]);
+                }
+                if(!same) {
+                    printf("%s differs from scalar - hops %u, stride %u, offset %u\n", simd_name(isa), cnt,
+                        layout[0], layout[1]);
+                }
+                CHECK(same);
+            }
+        }
+    }
+}
+
+int main()
+{
+    std::mt19937_64 rng(12345);
+    uint32_t best = simd_detect();
+    for(uint32_t isa = SIMD_SCALAR + 1; isa <= best; isa++) {
+        test_isa(isa, rng);
+        printf("simd_test - %s compared\n", simd_name(isa));
+    }
+    if(best == SIMD_SCALAR) {
+        printf("simd_test - no vector instruction set, nothing to compare\n");
+    }
+
+    if(failures != 0) {
+        printf("simd_test - %u checks failed\n", failures);
+        return 1;
+    }
+    printf("simd_test - ok\n");
+    return 0;
+}
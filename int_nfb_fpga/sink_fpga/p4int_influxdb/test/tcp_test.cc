@@ -0,0 +1,167 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Tests of the persistent TCP transport
+ *
+ * The collector is a listening socket of this process on the loopback. Run by
+ * "make test", it fails when any check fails.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "TCP.h"
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+// Time the collector waits for the data of the transport in ms
+#define TEST_WAIT_MS 3000
+
+static uint32_t failures = 0;
+
+/**
+ * Count and print a failed check
+ */
+static void check(bool ok, const char *cond, int line)
+{
+    if(!ok) {
+        printf("tcp_test.cc:%d: check failed: %s\n", line, cond);
+        failures++;
+    }
+}
+
+/**
+ * Open the listening socket of the collector on the loopback
+ * \param port Port of the collector, 0 picks a free one
+ * \return Socket, -1 on failure
+ */
+static int collector_open(uint16_t port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 4) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Port of the listening socket
+ */
+static uint16_t collector_port(int fd)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (struct sockaddr *)&addr, &len);
+    return ntohs(addr.sin_port);
+}
+
+/**
+ * Accept the connection of the transport and read until the expected data
+ * arrived or TEST_WAIT_MS elapsed
+ * \param fd Listening socket
+ * \param size Expected number of bytes
+ * \param conn Where to store the accepted connection, -1 when none came
+ * \return Received data
+ */
+static std::string collector_read(int fd, size_t size, int &conn)
+{
+    std::string data;
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::milliseconds(TEST_WAIT_MS);
+    conn = -1;
+    while(data.size() < size && std::chrono::steady_clock::now() < end) {
+        int left = std::chrono::duration_cast<std::chrono::milliseconds>(end - std::chrono::steady_clock::now()).count();
+        struct pollfd pfd = {conn < 0 ? fd : conn, POLLIN, 0};
+        if(poll(&pfd, 1, left) != 1) {
+            continue;
+        }
+        if(conn < 0) {
+            conn = accept(fd, NULL, NULL);
+            continue;
+        }
+        char buf[4096];
+        ssize_t len = recv(conn, buf, sizeof(buf), 0);
+        if(len <= 0) {
+            break;
+        }
+        data.append(buf, len);
+    }
+    return data;
+}
+
+/**
+ * Batches are delivered to a running collector
+ */
+static void test_deliver()
+{
+    int fd = collector_open(0);
+    CHECK(fd >= 0);
+    INT_TCP tcp("127.0.0.1", collector_port(fd));
+    std::string batch = "int_telemetry,srcip=10.0.0.1 seq=1i 1\nint_telemetry,srcip=10.0.0.1 seq=2i 2\n";
+    tcp.send(batch);
+
+    int conn;
+    CHECK(collector_read(fd, batch.size(), conn) == batch);
+    close(conn);
+    close(fd);
+}
+
+/**
+ * Batch spilled while the collector is down is delivered by the timer after
+ * the collector restarts, no batch follows it
+ */
+static void test_restart()
+{
+    int fd = collector_open(0);
+    CHECK(fd >= 0);
+    uint16_t port = collector_port(fd);
+    INT_TCP tcp("127.0.0.1", port);
+    std::string first = "int_telemetry,srcip=10.0.0.1 seq=1i 1\n";
+    tcp.send(first);
+    int conn;
+    CHECK(collector_read(fd, first.size(), conn) == first);
+
+    // Collector stops, the transport finds the closed connection on the next batch and spills it
+    close(conn);
+    close(fd);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::string spilled;
+    for(uint32_t i = 0; i < 1000; i++) {
+        spilled += "int_telemetry,srcip=10.0.0.2 seq=" + std::to_string(i) + "i " + std::to_string(i) + "\n";
+    }
+    tcp.send(spilled);
+
+    // Collector is back after the first attempts of the transport failed
+    std::this_thread::sleep_for(std::chrono::milliseconds(2 * TCP_BACKOFF_MIN_MS));
+    fd = collector_open(port);
+    CHECK(fd >= 0);
+    CHECK(collector_read(fd, spilled.size(), conn) == spilled);
+    close(conn);
+    close(fd);
+}
+
+int main()
+{
+    test_deliver();
+    test_restart();
+    if(failures != 0) {
+        printf("tcp_test - %u checks failed\n", failures);
+        return 1;
+    }
+    printf("tcp_test - ok\n");
+    return 0;
+}
@@ -0,0 +1,109 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Waiting of threads for new data
+ */
+
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "p4int.h"
+#include "wait_strategy.h"
+
+int32_t wait_mode_parse(const char *name) {
+    if(strcmp(name, "poll") == 0) {
+        return WAIT_POLL;
+    } else if(strcmp(name, "spin") == 0) {
+        return WAIT_SPIN;
+    } else if(strcmp(name, "hybrid") == 0) {
+        return WAIT_HYBRID;
+    }
+    return -1;
+}
+
+const char *wait_mode_name(uint32_t mode) {
+    switch(mode) {
+        case WAIT_POLL:
+            return "poll";
+        case WAIT_SPIN:
+            return "spin";
+        default:
+            return "hybrid";
+    }
+}
+
+ConsumerWaiter::ConsumerWaiter(uint32_t mode) : m_mode(mode), m_parked(0), m_parks(0)
+{
+}
+
+void ConsumerWaiter::prepare()
+{
+    m_parked.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void ConsumerWaiter::cancel()
+{
+    m_parked.store(0, std::memory_order_relaxed);
+}
+
+void ConsumerWaiter::park(uint32_t timeout_us)
+{
+    if(m_mode == WAIT_POLL) {
+        delay_usecs(timeout_us);
+        return;
+    }
+
+    struct timespec timeout;
+    timeout.tv_sec = timeout_us / 1000000;
+    timeout.tv_nsec = (timeout_us % 1000000) * 1000;
+
+    // Returns immediately when the producer already cleared the flag
+    m_parks++;
+    syscall(SYS_futex, &m_parked, FUTEX_WAIT_PRIVATE, 1,
+        timeout_us ? &timeout : NULL, NULL, 0);
+}
+
+void ConsumerWaiter::wake()
+{
+    m_parked.store(0, std::memory_order_relaxed);
+    syscall(SYS_futex, &m_parked, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+uint64_t ConsumerWaiter::now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+PollBackoff::PollBackoff(uint32_t mode) : m_mode(mode), m_empty(0), m_sleep(1)
+{
+}
+
+void PollBackoff::idle()
+{
+    switch(m_mode) {
+        case WAIT_POLL:
+            delay_usecs(WAIT_POLL_USECS);
+            break;
+
+        case WAIT_SPIN:
+            cpu_relax();
+            break;
+
+        default:
+            // Spin for a few polls, then sleep with exponential backoff
+            if(++m_empty < WAIT_RX_SPIN_POLLS) {
+                cpu_relax();
+                break;
+            }
+            delay_usecs(m_sleep);
+            if(m_sleep < WAIT_RX_MAX_USECS) {
+                m_sleep = m_sleep * 2 > WAIT_RX_MAX_USECS ? WAIT_RX_MAX_USECS : m_sleep * 2;
+            }
+            break;
+    }
+}
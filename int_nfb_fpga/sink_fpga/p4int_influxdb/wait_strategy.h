@@ -0,0 +1,210 @@
+/**
+ * @author Mario Kuka <kuka@cesnet.cz>
+ * @brief Waiting of threads for new data
+ */
+
+#ifndef _WAIT_STRATEGY_H_
+#define _WAIT_STRATEGY_H_
+
+#include <cstdint>
+#include <atomic>
+
+// Sleep for a fixed time between polls
+#define WAIT_POLL 0
+// Busy polling
+#define WAIT_SPIN 1
+// Spin for a while, then sleep until notified (consumers) or back off (RX)
+#define WAIT_HYBRID 2
+
+// Sleep of the WAIT_POLL strategy in microseconds
+#define WAIT_POLL_USECS 100
+// Number of spin iterations before the consumer parks
+#define WAIT_SPIN_ITERS 256
+// Number of empty RX polls before the backoff starts
+#define WAIT_RX_SPIN_POLLS 64
+// Maximal RX backoff in microseconds
+#define WAIT_RX_MAX_USECS 100
+
+/**
+ * Parse name of the strategy
+ * \param name One of "poll", "spin" or "hybrid"
+ * \return WAIT_* value or -1 for unknown name
+ */
+int32_t wait_mode_parse(const char *name);
+
+/**
+ * Name of the strategy
+ * \param mode WAIT_* value
+ * \return Name of the strategy
+ */
+const char *wait_mode_name(uint32_t mode);
+
+/**
+ * Waiting of a consumer thread for data produced by another thread.
+ *
+ * In the hybrid mode the consumer spins for a while and then parks on a futex.
+ * The producer calls \ref notify after publishing data, the wake up system
+ * call is issued only when the consumer is parked.
+ */
+class ConsumerWaiter
+{
+    public:
+        /**
+         * Constructor
+         * \param mode WAIT_* strategy
+         */
+        ConsumerWaiter(uint32_t mode);
+
+        /**
+         * Wait until the predicate holds or the timeout expires
+         * \param ready Predicate checking for new data, called by the consumer
+         * \param timeout_us Timeout in microseconds, 0 waits forever
+         * \return true when data are ready, false on timeout
+         */
+        template<typename Ready>
+        bool wait(Ready ready, uint32_t timeout_us);
+
+        /**
+         * Wake up the consumer if it is parked, called by the producer
+         * after the data were published
+         */
+        inline void notify()
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(m_parked.load(std::memory_order_relaxed)) {
+                wake();
+            }
+        }
+
+        /**
+         * Number of times the consumer went to sleep
+         */
+        uint64_t parks() const { return m_parks; }
+
+    protected:
+        /**
+         * Announce the parking, the predicate has to be checked afterwards
+         */
+        void prepare();
+
+        /**
+         * Sleep until notified or timeout
+         * \param timeout_us Timeout in microseconds, 0 waits forever
+         */
+        void park(uint32_t timeout_us);
+
+        /**
+         * Cancel the parking
+         */
+        void cancel();
+
+        /**
+         * Wake up the parked consumer
+         */
+        void wake();
+
+        /**
+         * Current monotonic time in microseconds
+         */
+        static uint64_t now_us();
+
+        // Selected strategy
+        uint32_t m_mode;
+        // Futex word, non zero when the consumer is parked
+        std::atomic<int> m_parked;
+        // Statistics of the consumer
+        uint64_t m_parks;
+};
+
+/**
+ * Idle handling of a polling thread, e.g. the RX loop
+ */
+class PollBackoff
+{
+    public:
+        /**
+         * Constructor
+         * \param mode WAIT_* strategy, WAIT_HYBRID selects the adaptive backoff
+         */
+        PollBackoff(uint32_t mode);
+
+        /**
+         * Called after an empty poll
+         */
+        void idle();
+
+        /**
+         * Called after a successful poll
+         */
+        inline void reset()
+        {
+            m_empty = 0;
+            m_sleep = 1;
+        }
+
+    protected:
+        // Selected strategy
+        uint32_t m_mode;
+        // Number of empty polls in a row
+        uint32_t m_empty;
+        // Next sleep of the backoff in microseconds
+        uint32_t m_sleep;
+};
+
+/**
+ * Pause instruction for spinning loops
+ */
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+template<typename Ready>
+bool ConsumerWaiter::wait(Ready ready, uint32_t timeout_us)
+{
+    uint64_t deadline = timeout_us ? now_us() + timeout_us : UINT64_MAX;
+
+    while(true) {
+        if(ready()) {
+            return true;
+        }
+
+        if(m_mode == WAIT_POLL) {
+            if(now_us() >= deadline) {
+                return false;
+            }
+            park(WAIT_POLL_USECS);
+            continue;
+        }
+
+        // Spin for a while
+        for(uint32_t i = 0; i < WAIT_SPIN_ITERS; i++) {
+            cpu_relax();
+            if(ready()) {
+                return true;
+            }
+        }
+
+        uint64_t now = now_us();
+        if(now >= deadline) {
+            return false;
+        }
+        if(m_mode == WAIT_SPIN) {
+            continue;
+        }
+
+        // Announce the parking and check once more, the producer either sees
+        // the flag or we see its data
+        prepare();
+        if(ready()) {
+            cancel();
+            return true;
+        }
+        park(deadline == UINT64_MAX ? 0 : deadline - now);
+        cancel();
+    }
+}
+
+#endif // _WAIT_STRATEGY_H_